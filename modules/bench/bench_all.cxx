@@ -23,14 +23,16 @@ void compute_features(Dataset &dataset) {
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
 #pragma omp parallel for schedule(dynamic)
 #endif
-	for (int64_t i = 0; i < dataset.num_images(); i++) {
+	for (int64_t i = 0; i < dataset.num_ids(); i++) {
+		if (!dataset.has_image(i)) continue;
 
 		PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> image = std::static_pointer_cast<SimpleDataset::SimpleImage>(dataset.image(i));
 		if (image ==  PTR_LIB::shared_ptr<SimpleDataset::SimpleImage>()) continue;
 
-		const std::string &keypoints_location = dataset.location(image->feature_path("keypoints"));
-		const std::string &descriptors_location = dataset.location(image->feature_path("descriptors"));
-		if (filesystem::file_exists(keypoints_location) && filesystem::file_exists(descriptors_location)) continue;
+		cv::Mat keypoints, descriptors;
+		// an image with only one of the features gets both again
+		if (dataset.load_mat_feature(image->id, "keypoints", keypoints) &&
+			dataset.load_mat_feature(image->id, "descriptors", descriptors)) continue;
 
 		const std::string &image_location = dataset.location(image->location());
 
@@ -38,19 +40,16 @@ void compute_features(Dataset &dataset) {
 
 		cv::Mat im = cv::imread(image_location, cv::IMREAD_GRAYSCALE);
 
-		cv::Mat keypoints, descriptors;
 		if (!vision::compute_sparse_sift_feature(im, PTR_LIB::shared_ptr<const vision::SIFTParams>(), keypoints, descriptors)) continue;
 
-		filesystem::create_file_directory(keypoints_location);
-		filesystem::create_file_directory(descriptors_location);
-
-		filesystem::write_cvmat(keypoints_location, keypoints);
-		filesystem::write_cvmat(descriptors_location, descriptors);
+		dataset.write_mat_feature(image->id, "keypoints", keypoints);
+		dataset.write_mat_feature(image->id, "descriptors", descriptors);
 	}
+	dataset.flush_mat_features();
 }
 
 void compute_bow_features(Dataset &dataset, PTR_LIB::shared_ptr<BagOfWords> bow, uint32_t num_clusters) {
-	const std::vector<  PTR_LIB::shared_ptr<const Image> > &all_images = dataset.all_images();
+	const ImageRange &all_images = dataset.all_images();
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
 	uint32_t num_threads = omp_get_max_threads();
 	std::vector< cv::Ptr<cv::DescriptorMatcher> > matchers;
@@ -65,12 +64,10 @@ void compute_bow_features(Dataset &dataset, PTR_LIB::shared_ptr<BagOfWords> bow,
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
 		const cv::Ptr<cv::DescriptorMatcher> &matcher = matchers[omp_get_thread_num()];
 #endif
-		const std::string &sift_descriptor_location = dataset.location(all_images[i]->feature_path("descriptors"));
 		const std::string &bow_descriptor_location = dataset.location(all_images[i]->feature_path("bow_descriptors"));
 
 		cv::Mat descriptors, bow_descriptors, descriptorsf;
-		if (!filesystem::file_exists(sift_descriptor_location)) continue;
-		if (!filesystem::load_cvmat(sift_descriptor_location, descriptors)) continue;
+		if (!dataset.load_mat_feature(all_images.id(i), "descriptors", descriptors)) continue;
 		descriptors.convertTo(descriptorsf, CV_32FC1);
 		filesystem::create_file_directory(bow_descriptor_location);
 
@@ -99,7 +96,7 @@ PTR_LIB::shared_ptr<BagOfWords> train_bow(Dataset &dataset, uint32_t num_images,
 	BagOfWords bow;
 	PTR_LIB::shared_ptr<BagOfWords::TrainParams> train_params = PTR_LIB::make_shared<BagOfWords::TrainParams>();
 	train_params->numClusters = num_clusters;
-	const std::vector<  PTR_LIB::shared_ptr<const Image> > &random_images = dataset.random_images(num_images);
+	const ImageRange &random_images = dataset.random_images(num_images);
 	bow.train(dataset, train_params, random_images);
 	std::stringstream vocab_output_file;
 	vocab_output_file << dataset.location() << "/vocabulary/" << train_params->numClusters << ".vocab";
@@ -216,7 +213,7 @@ void benchmark_dataset(Dataset &dataset) {
 		}
 
 		uint32_t num_validate = 10;
-		uint32_t total_iterations = MIN(dataset.num_images(), 128);
+		uint32_t total_iterations = MIN(dataset.num_ids(), 128);
 
 		LINFO << "Running index search";
 		// search index
@@ -225,6 +222,7 @@ void benchmark_dataset(Dataset &dataset) {
 			double total_time = 0.0;
 			uint32_t total_correct = 0, total_tested = 0;
 			for (uint32_t i = 0; i < total_iterations; i++) {
+				if (!dataset.has_image(i)) continue;
 				double start_time = CycleTimer::currentSeconds();
 
 				PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> query_image = std::static_pointer_cast<SimpleDataset::SimpleImage>(dataset.image(i));
@@ -239,10 +237,8 @@ void benchmark_dataset(Dataset &dataset) {
 
 				// validate matches
 				cv::Mat keypoints_0, descriptors_0;
-				const std::string &query_keypoints_location = dataset.location(query_image->feature_path("keypoints"));
-				const std::string &query_descriptors_location = dataset.location(query_image->feature_path("descriptors"));
-				filesystem::load_cvmat(query_keypoints_location, keypoints_0);
-				filesystem::load_cvmat(query_descriptors_location, descriptors_0);
+				dataset.load_mat_feature(query_image->id, "keypoints", keypoints_0);
+				dataset.load_mat_feature(query_image->id, "descriptors", descriptors_0);
 				std::vector<int> validated(MIN(num_validate, matches_index->matches.size()), 0);
 				total_tested += validated.size();
 				uint32_t total_correct_tmp = 0;
@@ -252,10 +248,8 @@ void benchmark_dataset(Dataset &dataset) {
 				for (int32_t j = 0; j < validated.size(); j++) {
 					cv::Mat keypoints_1, descriptors_1;
 					PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> match_image = std::static_pointer_cast<SimpleDataset::SimpleImage>(dataset.image(matches_index->matches[j]));
-					const std::string &match_keypoints_location = dataset.location(match_image->feature_path("keypoints"));
-					const std::string &match_descriptors_location = dataset.location(match_image->feature_path("descriptors"));
-					filesystem::load_cvmat(match_keypoints_location, keypoints_1);
-					filesystem::load_cvmat(match_descriptors_location, descriptors_1);
+					dataset.load_mat_feature(match_image->id, "keypoints", keypoints_1);
+					dataset.load_mat_feature(match_image->id, "descriptors", descriptors_1);
 
 					cv::detail::MatchesInfo match_info;
 					vision::geo_verify_f(descriptors_0, keypoints_0, descriptors_1, keypoints_1, match_info);
@@ -297,6 +291,7 @@ void benchmark_dataset(Dataset &dataset) {
 			double total_time = 0.0;
 			uint32_t total_correct = 0, total_tested = 0;
 			for (uint32_t i = 0; i < total_iterations; i++) {
+				if (!dataset.has_image(i)) continue;
 				double start_time = CycleTimer::currentSeconds();
 
 				PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> query_image = std::static_pointer_cast<SimpleDataset::SimpleImage>(dataset.image(i));
@@ -311,10 +306,8 @@ void benchmark_dataset(Dataset &dataset) {
 
 				// validate matches
 				cv::Mat keypoints_0, descriptors_0;
-				const std::string &query_keypoints_location = dataset.location(query_image->feature_path("keypoints"));
-				const std::string &query_descriptors_location = dataset.location(query_image->feature_path("descriptors"));
-				filesystem::load_cvmat(query_keypoints_location, keypoints_0);
-				filesystem::load_cvmat(query_descriptors_location, descriptors_0);
+				dataset.load_mat_feature(query_image->id, "keypoints", keypoints_0);
+				dataset.load_mat_feature(query_image->id, "descriptors", descriptors_0);
 				std::vector<int> validated(MIN(num_validate, matches_index->matches.size()), 0);
 				total_tested += validated.size();
 				uint32_t total_correct_tmp = 0;
@@ -324,10 +317,8 @@ void benchmark_dataset(Dataset &dataset) {
 				for (int32_t j = 0; j < validated.size(); j++) {
 					cv::Mat keypoints_1, descriptors_1;
 					PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> match_image = std::static_pointer_cast<SimpleDataset::SimpleImage>(dataset.image(matches_index->matches[j]));
-					const std::string &match_keypoints_location = dataset.location(match_image->feature_path("keypoints"));
-					const std::string &match_descriptors_location = dataset.location(match_image->feature_path("descriptors"));
-					filesystem::load_cvmat(match_keypoints_location, keypoints_1);
-					filesystem::load_cvmat(match_descriptors_location, descriptors_1);
+					dataset.load_mat_feature(match_image->id, "keypoints", keypoints_1);
+					dataset.load_mat_feature(match_image->id, "descriptors", descriptors_1);
 
 					cv::detail::MatchesInfo match_info;
 					vision::geo_verify_f(descriptors_0, keypoints_0, descriptors_1, keypoints_1, match_info);
@@ -35,7 +35,7 @@ void compute_bow(SimpleDataset &dataset, int num_clusters, int num_images, int n
 	if(filesystem::file_exists(vocab_output_file.str())) {
         bow.load(vocab_output_file.str());
     } else {
-        const std::vector< PTR_LIB::shared_ptr<const Image> > &random_images = dataset.random_images(num_images);
+        const ImageRange &random_images = dataset.random_images(num_images);
         bow.train(dataset, train_params, random_images);                
 #if ENABLE_FASTCLUSTER && ENABLE_MPI
         if(rank == 0) {
@@ -50,7 +50,7 @@ void compute_bow(SimpleDataset &dataset, int num_clusters, int num_images, int n
 	if(rank == 0) {
 #endif
 	
-	const std::vector<  PTR_LIB::shared_ptr<const Image> > &all_images = dataset.all_images();
+	const ImageRange &all_images = dataset.all_images();
 
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
 	uint32_t num_threads = omp_get_max_threads();
@@ -67,12 +67,10 @@ void compute_bow(SimpleDataset &dataset, int num_clusters, int num_images, int n
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
 		const cv::Ptr<cv::DescriptorMatcher> &matcher = matchers[omp_get_thread_num()];
 #endif
-		const std::string &sift_descriptor_location = dataset.location(all_images[i]->feature_path("descriptors"));
 		const std::string &bow_descriptor_location = dataset.location(all_images[i]->feature_path("bow_descriptors"));
 
 		cv::Mat descriptors, bow_descriptors, descriptorsf;
-		if (!filesystem::file_exists(sift_descriptor_location)) continue;
-		if (!filesystem::load_cvmat(sift_descriptor_location, descriptors)) continue;
+		if (!dataset.load_mat_feature(all_images.id(i), "descriptors", descriptors)) continue;
 		descriptors.convertTo(descriptorsf, CV_32FC1);
 
 		filesystem::create_file_directory(bow_descriptor_location);
@@ -11,18 +11,18 @@
 
 _INITIALIZE_EASYLOGGINGPP
 
-void compute_features(const SimpleDataset &dataset, BagOfWords &bow) {
+void compute_features(SimpleDataset &dataset, BagOfWords &bow) {
 #if ENABLE_MULTITHREADING && ENABLE_MPI
 	int rank, procs;
 	std::cout << rank << " of " << procs << std::endl;
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &procs);
-	uint64_t images_per_node = (dataset.num_images() / procs) + 1;
+	uint64_t images_per_node = (dataset.num_ids() / procs) + 1;
 	uint64_t begin = rank * images_per_node;
-	uint64_t end = MIN((rank+1) * images_per_node, dataset.num_images());
+	uint64_t end = MIN((rank+1) * images_per_node, dataset.num_ids());
 #else
 	uint64_t begin = 0;
-	uint64_t end = dataset.num_images();
+	uint64_t end = dataset.num_ids();
 #endif
 
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
@@ -38,26 +38,19 @@ void compute_features(const SimpleDataset &dataset, BagOfWords &bow) {
 #pragma omp parallel for schedule(dynamic)
 #endif
 	for (int64_t i = begin; i < end; i++) {
+		if (!dataset.has_image(i)) continue;
 		PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> image = std::static_pointer_cast<SimpleDataset::SimpleImage>(dataset.image(i));
 		if (image == PTR_LIB::shared_ptr<SimpleDataset::SimpleImage>()) continue;
 
-		const std::string &keypoints_location = dataset.location(image->feature_path("keypoints"));
-		const std::string &descriptors_location = dataset.location(image->feature_path("descriptors"));
-		
 		const std::string &image_location = dataset.location(image->location());
 		if (!filesystem::file_exists(image_location)) continue;
 		cv::Mat keypoints, descriptors, descriptorsf, bow_descriptors;
-		if (filesystem::file_exists(keypoints_location) && filesystem::file_exists(descriptors_location)) {
-			filesystem::load_cvmat(descriptors_location, descriptors);
-		} else {
+		if (!dataset.load_mat_feature(image->id, "descriptors", descriptors)) {
 			cv::Mat im = cv::imread(image_location, cv::IMREAD_GRAYSCALE);
 			
 			if (!vision::compute_sparse_sift_feature(im, PTR_LIB::shared_ptr<const vision::SIFTParams>(), keypoints, descriptors)) continue;
-			filesystem::create_file_directory(keypoints_location);
-			filesystem::create_file_directory(descriptors_location);
-
-			filesystem::write_cvmat(keypoints_location, keypoints);
-			filesystem::write_cvmat(descriptors_location, descriptors);
+			dataset.write_mat_feature(image->id, "keypoints", keypoints);
+			dataset.write_mat_feature(image->id, "descriptors", descriptors);
 		}
 
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
@@ -70,6 +63,7 @@ void compute_features(const SimpleDataset &dataset, BagOfWords &bow) {
 		const std::vector< std::pair<uint32_t, float> > &bow_descriptors_sparse = numerics::sparsify(bow_descriptors);
 		filesystem::write_sparse_vector(bow_descriptor_location, bow_descriptors_sparse);
 	}
+	dataset.flush_mat_features();
 }
 
 int main(int argc, char *argv[]) {
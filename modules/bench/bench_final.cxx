@@ -38,10 +38,8 @@ PTR_LIB::shared_ptr<MatchResultsBase> &matches, MatchesPage &html_output, std::o
       return;
 #endif
 	cv::Mat keypoints_0, descriptors_0;
-	const std::string &query_keypoints_location = dataset.location(query_image->feature_path("keypoints"));
-	const std::string &query_descriptors_location = dataset.location(query_image->feature_path("descriptors"));
-	filesystem::load_cvmat(query_keypoints_location, keypoints_0);
-	filesystem::load_cvmat(query_descriptors_location, descriptors_0);
+	dataset.load_mat_feature(query_image->id, "keypoints", keypoints_0);
+	dataset.load_mat_feature(query_image->id, "descriptors", descriptors_0);
  	uint32_t num_validate = std::min(64, (int)(matches->matches.size()));
   std::vector<int> validated(num_validate, 0); 
   uint32_t number_valid = 0;
@@ -51,10 +49,8 @@ PTR_LIB::shared_ptr<MatchResultsBase> &matches, MatchesPage &html_output, std::o
 	for(int32_t j=0; j<(int32_t)num_validate; j++) {
 		cv::Mat keypoints_1, descriptors_1;
 		PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> match_image = std::static_pointer_cast<SimpleDataset::SimpleImage>(dataset.image(matches->matches[j]));
-		const std::string &match_keypoints_location = dataset.location(match_image->feature_path("keypoints"));
-		const std::string &match_descriptors_location = dataset.location(match_image->feature_path("descriptors"));
-		filesystem::load_cvmat(match_keypoints_location, keypoints_1);
-		filesystem::load_cvmat(match_descriptors_location, descriptors_1);
+		dataset.load_mat_feature(match_image->id, "keypoints", keypoints_1);
+		dataset.load_mat_feature(match_image->id, "descriptors", descriptors_1);
 
 		cv::detail::MatchesInfo match_info;
 		vision::geo_verify_f(descriptors_0, keypoints_0, descriptors_1, keypoints_1, match_info);
@@ -85,7 +81,7 @@ void bench_dataset(SearchBase &searcher, SimpleDataset &dataset, const std::shar
 	MatchesPage html_output;
 	std::cout<< "Current list: " << std::endl;	
 
-	const std::vector<PTR_LIB::shared_ptr<const Image> > &rand_images = dataset.random_images(num_searches);
+	const ImageRange &rand_images = dataset.random_images(num_searches);
 	for(uint32_t i=0; i<num_searches; i++) {
     std::cout << i << std::endl;
     // if(i==16||i==101||i==136||i==140||i==198) continue;
@@ -180,9 +176,7 @@ int main(int argc, char *argv[]) {
     }
     else {
       std::cout << "No tree found at " << tree_location << ", building..." << std::endl;
-      const std::vector<PTR_LIB::shared_ptr<const Image> > &rand_images = train_dataset.all_images();//(num_searches);
-      const std::vector<PTR_LIB::shared_ptr<const Image> > subset(rand_images.begin(), rand_images.begin() + numImages);
-      vt.train(train_dataset, train_params, subset);
+      vt.train(train_dataset, train_params, train_dataset.all_images().chunk(0, numImages));
       vt.save(tree_location);
     }
     // PerfTracker::instance().save(output_loc + "/perf" + nodeID + ".train");
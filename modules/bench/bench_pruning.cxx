@@ -0,0 +1,156 @@
+#include <config.hpp>
+
+#include "bench_config.hpp"
+
+#include <utils/filesystem.hpp>
+#include <utils/numerics.hpp>
+#include <utils/dataset.hpp>
+#include <utils/misc.hpp>
+#include <utils/logger.hpp>
+#include <utils/cycletimer.hpp>
+#include <search/bag_of_words/bag_of_words.hpp>
+#include <search/inverted_index/inverted_index.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// A static (build time) and query time pruning policy to benchmark.
+struct PruningPolicy {
+	float max_document_frequency;
+	uint32_t max_query_words;
+	uint64_t max_postings_per_word;
+	bool dynamic_pruning;
+};
+
+/// Returns the fraction of the reference matches which are also in matches.
+float recall(const std::vector<uint64_t> &reference, const std::vector<uint64_t> &matches) {
+	if(reference.empty()) return 1.f;
+	std::vector<uint64_t> sorted_matches(matches);
+	std::sort(sorted_matches.begin(), sorted_matches.end());
+	uint32_t found = 0;
+	for(size_t i=0; i<reference.size(); i++) {
+		if(std::binary_search(sorted_matches.begin(), sorted_matches.end(), reference[i])) found++;
+	}
+	return (float)found / (float)reference.size();
+}
+
+void bench_pruning(Dataset &dataset, uint32_t num_clusters) {
+	const uint32_t num_queries = MIN(dataset.num_ids(), 256);
+	const uint64_t num_matches = 16;
+
+	std::stringstream vocab_output_file;
+	vocab_output_file << dataset.location() << "/vocabulary/" << num_clusters << ".vocab";
+	PTR_LIB::shared_ptr<BagOfWords> bow = PTR_LIB::make_shared<BagOfWords>(vocab_output_file.str());
+
+	const PruningPolicy policies[] = {
+		{ 1.f,   0,   0,    false }, // baseline, every posting is read
+		{ 1.f,   0,   0,    true  },
+		{ 0.1f,  0,   0,    false },
+		{ 0.05f, 0,   0,    false },
+		{ 0.01f, 0,   0,    false },
+		{ 1.f,   256, 0,    false },
+		{ 1.f,   64,  0,    false },
+		{ 1.f,   0,   dataset.num_images() / 20, false },
+		{ 0.05f, 128, 0,    true  },
+	};
+	const size_t num_policies = sizeof(policies) / sizeof(policies[0]);
+
+	std::stringstream timings_file_name;
+	timings_file_name << dataset.location() + "/results/times.pruning.json";
+	filesystem::create_file_directory(timings_file_name.str());
+	std::ofstream ofs(timings_file_name.str(), std::ios::app);
+
+	std::vector< std::vector<uint64_t> > reference(num_queries);
+
+	PTR_LIB::shared_ptr<InvertedIndex> ii;
+	float index_document_frequency = -1.f;
+	for(size_t p=0; p<num_policies; p++) {
+		const PruningPolicy &policy = policies[p];
+
+		if(policy.max_document_frequency != index_document_frequency) {
+			LINFO << "Training index with max document frequency " << policy.max_document_frequency;
+			ii = PTR_LIB::make_shared<InvertedIndex>();
+			PTR_LIB::shared_ptr<InvertedIndex::TrainParams> train_params =
+				PTR_LIB::make_shared<InvertedIndex::TrainParams>(policy.max_document_frequency);
+			train_params->bag_of_words = bow;
+			ii->train(dataset, train_params, dataset.all_images());
+			index_document_frequency = policy.max_document_frequency;
+		}
+
+		PTR_LIB::shared_ptr<InvertedIndex::SearchParams> search_params = PTR_LIB::make_shared<InvertedIndex::SearchParams>(
+			4096, num_matches, policy.dynamic_pruning, policy.max_query_words, policy.max_postings_per_word);
+
+		std::vector<double> latencies;
+		double total_recall = 0.0;
+		uint64_t total_postings = 0, total_skipped = 0;
+		for(uint32_t i=0; i<num_queries; i++) {
+			if(!dataset.has_image(i)) continue;
+			double start_time = CycleTimer::currentSeconds();
+			PTR_LIB::shared_ptr<InvertedIndex::MatchResults> matches =
+				std::static_pointer_cast<InvertedIndex::MatchResults>(ii->search(dataset, search_params, dataset.image(i)));
+			double end_time = CycleTimer::currentSeconds();
+
+			if(!matches) {
+				LERROR << "Error while running search.";
+				continue;
+			}
+			latencies.push_back(end_time - start_time);
+			total_postings += matches->num_postings;
+			total_skipped += matches->num_postings_skipped;
+
+			if(p == 0) reference[i] = matches->matches;
+			total_recall += recall(reference[i], matches->matches);
+		}
+		if(latencies.empty()) continue;
+
+		std::sort(latencies.begin(), latencies.end());
+		double mean_latency = 0.0;
+		for(size_t i=0; i<latencies.size(); i++) mean_latency += latencies[i];
+		mean_latency /= latencies.size();
+		const double p99_latency = latencies[MIN(latencies.size() - 1, (size_t)(0.99 * latencies.size()))];
+
+		std::stringstream timing;
+		timing << "{ " <<
+			"\"machine\" : \"" << misc::get_machine_name() << "\", " <<
+			"\"operation\" : \"" << "index_search_pruning" << "\", " <<
+			"\"index_numclusters\" : " << ii->num_clusters() << ", " <<
+			"\"db_size\" : " << dataset.num_images() << ", " <<
+			"\"index_postings\" : " << ii->num_postings() << ", " <<
+			"\"max_document_frequency\" : " << policy.max_document_frequency << ", " <<
+			"\"max_query_words\" : " << policy.max_query_words << ", " <<
+			"\"max_postings_per_word\" : " << policy.max_postings_per_word << ", " <<
+			"\"dynamic_pruning\" : " << policy.dynamic_pruning << ", " <<
+			"\"iterations\" : " << latencies.size() << ", " <<
+			"\"mean_time\" : " << mean_latency << ", " <<
+			"\"p99_time\" : " << p99_latency << ", " <<
+			"\"recall\" : " << total_recall / latencies.size() << ", " <<
+			"\"postings_read\" : " << total_postings - total_skipped << ", " <<
+			"\"multithreading\" : " << ENABLE_MULTITHREADING << ", " <<
+			"\"openmp\" : " << ENABLE_OPENMP << ", " <<
+			"\"mpi\" : " << ENABLE_MPI << ", " <<
+			"}" << std::endl;
+		LINFO << timing.str();
+		ofs.write(timing.str().c_str(), timing.str().size());
+		ofs.flush();
+	}
+	ofs.close();
+}
+
+int main(int argc, char *argv[]) {
+#if ENABLE_MULTITHREADING && ENABLE_MPI
+	MPI_Init(&argc, &argv);
+#endif
+
+	SimpleDataset oxford_dataset(s_oxfordmini_data_dir, s_oxfordmini_database_location);
+	LINFO << oxford_dataset;
+
+	bench_pruning(oxford_dataset, s_oxfordmini_num_clusters);
+
+#if ENABLE_MULTITHREADING && ENABLE_MPI
+	MPI_Finalize();
+#endif
+	return 0;
+}
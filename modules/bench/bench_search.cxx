@@ -38,8 +38,9 @@ void bench_oxford() {
 	double total_time = 0.0;
 	uint32_t num_validate = 16;
 	uint32_t total_iterations = 256;
-	// const std::vector<PTR_LIB::shared_ptr<const Image> > &rand_images = oxford_dataset.random_images(256);
+	// const ImageRange &rand_images = oxford_dataset.random_images(256);
 	for(uint32_t i=0; i<total_iterations; i++) {
+		if(!oxford_dataset.has_image(i)) continue;
 		std::cout << PerfTracker::instance() << std::endl;
 		PTR_LIB::shared_ptr<InvertedIndex::MatchResults> matches = 
 			std::static_pointer_cast<InvertedIndex::MatchResults>(ii.search(oxford_dataset, PTR_LIB::shared_ptr<const SearchParamsBase>(), oxford_dataset.image(i)));
@@ -55,10 +56,8 @@ void bench_oxford() {
 		// validate matches
 		cv::Mat keypoints_0, descriptors_0;
 		PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> query_image = std::static_pointer_cast<SimpleDataset::SimpleImage>(oxford_dataset.image(i));
-		const std::string &query_keypoints_location = oxford_dataset.location(query_image->feature_path("keypoints"));
-		const std::string &query_descriptors_location = oxford_dataset.location(query_image->feature_path("descriptors"));
-		filesystem::load_cvmat(query_keypoints_location, keypoints_0);
-		filesystem::load_cvmat(query_descriptors_location, descriptors_0);
+		oxford_dataset.load_mat_feature(query_image->id, "keypoints", keypoints_0);
+		oxford_dataset.load_mat_feature(query_image->id, "descriptors", descriptors_0);
 
     std::vector<int> validated(num_validate, 0);  
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
@@ -67,10 +66,8 @@ void bench_oxford() {
 		for(int32_t j=0; j<(int32_t)num_validate; j++) {
 			cv::Mat keypoints_1, descriptors_1;
 			PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> match_image = std::static_pointer_cast<SimpleDataset::SimpleImage>(oxford_dataset.image(matches->matches[j]));
-			const std::string &match_keypoints_location = oxford_dataset.location(match_image->feature_path("keypoints"));
-			const std::string &match_descriptors_location = oxford_dataset.location(match_image->feature_path("descriptors"));
-			filesystem::load_cvmat(match_keypoints_location, keypoints_1);
-			filesystem::load_cvmat(match_descriptors_location, descriptors_1);
+			oxford_dataset.load_mat_feature(match_image->id, "keypoints", keypoints_1);
+			oxford_dataset.load_mat_feature(match_image->id, "descriptors", descriptors_1);
 
 			cv::detail::MatchesInfo match_info;
 			vision::geo_verify_f(descriptors_0, keypoints_0, descriptors_1, keypoints_1, match_info);
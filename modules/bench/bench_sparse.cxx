@@ -0,0 +1,115 @@
+#include <config.hpp>
+
+#include "bench_config.hpp"
+
+#include <utils/filesystem.hpp>
+#include <utils/numerics.hpp>
+#include <utils/query_table.hpp>
+#include <utils/dataset.hpp>
+#include <utils/misc.hpp>
+#include <utils/logger.hpp>
+#include <utils/cycletimer.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <cmath>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Compares the time per scored pair of the pair based sparse vector functions with the
+/// structure of arrays ones, the ones taking pre-normalized vectors and the QueryTable batch
+/// scorer, scoring every pair of a sample of BoW vectors of the dataset.
+void bench_sparse(Dataset &dataset, uint32_t num_clusters) {
+	const uint32_t num_images = MIN(dataset.num_ids(), 1024);
+
+	std::vector<numerics::sparse_vector_t> pairs;
+	std::vector<numerics::SparseVector> vectors, l1_vectors, l2_vectors;
+	std::vector<float> idf_weights(num_clusters, 0.f);
+	for(uint32_t i=0; i<num_images; i++) {
+		const numerics::SparseVectorView &bow_descriptors = dataset.load_bow_feature(i);
+		if(bow_descriptors.empty()) continue;
+		vectors.push_back(numerics::SparseVector(bow_descriptors));
+		pairs.push_back(numerics::sparse_vector_t(bow_descriptors));
+		for(size_t j=0; j<bow_descriptors.size(); j++) {
+			if(bow_descriptors.index(j) < num_clusters) idf_weights[bow_descriptors.index(j)]++;
+		}
+	}
+	if(vectors.empty()) {
+		LERROR << "No BoW features found.";
+		return;
+	}
+	for(uint32_t i=0; i<num_clusters; i++) {
+		idf_weights[i] = idf_weights[i] > 0.f ? log((float)vectors.size() / idf_weights[i]) : 0.f;
+	}
+	for(size_t i=0; i<vectors.size(); i++) {
+		l1_vectors.push_back(numerics::normalize(vectors[i], idf_weights, numerics::NORM_L1));
+		l2_vectors.push_back(numerics::normalize(vectors[i], idf_weights, numerics::NORM_L2));
+	}
+
+	const uint64_t num_pairs = (uint64_t)vectors.size() * vectors.size();
+	const char *operations[] = { "min_hist_pairs", "min_hist", "cos_sim_pairs", "cos_sim", "l1_dist",
+		"min_hist_normalized", "cos_sim_normalized", "min_hist_table", "min_hist_table_normalized" };
+	const size_t num_operations = sizeof(operations) / sizeof(operations[0]);
+
+	std::stringstream timings_file_name;
+	timings_file_name << dataset.location() + "/results/times.sparse.json";
+	filesystem::create_file_directory(timings_file_name.str());
+	std::ofstream ofs(timings_file_name.str(), std::ios::app);
+
+	std::vector<float> scores(vectors.size());
+	const std::vector<numerics::SparseVectorView> views(vectors.begin(), vectors.end());
+	const std::vector<numerics::SparseVectorView> l1_views(l1_vectors.begin(), l1_vectors.end());
+	for(size_t o=0; o<num_operations; o++) {
+		// the checksum keeps the compiler from dropping the scoring
+		double checksum = 0.0;
+		double start_time = CycleTimer::currentSeconds();
+		for(size_t i=0; i<vectors.size(); i++) {
+			if(o >= 7) {
+				// the query is scattered once and scored against all vectors in one batch
+				QueryTable &table = QueryTable::thread_instance();
+				table.set(vectors[i], idf_weights);
+				if(o == 7) table.min_hist(&views[0], views.size(), idf_weights, &scores[0]);
+				else table.min_hist_normalized(&l1_views[0], l1_views.size(), &scores[0]);
+				table.clear();
+				for(size_t j=0; j<scores.size(); j++) checksum += scores[j];
+				continue;
+			}
+			for(size_t j=0; j<vectors.size(); j++) {
+				switch(o) {
+					case 0: checksum += numerics::min_hist(pairs[i], pairs[j], idf_weights); break;
+					case 1: checksum += numerics::min_hist(vectors[i], vectors[j], idf_weights); break;
+					case 2: checksum += numerics::cos_sim(pairs[i], pairs[j], idf_weights); break;
+					case 3: checksum += numerics::cos_sim(vectors[i], vectors[j], idf_weights); break;
+					case 4: checksum += numerics::l1_dist(vectors[i], vectors[j], idf_weights); break;
+					case 5: checksum += numerics::min_hist_normalized(l1_vectors[i], l1_vectors[j]); break;
+					case 6: checksum += numerics::cos_sim_normalized(l2_vectors[i], l2_vectors[j]); break;
+				}
+			}
+		}
+		double end_time = CycleTimer::currentSeconds();
+
+		std::stringstream timing;
+		timing << "{ " <<
+			"\"machine\" : \"" << misc::get_machine_name() << "\", " <<
+			"\"operation\" : \"" << operations[o] << "\", " <<
+			"\"index_numclusters\" : " << num_clusters << ", " <<
+			"\"num_vectors\" : " << vectors.size() << ", " <<
+			"\"num_pairs\" : " << num_pairs << ", " <<
+			"\"ns_per_pair\" : " << (end_time - start_time) * 1e9 / num_pairs << ", " <<
+			"\"checksum\" : " << checksum << ", " <<
+			"}" << std::endl;
+		LINFO << timing.str();
+		ofs.write(timing.str().c_str(), timing.str().size());
+		ofs.flush();
+	}
+	ofs.close();
+}
+
+int main(int argc, char *argv[]) {
+	SimpleDataset oxford_dataset(s_oxfordmini_data_dir, s_oxfordmini_database_location);
+	LINFO << oxford_dataset;
+
+	bench_sparse(oxford_dataset, s_oxfordmini_num_clusters);
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include <config.hpp>
+
+#include "bench_config.hpp"
+
+#include <utils/filesystem.hpp>
+#include <utils/numerics.hpp>
+#include <utils/dataset.hpp>
+#include <utils/misc.hpp>
+#include <utils/logger.hpp>
+#include <utils/cycletimer.hpp>
+#include <search/bag_of_words/bag_of_words.hpp>
+#include <search/inverted_index/inverted_index.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Compares the query latency of tiered loads of an index using a fraction of its size as memory
+/// budget.  The first budget fits the whole index in memory and is the baseline.  Every budget is
+/// run twice: the first run starts without access counts, the second one uses the counts saved
+/// by the first.
+void bench_tiered(Dataset &dataset, uint32_t num_clusters) {
+	const uint32_t num_queries = MIN(dataset.num_ids(), 256);
+	const float budget_fractions[] = { 2.f, 0.5f, 0.25f, 0.1f, 0.f };
+	const size_t num_budgets = sizeof(budget_fractions) / sizeof(budget_fractions[0]);
+
+	std::stringstream index_file;
+	index_file << dataset.location() << "/index/" << num_clusters << ".mapped.index";
+	const std::string access_counts_file = index_file.str() + ".bench_access";
+
+	{
+		std::stringstream vocab_output_file;
+		vocab_output_file << dataset.location() << "/vocabulary/" << num_clusters << ".vocab";
+		InvertedIndex ii;
+		PTR_LIB::shared_ptr<InvertedIndex::TrainParams> train_params = PTR_LIB::make_shared<InvertedIndex::TrainParams>();
+		train_params->bag_of_words = PTR_LIB::make_shared<BagOfWords>(vocab_output_file.str());
+		ii.train(dataset, train_params, dataset.all_images());
+		filesystem::create_file_directory(index_file.str());
+		ii.save_mapped(index_file.str());
+	}
+	std::ifstream index_stream(index_file.str(), std::ios::binary | std::ios::ate);
+	const uint64_t index_bytes = (uint64_t)index_stream.tellg();
+	index_stream.close();
+
+	std::stringstream timings_file_name;
+	timings_file_name << dataset.location() + "/results/times.tiered.json";
+	filesystem::create_file_directory(timings_file_name.str());
+	std::ofstream ofs(timings_file_name.str(), std::ios::app);
+
+	PTR_LIB::shared_ptr<InvertedIndex::SearchParams> search_params = PTR_LIB::make_shared<InvertedIndex::SearchParams>(4096, 16);
+	for(size_t b=0; b<num_budgets; b++) {
+		const uint64_t budget = (uint64_t)(budget_fractions[b] * index_bytes);
+		for(uint32_t run=0; run<2; run++) {
+			if(run == 0) filesystem::remove_file(access_counts_file);
+
+			InvertedIndex ii;
+			if(!ii.load_tiered(index_file.str(), budget, access_counts_file)) {
+				LERROR << "Error loading " << index_file.str();
+				return;
+			}
+
+			std::vector<double> latencies;
+			for(uint32_t i=0; i<num_queries; i++) {
+				if(!dataset.has_image(i)) continue;
+				double start_time = CycleTimer::currentSeconds();
+				PTR_LIB::shared_ptr<MatchResultsBase> matches = ii.search(dataset, search_params, dataset.image(i));
+				double end_time = CycleTimer::currentSeconds();
+				if(!matches) {
+					LERROR << "Error while running search.";
+					continue;
+				}
+				latencies.push_back(end_time - start_time);
+			}
+			if(latencies.empty()) continue;
+
+			std::sort(latencies.begin(), latencies.end());
+			double mean_latency = 0.0;
+			for(size_t i=0; i<latencies.size(); i++) mean_latency += latencies[i];
+			mean_latency /= latencies.size();
+			const double p99_latency = latencies[MIN(latencies.size() - 1, (size_t)(0.99 * latencies.size()))];
+			const InvertedIndex::TierStats &stats = ii.tier_stats();
+
+			std::stringstream timing;
+			timing << "{ " <<
+				"\"machine\" : \"" << misc::get_machine_name() << "\", " <<
+				"\"operation\" : \"" << "index_search_tiered" << "\", " <<
+				"\"index_numclusters\" : " << ii.num_clusters() << ", " <<
+				"\"db_size\" : " << dataset.num_images() << ", " <<
+				"\"index_bytes\" : " << index_bytes << ", " <<
+				"\"memory_budget\" : " << budget << ", " <<
+				"\"access_counts\" : " << (run > 0) << ", " <<
+				"\"hot_lists\" : " << stats.num_hot_lists << ", " <<
+				"\"cold_lists\" : " << stats.num_cold_lists << ", " <<
+				"\"hot_bytes\" : " << stats.hot_bytes << ", " <<
+				"\"pool_hits\" : " << stats.pool_hits << ", " <<
+				"\"pool_misses\" : " << stats.pool_misses << ", " <<
+				"\"iterations\" : " << latencies.size() << ", " <<
+				"\"mean_time\" : " << mean_latency << ", " <<
+				"\"p99_time\" : " << p99_latency << ", " <<
+				"\"multithreading\" : " << ENABLE_MULTITHREADING << ", " <<
+				"\"openmp\" : " << ENABLE_OPENMP << ", " <<
+				"\"mpi\" : " << ENABLE_MPI << ", " <<
+				"}" << std::endl;
+			LINFO << timing.str();
+			ofs.write(timing.str().c_str(), timing.str().size());
+			ofs.flush();
+		}
+	}
+	ofs.close();
+}
+
+int main(int argc, char *argv[]) {
+#if ENABLE_MULTITHREADING && ENABLE_MPI
+	MPI_Init(&argc, &argv);
+#endif
+
+	SimpleDataset oxford_dataset(s_oxfordmini_data_dir, s_oxfordmini_database_location);
+	LINFO << oxford_dataset;
+
+	bench_tiered(oxford_dataset, s_oxfordmini_num_clusters);
+
+#if ENABLE_MULTITHREADING && ENABLE_MPI
+	MPI_Finalize();
+#endif
+	return 0;
+}
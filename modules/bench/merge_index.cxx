@@ -0,0 +1,40 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/logger.hpp>
+#include <search/inverted_index/inverted_index.hpp>
+
+#include <iostream>
+#include <cstdlib>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Merges inverted indexes built on disjoint image id ranges, e.g. by running bench_index on
+/// partitions of a dataset, into a single index with global idf weights.
+int main(int argc, char *argv[]) {
+	if(argc < 3) {
+		std::cout << "Usage: " << argv[0] << " <output index> <input index>... [--num-images N]" << std::endl;
+		return -1;
+	}
+
+	const std::string output_path = argv[1];
+	std::vector<std::string> input_paths;
+	uint64_t num_images = 0;
+	for(int i=2; i<argc; i++) {
+		const std::string arg = argv[i];
+		if(arg == "--num-images" && i + 1 < argc) {
+			num_images = strtoull(argv[++i], 0, 10);
+		}
+		else {
+			input_paths.push_back(arg);
+		}
+	}
+
+	filesystem::create_file_directory(output_path);
+	if(!InvertedIndex::merge(input_paths, output_path, num_images)) {
+		LERROR << "Failed to merge inverted indexes into " << output_path;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/dataset.hpp>
+#include <utils/vision.hpp>
+#include <utils/logger.hpp>
+#include <search/bag_of_words/bag_of_words.hpp>
+#include <search/hamming_embedding/hamming_embedding.hpp>
+
+#include <iostream>
+#include <cstdlib>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Loads the descriptors of an image as floats.  Returns false if the image has none.
+static bool load_descriptors(Dataset &dataset, const PTR_LIB::shared_ptr<const Image> &image, cv::Mat &descriptorsf) {
+	cv::Mat descriptors;
+	if(!dataset.load_mat_feature(image->id, "descriptors", descriptors)) return false;
+	descriptors.convertTo(descriptorsf, CV_32FC1);
+	return descriptorsf.rows > 0;
+}
+
+/// Learns a Hamming embedding for a BoW vocabulary on a random sample of the images (unless the
+/// embedding file exists already), then writes the "he_signatures" feature of every image, which
+/// InvertedIndex reads when it is trained with TrainParams::hamming_signatures.
+int main(int argc, char *argv[]) {
+	if(argc < 5) {
+		std::cout << "Usage: " << argv[0] << " <data dir> <dataset file> <vocabulary> <embedding> [num training images]" << std::endl;
+		return -1;
+	}
+
+	SimpleDataset dataset(argv[1], argv[2]);
+	LINFO << dataset;
+	BagOfWords bow(argv[3]);
+	const uint32_t num_training_images = argc > 5 ? (uint32_t)atoi(argv[5]) : 256;
+
+	HammingEmbedding embedding;
+	if(filesystem::file_exists(argv[4])) {
+		if(!embedding.load(argv[4])) return -1;
+	} else {
+		std::cout << "Training hamming embedding on " << num_training_images << " images..." << std::endl;
+		const cv::Ptr<cv::DescriptorMatcher> &matcher = vision::construct_descriptor_matcher(bow.vocabulary());
+		const ImageRange &images = dataset.random_images(num_training_images);
+		std::vector<cv::Mat> all_descriptors;
+		std::vector<uint32_t> words;
+		for(size_t i=0; i<images.size(); i++) {
+			cv::Mat descriptorsf;
+			if(!load_descriptors(dataset, images[i], descriptorsf)) continue;
+			std::vector<cv::DMatch> matches;
+			matcher->match(descriptorsf, matches);
+			for(size_t j=0; j<matches.size(); j++) words.push_back(matches[j].trainIdx);
+			all_descriptors.push_back(descriptorsf);
+		}
+		if(all_descriptors.empty() || !embedding.train(vision::merge_descriptors(all_descriptors), words, bow.num_clusters())) {
+			LERROR << "Failed to train the hamming embedding";
+			return -1;
+		}
+		if(!embedding.save(argv[4])) return -1;
+	}
+
+	std::cout << "Computing signatures..." << std::endl;
+	const ImageRange &all_images = dataset.all_images();
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	uint32_t num_threads = omp_get_max_threads();
+	std::vector< cv::Ptr<cv::DescriptorMatcher> > matchers;
+	for(uint32_t i=0; i<num_threads; i++) {
+		matchers.push_back(vision::construct_descriptor_matcher(bow.vocabulary()));
+	}
+#pragma omp parallel for schedule(dynamic)
+#else
+	const cv::Ptr<cv::DescriptorMatcher> &matcher = vision::construct_descriptor_matcher(bow.vocabulary());
+#endif
+	for(int64_t i=0; i<(int64_t)all_images.size(); i++) {
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+		const cv::Ptr<cv::DescriptorMatcher> &matcher = matchers[omp_get_thread_num()];
+#endif
+		cv::Mat descriptorsf, bow_descriptors;
+		if(!load_descriptors(dataset, all_images[i], descriptorsf)) continue;
+
+		PTR_LIB::shared_ptr< std::vector<std::vector<uint32_t> > > cluster_indices = PTR_LIB::make_shared< std::vector<std::vector<uint32_t> > >();
+		if(!vision::compute_bow_feature(descriptorsf, matcher, bow_descriptors, cluster_indices)) continue;
+
+		HammingEmbedding::signatures_t signatures;
+		embedding.compute_signatures(descriptorsf, *cluster_indices, signatures);
+		const std::string &signatures_location = dataset.location(all_images[i]->feature_path("he_signatures"));
+		filesystem::create_file_directory(signatures_location);
+		if(!HammingEmbedding::write_signatures(signatures_location, signatures)) {
+			LERROR << "Failed to write " << signatures_location;
+		}
+	}
+
+	return 0;
+}
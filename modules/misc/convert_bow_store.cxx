@@ -0,0 +1,34 @@
+#include <config.hpp>
+
+#include <utils/dataset.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Packs the per image BoW feature files of a dataset (feats/bow_descriptors/...) into a single
+/// memory mapped store, which SimpleDataset then serves the BoW features from.  The store is
+/// written to <data dir>/feats/bow_descriptors.bowstore unless another location is given.
+int main(int argc, char *argv[]) {
+	if(argc < 3) {
+		std::cout << "Usage: " << argv[0] << " <data dir> <dataset file> [store file]" << std::endl;
+		return -1;
+	}
+
+	SimpleDataset dataset(argv[1], argv[2]);
+	LINFO << dataset;
+	const std::string store_location = argc > 3 ? argv[3] : dataset.bow_store_location();
+
+	std::cout << "Writing BoW store to " << store_location << "..." << std::endl;
+	if(!dataset.write_bow_store(store_location)) {
+		LERROR << "Failed to write the BoW store to " << store_location;
+		return -1;
+	}
+
+	BowStore store;
+	store.open(store_location);
+	std::cout << "Packed " << store.num_entries() << " entries of " << store.num_images() << " images, " <<
+		(uint32_t)store.encoding() << " bytes per term frequency" << std::endl;
+	return 0;
+}
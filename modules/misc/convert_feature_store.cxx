@@ -0,0 +1,43 @@
+#include <config.hpp>
+
+#include <utils/dataset.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Packs the per image files of matrix features (feats/keypoints/..., feats/descriptors/...) of a
+/// dataset into FeatureStores at <data dir>/feats/<feat_name>.featstore, which SimpleDataset then
+/// loads the features from.  Converts the keypoints and descriptors unless feature names are given.
+int main(int argc, char *argv[]) {
+	if(argc < 3) {
+		std::cout << "Usage: " << argv[0] << " <data dir> <dataset file> [feature name...]" << std::endl;
+		return -1;
+	}
+
+	SimpleDataset dataset(argv[1], argv[2]);
+	LINFO << dataset;
+
+	std::vector<std::string> feat_names(argv + 3, argv + argc);
+	if(feat_names.empty()) {
+		feat_names.push_back("keypoints");
+		feat_names.push_back("descriptors");
+	}
+
+	for(size_t i=0; i<feat_names.size(); i++) {
+		const std::string &store_location = dataset.feature_store_location(feat_names[i]);
+		std::cout << "Writing " << feat_names[i] << " store to " << store_location << "..." << std::endl;
+		if(!dataset.write_feature_store(feat_names[i], store_location)) {
+			LERROR << "Failed to write the feature store to " << store_location;
+			return -1;
+		}
+
+		FeatureStore store;
+		store.open(store_location);
+		std::cout << "Packed " << store.num_blocks() << " images, " << store.valid_size() << " bytes" << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,230 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/dataset.hpp>
+#include <utils/logger.hpp>
+#include <search/inverted_index/inverted_index.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Number of swap rounds per bisection step.
+static const uint32_t s_bisection_iterations = 20;
+/// Image sets of at most this size are not split any further.
+static const size_t s_bisection_leaf_size = 16;
+
+/// Estimated number of bits used by the gaps of a posting list with degree entries spread over
+/// size images.
+static inline float log_gap_cost(float size, float degree) {
+	return degree * log2f(size / (degree + 1.f));
+}
+
+/// Recursive graph bisection: the images are split into two halves, and images are swapped between
+/// the halves while this lowers the estimated size of the delta coded postings.  Images which
+/// share many words end up in the same half, and so get nearby ids.
+static void bisect(const std::vector<numerics::sparse_vector_t> &forward, uint64_t *images, size_t size,
+	std::vector<uint32_t> &left_degrees, std::vector<uint32_t> &right_degrees) {
+
+	if(size <= s_bisection_leaf_size) return;
+
+	const size_t half = size / 2;
+	uint64_t *left = images, *right = images + half;
+	const float left_size = (float)half, right_size = (float)(size - half);
+	std::vector< std::pair<float, uint64_t> > left_gains(half), right_gains(size - half);
+
+	for(uint32_t iteration=0; iteration<s_bisection_iterations; iteration++) {
+		for(size_t i=0; i<size; i++) {
+			const numerics::sparse_vector_t &words = forward[images[i]];
+			for(size_t j=0; j<words.size(); j++) {
+				left_degrees[words[j].first] = right_degrees[words[j].first] = 0;
+			}
+		}
+		for(size_t i=0; i<size; i++) {
+			std::vector<uint32_t> &degrees = i < half ? left_degrees : right_degrees;
+			const numerics::sparse_vector_t &words = forward[images[i]];
+			for(size_t j=0; j<words.size(); j++) degrees[words[j].first]++;
+		}
+
+		// gain of moving every image to the other half
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+		#pragma omp parallel for schedule(dynamic, 64)
+#endif
+		for(int64_t i=0; i<(int64_t)size; i++) {
+			const numerics::sparse_vector_t &words = forward[images[i]];
+			const int32_t direction = i < (int64_t)half ? -1 : 1;
+			float gain = 0.f;
+			for(size_t j=0; j<words.size(); j++) {
+				const float l = (float)left_degrees[words[j].first], r = (float)right_degrees[words[j].first];
+				gain += log_gap_cost(left_size, l) + log_gap_cost(right_size, r) -
+					log_gap_cost(left_size, l + direction) - log_gap_cost(right_size, r - direction);
+			}
+			if(i < (int64_t)half) left_gains[i] = std::pair<float, uint64_t>(gain, left[i]);
+			else right_gains[i - half] = std::pair<float, uint64_t>(gain, right[i - half]);
+		}
+
+		std::sort(left_gains.begin(), left_gains.end(), std::greater< std::pair<float, uint64_t> >());
+		std::sort(right_gains.begin(), right_gains.end(), std::greater< std::pair<float, uint64_t> >());
+		size_t num_swaps = 0;
+		while(num_swaps < left_gains.size() && num_swaps < right_gains.size() &&
+			left_gains[num_swaps].first + right_gains[num_swaps].first > 0.f) {
+			num_swaps++;
+		}
+		if(num_swaps == 0) break;
+
+		for(size_t i=0; i<left_gains.size(); i++) {
+			left[i] = i < num_swaps ? right_gains[i].second : left_gains[i].second;
+		}
+		for(size_t i=0; i<right_gains.size(); i++) {
+			right[i] = i < num_swaps ? left_gains[i].second : right_gains[i].second;
+		}
+	}
+
+	bisect(forward, left, half, left_degrees, right_degrees);
+	bisect(forward, right, size - half, left_degrees, right_degrees);
+}
+
+/// Returns the average number of bits of the log coded gaps of the postings, with the images
+/// numbered in the given order.
+static double average_gap_bits(const std::vector<numerics::sparse_vector_t> &forward, const std::vector<uint64_t> &order, uint32_t num_words) {
+	std::vector<uint64_t> last(num_words, 0);
+	double bits = 0.0;
+	uint64_t num_postings = 0;
+	for(size_t i=0; i<order.size(); i++) {
+		const numerics::sparse_vector_t &words = forward[order[i]];
+		for(size_t j=0; j<words.size(); j++) {
+			bits += log2((double)(i + 1 - last[words[j].first])) + 1.0;
+			last[words[j].first] = i + 1;
+			num_postings++;
+		}
+	}
+	return num_postings > 0 ? bits / num_postings : 0.0;
+}
+
+/// Moves the feature files of every feature type from the old to the new ids.  Files are first
+/// moved to temporary names, so that an image never overwrites a file that was not moved yet.
+static bool move_features(const SimpleDataset &dataset, const std::vector<uint64_t> &new_ids) {
+	const std::vector<std::string> &feature_directories = filesystem::list_directories(dataset.location() + "/feats");
+	for(size_t f=0; f<feature_directories.size(); f++) {
+		const std::string &feat_name = filesystem::basename(feature_directories[f], true);
+		std::cout << "Moving " << feat_name << " features..." << std::endl;
+
+		std::vector<bool> moved(new_ids.size(), false);
+		for(uint64_t id=0; id<new_ids.size(); id++) {
+			const std::string &from = dataset.location(SimpleDataset::SimpleImage("", id).feature_path(feat_name));
+			if(!filesystem::file_exists(from)) continue;
+			const std::string &to = dataset.location(SimpleDataset::SimpleImage("", new_ids[id]).feature_path(feat_name));
+			if(!filesystem::move_file(from, to + ".reorder")) return false;
+			moved[new_ids[id]] = true;
+		}
+		for(uint64_t id=0; id<new_ids.size(); id++) {
+			if(!moved[id]) continue;
+			const std::string &to = dataset.location(SimpleDataset::SimpleImage("", id).feature_path(feat_name));
+			if(!filesystem::move_file(to + ".reorder", to)) return false;
+		}
+	}
+	return true;
+}
+
+/// Updates the map from image ids to external ids stored next to the dataset file.  The file
+/// holds the number of images followed by the external id of every image, by image id.  Before
+/// the first reordering the external ids are the original ids.
+static bool update_id_map(const std::string &id_map_location, const std::vector<uint64_t> &new_ids) {
+	std::vector<uint64_t> external_ids(new_ids.size());
+	for(uint64_t id=0; id<new_ids.size(); id++) external_ids[id] = id;
+
+	if(filesystem::file_exists(id_map_location)) {
+		std::ifstream ifs(id_map_location, std::ios::binary);
+		uint64_t num_images = 0;
+		ifs.read((char *)&num_images, sizeof(uint64_t));
+		if(num_images != new_ids.size()) {
+			std::cerr << "Id map " << id_map_location << " does not match the dataset" << std::endl;
+			return false;
+		}
+		ifs.read((char *)&external_ids[0], sizeof(uint64_t) * num_images);
+		if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+	}
+
+	std::vector<uint64_t> remapped(new_ids.size());
+	for(uint64_t id=0; id<new_ids.size(); id++) remapped[new_ids[id]] = external_ids[id];
+
+	std::ofstream ofs(id_map_location, std::ios::binary | std::ios::trunc);
+	uint64_t num_images = remapped.size();
+	ofs.write((const char *)&num_images, sizeof(uint64_t));
+	ofs.write((const char *)&remapped[0], sizeof(uint64_t) * num_images);
+	return (ofs.rdstate() & std::ofstream::failbit) == 0;
+}
+
+/// Renumbers the images of a dataset so that images with similar BoW features get nearby ids,
+/// which makes delta coded postings smaller and candidate feature loads more local.  The new
+/// numbering is applied to the dataset file, the feature files and the given inverted indexes,
+/// and the original ids are kept in <dataset file>.idmap.
+int main(int argc, char *argv[]) {
+	if(argc < 3) {
+		std::cout << "Usage: " << argv[0] << " <data dir> <dataset file> [inverted index]..." << std::endl;
+		return -1;
+	}
+
+	SimpleDataset dataset(argv[1], argv[2]);
+	LINFO << dataset;
+	const uint64_t num_ids = dataset.num_ids();
+
+	std::cout << "Reading BoW features..." << std::endl;
+	std::vector<numerics::sparse_vector_t> forward(num_ids);
+	uint32_t num_words = 0;
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	#pragma omp parallel for schedule(dynamic) reduction(max : num_words)
+#endif
+	for(int64_t id=0; id<(int64_t)num_ids; id++) {
+		forward[id] = numerics::sparse_vector_t(dataset.load_bow_feature(id));
+		if(!forward[id].empty()) num_words = MAX(num_words, forward[id].back().first + 1);
+	}
+
+	std::cout << "Ordering images..." << std::endl;
+	std::vector<uint64_t> order(num_ids);
+	for(uint64_t id=0; id<num_ids; id++) order[id] = id;
+	const double bits_before = average_gap_bits(forward, order, num_words);
+	if(num_ids > 0) {
+		std::vector<uint32_t> left_degrees(num_words), right_degrees(num_words);
+		bisect(forward, &order[0], order.size(), left_degrees, right_degrees);
+	}
+	std::cout << "Average gap bits per posting: " << bits_before << " before, " <<
+		average_gap_bits(forward, order, num_words) << " after" << std::endl;
+
+	std::vector<uint64_t> new_ids(num_ids);
+	for(uint64_t i=0; i<num_ids; i++) new_ids[order[i]] = i;
+
+	// the id map is written first, so that a failure later on can be repaired by hand
+	if(!update_id_map(std::string(argv[2]) + ".idmap", new_ids)) {
+		LERROR << "Failed to write the id map";
+		return -1;
+	}
+	if(!move_features(dataset, new_ids)) {
+		LERROR << "Failed to move the feature files";
+		return -1;
+	}
+	dataset.remap_ids(new_ids);
+	if(!dataset.write(argv[2])) {
+		LERROR << "Failed to write the dataset to " << argv[2];
+		return -1;
+	}
+
+	for(int i=3; i<argc; i++) {
+		InvertedIndex index;
+		if(!index.load(argv[i])) {
+			LERROR << "Failed to load inverted index " << argv[i];
+			return -1;
+		}
+		const bool mapped = index.is_mapped();
+		index.remap_ids(new_ids);
+		if(!(mapped ? index.save_mapped(argv[i]) : index.save(argv[i]))) {
+			LERROR << "Failed to save inverted index " << argv[i];
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,44 @@
+#include <config.hpp>
+
+#include <utils/dataset.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <string>
+#include <cstring>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Picks up the images added to or removed from <data dir>/images since the dataset file was
+/// written, and rewrites the dataset file.  Existing images keep their ids, so their features and
+/// index entries stay valid.  Only the directories which changed since the last scan are listed,
+/// unless --full is given, which also reports the images modified in place.
+int main(int argc, char *argv[]) {
+	if(argc < 3) {
+		std::cout << "Usage: " << argv[0] << " <data dir> <dataset file> [--full]" << std::endl;
+		return -1;
+	}
+	const bool full = argc > 3 && strcmp(argv[3], "--full") == 0;
+
+	SimpleDataset dataset(argv[1], argv[2]);
+	LINFO << dataset;
+
+	ImageManifest::ScanResult result;
+	if(!dataset.rescan(result, full)) {
+		LERROR << "Failed to scan " << dataset.location() << "/images";
+		return -1;
+	}
+	std::cout << "Listed " << result.num_listed << " directories, " << result.num_reused << " unchanged" << std::endl;
+	std::cout << result.added.size() << " images added, " << result.removed.size() << " removed, " <<
+		result.modified.size() << " modified" << std::endl;
+	for(size_t i=0; i<result.added.size(); i++) std::cout << "+ " << result.added[i] << " " << dataset.image_location(result.added[i]) << std::endl;
+	for(size_t i=0; i<result.removed.size(); i++) std::cout << "- " << result.removed[i] << std::endl;
+	for(size_t i=0; i<result.modified.size(); i++) std::cout << "M " << result.modified[i] << " " << dataset.image_location(result.modified[i]) << std::endl;
+
+	if(!dataset.write(argv[2])) {
+		LERROR << "Failed to write the dataset to " << argv[2];
+		return -1;
+	}
+	LINFO << dataset;
+	return 0;
+}
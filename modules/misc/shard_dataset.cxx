@@ -0,0 +1,50 @@
+#include <config.hpp>
+
+#include <utils/dataset.hpp>
+#include <utils/sharded_dataset.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Splits a dataset into self-contained shards, one per shard directory, and writes the list of
+/// shards which ShardedDataset opens as a single dataset.  The images and feature files are hard
+/// linked into the shards (copied across filesystems), or moved with --move.  Images are assigned
+/// to the shards by id range, or by a hash of the id with --hash.
+int main(int argc, char *argv[]) {
+	if(argc < 5) {
+		std::cout << "Usage: " << argv[0] << " <data dir> <dataset file> <shard list file> <shard dir>... [--hash] [--move]" << std::endl;
+		return -1;
+	}
+	SimpleDataset::Partition partition = SimpleDataset::PARTITION_RANGE;
+	SimpleDataset::Transfer transfer = SimpleDataset::TRANSFER_LINK;
+	std::vector<std::string> shard_locations;
+	for(int i=4; i<argc; i++) {
+		if(strcmp(argv[i], "--hash") == 0) partition = SimpleDataset::PARTITION_HASH;
+		else if(strcmp(argv[i], "--move") == 0) transfer = SimpleDataset::TRANSFER_MOVE;
+		else shard_locations.push_back(argv[i]);
+	}
+
+	SimpleDataset dataset(argv[1], argv[2]);
+	LINFO << dataset;
+
+	if(!dataset.shard(shard_locations, partition, transfer)) {
+		LERROR << "Failed to shard " << dataset.location();
+		return -1;
+	}
+
+	ShardedDataset sharded_dataset(argv[1], shard_locations);
+	for(uint32_t s=0; s<sharded_dataset.num_shards(); s++) {
+		std::cout << shard_locations[s] << ": " << sharded_dataset.shard(s)->num_images() << " images" << std::endl;
+	}
+	if(sharded_dataset.num_images() != dataset.num_images() || !sharded_dataset.write(argv[3])) {
+		LERROR << "Failed to write the shard list to " << argv[3];
+		return -1;
+	}
+	LINFO << sharded_dataset;
+	return 0;
+}
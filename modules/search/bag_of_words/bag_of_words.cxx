@@ -68,30 +68,23 @@ fastann::nn_obj<float>* build_nnobj(void* p, float* clusters, unsigned K, unsign
 }
 #endif
 
-bool BagOfWords::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params, const std::vector< PTR_LIB::shared_ptr<const Image > > &examples) {
+bool BagOfWords::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params, const ImageRange &examples) {
 
 	const PTR_LIB::shared_ptr<const TrainParams> &ii_params = std::static_pointer_cast<const TrainParams>(params);
 	
 	uint32_t k = ii_params->numClusters;
 	uint32_t n = ii_params->numFeatures;
 
-	std::vector<uint64_t> all_ids(examples.size());
-	for (uint64_t i = 0; i < examples.size(); i++) {
-		all_ids[i] = examples[i]->id;
-	}
-	std::random_shuffle(all_ids.begin(), all_ids.end());
+	// examples are visited in random order until n features are gathered, so only the visited
+	// part of the permutation is ever built
+	ImageShuffler shuffler(examples);
 
 	std::vector<cv::Mat> all_descriptors;
 	uint64_t num_features = 0;
-	for (size_t i = 0; i < all_ids.size(); i++) {
-		PTR_LIB::shared_ptr<Image> image = std::static_pointer_cast<Image>(dataset.image(all_ids[i]));
-		if (image == PTR_LIB::shared_ptr<Image>()) continue;
-
-		const std::string &descriptors_location = dataset.location(image->feature_path("descriptors"));
-		if (!filesystem::file_exists(descriptors_location)) continue;
-
+	uint64_t id;
+	while (shuffler.next(id)) {
 		cv::Mat descriptors, descriptorsf;
-		if (filesystem::load_cvmat(descriptors_location, descriptors)) {
+		if (dataset.load_mat_feature(id, "descriptors", descriptors)) {
 			num_features += descriptors.rows;
 			if (n > 0 && num_features > n) break;
 			descriptors.convertTo(descriptorsf, CV_32FC1);
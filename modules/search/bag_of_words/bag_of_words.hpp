@@ -33,7 +33,7 @@ public:
 	/// Given a set of training parameters, list of images, trains.  Returns true if successful, false
 	/// if not successful.
 	bool train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params,
-		 		const std::vector< PTR_LIB::shared_ptr<const Image > > &examples);
+		 		const ImageRange &examples);
 
 	/// Loads a trained search structure from the input filepath
 	bool load (const std::string &file_path);
@@ -0,0 +1,211 @@
+#include <config.hpp>
+
+#include "hamming_embedding.hpp"
+
+#include <utils/filesystem.hpp>
+#include <fstream>
+#include <algorithm>
+
+const uint32_t HammingEmbedding::num_bits;
+
+HammingEmbedding::HammingEmbedding() {
+
+}
+
+HammingEmbedding::HammingEmbedding(const std::string &file_path) {
+	if(!filesystem::file_exists(file_path)) {
+		std::cerr << "Error reading hamming embedding from " << file_path << std::endl;
+		return;
+	}
+	if(!this->load(file_path)) {
+		std::cerr << "Error reading hamming embedding from " << file_path << std::endl;
+	}
+}
+
+bool HammingEmbedding::train(const cv::Mat &descriptors, const std::vector<uint32_t> &words, uint32_t num_words, uint64_t seed) {
+	if(descriptors.rows == 0 || descriptors.rows != (int)words.size()) return false;
+
+	cv::Mat descriptorsf;
+	descriptors.convertTo(descriptorsf, CV_32FC1);
+
+	// orthonormal rows from the SVD of a gaussian matrix
+	cv::Mat gaussian(num_bits, descriptorsf.cols, CV_32FC1);
+	cv::RNG rng(seed);
+	rng.fill(gaussian, cv::RNG::NORMAL, 0.0, 1.0);
+	cv::SVD svd(gaussian, cv::SVD::MODIFY_A);
+	projection = svd.u * svd.vt;
+
+	const cv::Mat &projected = project(descriptorsf);
+
+	// group the projections of every word, words without training descriptors use the median
+	// of all descriptors
+	std::vector<uint32_t> word_offsets(num_words + 2, 0);
+	for(size_t i=0; i<words.size(); i++) word_offsets[words[i] + 2]++;
+	for(uint32_t i=2; i<word_offsets.size(); i++) word_offsets[i] += word_offsets[i - 1];
+	std::vector<uint32_t> order(words.size());
+	for(size_t i=0; i<words.size(); i++) order[word_offsets[words[i] + 1]++] = (uint32_t)i;
+
+	medians = cv::Mat(num_words, num_bits, CV_32FC1, cv::Scalar::all(0.0));
+	std::vector<float> values;
+	for(uint32_t b=0; b<num_bits; b++) {
+		values.resize(words.size());
+		for(size_t i=0; i<words.size(); i++) values[i] = projected.at<float>((int)i, b);
+		std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+		const float global_median = values[values.size() / 2];
+
+		for(uint32_t w=0; w<num_words; w++) {
+			const uint32_t begin = word_offsets[w], end = word_offsets[w + 1];
+			if(begin == end) {
+				medians.at<float>(w, b) = global_median;
+				continue;
+			}
+			values.resize(end - begin);
+			for(uint32_t i=begin; i<end; i++) values[i - begin] = projected.at<float>(order[i], b);
+			std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+			medians.at<float>(w, b) = values[values.size() / 2];
+		}
+	}
+
+	return true;
+}
+
+bool HammingEmbedding::load(const std::string &file_path) {
+	std::cout << "Reading hamming embedding from " << file_path << "..." << std::endl;
+
+	std::ifstream ifs(file_path, std::ios::binary);
+	if(!read(ifs)) return false;
+
+	std::cout << "Done reading hamming embedding." << std::endl;
+	return true;
+}
+
+bool HammingEmbedding::save(const std::string &file_path) const {
+	std::cout << "Writing hamming embedding to " << file_path << "..." << std::endl;
+
+	filesystem::create_file_directory(file_path);
+	std::ofstream ofs(file_path, std::ios::binary | std::ios::trunc);
+	if(!write(ofs)) return false;
+
+	std::cout << "Done writing hamming embedding." << std::endl;
+	return true;
+}
+
+bool HammingEmbedding::read(std::istream &is) {
+	uint32_t bits = 0, dimensions = 0, words = 0;
+	is.read((char *)&bits, sizeof(uint32_t));
+	is.read((char *)&dimensions, sizeof(uint32_t));
+	is.read((char *)&words, sizeof(uint32_t));
+	if((is.rdstate() & std::istream::failbit) != 0 || bits != num_bits) return false;
+
+	projection.create(num_bits, dimensions, CV_32FC1);
+	medians.create(words, num_bits, CV_32FC1);
+	is.read((char *)projection.ptr(), sizeof(float) * num_bits * dimensions);
+	is.read((char *)medians.ptr(), sizeof(float) * num_bits * words);
+	return (is.rdstate() & std::istream::failbit) == 0;
+}
+
+bool HammingEmbedding::write(std::ostream &os) const {
+	uint32_t bits = num_bits, dimensions = projection.cols, words = medians.rows;
+	os.write((const char *)&bits, sizeof(uint32_t));
+	os.write((const char *)&dimensions, sizeof(uint32_t));
+	os.write((const char *)&words, sizeof(uint32_t));
+	os.write((const char *)projection.ptr(), sizeof(float) * num_bits * dimensions);
+	os.write((const char *)medians.ptr(), sizeof(float) * num_bits * words);
+	return (os.rdstate() & std::ostream::failbit) == 0;
+}
+
+cv::Mat HammingEmbedding::project(const cv::Mat &descriptors) const {
+	cv::Mat projected;
+	cv::gemm(descriptors, projection, 1.0, cv::Mat(), 0.0, projected, cv::GEMM_2_T);
+	return projected;
+}
+
+uint64_t HammingEmbedding::threshold(const float *projected, uint32_t word) const {
+	const float *thresholds = medians.ptr<float>(word);
+	uint64_t code = 0;
+	for(uint32_t b=0; b<num_bits; b++) {
+		if(projected[b] > thresholds[b]) code |= 1ULL << b;
+	}
+	return code;
+}
+
+uint64_t HammingEmbedding::signature(const cv::Mat &descriptor, uint32_t word) const {
+	cv::Mat descriptorf;
+	descriptor.convertTo(descriptorf, CV_32FC1);
+	const cv::Mat &projected = project(descriptorf);
+	return threshold(projected.ptr<float>(0), word);
+}
+
+void HammingEmbedding::compute_signatures(const cv::Mat &descriptors, const std::vector< std::vector<uint32_t> > &cluster_indices,
+	signatures_t &signatures) const {
+
+	signatures.clear();
+	if(descriptors.rows == 0) return;
+
+	cv::Mat descriptorsf;
+	descriptors.convertTo(descriptorsf, CV_32FC1);
+	const cv::Mat &projected = project(descriptorsf);
+
+	for(uint32_t w=0; w<cluster_indices.size() && w<(uint32_t)medians.rows; w++) {
+		for(size_t i=0; i<cluster_indices[w].size(); i++) {
+			signatures.push_back(std::pair<uint32_t, uint64_t>(w, threshold(projected.ptr<float>(cluster_indices[w][i]), w)));
+		}
+	}
+}
+
+void HammingEmbedding::compute_signatures(const cv::Mat &descriptors, const std::vector<uint32_t> &words,
+	std::vector<uint64_t> &signatures) const {
+
+	signatures.resize(descriptors.rows);
+	if(descriptors.rows == 0) return;
+
+	cv::Mat descriptorsf;
+	descriptors.convertTo(descriptorsf, CV_32FC1);
+	const cv::Mat &projected = project(descriptorsf);
+	for(int r=0; r<descriptors.rows; r++) signatures[r] = threshold(projected.ptr<float>(r), words[r]);
+}
+
+bool HammingEmbedding::empty() const {
+	return projection.empty();
+}
+
+uint32_t HammingEmbedding::num_words() const {
+	return medians.rows;
+}
+
+bool HammingEmbedding::load_signatures(const std::string &file_path, signatures_t &signatures) {
+	signatures.clear();
+	if(!filesystem::file_exists(file_path)) return false;
+
+	std::ifstream ifs(file_path, std::ios::binary);
+	uint32_t size = 0;
+	ifs.read((char *)&size, sizeof(uint32_t));
+	std::vector<uint32_t> words(size);
+	std::vector<uint64_t> codes(size);
+	if(size > 0) {
+		ifs.read((char *)&words[0], sizeof(uint32_t) * size);
+		ifs.read((char *)&codes[0], sizeof(uint64_t) * size);
+	}
+	if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+
+	signatures.resize(size);
+	for(uint32_t i=0; i<size; i++) signatures[i] = std::pair<uint32_t, uint64_t>(words[i], codes[i]);
+	return true;
+}
+
+bool HammingEmbedding::write_signatures(const std::string &file_path, const signatures_t &signatures) {
+	std::ofstream ofs(file_path, std::ios::binary | std::ios::trunc);
+	uint32_t size = signatures.size();
+	std::vector<uint32_t> words(size);
+	std::vector<uint64_t> codes(size);
+	for(uint32_t i=0; i<size; i++) {
+		words[i] = signatures[i].first;
+		codes[i] = signatures[i].second;
+	}
+	ofs.write((const char *)&size, sizeof(uint32_t));
+	if(size > 0) {
+		ofs.write((const char *)&words[0], sizeof(uint32_t) * size);
+		ofs.write((const char *)&codes[0], sizeof(uint64_t) * size);
+	}
+	return (ofs.rdstate() & std::ofstream::failbit) == 0;
+}
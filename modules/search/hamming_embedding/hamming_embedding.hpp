@@ -0,0 +1,97 @@
+#pragma once
+
+#include <config.hpp>
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <vector>
+#include <utility>
+
+/// Hamming embedding of descriptors: every descriptor is projected on num_bits random orthogonal
+/// directions and each projection is thresholded by its median over the training descriptors
+/// assigned to the same visual word.  Two descriptors of the same word whose signatures are far
+/// apart in Hamming distance are unlikely to match, so the signatures can reject false votes of a
+/// word before any geometric verification.
+class HammingEmbedding {
+public:
+	/// Signatures of the descriptors of an image, one (word, signature) pair per descriptor sorted
+	/// by word.
+	typedef std::vector< std::pair<uint32_t, uint64_t> > signatures_t;
+
+	/// Number of bits of a signature.
+	static const uint32_t num_bits = 64;
+
+	HammingEmbedding();
+	HammingEmbedding(const std::string &file_path);
+
+	/// Learns the projection and the per word medians from training descriptors (one per row,
+	/// converted to float) and the word each descriptor is assigned to.  The projection is drawn
+	/// from seed, so training is repeatable.  Returns false if there are no descriptors.
+	bool train(const cv::Mat &descriptors, const std::vector<uint32_t> &words, uint32_t num_words, uint64_t seed = 0);
+
+	/// Loads an embedding from the input filepath.
+	bool load(const std::string &file_path);
+
+	/// Saves the embedding to the input filepath.
+	bool save(const std::string &file_path) const;
+
+	/// Reads or writes the embedding at the current position of a stream, so that it can be stored
+	/// inside another model file.
+	bool read(std::istream &is);
+	bool write(std::ostream &os) const;
+
+	/// Returns the signature of a descriptor (a single float row) assigned to word.
+	uint64_t signature(const cv::Mat &descriptor, uint32_t word) const;
+
+	/// Computes the signatures of the descriptors of an image given the descriptors assigned to
+	/// every word (see vision::compute_bow_feature).
+	void compute_signatures(const cv::Mat &descriptors, const std::vector< std::vector<uint32_t> > &cluster_indices,
+		signatures_t &signatures) const;
+
+	/// Computes the signature of every descriptor (one per row) given the word of every descriptor.
+	void compute_signatures(const cv::Mat &descriptors, const std::vector<uint32_t> &words,
+		std::vector<uint64_t> &signatures) const;
+
+	/// Returns true if the embedding was not trained or loaded.
+	bool empty() const;
+
+	/// Returns the number of words the medians were learned for.
+	uint32_t num_words() const;
+
+	/// Returns the number of differing bits of two signatures.
+	static inline uint32_t distance(uint64_t a, uint64_t b) {
+#if defined(__GNUC__)
+		return (uint32_t)__builtin_popcountll(a ^ b);
+#else
+		uint64_t x = a ^ b;
+		x = x - ((x >> 1) & 0x5555555555555555ULL);
+		x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+		x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+		return (uint32_t)((x * 0x0101010101010101ULL) >> 56);
+#endif
+	}
+
+	/// Returns true if any signature of a is within max_distance bits of any signature of b.
+	static inline bool any_within(const uint64_t *a, size_t a_size, const uint64_t *b, size_t b_size, uint32_t max_distance) {
+		for(size_t i=0; i<a_size; i++) {
+			for(size_t j=0; j<b_size; j++) {
+				if(distance(a[i], b[j]) <= max_distance) return true;
+			}
+		}
+		return false;
+	}
+
+	/// Reads and writes the signatures of an image.
+	static bool load_signatures(const std::string &file_path, signatures_t &signatures);
+	static bool write_signatures(const std::string &file_path, const signatures_t &signatures);
+
+protected:
+	/// Projects descriptors (one per row) into num_bits dimensions.
+	cv::Mat project(const cv::Mat &descriptors) const;
+
+	/// Thresholds a projected descriptor by the medians of word.
+	uint64_t threshold(const float *projected, uint32_t word) const;
+
+	cv::Mat projection; /// num_bits x descriptor dimensions, orthonormal rows
+	cv::Mat medians; /// num_words x num_bits thresholds
+};
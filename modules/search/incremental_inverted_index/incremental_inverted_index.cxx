@@ -0,0 +1,624 @@
+#include <config.hpp>
+
+#include "incremental_inverted_index.hpp"
+
+#include <utils/filesystem.hpp>
+#include <utils/misc.hpp>
+#include <utils/numerics.hpp>
+#include <utils/accumulator.hpp>
+#include <utils/array_view.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+
+/// Number of segments merged at once by the background compaction.
+static const uint32_t s_merge_factor = 4;
+/// Number of buffered images at which the buffer is turned into a segment.  Queries scan the
+/// buffered images, so this bounds the work an update adds to every query.
+static const size_t s_max_buffered_images = 1024;
+
+/// Immutable set of indexed images.  Stores both the BoW vector of every image (forward index)
+/// and the list of images containing each word (inverted index).  Images are identified within
+/// the segment by their ordinal, the position of their id in the sorted image_ids.
+struct IncrementalInvertedIndex::Segment {
+	std::vector<uint64_t> image_ids; /// ascending
+	std::vector<uint64_t> image_offsets; /// start of each image's words, image_ids.size() + 1 entries
+	std::vector<uint32_t> image_words;
+	std::vector<float> image_frequencies;
+
+	std::vector<uint32_t> words; /// ascending words occurring in the segment
+	std::vector<uint64_t> word_offsets; /// start of each word's postings, words.size() + 1 entries
+	std::vector<uint32_t> postings; /// ascending ordinals of the images containing each word
+
+	/// Builds the segment from (id, BoW vector) pairs, the pairs are sorted by id.  The work only
+	/// depends on the number of entries, not on the size of the vocabulary, so building the small
+	/// segments of frequent flushes is cheap.
+	void build(std::vector< std::pair<uint64_t, numerics::SparseVectorView> > &images) {
+		std::sort(images.begin(), images.end(),
+			boost::bind(&std::pair<uint64_t, numerics::SparseVectorView>::first, _1) <
+			boost::bind(&std::pair<uint64_t, numerics::SparseVectorView>::first, _2));
+
+		image_ids.resize(images.size());
+		image_offsets.resize(images.size() + 1);
+		image_offsets[0] = 0;
+		for(size_t i=0; i<images.size(); i++) {
+			image_ids[i] = images[i].first;
+			image_offsets[i + 1] = image_offsets[i] + images[i].second.size();
+		}
+
+		// (word, ordinal) keys sorted by word then ordinal give the postings in order
+		image_words.resize(image_offsets.back());
+		image_frequencies.resize(image_offsets.back());
+		std::vector<uint64_t> entries(image_offsets.back());
+		for(size_t i=0; i<images.size(); i++) {
+			const numerics::SparseVectorView &bow_descriptors = images[i].second;
+			for(size_t j=0; j<bow_descriptors.size(); j++) {
+				image_words[image_offsets[i] + j] = bow_descriptors.index(j);
+				image_frequencies[image_offsets[i] + j] = bow_descriptors.value(j);
+				entries[image_offsets[i] + j] = ((uint64_t)bow_descriptors.index(j) << 32) | i;
+			}
+		}
+		std::sort(entries.begin(), entries.end());
+
+		words.clear();
+		word_offsets.assign(1, 0);
+		postings.resize(entries.size());
+		for(size_t i=0; i<entries.size(); i++) {
+			const uint32_t word = entries[i] >> 32;
+			if(words.empty() || words.back() != word) {
+				if(!words.empty()) word_offsets.push_back(i);
+				words.push_back(word);
+			}
+			postings[i] = (uint32_t)entries[i];
+		}
+		if(!words.empty()) word_offsets.push_back(entries.size());
+	}
+
+	/// Returns the ordinals of the images containing the word.
+	ArrayView<uint32_t> word_postings(uint32_t word) const {
+		std::vector<uint32_t>::const_iterator it = std::lower_bound(words.begin(), words.end(), word);
+		if(it == words.end() || *it != word) return ArrayView<uint32_t>();
+		const size_t i = it - words.begin();
+		return ArrayView<uint32_t>(&postings[word_offsets[i]], word_offsets[i + 1] - word_offsets[i]);
+	}
+
+	/// Returns the ordinal of the image, or UINT32_MAX if it is not in the segment.
+	uint32_t find(uint64_t id) const {
+		std::vector<uint64_t>::const_iterator it = std::lower_bound(image_ids.begin(), image_ids.end(), id);
+		return (it == image_ids.end() || *it != id) ? UINT32_MAX : (uint32_t)(it - image_ids.begin());
+	}
+
+	/// Returns a view of the BoW vector of an image, valid as long as the segment.
+	numerics::SparseVectorView bow(uint32_t ordinal) const {
+		const uint64_t begin = image_offsets[ordinal], size = image_offsets[ordinal + 1] - begin;
+		if(size == 0) return numerics::SparseVectorView();
+		return numerics::SparseVectorView(&image_words[begin], &image_frequencies[begin], size);
+	}
+
+	uint32_t num_images() const {
+		return image_ids.size();
+	}
+};
+
+/// Consistent view of the index used by queries.
+struct IncrementalInvertedIndex::Snapshot {
+	std::vector<SegmentRef> segments;
+	std::vector<uint64_t> bases; /// first candidate key of every segment, plus the first key of the buffered images
+	std::vector<buffered_image_t> buffered;
+	std::vector<float> idf_weights;
+};
+
+/// Counts the words two vectors share.
+struct SharedWordCounter {
+	uint32_t count;
+
+	SharedWordCounter() : count(0) { }
+
+	inline void operator()(size_t i, size_t j) {
+		count++;
+	}
+};
+
+static inline bool is_removed(const PTR_LIB::shared_ptr<const std::vector<uint64_t> > &tombstones, uint32_t ordinal) {
+	return tombstones && ((*tombstones)[ordinal / 64] >> (ordinal % 64)) & 1;
+}
+
+IncrementalInvertedIndex::IncrementalInvertedIndex(uint32_t max_segments, bool background_compaction) : SearchBase(),
+	num_indexed(0), max_segments(MAX(max_segments, 1)), stopping(false) {
+	if(background_compaction) {
+		compaction_thread = std::thread(&IncrementalInvertedIndex::compaction_loop, this);
+	}
+}
+
+IncrementalInvertedIndex::IncrementalInvertedIndex(const std::string &file_name) : SearchBase(file_name),
+	num_indexed(0), max_segments(8), stopping(false) {
+	compaction_thread = std::thread(&IncrementalInvertedIndex::compaction_loop, this);
+	if(!filesystem::file_exists(file_name)) {
+		std::cerr << "Error reading incremental index from " << file_name << std::endl;
+		return;
+	}
+	if(!this->load(file_name)) {
+		std::cerr << "Error reading incremental index from " << file_name << std::endl;
+	}
+}
+
+IncrementalInvertedIndex::~IncrementalInvertedIndex() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	compaction_needed.notify_all();
+	if(compaction_thread.joinable()) compaction_thread.join();
+}
+
+bool IncrementalInvertedIndex::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params,
+	const ImageRange &examples) {
+
+	{
+		std::lock_guard<std::mutex> merge_lock(merge_mutex);
+		std::lock_guard<std::mutex> lock(mutex);
+		segments.clear();
+		buffered.clear();
+		buffered_index.clear();
+		document_frequencies.clear();
+		num_indexed = 0;
+		current_snapshot.reset();
+	}
+
+	std::vector<numerics::SparseVectorView> features(examples.size());
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int64_t i=0; i<(int64_t)examples.size(); i++) {
+		features[i] = dataset.load_bow_feature(examples.id(i));
+	}
+
+	for(size_t i=0; i<examples.size(); i++) {
+		if(!features[i].empty()) add(examples.id(i), features[i]);
+	}
+
+	compact();
+
+	return true;
+}
+
+bool IncrementalInvertedIndex::add(Dataset &dataset, const PTR_LIB::shared_ptr<const Image > &image) {
+	const numerics::SparseVectorView &bow_descriptors = dataset.load_bow_feature(image->id);
+	if(bow_descriptors.empty()) return false;
+
+	add(image->id, bow_descriptors);
+	return true;
+}
+
+void IncrementalInvertedIndex::add(uint64_t id, const numerics::sparse_vector_t &bow_descriptors) {
+	add_buffered(id, PTR_LIB::make_shared<const numerics::SparseVector>(bow_descriptors));
+}
+
+void IncrementalInvertedIndex::add(uint64_t id, const numerics::SparseVectorView &bow_descriptors) {
+	add_buffered(id, PTR_LIB::make_shared<const numerics::SparseVector>(bow_descriptors));
+}
+
+void IncrementalInvertedIndex::add_buffered(uint64_t id, const PTR_LIB::shared_ptr<const numerics::SparseVector> &bow_descriptors) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	remove_locked(id);
+
+	buffered_index[id] = buffered.size();
+	buffered.push_back(buffered_image_t(id, bow_descriptors));
+	update_document_frequencies(*bow_descriptors, 1);
+	num_indexed++;
+	current_snapshot.reset();
+
+	if(buffered.size() >= s_max_buffered_images) flush();
+}
+
+bool IncrementalInvertedIndex::remove(uint64_t id) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return remove_locked(id);
+}
+
+bool IncrementalInvertedIndex::remove_locked(uint64_t id) {
+	std::unordered_map<uint64_t, size_t>::iterator it = buffered_index.find(id);
+	if(it != buffered_index.end()) {
+		const size_t position = it->second;
+		update_document_frequencies(*buffered[position].second, -1);
+		if(position + 1 != buffered.size()) {
+			buffered[position].swap(buffered.back());
+			buffered_index[buffered[position].first] = position;
+		}
+		buffered.pop_back();
+		buffered_index.erase(it);
+		num_indexed--;
+		current_snapshot.reset();
+		return true;
+	}
+
+	for(size_t i=0; i<segments.size(); i++) {
+		const Segment &segment = *segments[i].segment;
+		const uint32_t ordinal = segment.find(id);
+		if(ordinal == UINT32_MAX || is_removed(segments[i].tombstones, ordinal)) continue;
+
+		// copy on write, snapshots keep the previous tombstones
+		PTR_LIB::shared_ptr< std::vector<uint64_t> > tombstones = segments[i].tombstones ?
+			PTR_LIB::make_shared< std::vector<uint64_t> >(*segments[i].tombstones) :
+			PTR_LIB::make_shared< std::vector<uint64_t> >((segment.num_images() + 63) / 64, 0);
+		(*tombstones)[ordinal / 64] |= 1ULL << (ordinal % 64);
+		segments[i].tombstones = tombstones;
+
+		update_document_frequencies(segment.bow(ordinal), -1);
+		num_indexed--;
+		current_snapshot.reset();
+		return true;
+	}
+	return false;
+}
+
+void IncrementalInvertedIndex::update_document_frequencies(const numerics::SparseVectorView &bow_descriptors, int32_t delta) {
+	for(size_t i=0; i<bow_descriptors.size(); i++) {
+		const uint32_t word = bow_descriptors.index(i);
+		if(word >= document_frequencies.size()) document_frequencies.resize(word + 1, 0);
+		document_frequencies[word] += delta;
+	}
+}
+
+void IncrementalInvertedIndex::flush() {
+	if(buffered.empty()) return;
+
+	std::vector< std::pair<uint64_t, numerics::SparseVectorView> > images(buffered.size());
+	for(size_t i=0; i<buffered.size(); i++) {
+		images[i] = std::pair<uint64_t, numerics::SparseVectorView>(buffered[i].first, *buffered[i].second);
+	}
+	PTR_LIB::shared_ptr<Segment> segment = PTR_LIB::make_shared<Segment>();
+	segment->build(images);
+	buffered.clear();
+	buffered_index.clear();
+
+	SegmentRef ref;
+	ref.segment = segment;
+	segments.push_back(ref);
+	current_snapshot.reset();
+
+	if(segments.size() > max_segments) compaction_needed.notify_one();
+}
+
+PTR_LIB::shared_ptr<const IncrementalInvertedIndex::Snapshot> IncrementalInvertedIndex::snapshot() {
+	if(current_snapshot) return current_snapshot;
+
+	PTR_LIB::shared_ptr<Snapshot> snapshot = PTR_LIB::make_shared<Snapshot>();
+	snapshot->segments = segments;
+	snapshot->buffered = buffered;
+	snapshot->bases.resize(segments.size() + 1, 0);
+	for(size_t i=0; i<segments.size(); i++) {
+		snapshot->bases[i + 1] = snapshot->bases[i] + segments[i].segment->num_images();
+	}
+	snapshot->idf_weights.resize(document_frequencies.size(), 0.f);
+	for(size_t i=0; i<document_frequencies.size(); i++) {
+		if(document_frequencies[i] > 0) snapshot->idf_weights[i] = logf((float)num_indexed / (float)document_frequencies[i]);
+	}
+
+	current_snapshot = snapshot;
+	return current_snapshot;
+}
+
+bool IncrementalInvertedIndex::merge(std::vector<SegmentRef> refs) {
+	std::lock_guard<std::mutex> merge_lock(merge_mutex);
+
+	// another merge may have replaced some of the segments, and images may have been removed
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(size_t i=0; i<refs.size(); i++) {
+			size_t j = 0;
+			while(j < segments.size() && segments[j].segment != refs[i].segment) j++;
+			if(j == segments.size()) return false;
+			refs[i] = segments[j];
+		}
+	}
+	if(refs.empty()) return false;
+
+	// the vectors are viewed in the merged segments, which refs keeps alive
+	std::vector< std::pair<uint64_t, numerics::SparseVectorView> > images;
+	for(size_t i=0; i<refs.size(); i++) {
+		const Segment &segment = *refs[i].segment;
+		for(uint32_t j=0; j<segment.num_images(); j++) {
+			if(is_removed(refs[i].tombstones, j)) continue;
+			images.push_back(std::pair<uint64_t, numerics::SparseVectorView>(segment.image_ids[j], segment.bow(j)));
+		}
+	}
+	PTR_LIB::shared_ptr<Segment> merged = PTR_LIB::make_shared<Segment>();
+	merged->build(images);
+	std::vector< std::pair<uint64_t, numerics::SparseVectorView> >().swap(images);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// carry over the images removed while merging
+	SegmentRef merged_ref;
+	merged_ref.segment = merged;
+	PTR_LIB::shared_ptr< std::vector<uint64_t> > tombstones;
+	for(size_t i=0; i<refs.size(); i++) {
+		std::vector<SegmentRef>::iterator it = segments.begin();
+		while(it->segment != refs[i].segment) it++;
+
+		if(it->tombstones != refs[i].tombstones) {
+			const Segment &segment = *refs[i].segment;
+			for(uint32_t j=0; j<segment.num_images(); j++) {
+				if(!is_removed(it->tombstones, j) || is_removed(refs[i].tombstones, j)) continue;
+				const uint32_t ordinal = merged->find(segment.image_ids[j]);
+				if(ordinal == UINT32_MAX) continue;
+				if(!tombstones) tombstones = PTR_LIB::make_shared< std::vector<uint64_t> >((merged->num_images() + 63) / 64, 0);
+				(*tombstones)[ordinal / 64] |= 1ULL << (ordinal % 64);
+			}
+		}
+		segments.erase(it);
+	}
+	merged_ref.tombstones = tombstones;
+	if(merged->num_images() > 0) segments.push_back(merged_ref);
+	current_snapshot.reset();
+
+	return true;
+}
+
+static bool segment_size_less(const std::pair<uint32_t, size_t> &a, const std::pair<uint32_t, size_t> &b) {
+	return a.first < b.first;
+}
+
+void IncrementalInvertedIndex::compact_segments() {
+	while(true) {
+		std::vector<SegmentRef> refs;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(stopping || segments.size() <= max_segments) return;
+
+			std::vector< std::pair<uint32_t, size_t> > sizes(segments.size());
+			for(size_t i=0; i<segments.size(); i++) {
+				sizes[i] = std::pair<uint32_t, size_t>(segments[i].segment->num_images(), i);
+			}
+			const size_t count = MIN(MAX(s_merge_factor, segments.size() - max_segments + 1), segments.size());
+			std::partial_sort(sizes.begin(), sizes.begin() + count, sizes.end(), segment_size_less);
+			for(size_t i=0; i<count; i++) refs.push_back(segments[sizes[i].second]);
+		}
+		merge(refs);
+	}
+}
+
+void IncrementalInvertedIndex::compaction_loop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while(!stopping) {
+		// the segments are checked under the lock, so a flush notifying while the thread was
+		// compacting is not missed
+		compaction_needed.wait(lock, [this] { return stopping || segments.size() > max_segments; });
+		if(stopping) break;
+		lock.unlock();
+		compact_segments();
+		lock.lock();
+	}
+}
+
+void IncrementalInvertedIndex::compact() {
+	std::vector<SegmentRef> refs;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		flush();
+		refs = segments;
+	}
+	if(refs.size() > 1 || (refs.size() == 1 && refs[0].tombstones)) merge(refs);
+}
+
+uint64_t IncrementalInvertedIndex::num_images() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return num_indexed;
+}
+
+uint32_t IncrementalInvertedIndex::num_segments() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return segments.size();
+}
+
+bool IncrementalInvertedIndex::load (const std::string &file_path) {
+	std::cout << "Reading incremental inverted index from " << file_path << "..." << std::endl;
+
+	std::ifstream ifs(file_path, std::ios::binary);
+	uint64_t num_images = 0;
+	ifs.read((char *)&num_images, sizeof(uint64_t));
+
+	std::vector< std::pair<uint64_t, numerics::sparse_vector_t> > images(num_images);
+	for(uint64_t i=0; i<num_images && ifs; i++) {
+		uint32_t num_words = 0;
+		ifs.read((char *)&images[i].first, sizeof(uint64_t));
+		ifs.read((char *)&num_words, sizeof(uint32_t));
+		images[i].second.resize(num_words);
+		if(num_words > 0) ifs.read((char *)&images[i].second[0], sizeof(std::pair<uint32_t, float>) * num_words);
+	}
+	if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+
+	{
+		std::lock_guard<std::mutex> merge_lock(merge_mutex);
+		std::lock_guard<std::mutex> lock(mutex);
+		segments.clear();
+		buffered.clear();
+		buffered_index.clear();
+		document_frequencies.clear();
+		num_indexed = 0;
+		for(uint64_t i=0; i<num_images; i++) {
+			remove_locked(images[i].first);
+			const PTR_LIB::shared_ptr<const numerics::SparseVector> bow_descriptors =
+				PTR_LIB::make_shared<const numerics::SparseVector>(images[i].second);
+			numerics::sparse_vector_t().swap(images[i].second);
+			update_document_frequencies(*bow_descriptors, 1);
+			buffered_index[images[i].first] = buffered.size();
+			buffered.push_back(buffered_image_t(images[i].first, bow_descriptors));
+			num_indexed++;
+		}
+		flush();
+	}
+
+	std::cout << "Done reading incremental inverted index." << std::endl;
+
+	return true;
+}
+
+/// Writes an image as its id, its number of words and its (word, frequency) pairs.
+static void write_image(std::ofstream &ofs, uint64_t id, const numerics::SparseVectorView &bow_descriptors) {
+	const numerics::sparse_vector_t pairs(bow_descriptors);
+	uint32_t num_words = pairs.size();
+	ofs.write((const char *)&id, sizeof(uint64_t));
+	ofs.write((const char *)&num_words, sizeof(uint32_t));
+	if(num_words > 0) ofs.write((const char *)&pairs[0], sizeof(std::pair<uint32_t, float>) * num_words);
+}
+
+bool IncrementalInvertedIndex::save (const std::string &file_path) const {
+	std::cout << "Writing incremental inverted index to " << file_path << "..." << std::endl;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::ofstream ofs(file_path, std::ios::binary | std::ios::trunc);
+	ofs.write((const char *)&num_indexed, sizeof(uint64_t));
+
+	for(size_t i=0; i<segments.size() + buffered.size(); i++) {
+		if(i < segments.size()) {
+			const Segment &segment = *segments[i].segment;
+			for(uint32_t j=0; j<segment.num_images(); j++) {
+				if(is_removed(segments[i].tombstones, j)) continue;
+				write_image(ofs, segment.image_ids[j], segment.bow(j));
+			}
+		} else {
+			const buffered_image_t &image = buffered[i - segments.size()];
+			write_image(ofs, image.first, *image.second);
+		}
+	}
+
+	std::cout << "Done writing incremental inverted index." << std::endl;
+
+	return (ofs.rdstate() & std::ofstream::failbit) == 0;
+}
+
+PTR_LIB::shared_ptr<MatchResultsBase> IncrementalInvertedIndex::search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params,
+	const PTR_LIB::shared_ptr<const Image > &example) {
+
+	const numerics::SparseVectorView &example_bow_descriptors = dataset.load_bow_feature(example->id);
+	return this->search(params, example_bow_descriptors);
+}
+
+PTR_LIB::shared_ptr<MatchResultsBase> IncrementalInvertedIndex::search(const PTR_LIB::shared_ptr<const SearchParamsBase> &params,
+	const numerics::sparse_vector_t &example_bow_descriptors) {
+
+	const numerics::SparseVector example_vector(example_bow_descriptors);
+	return this->search(params, example_vector);
+}
+
+PTR_LIB::shared_ptr<MatchResultsBase> IncrementalInvertedIndex::search(const PTR_LIB::shared_ptr<const SearchParamsBase> &params,
+	const numerics::SparseVectorView &example_bow_descriptors) {
+
+	SCOPED_TIMER
+
+	const PTR_LIB::shared_ptr<const InvertedIndex::SearchParams> &ii_params = (!params) ?
+		PTR_LIB::make_shared<const InvertedIndex::SearchParams>()
+		: std::static_pointer_cast<const InvertedIndex::SearchParams>(params);
+
+	PTR_LIB::shared_ptr<const Snapshot> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		snapshot = this->snapshot();
+	}
+
+	PTR_LIB::shared_ptr<InvertedIndex::MatchResults> match_result = PTR_LIB::make_shared<InvertedIndex::MatchResults>();
+
+	// words which are not indexed cannot match and have no idf weight
+	numerics::SparseVector query;
+	for(size_t i=0; i<example_bow_descriptors.size(); i++) {
+		if(example_bow_descriptors.index(i) < snapshot->idf_weights.size()) {
+			query.push_back(example_bow_descriptors.index(i), example_bow_descriptors.value(i));
+		}
+	}
+
+	// Count the number of words each image shares with the query, images are keyed by the
+	// segment base plus their ordinal.
+	std::vector< std::vector< ArrayView<uint32_t> > > segment_postings(snapshot->segments.size());
+	for(size_t s=0; s<snapshot->segments.size(); s++) {
+		segment_postings[s].resize(query.size());
+		for(size_t i=0; i<query.size(); i++) {
+			segment_postings[s][i] = snapshot->segments[s].segment->word_postings(query.index(i));
+			match_result->num_postings += segment_postings[s][i].size();
+		}
+	}
+
+	// the buffered images are not indexed, they are intersected with the query one by one
+	const uint64_t buffered_base = snapshot->bases.back();
+	std::vector<uint32_t> buffered_counts(snapshot->buffered.size());
+	for(size_t i=0; i<snapshot->buffered.size(); i++) {
+		SharedWordCounter counter;
+		numerics::intersect(query, *snapshot->buffered[i].second, counter);
+		buffered_counts[i] = counter.count;
+		match_result->num_postings += counter.count;
+	}
+
+	ScoreAccumulator &accumulator = ScoreAccumulator::thread_instance();
+	accumulator.reset(buffered_base + snapshot->buffered.size(), match_result->num_postings);
+	for(size_t i=0; i<snapshot->buffered.size(); i++) {
+		if(buffered_counts[i] > 0) accumulator.add(buffered_base + i, buffered_counts[i]);
+	}
+	for(size_t s=0; s<snapshot->segments.size(); s++) {
+		const PTR_LIB::shared_ptr<const std::vector<uint64_t> > &tombstones = snapshot->segments[s].tombstones;
+		const uint64_t base = snapshot->bases[s];
+		for(size_t i=0; i<query.size(); i++) {
+			const ArrayView<uint32_t> &postings = segment_postings[s][i];
+			for(size_t j=0; j<postings.size(); j++) {
+				if(!is_removed(tombstones, postings[j])) accumulator.add(base + postings[j]);
+			}
+		}
+	}
+
+	std::vector<ScoreAccumulator::entry_t> candidates;
+	accumulator.top(ii_params->cutoff_idx, candidates);
+	accumulator.clear();
+
+	std::vector< std::pair<float, uint64_t> > candidate_scores(candidates.size());
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int64_t i=0; i<(int64_t)candidates.size(); i++) {
+		const uint64_t key = candidates[i].second;
+		if(key >= buffered_base) {
+			const buffered_image_t &image = snapshot->buffered[key - buffered_base];
+			candidate_scores[i] = std::pair<float, uint64_t>(numerics::min_hist(query, *image.second, snapshot->idf_weights), image.first);
+			continue;
+		}
+		const size_t s = std::upper_bound(snapshot->bases.begin(), snapshot->bases.end(), key) - snapshot->bases.begin() - 1;
+		const Segment &segment = *snapshot->segments[s].segment;
+		const uint32_t ordinal = key - snapshot->bases[s];
+
+		float sim = numerics::min_hist(query, segment.bow(ordinal), snapshot->idf_weights);
+		candidate_scores[i] = std::pair<float, uint64_t>(sim, segment.image_ids[ordinal]);
+	}
+
+	if(ii_params->max_matches > 0 && ii_params->max_matches < candidate_scores.size()) {
+		std::partial_sort(candidate_scores.begin(), candidate_scores.begin() + ii_params->max_matches, candidate_scores.end(),
+			match_greater<float>);
+		candidate_scores.resize(ii_params->max_matches);
+	} else {
+		std::sort(candidate_scores.begin(), candidate_scores.end(), match_greater<float>);
+	}
+
+	match_result->tfidf_scores.resize(candidate_scores.size());
+	match_result->matches.resize(candidate_scores.size());
+	for(size_t i=0; i<candidate_scores.size(); i++) {
+		match_result->tfidf_scores[i] = candidate_scores[i].first;
+		match_result->matches[i] = candidate_scores[i].second;
+	}
+
+	return std::static_pointer_cast<MatchResultsBase>(match_result);
+}
+
+std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > IncrementalInvertedIndex::search(Dataset &dataset, const PTR_LIB::shared_ptr<SearchParamsBase> &params,
+															 const std::vector< PTR_LIB::shared_ptr<const Image > > &examples) {
+	std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > match_results(examples.size());
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int64_t i=0; i<(int64_t)examples.size(); i++) {
+		match_results[i] = this->search(dataset, params, examples[i]);
+	}
+	return match_results;
+}
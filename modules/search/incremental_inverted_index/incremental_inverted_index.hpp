@@ -0,0 +1,130 @@
+#pragma once
+
+#include <search/search_base/search_base.hpp>
+#include <search/inverted_index/inverted_index.hpp>
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+
+/// Implements a Bag of Words based image search over an inverted index which can be updated while
+/// it is searched.  Added images are buffered in memory, where queries score them directly, and
+/// the buffer is turned into an immutable segment once it is full (see flush).  Removed images
+/// are marked in a per segment tombstone bitmap.  A background thread merges small segments into
+/// larger ones and drops removed images, so the number of segments stays bounded.  Every query
+/// works on a snapshot of the segments, tombstones, buffered images and idf weights, which is not
+/// affected by concurrent updates or compactions.  Segments store the BoW vectors of their
+/// images, so the candidates are scored without reading features from the dataset.
+class IncrementalInvertedIndex : public SearchBase {
+public:
+
+	/// Subclass of train params base which specifies incremental inverted index training parameters.
+	struct TrainParams : public TrainParamsBase {
+	};
+
+	/// Segments are merged whenever there are more than max_segments of them.  If
+	/// background_compaction is false, merges only happen when compact() is called.
+	IncrementalInvertedIndex(uint32_t max_segments = 8, bool background_compaction = true);
+	IncrementalInvertedIndex(const std::string &file_name);
+	~IncrementalInvertedIndex();
+
+	/// Replaces the contents of the index with the examples and merges them into a single segment.
+	bool train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params,
+		 		const ImageRange &examples);
+
+	/// Adds an image, reading its BoW features from the dataset.  If the image is already indexed
+	/// it is replaced.  Returns false if the image has no BoW vector.
+	bool add(Dataset &dataset, const PTR_LIB::shared_ptr<const Image > &image);
+
+	/// Adds an image with the given BoW vector (sorted by cluster index).
+	void add(uint64_t id, const numerics::sparse_vector_t &bow_descriptors);
+	void add(uint64_t id, const numerics::SparseVectorView &bow_descriptors);
+
+	/// Removes an image.  Returns false if the image is not indexed.
+	bool remove(uint64_t id);
+
+	/// Turns the buffered images into a segment and merges all segments into one, dropping removed
+	/// images.
+	void compact();
+
+	/// Returns the number of indexed (not removed) images.
+	uint64_t num_images() const;
+
+	/// Returns the number of immutable segments.
+	uint32_t num_segments() const;
+
+	/// Loads the indexed images from the input filepath.
+	bool load (const std::string &file_path);
+
+	/// Saves the indexed images to the input filepath.
+	bool save (const std::string &file_path) const;
+
+	/// Given a set of search parameters (InvertedIndex::SearchParams), a query image, searches for matching images and
+	/// returns InvertedIndex::MatchResults.  If the match is 0, then the search failed.
+	PTR_LIB::shared_ptr<MatchResultsBase> search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, const PTR_LIB::shared_ptr<const Image > &example);
+
+	/// Given a set of search parameters and the BoW vector of a query, searches for matching images and returns the match.
+	PTR_LIB::shared_ptr<MatchResultsBase> search(const PTR_LIB::shared_ptr<const SearchParamsBase> &params, const numerics::sparse_vector_t &example_bow_descriptors);
+	/// Same as above for a view of the BoW vector (ex. Dataset::load_bow_feature), which is not copied.
+	PTR_LIB::shared_ptr<MatchResultsBase> search(const PTR_LIB::shared_ptr<const SearchParamsBase> &params, const numerics::SparseVectorView &example_bow_descriptors);
+
+	/// Given a set of search parameters, query images, searches for matching images and returns the matches.
+	std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > search(Dataset &dataset, const PTR_LIB::shared_ptr<SearchParamsBase> &params,
+															 const std::vector< PTR_LIB::shared_ptr<const Image > > &examples);
+
+protected:
+	struct Segment;
+	struct Snapshot;
+
+	/// An immutable segment together with the tombstones of its removed images.  Tombstones are
+	/// copied on write, so a snapshot keeps seeing the tombstones it was created with.
+	struct SegmentRef {
+		PTR_LIB::shared_ptr<const Segment> segment;
+		PTR_LIB::shared_ptr<const std::vector<uint64_t> > tombstones; /// bitmap over segment ordinals, 0 if none removed
+	};
+
+	/// An added image which is not in a segment yet.  The vectors are shared with the snapshots,
+	/// so taking a snapshot only copies the pointers.
+	typedef std::pair<uint64_t, PTR_LIB::shared_ptr<const numerics::SparseVector> > buffered_image_t;
+
+	/// Returns the current snapshot.  The caller must hold mutex.
+	PTR_LIB::shared_ptr<const Snapshot> snapshot();
+
+	/// Buffers an image, replacing a previous image with the same id.
+	void add_buffered(uint64_t id, const PTR_LIB::shared_ptr<const numerics::SparseVector> &bow_descriptors);
+
+	/// Turns the buffered images into a new segment.  The caller must hold mutex.
+	void flush();
+
+	/// Removes an image, the caller must hold mutex.
+	bool remove_locked(uint64_t id);
+
+	/// Merges the given segments into one and replaces them, mutex must not be held.  Returns
+	/// false if nothing was merged.
+	bool merge(std::vector<SegmentRef> refs);
+
+	/// Merges the smallest segments while there are more than max_segments of them.
+	void compact_segments();
+
+	/// Body of the background compaction thread.
+	void compaction_loop();
+
+	void update_document_frequencies(const numerics::SparseVectorView &bow_descriptors, int32_t delta);
+
+	mutable std::mutex mutex; /// guards all members below
+	std::mutex merge_mutex; /// serializes merges
+
+	std::vector<SegmentRef> segments;
+	std::vector<buffered_image_t> buffered; /// added images which are not in a segment yet
+	std::unordered_map<uint64_t, size_t> buffered_index; /// position of every buffered image in buffered
+
+	std::vector<uint32_t> document_frequencies; /// number of indexed images containing each word
+	uint64_t num_indexed; /// number of indexed images
+	PTR_LIB::shared_ptr<const Snapshot> current_snapshot; /// 0 if the index changed since the last snapshot
+
+	uint32_t max_segments;
+	bool stopping;
+	std::condition_variable compaction_needed;
+	std::thread compaction_thread;
+};
@@ -6,14 +6,48 @@
 #include <utils/filesystem.hpp>
 #include <utils/misc.hpp>
 #include <utils/numerics.hpp>
+#include <utils/accumulator.hpp>
+#include <utils/query_table.hpp>
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <functional>
+
+const uint32_t InvertedIndex::block_size;
 
 InvertedIndex::InvertedIndex() : SearchBase() {
 
 }
 
+InvertedIndex::InvertedIndex(const InvertedIndex &other) : SearchBase(other) {
+	*this = other;
+}
+
+InvertedIndex &InvertedIndex::operator=(const InvertedIndex &other) {
+	inverted_index = other.inverted_index;
+	term_frequencies = other.term_frequencies;
+	idf_weights = other.idf_weights;
+	inv_image_norms = other.inv_image_norms;
+	block_max_weights = other.block_max_weights;
+	signature_offsets = other.signature_offsets;
+	signatures = other.signatures;
+	mapped_file = other.mapped_file;
+	tiered_store = other.tiered_store;
+
+	// views of a mapped index stay valid since the mapping is shared, the others must point to
+	// the copied arrays (a tiered index shares its on disk tier)
+	if(mapped_file) {
+		posting_lists = other.posting_lists;
+		frequency_lists = other.frequency_lists;
+		block_max_lists = other.block_max_lists;
+		inv_norms = other.inv_norms;
+	} else {
+		update_views();
+	}
+	return *this;
+}
+
 InvertedIndex::InvertedIndex(const std::string &file_name) : SearchBase(file_name) {
 	if(!filesystem::file_exists(file_name)) {
 		std::cerr << "Error reading index from " << file_name << std::endl;
@@ -24,11 +58,335 @@ InvertedIndex::InvertedIndex(const std::string &file_name) : SearchBase(file_nam
 	}
 }
 
+/// Optional sections appended after the postings of an index file.  Each section starts with a
+/// uint32_t tag followed by the uint64_t size of its payload in bytes.  Unknown sections are
+/// skipped when loading, and indexes written before a section existed are still readable.
+enum IndexSectionTag {
+	TERM_FREQUENCIES_TAG = 0x51524654, /// "TFRQ": one float per posting, in posting order
+	HAMMING_SIGNATURES_TAG = 0x47534548 /// "HESG": the number of signatures of every posting (uint32_t), then the signatures (uint64_t), in posting order
+};
+
+/// Header of the memory mappable index format written by save_mapped.  It is followed by, each
+/// starting at a multiple of 8 bytes: the idf weights (float x num_clusters), the posting and
+/// block offset tables (uint64_t x (num_clusters + 1) each), the ids (uint64_t x num_postings),
+/// the term frequencies (float x num_postings), the inverse image norms (float x num_images) and
+/// the block-max weights (float x num_blocks).
+struct MappedIndexHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_clusters;
+	uint32_t block_size;
+	uint64_t num_postings;
+	uint64_t num_blocks;
+	uint64_t num_images;
+};
+
+/// "VIMP", chosen so that it cannot be mistaken for the cluster count of an old index file.
+static const uint32_t s_mapped_index_magic = 0x504d4956;
+static const uint32_t s_mapped_index_version = 1;
+
+/// Byte offsets of the arrays of a mapped index.
+struct MappedIndexLayout {
+	uint64_t idf_weights, posting_offsets, block_offsets, ids, frequencies, inv_norms, block_max, total_size;
+
+	static uint64_t align(uint64_t offset) { return (offset + 7) & ~(uint64_t)7; }
+
+	MappedIndexLayout(const MappedIndexHeader &header) {
+		idf_weights = align(sizeof(MappedIndexHeader));
+		posting_offsets = align(idf_weights + sizeof(float) * header.num_clusters);
+		block_offsets = posting_offsets + sizeof(uint64_t) * ((uint64_t)header.num_clusters + 1);
+		ids = block_offsets + sizeof(uint64_t) * ((uint64_t)header.num_clusters + 1);
+		frequencies = ids + sizeof(uint64_t) * header.num_postings;
+		inv_norms = align(frequencies + sizeof(float) * header.num_postings);
+		block_max = align(inv_norms + sizeof(float) * header.num_images);
+		total_size = block_max + sizeof(float) * header.num_blocks;
+	}
+};
+
+/// Posting lists of an index loaded with load_tiered which are read from disk when needed, and
+/// the access counts of all lists.
+struct InvertedIndex::TieredStore {
+	TieredStore(const MappedIndexHeader &header) : layout(header), hot(header.num_clusters, false),
+		hot_bytes(0), access_counts(new std::atomic<uint64_t>[header.num_clusters]) {
+		for(uint32_t i=0; i<header.num_clusters; i++) access_counts[i] = 0;
+	}
+
+	~TieredStore() {
+		save_access_counts();
+	}
+
+	uint64_t num_postings(uint32_t word) const {
+		return posting_offsets[word + 1] - posting_offsets[word];
+	}
+
+	uint64_t num_blocks(uint32_t word) const {
+		return block_offsets[word + 1] - block_offsets[word];
+	}
+
+	/// Size in bytes of the postings, term frequencies and block-max weights of a word.
+	uint64_t list_bytes(uint32_t word) const {
+		return (sizeof(uint64_t) + sizeof(float)) * num_postings(word) + sizeof(float) * num_blocks(word);
+	}
+
+	/// File ranges holding the postings, term frequencies and block-max weights of a word.
+	std::vector<BufferPool::range_t> list_ranges(uint32_t word) const {
+		std::vector<BufferPool::range_t> ranges(3);
+		ranges[0] = BufferPool::range_t(layout.ids + sizeof(uint64_t) * posting_offsets[word], sizeof(uint64_t) * num_postings(word));
+		ranges[1] = BufferPool::range_t(layout.frequencies + sizeof(float) * posting_offsets[word], sizeof(float) * num_postings(word));
+		ranges[2] = BufferPool::range_t(layout.block_max + sizeof(float) * block_offsets[word], sizeof(float) * num_blocks(word));
+		return ranges;
+	}
+
+	/// Reads the lists of a word without caching them.
+	bool read_list(uint32_t word, std::vector<uint64_t> &ids, std::vector<float> &frequencies, std::vector<float> &block_max) const {
+		const std::vector<BufferPool::range_t> &ranges = list_ranges(word);
+		ids.resize(num_postings(word));
+		frequencies.resize(num_postings(word));
+		block_max.resize(num_blocks(word));
+		return (ids.empty() || pool.read(ranges[0].first, ranges[0].second, &ids[0])) &&
+			(frequencies.empty() || pool.read(ranges[1].first, ranges[1].second, &frequencies[0])) &&
+			(block_max.empty() || pool.read(ranges[2].first, ranges[2].second, &block_max[0]));
+	}
+
+	/// Reads the access counts, which are kept if the file is missing or does not match the index.
+	bool load_access_counts() {
+		std::ifstream ifs(access_counts_path, std::ios::binary);
+		uint32_t num_clusters = 0;
+		ifs.read((char *)&num_clusters, sizeof(uint32_t));
+		if(!ifs || num_clusters != hot.size()) return false;
+		std::vector<uint64_t> counts(num_clusters);
+		if(num_clusters > 0) ifs.read((char *)&counts[0], sizeof(uint64_t) * num_clusters);
+		if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+		for(uint32_t i=0; i<num_clusters; i++) access_counts[i] = counts[i];
+		return true;
+	}
+
+	bool save_access_counts() const {
+		std::ofstream ofs(access_counts_path, std::ios::binary | std::ios::trunc);
+		uint32_t num_clusters = hot.size();
+		std::vector<uint64_t> counts(num_clusters);
+		for(uint32_t i=0; i<num_clusters; i++) counts[i] = access_counts[i];
+		ofs.write((const char *)&num_clusters, sizeof(uint32_t));
+		if(num_clusters > 0) ofs.write((const char *)&counts[0], sizeof(uint64_t) * num_clusters);
+		return (ofs.rdstate() & std::ofstream::failbit) == 0;
+	}
+
+	const MappedIndexLayout layout;
+	std::vector<uint64_t> posting_offsets, block_offsets; /// same as in the index file
+	std::vector<bool> hot; /// true for the lists kept in memory
+	uint64_t hot_bytes;
+	mutable BufferPool pool; /// cold lists
+	std::unique_ptr< std::atomic<uint64_t>[] > access_counts; /// number of queries which read each list
+	std::string access_counts_path;
+};
+
+/// Fraction of the memory budget of a tiered index, after the weights, used by the buffer pool.
+static const float s_buffer_pool_fraction = 0.25f;
+
+/// Order of the posting lists kept in memory by a tiered index, by accesses per byte.
+static bool list_priority_greater(const std::pair<double, uint32_t> &a, const std::pair<double, uint32_t> &b) {
+	return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+bool InvertedIndex::load_tiered (const std::string &file_path, uint64_t memory_budget, const std::string &access_counts_path) {
+	std::cout << "Reading tiered inverted index from " << file_path << "..." << std::endl;
+
+	std::ifstream ifs(file_path, std::ios::binary);
+	MappedIndexHeader header;
+	ifs.read((char *)&header, sizeof(MappedIndexHeader));
+	if(!ifs || header.magic != s_mapped_index_magic || header.version != s_mapped_index_version || header.block_size != block_size) {
+		std::cerr << "Unsupported tiered index format in " << file_path << std::endl;
+		return false;
+	}
+
+	PTR_LIB::shared_ptr<TieredStore> store = PTR_LIB::make_shared<TieredStore>(header);
+	const MappedIndexLayout &layout = store->layout;
+	std::vector<float> idf(header.num_clusters), norms(header.num_images);
+	store->posting_offsets.resize(header.num_clusters + 1);
+	store->block_offsets.resize(header.num_clusters + 1);
+	ifs.seekg(layout.idf_weights, std::ios::beg);
+	if(header.num_clusters > 0) ifs.read((char *)&idf[0], sizeof(float) * header.num_clusters);
+	ifs.seekg(layout.posting_offsets, std::ios::beg);
+	ifs.read((char *)&store->posting_offsets[0], sizeof(uint64_t) * store->posting_offsets.size());
+	ifs.read((char *)&store->block_offsets[0], sizeof(uint64_t) * store->block_offsets.size());
+	ifs.seekg(layout.inv_norms, std::ios::beg);
+	if(header.num_images > 0) ifs.read((char *)&norms[0], sizeof(float) * header.num_images);
+	if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+	for(uint32_t i=0; i<header.num_clusters; i++) {
+		if(store->posting_offsets[i] > store->posting_offsets[i + 1] || store->block_offsets[i] > store->block_offsets[i + 1]) return false;
+	}
+	if(store->posting_offsets[header.num_clusters] != header.num_postings || store->block_offsets[header.num_clusters] != header.num_blocks) return false;
+	ifs.close();
+
+	store->access_counts_path = access_counts_path.empty() ? file_path + ".access" : access_counts_path;
+	store->load_access_counts();
+
+	// the weights and offsets are always in memory, the rest of the budget is split between the
+	// pinned lists and the buffer pool
+	const uint64_t fixed_bytes = sizeof(float) * ((uint64_t)header.num_clusters + header.num_images) +
+		2 * sizeof(uint64_t) * ((uint64_t)header.num_clusters + 1);
+	const uint64_t list_budget = memory_budget > fixed_bytes ? memory_budget - fixed_bytes : 0;
+	const uint64_t pool_capacity = (uint64_t)(s_buffer_pool_fraction * list_budget);
+	const uint64_t hot_budget = list_budget - pool_capacity;
+	if(!store->pool.open(file_path, pool_capacity)) return false;
+
+	std::vector< std::pair<double, uint32_t> > priorities;
+	for(uint32_t i=0; i<header.num_clusters; i++) {
+		if(store->num_postings(i) == 0) continue;
+		priorities.push_back(std::pair<double, uint32_t>((double)(store->access_counts[i] + 1) / store->list_bytes(i), i));
+	}
+	std::sort(priorities.begin(), priorities.end(), list_priority_greater);
+
+	inverted_index.assign(header.num_clusters, std::vector<uint64_t>());
+	term_frequencies.assign(header.num_clusters, std::vector<float>());
+	block_max_weights.assign(header.num_clusters, std::vector<float>());
+	signature_offsets.clear();
+	signatures.clear();
+	for(size_t i=0; i<priorities.size(); i++) {
+		const uint32_t word = priorities[i].second;
+		if(store->hot_bytes + store->list_bytes(word) > hot_budget) continue;
+		if(!store->read_list(word, inverted_index[word], term_frequencies[word], block_max_weights[word])) return false;
+		store->hot[word] = true;
+		store->hot_bytes += store->list_bytes(word);
+	}
+	for(uint32_t i=0; i<header.num_clusters; i++) {
+		if(store->num_postings(i) == 0) store->hot[i] = true;
+	}
+
+	mapped_file.reset();
+	idf_weights.swap(idf);
+	inv_image_norms.swap(norms);
+	tiered_store = store;
+	update_views();
+
+	const TierStats &stats = tier_stats();
+	std::cout << "Done reading tiered inverted index, " << stats.num_hot_lists << " of " << 
+		stats.num_hot_lists + stats.num_cold_lists << " posting lists in memory." << std::endl;
+
+	return true;
+}
+
+bool InvertedIndex::save_access_counts() const {
+	return tiered_store && tiered_store->save_access_counts();
+}
+
+InvertedIndex::TierStats InvertedIndex::tier_stats() const {
+	TierStats stats;
+	if(!tiered_store) return stats;
+
+	for(size_t i=0; i<posting_lists.size(); i++) {
+		if(posting_lists[i].empty()) continue;
+		if(tiered_store->hot[i]) stats.num_hot_lists++;
+		else stats.num_cold_lists++;
+	}
+	stats.hot_bytes = tiered_store->hot_bytes;
+	stats.pool_capacity = tiered_store->pool.capacity();
+	stats.pool_bytes = tiered_store->pool.size();
+	stats.pool_hits = tiered_store->pool.hits();
+	stats.pool_misses = tiered_store->pool.misses();
+	return stats;
+}
+
+InvertedIndex::PostingList InvertedIndex::fetch_list(uint32_t word) const {
+	PostingList list;
+	if(!tiered_store || tiered_store->hot[word]) {
+		list.ids = posting_lists[word];
+		list.frequencies = frequency_lists[word];
+		list.block_max = block_max_lists[word];
+		return list;
+	}
+
+	list.buffer = tiered_store->pool.read(word, tiered_store->list_ranges(word));
+	if(!list.buffer) {
+		std::cerr << "Error reading the postings of word " << word << std::endl;
+		return list;
+	}
+	const uint64_t num_postings = tiered_store->num_postings(word);
+	const char *data = list.buffer->empty() ? 0 : &(*list.buffer)[0];
+	list.ids = ArrayView<uint64_t>((const uint64_t *)data, num_postings);
+	list.frequencies = ArrayView<float>((const float *)(data + sizeof(uint64_t) * num_postings), num_postings);
+	list.block_max = ArrayView<float>((const float *)(data + (sizeof(uint64_t) + sizeof(float)) * num_postings),
+		tiered_store->num_blocks(word));
+	return list;
+}
+
+void InvertedIndex::fetch_lists(const numerics::SparseVectorView &words, std::vector<PostingList> &lists) const {
+	lists.resize(words.size());
+	for(size_t i=0; i<words.size(); i++) {
+		if(tiered_store) tiered_store->access_counts[words.index(i)].fetch_add(1, std::memory_order_relaxed);
+		lists[i] = fetch_list(words.index(i));
+	}
+}
+
+/// Orders blocks by decreasing block-max weight, then by position.
+static bool block_greater(const std::pair<float, uint64_t> &a, const std::pair<float, uint64_t> &b) {
+	return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+InvertedIndex::PostingList InvertedIndex::cap_list(const PostingList &list, uint64_t max_postings) const {
+	// the blocks weighing the most are kept, the last one partially
+	std::vector< std::pair<float, uint64_t> > blocks(list.block_max.size());
+	for(size_t b=0; b<blocks.size(); b++) blocks[b] = std::pair<float, uint64_t>(list.block_max[b], b);
+	std::sort(blocks.begin(), blocks.end(), block_greater);
+	std::vector< std::pair<uint64_t, uint64_t> > kept; // (first position, number of postings)
+	uint64_t num_kept = 0;
+	for(size_t b=0; b<blocks.size() && num_kept < max_postings; b++) {
+		const uint64_t begin = blocks[b].second * block_size;
+		const uint64_t size = MIN(MIN((uint64_t)block_size, list.ids.size() - begin), max_postings - num_kept);
+		kept.push_back(std::pair<uint64_t, uint64_t>(begin, size));
+		num_kept += size;
+	}
+	std::sort(kept.begin(), kept.end());
+
+	// ids and positions first, so that every array is aligned
+	const uint64_t num_blocks = (num_kept + block_size - 1) / block_size;
+	PTR_LIB::shared_ptr< std::vector<char> > buffer = PTR_LIB::make_shared< std::vector<char> >(
+		(2 * sizeof(uint64_t) + sizeof(float)) * num_kept + sizeof(float) * num_blocks);
+	char *data = buffer->empty() ? 0 : &(*buffer)[0];
+	uint64_t *ids = (uint64_t *)data;
+	uint64_t *positions = (uint64_t *)(data + sizeof(uint64_t) * num_kept);
+	float *frequencies = (float *)(data + 2 * sizeof(uint64_t) * num_kept);
+	float *block_max = (float *)(data + (2 * sizeof(uint64_t) + sizeof(float)) * num_kept);
+	uint64_t j = 0;
+	for(size_t k=0; k<kept.size(); k++) {
+		for(uint64_t position=kept[k].first; position<kept[k].first + kept[k].second; position++, j++) {
+			ids[j] = list.ids[position];
+			frequencies[j] = list.frequencies[position];
+			positions[j] = position;
+		}
+	}
+	for(uint64_t b=0; b<num_blocks; b++) {
+		block_max[b] = 0.f;
+		for(uint64_t k=b * block_size; k<MIN((b + 1) * block_size, num_kept); k++) {
+			block_max[b] = MAX(block_max[b], frequencies[k] * inv_norms[ids[k]]);
+		}
+	}
+
+	PostingList capped;
+	capped.ids = ArrayView<uint64_t>(ids, num_kept);
+	capped.frequencies = ArrayView<float>(frequencies, num_kept);
+	capped.block_max = ArrayView<float>(block_max, num_blocks);
+	capped.positions = ArrayView<uint64_t>(positions, num_kept);
+	capped.buffer = buffer;
+	return capped;
+}
+
 bool InvertedIndex::load (const std::string &file_path) {
+	std::ifstream ifs(file_path, std::ios::binary);
+	uint32_t num_clusters = 0;
+	ifs.read((char *)&num_clusters, sizeof(uint32_t));
+	if(num_clusters == s_mapped_index_magic) {
+		ifs.close();
+		return load_mapped(file_path);
+	}
+	ifs.seekg(0, std::ios::beg);
+
 	std::cout << "Reading inverted index from " << file_path << "..." << std::endl;
 
-	std::ifstream ifs(file_path, std::ios::binary);
-	uint32_t num_clusters;
+	mapped_file.reset();
+	tiered_store.reset();
+	signature_offsets.clear();
+	signatures.clear();
 	ifs.read((char *)&num_clusters, sizeof(uint32_t));
 	inverted_index.resize(num_clusters);
 	idf_weights.resize(num_clusters);
@@ -41,9 +399,53 @@ bool InvertedIndex::load (const std::string &file_path) {
 		  ifs.read((char *)&inverted_index[i][0], sizeof(uint64_t) * num_entries);
 	}
 
+	bool success = (ifs.rdstate() & std::ifstream::failbit) == 0;
+
+	// indexes without term frequencies are treated as binary BoW vectors
+	uint64_t total_entries = 0;
+	term_frequencies.resize(num_clusters);
+	for(uint32_t i=0; i<num_clusters; i++) {
+		term_frequencies[i].assign(inverted_index[i].size(), 1.f);
+		total_entries += inverted_index[i].size();
+	}
+
+	uint32_t tag;
+	uint64_t section_size;
+	while(success && ifs.read((char *)&tag, sizeof(uint32_t))) {
+		ifs.read((char *)&section_size, sizeof(uint64_t));
+		if(tag == TERM_FREQUENCIES_TAG && section_size == sizeof(float) * total_entries) {
+			for(uint32_t i=0; i<num_clusters; i++) {
+				if (!term_frequencies[i].empty())
+					ifs.read((char *)&term_frequencies[i][0], sizeof(float) * term_frequencies[i].size());
+			}
+		} else if(tag == HAMMING_SIGNATURES_TAG && section_size >= sizeof(uint32_t) * total_entries) {
+			signature_offsets.resize(num_clusters);
+			for(uint32_t i=0; i<num_clusters; i++) {
+				if(inverted_index[i].empty()) continue;
+				std::vector<uint32_t> &offsets = signature_offsets[i];
+				offsets.resize(inverted_index[i].size() + 1);
+				ifs.read((char *)&offsets[1], sizeof(uint32_t) * inverted_index[i].size());
+				offsets[0] = 0;
+				for(size_t j=1; j<offsets.size(); j++) offsets[j] += offsets[j - 1];
+			}
+			signatures.resize(num_clusters);
+			for(uint32_t i=0; i<num_clusters; i++) {
+				if(signature_offsets[i].empty()) continue;
+				signatures[i].resize(signature_offsets[i].back());
+				if(!signatures[i].empty())
+					ifs.read((char *)&signatures[i][0], sizeof(uint64_t) * signatures[i].size());
+			}
+		} else {
+			ifs.seekg(section_size, std::ios::cur);
+		}
+		success = (ifs.rdstate() & std::ifstream::failbit) == 0;
+	}
+
+	compute_weights();
+
 	std::cout << "Done reading inverted index." << std::endl;
 	
-	return (ifs.rdstate() & std::ifstream::failbit) == 0;
+	return success;
 }
 
 
@@ -52,14 +454,44 @@ bool InvertedIndex::save (const std::string &file_path) const {
 
 	std::ofstream ofs(file_path, std::ios::binary | std::ios::trunc);
 
-	uint32_t num_clusters = inverted_index.size();
+	uint32_t num_clusters = posting_lists.size();
 	ofs.write((const char *)&num_clusters, sizeof(uint32_t));
 	ofs.write((const char *)&idf_weights[0], sizeof(float) * num_clusters);
+	uint64_t total_entries = 0;
 	for(uint32_t i=0; i<num_clusters; i++) {
-		uint64_t num_entries = inverted_index[i].size();
+		uint64_t num_entries = posting_lists[i].size();
 		ofs.write((const char *)&num_entries, sizeof(uint64_t));
     if (num_entries != 0)
-		  ofs.write((const char *)&inverted_index[i][0], sizeof(uint64_t) * num_entries);
+		  ofs.write((const char *)fetch_list(i).ids.data(), sizeof(uint64_t) * num_entries);
+		total_entries += num_entries;
+	}
+
+	uint32_t tag = TERM_FREQUENCIES_TAG;
+	uint64_t section_size = sizeof(float) * total_entries;
+	ofs.write((const char *)&tag, sizeof(uint32_t));
+	ofs.write((const char *)&section_size, sizeof(uint64_t));
+	for(uint32_t i=0; i<num_clusters; i++) {
+		if (!frequency_lists[i].empty())
+			ofs.write((const char *)fetch_list(i).frequencies.data(), sizeof(float) * frequency_lists[i].size());
+	}
+
+	if(has_signatures()) {
+		uint64_t total_signatures = 0;
+		for(uint32_t i=0; i<num_clusters; i++) total_signatures += signatures[i].size();
+		tag = HAMMING_SIGNATURES_TAG;
+		section_size = sizeof(uint32_t) * total_entries + sizeof(uint64_t) * total_signatures;
+		ofs.write((const char *)&tag, sizeof(uint32_t));
+		ofs.write((const char *)&section_size, sizeof(uint64_t));
+		std::vector<uint32_t> counts;
+		for(uint32_t i=0; i<num_clusters; i++) {
+			const std::vector<uint32_t> &offsets = signature_offsets[i];
+			counts.resize(posting_lists[i].size());
+			for(size_t j=0; j<counts.size(); j++) counts[j] = offsets.empty() ? 0 : offsets[j + 1] - offsets[j];
+			if(!counts.empty()) ofs.write((const char *)&counts[0], sizeof(uint32_t) * counts.size());
+		}
+		for(uint32_t i=0; i<num_clusters; i++) {
+			if(!signatures[i].empty()) ofs.write((const char *)&signatures[i][0], sizeof(uint64_t) * signatures[i].size());
+		}
 	}
 
 	std::cout << "Done writing inverted index." << std::endl;
@@ -67,39 +499,736 @@ bool InvertedIndex::save (const std::string &file_path) const {
 	return (ofs.rdstate() & std::ofstream::failbit) == 0;
 }
 
-bool InvertedIndex::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params, const std::vector< PTR_LIB::shared_ptr<const Image > > &examples) {
+/// Number of postings buffered per input and for the output while merging index files.
+static const size_t s_merge_buffer_size = 1 << 16;
+
+/// Sequential reader of the postings of an index file written by save.  The ids and the term
+/// frequencies are stored in different parts of the file, so each is read by its own stream.
+struct IndexFileReader {
+	std::ifstream id_stream, frequency_stream;
+	bool has_frequencies;
+	uint64_t remaining; /// postings of the current word which are not read yet
+	std::vector<uint64_t> ids;
+	std::vector<float> frequencies;
+	size_t position, size; /// buffered postings
+
+	IndexFileReader() : has_frequencies(false), remaining(0), position(0), size(0) { }
+
+	/// Opens the file and finds the term frequencies.  Returns false if the file cannot be read.
+	bool open(const std::string &file_path, uint32_t &num_clusters, uint64_t &num_postings) {
+		id_stream.open(file_path, std::ios::binary);
+		id_stream.read((char *)&num_clusters, sizeof(uint32_t));
+		if(!id_stream || num_clusters == s_mapped_index_magic) return false;
+
+		// skip the postings to find the optional sections
+		const std::streamoff postings_start = sizeof(uint32_t) + sizeof(float) * (std::streamoff)num_clusters;
+		id_stream.seekg(postings_start, std::ios::beg);
+		num_postings = 0;
+		for(uint32_t i=0; i<num_clusters && id_stream; i++) {
+			uint64_t num_entries = 0;
+			id_stream.read((char *)&num_entries, sizeof(uint64_t));
+			id_stream.seekg(sizeof(uint64_t) * num_entries, std::ios::cur);
+			num_postings += num_entries;
+		}
+		if(!id_stream) return false;
+
+		uint32_t tag;
+		uint64_t section_size;
+		while(id_stream.read((char *)&tag, sizeof(uint32_t))) {
+			id_stream.read((char *)&section_size, sizeof(uint64_t));
+			if(tag == TERM_FREQUENCIES_TAG && section_size == sizeof(float) * num_postings) {
+				frequency_stream.open(file_path, std::ios::binary);
+				frequency_stream.seekg(id_stream.tellg());
+				has_frequencies = true;
+				break;
+			}
+			id_stream.seekg(section_size, std::ios::cur);
+		}
+
+		id_stream.clear();
+		id_stream.seekg(postings_start, std::ios::beg);
+		ids.resize(s_merge_buffer_size);
+		frequencies.resize(s_merge_buffer_size, 1.f);
+		return (bool)id_stream;
+	}
+
+	/// Starts reading the postings of the next word, returns their number.
+	uint64_t next_word() {
+		id_stream.read((char *)&remaining, sizeof(uint64_t));
+		position = size = 0;
+		return remaining;
+	}
+
+	/// Returns the next posting of the current word, or false if there is none.
+	inline bool next(uint64_t &id, float &frequency) {
+		if(position == size) {
+			if(remaining == 0) return false;
+			size = MIN(remaining, ids.size());
+			id_stream.read((char *)&ids[0], sizeof(uint64_t) * size);
+			if(has_frequencies) frequency_stream.read((char *)&frequencies[0], sizeof(float) * size);
+			remaining -= size;
+			position = 0;
+		}
+		id = ids[position];
+		frequency = frequencies[position];
+		position++;
+		return true;
+	}
+
+	bool good() const {
+		return !id_stream.fail() && (!has_frequencies || !frequency_stream.fail());
+	}
+};
+
+/// Writes size bytes at offset and moves offset past them.
+static void write_at(std::ostream &os, std::streamoff &offset, const char *data, size_t size) {
+	os.seekp(offset, std::ios::beg);
+	os.write(data, size);
+	offset += size;
+}
+
+bool InvertedIndex::merge(const std::vector<std::string> &input_paths, const std::string &output_path, uint64_t num_images) {
+	std::cout << "Merging " << input_paths.size() << " inverted indexes into " << output_path << "..." << std::endl;
+
+	if(input_paths.empty()) return false;
+
+	std::vector<IndexFileReader> readers(input_paths.size());
+	uint32_t num_clusters = 0;
+	uint64_t num_postings = 0;
+	for(size_t i=0; i<input_paths.size(); i++) {
+		uint32_t input_clusters = 0;
+		uint64_t input_postings = 0;
+		if(!readers[i].open(input_paths[i], input_clusters, input_postings)) {
+			std::cerr << "Error reading inverted index from " << input_paths[i] << std::endl;
+			return false;
+		}
+		if(i > 0 && input_clusters != num_clusters) {
+			std::cerr << "Inverted index " << input_paths[i] << " has " << input_clusters << " clusters, expected " << num_clusters << std::endl;
+			return false;
+		}
+		num_clusters = input_clusters;
+		num_postings += input_postings;
+	}
+
+	// The posting counts and ids, and the term frequencies which follow all the ids, are written
+	// through one stream, which seeks to the end of either part whenever the buffers are written.
+	// The idf weights are written once all document frequencies are known.
+	std::ofstream ofs(output_path, std::ios::binary | std::ios::trunc);
+	std::streamoff id_offset = sizeof(uint32_t) + sizeof(float) * (std::streamoff)num_clusters;
+	std::streamoff frequency_offset = id_offset + sizeof(uint64_t) * ((std::streamoff)num_clusters + num_postings);
+	ofs.write((const char *)&num_clusters, sizeof(uint32_t));
+	std::vector<float> idf_weights(num_clusters, 0.f);
+	ofs.write((const char *)&idf_weights[0], sizeof(float) * num_clusters);
+
+	uint32_t tag = TERM_FREQUENCIES_TAG;
+	uint64_t section_size = sizeof(float) * num_postings;
+	write_at(ofs, frequency_offset, (const char *)&tag, sizeof(uint32_t));
+	write_at(ofs, frequency_offset, (const char *)&section_size, sizeof(uint64_t));
+
+	std::vector<uint64_t> document_frequencies(num_clusters, 0);
+	std::vector<bool> indexed; // ids seen, to count the images when num_images is not given
+	std::vector<uint64_t> id_buffer; // posting counts and ids, in file order
+	std::vector<float> frequency_buffer;
+	id_buffer.reserve(s_merge_buffer_size + 1);
+	frequency_buffer.reserve(s_merge_buffer_size);
+
+	// min-heap of the next posting of every input, by id
+	typedef std::pair<uint64_t, size_t> head_t;
+	std::vector<head_t> heads;
+	std::vector<float> head_frequencies(readers.size());
+
+	for(uint32_t w=0; w<num_clusters; w++) {
+		uint64_t num_entries = 0;
+		heads.clear();
+		for(size_t i=0; i<readers.size(); i++) {
+			num_entries += readers[i].next_word();
+			uint64_t id;
+			if(readers[i].next(id, head_frequencies[i])) heads.push_back(head_t(id, i));
+		}
+		std::make_heap(heads.begin(), heads.end(), std::greater<head_t>());
+		document_frequencies[w] = num_entries;
+		id_buffer.push_back(num_entries);
+
+		while(!heads.empty()) {
+			std::pop_heap(heads.begin(), heads.end(), std::greater<head_t>());
+			const head_t head = heads.back();
+			heads.pop_back();
+
+			id_buffer.push_back(head.first);
+			frequency_buffer.push_back(head_frequencies[head.second]);
+			if(num_images == 0) {
+				if(head.first >= indexed.size()) indexed.resize(head.first + 1, false);
+				indexed[head.first] = true;
+			}
+			if(id_buffer.size() >= s_merge_buffer_size) {
+				write_at(ofs, id_offset, (const char *)&id_buffer[0], sizeof(uint64_t) * id_buffer.size());
+				write_at(ofs, frequency_offset, (const char *)&frequency_buffer[0], sizeof(float) * frequency_buffer.size());
+				id_buffer.clear();
+				frequency_buffer.clear();
+			}
+
+			uint64_t id;
+			if(readers[head.second].next(id, head_frequencies[head.second])) {
+				heads.push_back(head_t(id, head.second));
+				std::push_heap(heads.begin(), heads.end(), std::greater<head_t>());
+			}
+		}
+	}
+	if(!id_buffer.empty()) write_at(ofs, id_offset, (const char *)&id_buffer[0], sizeof(uint64_t) * id_buffer.size());
+	if(!frequency_buffer.empty()) {
+		write_at(ofs, frequency_offset, (const char *)&frequency_buffer[0], sizeof(float) * frequency_buffer.size());
+	}
+
+	for(size_t i=0; i<readers.size(); i++) {
+		if(!readers[i].good()) {
+			std::cerr << "Error reading inverted index from " << input_paths[i] << std::endl;
+			return false;
+		}
+	}
+
+	if(num_images == 0) num_images = std::count(indexed.begin(), indexed.end(), true);
+	for(uint32_t i=0; i<num_clusters; i++) {
+		// words without postings get a zero weight instead of log(N / 0)
+		if(document_frequencies[i] > 0) idf_weights[i] = logf((float)num_images / (float)document_frequencies[i]);
+	}
+	ofs.seekp(sizeof(uint32_t), std::ios::beg);
+	ofs.write((const char *)&idf_weights[0], sizeof(float) * num_clusters);
+	ofs.close();
+
+	std::cout << "Done merging inverted indexes." << std::endl;
+
+	return !ofs.fail();
+}
+
+/// Writes zeros up to the given offset.
+static void pad_stream(std::ofstream &ofs, uint64_t offset) {
+	static const char zeros[8] = { 0 };
+	const uint64_t position = (uint64_t)ofs.tellp();
+	if(offset > position) ofs.write(zeros, offset - position);
+}
+
+bool InvertedIndex::save_mapped (const std::string &file_path) const {
+	std::cout << "Writing mapped inverted index to " << file_path << "..." << std::endl;
+
+	MappedIndexHeader header;
+	header.magic = s_mapped_index_magic;
+	header.version = s_mapped_index_version;
+	header.num_clusters = posting_lists.size();
+	header.block_size = block_size;
+	header.num_postings = 0;
+	header.num_blocks = 0;
+	header.num_images = inv_norms.size();
+
+	std::vector<uint64_t> posting_offsets(header.num_clusters + 1, 0), block_offsets(header.num_clusters + 1, 0);
+	for(uint32_t i=0; i<header.num_clusters; i++) {
+		header.num_postings += posting_lists[i].size();
+		header.num_blocks += block_max_lists[i].size();
+		posting_offsets[i + 1] = header.num_postings;
+		block_offsets[i + 1] = header.num_blocks;
+	}
+	const MappedIndexLayout layout(header);
+
+	std::ofstream ofs(file_path, std::ios::binary | std::ios::trunc);
+	ofs.write((const char *)&header, sizeof(MappedIndexHeader));
+	pad_stream(ofs, layout.idf_weights);
+	if(header.num_clusters > 0) ofs.write((const char *)&idf_weights[0], sizeof(float) * header.num_clusters);
+	pad_stream(ofs, layout.posting_offsets);
+	ofs.write((const char *)&posting_offsets[0], sizeof(uint64_t) * posting_offsets.size());
+	ofs.write((const char *)&block_offsets[0], sizeof(uint64_t) * block_offsets.size());
+	for(uint32_t i=0; i<header.num_clusters; i++) {
+		if(!posting_lists[i].empty()) ofs.write((const char *)fetch_list(i).ids.data(), sizeof(uint64_t) * posting_lists[i].size());
+	}
+	for(uint32_t i=0; i<header.num_clusters; i++) {
+		if(!frequency_lists[i].empty()) ofs.write((const char *)fetch_list(i).frequencies.data(), sizeof(float) * frequency_lists[i].size());
+	}
+	pad_stream(ofs, layout.inv_norms);
+	if(!inv_norms.empty()) ofs.write((const char *)inv_norms.data(), sizeof(float) * inv_norms.size());
+	pad_stream(ofs, layout.block_max);
+	for(uint32_t i=0; i<header.num_clusters; i++) {
+		if(!block_max_lists[i].empty()) ofs.write((const char *)fetch_list(i).block_max.data(), sizeof(float) * block_max_lists[i].size());
+	}
+
+	std::cout << "Done writing mapped inverted index." << std::endl;
+
+	return (ofs.rdstate() & std::ofstream::failbit) == 0;
+}
+
+bool InvertedIndex::load_mapped (const std::string &file_path, MappedFile::Advice advice, uint32_t num_prefault_words) {
+	std::cout << "Mapping inverted index from " << file_path << "..." << std::endl;
+
+	PTR_LIB::shared_ptr<MappedFile> file = PTR_LIB::make_shared<MappedFile>();
+	if(!file->open(file_path) || file->size() < sizeof(MappedIndexHeader)) return false;
+
+	const MappedIndexHeader &header = *(const MappedIndexHeader *)file->data();
+	if(header.magic != s_mapped_index_magic || header.version != s_mapped_index_version || header.block_size != block_size) {
+		std::cerr << "Unsupported mapped index format in " << file_path << std::endl;
+		return false;
+	}
+	const MappedIndexLayout layout(header);
+	if(layout.total_size > file->size()) return false;
+
+	const uint64_t *posting_offsets = (const uint64_t *)(file->data() + layout.posting_offsets);
+	const uint64_t *block_offsets = (const uint64_t *)(file->data() + layout.block_offsets);
+	for(uint32_t i=0; i<header.num_clusters; i++) {
+		if(posting_offsets[i] > posting_offsets[i + 1] || block_offsets[i] > block_offsets[i + 1]) return false;
+	}
+	if(posting_offsets[header.num_clusters] != header.num_postings || block_offsets[header.num_clusters] != header.num_blocks) return false;
+
+	// the in memory arrays are not used by a mapped index
+	inverted_index.clear();
+	term_frequencies.clear();
+	inv_image_norms.clear();
+	block_max_weights.clear();
+	signature_offsets.clear();
+	signatures.clear();
+
+	const float *idf = (const float *)(file->data() + layout.idf_weights);
+	idf_weights.assign(idf, idf + header.num_clusters);
+
+	const uint64_t *ids = (const uint64_t *)(file->data() + layout.ids);
+	const float *frequencies = (const float *)(file->data() + layout.frequencies);
+	const float *block_max = (const float *)(file->data() + layout.block_max);
+	posting_lists.resize(header.num_clusters);
+	frequency_lists.resize(header.num_clusters);
+	block_max_lists.resize(header.num_clusters);
+	for(uint32_t i=0; i<header.num_clusters; i++) {
+		posting_lists[i] = ArrayView<uint64_t>(ids + posting_offsets[i], posting_offsets[i + 1] - posting_offsets[i]);
+		frequency_lists[i] = ArrayView<float>(frequencies + posting_offsets[i], posting_offsets[i + 1] - posting_offsets[i]);
+		block_max_lists[i] = ArrayView<float>(block_max + block_offsets[i], block_offsets[i + 1] - block_offsets[i]);
+	}
+	inv_norms = ArrayView<float>((const float *)(file->data() + layout.inv_norms), header.num_images);
+
+	// postings are read according to the queries, the weights are small and read by every query
+	file->advise(advice, layout.ids, layout.inv_norms - layout.ids);
+	file->advise(MappedFile::ADVICE_WILLNEED, layout.inv_norms, layout.total_size - layout.inv_norms);
+
+	mapped_file = file;
+	tiered_store.reset();
+	prefault(num_prefault_words);
+
+	std::cout << "Done mapping inverted index." << std::endl;
+
+	return true;
+}
+
+static bool list_size_greater(const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b) {
+	return a.first > b.first;
+}
+
+void InvertedIndex::prefault(uint32_t num_words) {
+	if(!mapped_file || num_words == 0) return;
+
+	std::vector< std::pair<uint64_t, uint32_t> > list_sizes(posting_lists.size());
+	for(size_t i=0; i<posting_lists.size(); i++) {
+		list_sizes[i] = std::pair<uint64_t, uint32_t>(posting_lists[i].size(), i);
+	}
+	num_words = MIN(num_words, list_sizes.size());
+	std::partial_sort(list_sizes.begin(), list_sizes.begin() + num_words, list_sizes.end(), list_size_greater);
+
+	std::vector< std::pair<uint64_t, uint64_t> > ranges;
+	for(uint32_t i=0; i<num_words && list_sizes[i].first > 0; i++) {
+		const uint32_t word = list_sizes[i].second;
+		ranges.push_back(std::pair<uint64_t, uint64_t>((const char *)posting_lists[word].data() - mapped_file->data(), 
+			sizeof(uint64_t) * posting_lists[word].size()));
+		ranges.push_back(std::pair<uint64_t, uint64_t>((const char *)frequency_lists[word].data() - mapped_file->data(), 
+			sizeof(float) * frequency_lists[word].size()));
+	}
+	mapped_file->prefault(ranges);
+}
+
+void InvertedIndex::update_views() {
+	posting_lists.resize(inverted_index.size());
+	frequency_lists.resize(inverted_index.size());
+	block_max_lists.resize(inverted_index.size());
+	for(size_t i=0; i<inverted_index.size(); i++) {
+		if(tiered_store && !tiered_store->hot[i]) {
+			posting_lists[i] = ArrayView<uint64_t>(0, tiered_store->num_postings(i));
+			frequency_lists[i] = ArrayView<float>(0, tiered_store->num_postings(i));
+			block_max_lists[i] = ArrayView<float>(0, tiered_store->num_blocks(i));
+			continue;
+		}
+		posting_lists[i] = ArrayView<uint64_t>(inverted_index[i]);
+		frequency_lists[i] = ArrayView<float>(term_frequencies[i]);
+		block_max_lists[i] = ArrayView<float>(block_max_weights[i]);
+	}
+	inv_norms = ArrayView<float>(inv_image_norms);
+}
+
+void InvertedIndex::unmap() {
+	if(tiered_store) {
+		for(size_t i=0; i<inverted_index.size(); i++) {
+			if(!tiered_store->hot[i]) tiered_store->read_list(i, inverted_index[i], term_frequencies[i], block_max_weights[i]);
+		}
+		tiered_store.reset();
+		update_views();
+		return;
+	}
+	if(!mapped_file) return;
+
+	inverted_index.resize(posting_lists.size());
+	term_frequencies.resize(posting_lists.size());
+	block_max_weights.resize(posting_lists.size());
+	for(size_t i=0; i<posting_lists.size(); i++) {
+		inverted_index[i].assign(posting_lists[i].begin(), posting_lists[i].end());
+		term_frequencies[i].assign(frequency_lists[i].begin(), frequency_lists[i].end());
+		block_max_weights[i].assign(block_max_lists[i].begin(), block_max_lists[i].end());
+	}
+	inv_image_norms.assign(inv_norms.begin(), inv_norms.end());
+
+	update_views();
+	mapped_file.reset();
+}
+
+void InvertedIndex::compute_weights() {
+	uint64_t max_id = 0;
+	for(size_t i=0; i<inverted_index.size(); i++) {
+		if (!inverted_index[i].empty()) max_id = MAX(max_id, inverted_index[i].back() + 1);
+	}
+
+	std::vector<float> image_norms(max_id, 0.f);
+	for(size_t i=0; i<inverted_index.size(); i++) {
+		for(size_t j=0; j<inverted_index[i].size(); j++) {
+			image_norms[inverted_index[i][j]] += term_frequencies[i][j] * idf_weights[i];
+		}
+	}
+
+	inv_image_norms.resize(max_id);
+	for(size_t i=0; i<image_norms.size(); i++) {
+		inv_image_norms[i] = image_norms[i] > 0.f ? 1.f / image_norms[i] : 0.f;
+	}
+
+	block_max_weights.resize(inverted_index.size());
+	for(size_t i=0; i<inverted_index.size(); i++) {
+		const std::vector<uint64_t> &postings = inverted_index[i];
+		block_max_weights[i].assign((postings.size() + block_size - 1) / block_size, 0.f);
+		for(size_t j=0; j<postings.size(); j++) {
+			float &block_max = block_max_weights[i][j / block_size];
+			block_max = MAX(block_max, term_frequencies[i][j] * inv_image_norms[postings[j]]);
+		}
+	}
+
+	update_views();
+}
+
+void InvertedIndex::gather_signatures(Dataset &dataset, const ImageRange &examples) {
+	const uint32_t num_clusters = inverted_index.size();
+	signature_offsets.assign(num_clusters, std::vector<uint32_t>());
+	signatures.assign(num_clusters, std::vector<uint64_t>());
+	for(uint32_t i=0; i<num_clusters; i++) {
+		if(!inverted_index[i].empty()) signature_offsets[i].assign(inverted_index[i].size() + 1, 0);
+	}
+
+	// The signatures are read twice: the first pass counts the signatures of every posting, the
+	// second one copies them once the offsets are known.  Every posting belongs to one example,
+	// so the examples can be processed in parallel.
+	for(uint32_t pass=0; pass<2; pass++) {
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+		#pragma omp parallel for schedule(dynamic)
+#endif
+		for(int64_t i=0; i<(int64_t)examples.size(); i++) {
+			const uint64_t id = examples.id(i);
+			HammingEmbedding::signatures_t example_signatures;
+			// signatures are only stored as per image files, the dataset has no loader for them
+			if(!HammingEmbedding::load_signatures(dataset.location(examples[i]->feature_path("he_signatures")), example_signatures)) continue;
+
+			for(size_t begin=0, end=0; begin<example_signatures.size(); begin=end) {
+				const uint32_t word = example_signatures[begin].first;
+				for(end=begin; end<example_signatures.size() && example_signatures[end].first == word; end++);
+				if(word >= num_clusters || signature_offsets[word].empty()) continue;
+
+				const std::vector<uint64_t> &postings = inverted_index[word];
+				const size_t position = std::lower_bound(postings.begin(), postings.end(), id) - postings.begin();
+				if(position == postings.size() || postings[position] != id) continue;
+
+				if(pass == 0) {
+					signature_offsets[word][position + 1] = (uint32_t)(end - begin);
+				} else {
+					uint64_t *output = &signatures[word][signature_offsets[word][position]];
+					for(size_t j=begin; j<end; j++) *output++ = example_signatures[j].second;
+				}
+			}
+		}
+
+		if(pass > 0) break;
+		for(uint32_t i=0; i<num_clusters; i++) {
+			std::vector<uint32_t> &offsets = signature_offsets[i];
+			for(size_t j=1; j<offsets.size(); j++) offsets[j] += offsets[j - 1];
+			if(!offsets.empty()) signatures[i].resize(offsets.back());
+		}
+	}
+}
+
+/// Number of examples indexed by one partial index (run) while training.
+static const size_t s_train_run_size = 4096;
+
+/// Partial inverted index over a contiguous range of training examples.  Only the words which
+/// occur in the range are stored, postings of each word are in example order, which is id order
+/// (see sorted_examples).
+struct PostingRun {
+	std::vector<uint32_t> words; /// sorted words occurring in the run
+	std::vector<uint64_t> word_offsets; /// start of each word's postings, words.size() + 1 entries
+	std::vector<uint64_t> ids;
+	std::vector<float> frequencies;
+	std::string file_path; /// set while the run is written to disk instead of held in memory
+
+	uint64_t num_bytes() const {
+		return words.size() * sizeof(uint32_t) + word_offsets.size() * sizeof(uint64_t) + 
+			ids.size() * (sizeof(uint64_t) + sizeof(float));
+	}
+
+	void release() {
+		std::vector<uint32_t>().swap(words);
+		std::vector<uint64_t>().swap(word_offsets);
+		std::vector<uint64_t>().swap(ids);
+		std::vector<float>().swap(frequencies);
+	}
+
+	bool write(const std::string &path) const {
+		std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+		uint64_t num_words = words.size(), num_postings = ids.size();
+		ofs.write((const char *)&num_words, sizeof(uint64_t));
+		ofs.write((const char *)&num_postings, sizeof(uint64_t));
+		if(num_words > 0) ofs.write((const char *)&words[0], sizeof(uint32_t) * num_words);
+		ofs.write((const char *)&word_offsets[0], sizeof(uint64_t) * (num_words + 1));
+		if(num_postings > 0) {
+			ofs.write((const char *)&ids[0], sizeof(uint64_t) * num_postings);
+			ofs.write((const char *)&frequencies[0], sizeof(float) * num_postings);
+		}
+		return (ofs.rdstate() & std::ofstream::failbit) == 0;
+	}
+
+	bool read(const std::string &path) {
+		std::ifstream ifs(path, std::ios::binary);
+		uint64_t num_words = 0, num_postings = 0;
+		ifs.read((char *)&num_words, sizeof(uint64_t));
+		ifs.read((char *)&num_postings, sizeof(uint64_t));
+		if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+		words.resize(num_words);
+		word_offsets.resize(num_words + 1);
+		ids.resize(num_postings);
+		frequencies.resize(num_postings);
+		if(num_words > 0) ifs.read((char *)&words[0], sizeof(uint32_t) * num_words);
+		ifs.read((char *)&word_offsets[0], sizeof(uint64_t) * (num_words + 1));
+		if(num_postings > 0) {
+			ifs.read((char *)&ids[0], sizeof(uint64_t) * num_postings);
+			ifs.read((char *)&frequencies[0], sizeof(float) * num_postings);
+		}
+		return (ifs.rdstate() & std::ifstream::failbit) == 0;
+	}
+};
+
+/// Builds the run for a chunk of the examples.  word_counts is scratch space with one zeroed
+/// counter per word, it is zeroed again on return.
+static void build_posting_run(Dataset &dataset, const ImageRange &examples, std::vector<uint64_t> &word_counts,
+	PostingRun &run) {
+
+	// the features are views of the dataset's store or cache, so loading them does not copy them
+	std::vector<numerics::SparseVectorView> features;
+	std::vector<uint64_t> feature_ids;
+	features.reserve(examples.size());
+	feature_ids.reserve(examples.size());
+	for(size_t i=0; i<examples.size(); i++) {
+		const numerics::SparseVectorView &bow_descriptors = dataset.load_bow_feature(examples.id(i));
+		if(bow_descriptors.empty()) continue;
+		features.push_back(bow_descriptors);
+		feature_ids.push_back(examples.id(i));
+	}
+
+	uint64_t num_postings = 0;
+	for(size_t i=0; i<features.size(); i++) {
+		for(size_t j=0; j<features[i].size(); j++) {
+			if(word_counts[features[i].index(j)]++ == 0) run.words.push_back(features[i].index(j));
+		}
+		num_postings += features[i].size();
+	}
+	std::sort(run.words.begin(), run.words.end());
+
+	// prefix sum of the counts, the counters then serve as write cursors
+	run.word_offsets.resize(run.words.size() + 1);
+	run.word_offsets[0] = 0;
+	for(size_t i=0; i<run.words.size(); i++) {
+		run.word_offsets[i + 1] = run.word_offsets[i] + word_counts[run.words[i]];
+		word_counts[run.words[i]] = run.word_offsets[i];
+	}
+
+	run.ids.resize(num_postings);
+	run.frequencies.resize(num_postings);
+	for(size_t i=0; i<features.size(); i++) {
+		for(size_t j=0; j<features[i].size(); j++) {
+			const uint64_t position = word_counts[features[i].index(j)]++;
+			run.ids[position] = feature_ids[i];
+			run.frequencies[position] = features[i].value(j);
+		}
+	}
+
+	for(size_t i=0; i<run.words.size(); i++) word_counts[run.words[i]] = 0;
+}
+
+/// Returns the examples in increasing id order without duplicates, so that every run, and the
+/// posting lists concatenated from the runs, are sorted by id as the searches expect.  Ranges
+/// which already are, like all_images() and samples, are returned as is.
+static ImageRange sorted_examples(const Dataset &dataset, const ImageRange &examples) {
+	bool sorted = true;
+	for(uint64_t i=1; i<examples.size() && sorted; i++) sorted = examples.id(i - 1) < examples.id(i);
+	if(sorted) return examples;
+
+	std::vector<uint64_t> ids(examples.size());
+	for(uint64_t i=0; i<examples.size(); i++) ids[i] = examples.id(i);
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+	return ImageRange(dataset, ids);
+}
+
+bool InvertedIndex::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params, const ImageRange &unsorted_examples) {
+	const ImageRange &examples = sorted_examples(dataset, unsorted_examples);
 	const PTR_LIB::shared_ptr<const TrainParams> &ii_params = std::static_pointer_cast<const TrainParams>(params);
 	
 	const PTR_LIB::shared_ptr<BagOfWords> &bag_of_words = ii_params->bag_of_words;
 	
 	if(!bag_of_words) return false;
 
-	inverted_index.resize(bag_of_words->num_clusters());
-	idf_weights.resize(bag_of_words->num_clusters(), 0.f);
+	const uint32_t num_clusters = bag_of_words->num_clusters();
 
-	for (size_t i = 0; i < examples.size(); i++) {
-		const PTR_LIB::shared_ptr<const Image> &image = examples[i];
-		const std::string &bow_descriptors_location = dataset.location(image->feature_path("bow_descriptors"));
+	// Build one partial index per range of examples in parallel.  Since the ranges are contiguous,
+	// concatenating the runs in order gives every word the same postings as a serial scan.
+	const int64_t num_runs = examples.num_chunks(s_train_run_size);
+	std::vector<PostingRun> runs(num_runs);
+	std::vector<uint64_t> word_counts(num_clusters, 0);
+	uint64_t buffered_bytes = 0;
+	bool success = true;
 
-		if (!filesystem::file_exists(bow_descriptors_location)) continue;
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp parallel
+#endif
+	{
+		std::vector<uint64_t> run_counts(num_clusters, 0);
 
-		numerics::sparse_vector_t bow_descriptors;
-		if(!filesystem::load_sparse_vector(bow_descriptors_location, bow_descriptors)) continue;
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+		for(int64_t r=0; r<num_runs; r++) {
+			PostingRun &run = runs[r];
+			build_posting_run(dataset, examples.chunk(r, s_train_run_size), run_counts, run);
 
-		for(size_t j=0; j<bow_descriptors.size(); j++) {
-			inverted_index[bow_descriptors[j].first].push_back(image->id);
+			bool spill = false;
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp critical (inverted_index_train)
+#endif
+			{
+				for(size_t i=0; i<run.words.size(); i++) {
+					word_counts[run.words[i]] += run.word_offsets[i + 1] - run.word_offsets[i];
+				}
+				spill = ii_params->max_memory_bytes > 0 && buffered_bytes + run.num_bytes() > ii_params->max_memory_bytes;
+				if(!spill) buffered_bytes += run.num_bytes();
+			}
+
+			if(spill) {
+				run.file_path = filesystem::temp_file_path(ii_params->run_directory);
+				if(!run.write(run.file_path)) {
+					std::cerr << "Error writing index run to " << run.file_path << std::endl;
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp critical (inverted_index_train)
+#endif
+					success = false;
+				}
+				run.release();
+			}
 		}
 	}
 
+	// Merge the runs, the size of every posting list is known so each one is allocated once
+	// and each run copies its postings to the current end of the lists.
+	mapped_file.reset();
+	tiered_store.reset();
+	inverted_index.assign(num_clusters, std::vector<uint64_t>());
+	term_frequencies.assign(num_clusters, std::vector<float>());
+	idf_weights.assign(num_clusters, 0.f);
+	signature_offsets.clear();
+	signatures.clear();
+
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+	for(int64_t i=0; i<num_clusters; i++) {
+		inverted_index[i].resize(word_counts[i]);
+		term_frequencies[i].resize(word_counts[i]);
+		word_counts[i] = 0;
+	}
+
+	for(int64_t r=0; r<num_runs; r++) {
+		PostingRun &run = runs[r];
+		if(!run.file_path.empty()) {
+			if(success && !run.read(run.file_path)) {
+				std::cerr << "Error reading index run from " << run.file_path << std::endl;
+				success = false;
+			}
+			filesystem::remove_file(run.file_path);
+		}
+		if(!success) {
+			run.release();
+			continue;
+		}
+
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+		for(int64_t i=0; i<(int64_t)run.words.size(); i++) {
+			const uint32_t word = run.words[i];
+			const uint64_t begin = run.word_offsets[i], end = run.word_offsets[i + 1];
+			std::copy(run.ids.begin() + begin, run.ids.begin() + end, inverted_index[word].begin() + word_counts[word]);
+			std::copy(run.frequencies.begin() + begin, run.frequencies.begin() + end, term_frequencies[word].begin() + word_counts[word]);
+			word_counts[word] += end - begin;
+		}
+		run.release();
+	}
+
+	if(!success) {
+		inverted_index.clear();
+		term_frequencies.clear();
+		idf_weights.clear();
+		inv_image_norms.clear();
+		block_max_weights.clear();
+		update_views();
+		return false;
+	}
+
+	const float max_document_count = ii_params->max_document_frequency * (float)examples.size();
 	for(size_t i=0; i<idf_weights.size(); i++) {
+		if(ii_params->max_document_frequency < 1.f && (float)inverted_index[i].size() > max_document_count) {
+			// stop word, drop its postings
+			std::vector<uint64_t>().swap(inverted_index[i]);
+			std::vector<float>().swap(term_frequencies[i]);
+			idf_weights[i] = 0.f;
+			continue;
+		}
 		idf_weights[i] = logf(
 				(float)examples.size() /
 				(float)inverted_index[i].size());
 	}
 
+	if(ii_params->hamming_signatures) gather_signatures(dataset, examples);
+
+	compute_weights();
+
+	if(ii_params->normalized_features) return save_normalized_features(dataset);
+
 	return true;
 }
 
+bool InvertedIndex::save_normalized_features(Dataset &dataset, numerics::Norm norm) const {
+	return dataset.write_normalized_bow_features(idf_weights, norm, normalized_stamp(norm));
+}
+
+uint64_t InvertedIndex::normalized_stamp(numerics::Norm norm) const {
+	// FNV-1a of the norm and the bytes of the idf weights
+	uint64_t stamp = 14695981039346656037ULL;
+	stamp = (stamp ^ (uint64_t)norm) * 1099511628211ULL;
+	const unsigned char *bytes = (const unsigned char *)(idf_weights.empty() ? 0 : &idf_weights[0]);
+	for(size_t i=0; i<sizeof(float) * idf_weights.size(); i++) stamp = (stamp ^ bytes[i]) * 1099511628211ULL;
+	// 0 is the stamp of datasets without normalized features
+	return stamp == 0 ? 1 : stamp;
+}
+
 std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > InvertedIndex::search(Dataset &dataset, const PTR_LIB::shared_ptr<SearchParamsBase> &params,
 															 const std::vector< PTR_LIB::shared_ptr<const Image > > &examples) {
 std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > match_results(examples.size());
@@ -112,6 +1241,38 @@ std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > match_results(examples.size
 
 PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, 
 	const PTR_LIB::shared_ptr<const Image > &example) {
+
+	const numerics::SparseVectorView &example_bow_descriptors = dataset.load_bow_feature(
+		example->id
+	);
+
+	HammingEmbedding::signatures_t example_signatures;
+	if(has_signatures() && params && 
+		std::static_pointer_cast<const SearchParams>(params)->max_hamming_distance < HammingEmbedding::num_bits) {
+		HammingEmbedding::load_signatures(dataset.location(example->feature_path("he_signatures")), example_signatures);
+	}
+
+	return this->search(dataset, params, example_bow_descriptors, example_signatures);
+}
+
+PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, 
+	const numerics::sparse_vector_t &example_bow_descriptors) {
+
+	const numerics::SparseVector example_vector(example_bow_descriptors);
+	return this->search(dataset, params, example_vector, HammingEmbedding::signatures_t());
+}
+
+PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, 
+	const numerics::SparseVectorView &example_bow_descriptors) {
+
+	return this->search(dataset, params, example_bow_descriptors, HammingEmbedding::signatures_t());
+}
+
+/// Number of candidates loaded and scored together against the query table.
+static const size_t s_score_block_size = 64;
+
+PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, 
+	const numerics::SparseVectorView &example_bow_descriptors, const HammingEmbedding::signatures_t &example_signatures) {
 	
 	SCOPED_TIMER
 
@@ -121,34 +1282,107 @@ PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search(Dataset &dataset, co
 	
 	PTR_LIB::shared_ptr<MatchResults> match_result = PTR_LIB::make_shared<MatchResults>();
 
-	const numerics::sparse_vector_t &example_bow_descriptors = dataset.load_bow_feature(
-		example->id
-	);
+	const numerics::SparseVectorView &query_words = select_query_words(example_bow_descriptors, *ii_params);
+	std::vector<PostingList> lists;
+	fetch_lists(query_words, lists);
+	if(ii_params->max_postings_per_word > 0) {
+		for(size_t i=0; i<lists.size(); i++) {
+			if(lists[i].ids.size() > ii_params->max_postings_per_word) lists[i] = cap_list(lists[i], ii_params->max_postings_per_word);
+		}
+	}
 
-	std::vector<std::pair<uint64_t, uint64_t> > candidates(dataset.num_images(), std::pair<uint64_t, uint64_t>(0, 0));
-	uint64_t num_candidates = 0; // number of matches > 0
-	for(size_t i=0; i<example_bow_descriptors.size(); i++) {
-		uint32_t cluster = example_bow_descriptors[i].first;
-		for(size_t j=0; j<inverted_index[cluster].size(); j++) {
-			uint64_t id = inverted_index[cluster][j];
-			if(!candidates[id].first) {
-				candidates[id].second = id;
-				++num_candidates;
+	const IdBitmap *filter = ii_params->filter.get();
+	if(filter && filter->cardinality() <= ii_params->direct_scoring_selectivity * inv_norms.size()) {
+		return search_filtered(example_bow_descriptors, query_words, lists, ii_params);
+	}
+
+	if(ii_params->dynamic_pruning) {
+		return search_pruned(example_bow_descriptors, query_words, lists, ii_params);
+	}
+
+	// Count the number of words each image shares with the query.  The accumulator is reused
+	// between queries on the same thread and only the touched ids are visited.
+	uint64_t num_postings = 0;
+	for(size_t i=0; i<query_words.size(); i++) {
+		num_postings += lists[i].ids.size();
+	}
+
+	std::vector<ScoreAccumulator::entry_t> candidates;
+	uint64_t num_filtered = 0, num_rejected = 0;
+	const bool gated = has_signatures() && !example_signatures.empty() &&
+		ii_params->max_hamming_distance < HammingEmbedding::num_bits;
+	bool parallel = false;
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	parallel = !gated && ii_params->parallel_min_postings > 0 && num_postings >= ii_params->parallel_min_postings &&
+		!omp_in_parallel() && omp_get_max_threads() > 1;
+#endif
+	if(parallel) {
+		count_parallel(lists, filter, num_postings, ii_params->cutoff_idx, candidates, num_filtered);
+	} else {
+		ScoreAccumulator &accumulator = ScoreAccumulator::thread_instance();
+		accumulator.reset(inv_norms.size(), num_postings);
+		std::vector<uint64_t> query_signatures;
+		for(size_t i=0; i<lists.size(); i++) {
+			const ArrayView<uint64_t> &postings = lists[i].ids;
+			const uint32_t word = query_words.index(i);
+			if(gated && !signature_offsets[word].empty()) {
+				// a posting only votes if one of its descriptors is close to a query descriptor of
+				// the same word, postings without signatures always vote
+				query_signatures.clear();
+				HammingEmbedding::signatures_t::const_iterator it = std::lower_bound(example_signatures.begin(), example_signatures.end(),
+					std::pair<uint32_t, uint64_t>(word, 0));
+				for(; it != example_signatures.end() && it->first == word; it++) query_signatures.push_back(it->second);
+
+				if(!query_signatures.empty()) {
+					const std::vector<uint32_t> &offsets = signature_offsets[word];
+					const uint64_t *codes = signatures[word].empty() ? 0 : &signatures[word][0];
+					for(size_t j=0; j<postings.size(); j++) {
+						if(filter && !filter->contains(postings[j])) {
+							num_filtered++;
+							continue;
+						}
+						const uint64_t position = lists[i].positions.empty() ? j : lists[i].positions[j];
+						const uint32_t begin = offsets[position], end = offsets[position + 1];
+						if(begin == end || HammingEmbedding::any_within(&query_signatures[0], query_signatures.size(),
+							codes + begin, end - begin, ii_params->max_hamming_distance)) {
+							accumulator.add(postings[j]);
+						} else {
+							num_rejected++;
+						}
+					}
+					continue;
+				}
+			}
+
+			if(filter) {
+				for(size_t j=0; j<postings.size(); j++) {
+					if(filter->contains(postings[j])) accumulator.add(postings[j]);
+					else num_filtered++;
+				}
+			} else {
+				for(size_t j=0; j<postings.size(); j++) {
+					accumulator.add(postings[j]);
+				}
 			}
-			candidates[id].first++;
-			
 		}
+
+		accumulator.top(ii_params->cutoff_idx, candidates);
+		accumulator.clear();
 	}
 
-	std::sort(candidates.begin(), candidates.end());
-	std::reverse(candidates.begin(), candidates.end());
-	
-	num_candidates = MIN(num_candidates, ii_params->cutoff_idx);
+	match_result->num_postings = num_postings;
+	match_result->num_postings_skipped = num_filtered + num_rejected;
+	match_result->num_postings_rejected = num_rejected;
+
+	uint64_t num_candidates = candidates.size();
 
   if (num_candidates == 0)
     return match_result;
 
   std::vector< std::pair<float, uint64_t> > candidate_scores(num_candidates);
+	// stale normalized features were written with other idf weights, the candidates are then
+	// scored with their BoW features, which gives the same scores
+	const bool normalized = ii_params->normalized_scoring && dataset.normalized_bow_stamp() == normalized_stamp(numerics::NORM_L1);
 
 #if ENABLE_MULTITHREADING && ENABLE_MPI
   int rank, procs;
@@ -160,23 +1394,54 @@ PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search(Dataset &dataset, co
   int leftover = num_candidates%candidatesPerProc;
   /// actual number of candidates a node has, will only be different for last node if num_candidates % procs !=0
   int myCandidates = (rank==procs-1)?leftover : candidatesPerProc;
+  const int64_t first_candidate = rank*candidatesPerProc, last_candidate = rank*candidatesPerProc + myCandidates;
+#else
+	const int64_t first_candidate = 0, last_candidate = num_candidates;
 #endif
+	const int64_t num_blocks = (last_candidate - first_candidate + s_score_block_size - 1) / s_score_block_size;
 
+	Prefetcher::Ticket prefetch_ticket;
+	if(ii_params->prefetch_candidates) {
+		// the blocks are handed out in order, so the scoring threads follow the prefetched reads
+		std::sort(candidates.begin(), candidates.end(),
+			boost::bind(&ScoreAccumulator::entry_t::second, _1) <
+			boost::bind(&ScoreAccumulator::entry_t::second, _2));
+		std::vector<uint64_t> ids(last_candidate - first_candidate);
+		for(int64_t i=first_candidate; i<last_candidate; i++) ids[i - first_candidate] = candidates[i].second;
+		prefetch_ticket = normalized ? dataset.prefetch_normalized_bow_features(ids) : dataset.prefetch_bow_features(ids);
+	}
 
+	// Every thread scatters the query into its table once, then loads a block of candidates and
+	// scores it with table lookups.
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
-#pragma omp parallel for schedule(dynamic)
-#endif
-#if ENABLE_MULTITHREADING && ENABLE_MPI
-  for (int64_t i = rank*candidatesPerProc; i<(rank*candidatesPerProc + myCandidates); i++) {
-#else
-	for(int64_t i=0; i<num_candidates; i++) {
+#pragma omp parallel
 #endif
+	{
+		QueryTable &table = QueryTable::thread_instance();
+		table.set(example_bow_descriptors, idf_weights);
+		numerics::SparseVectorView block[s_score_block_size];
+		float scores[s_score_block_size];
 
-		const numerics::sparse_vector_t &bow_descriptors = dataset.load_bow_feature(candidates[i].second);
-
-		float sim = numerics::min_hist(example_bow_descriptors, bow_descriptors, idf_weights);
-		candidate_scores[i] = std::pair<float, uint64_t>(sim, candidates[i].second);
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+		for(int64_t b=0; b<num_blocks; b++) {
+			const int64_t begin = first_candidate + b * s_score_block_size;
+			const int64_t end = MIN(begin + (int64_t)s_score_block_size, last_candidate);
+			for(int64_t i=begin; i<end; i++) {
+				block[i - begin] = normalized ? dataset.load_normalized_bow_feature(candidates[i].second) :
+					dataset.load_bow_feature(candidates[i].second);
+			}
+			if(normalized) table.min_hist_normalized(block, end - begin, scores);
+			else table.min_hist(block, end - begin, idf_weights, scores);
+			for(int64_t i=begin; i<end; i++) {
+				candidate_scores[i] = std::pair<float, uint64_t>(scores[i - begin], candidates[i].second);
+			}
+		}
+		table.clear();
 	}
+	// every candidate is scored, the prefetches still queued would only be reloads
+	prefetch_ticket.cancel();
 
 	// aggregate all results into node zero.
 #if ENABLE_MULTITHREADING && ENABLE_MPI
@@ -202,9 +1467,13 @@ PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search(Dataset &dataset, co
     return std::static_pointer_cast<MatchResultsBase>(match_result); // will be empty
 #endif
 
-	std::sort(candidate_scores.begin(), candidate_scores.end(), 
-          boost::bind(&std::pair<float, uint64_t>::first, _1) >
-          boost::bind(&std::pair<float, uint64_t>::first, _2));
+	if(ii_params->max_matches > 0 && ii_params->max_matches < candidate_scores.size()) {
+		std::partial_sort(candidate_scores.begin(), candidate_scores.begin() + ii_params->max_matches, candidate_scores.end(),
+			match_greater<float>);
+		candidate_scores.resize(ii_params->max_matches);
+	} else {
+		std::sort(candidate_scores.begin(), candidate_scores.end(), match_greater<float>);
+	}
 
 	match_result->tfidf_scores.resize(candidate_scores.size());
 	match_result->matches.resize(candidate_scores.size());
@@ -218,10 +1487,361 @@ PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search(Dataset &dataset, co
 	return std::static_pointer_cast<MatchResultsBase>(match_result);
 }
 
+void InvertedIndex::count_parallel(const std::vector<PostingList> &lists, const IdBitmap *filter, uint64_t num_postings,
+	uint64_t k, std::vector<ScoreAccumulator::entry_t> &candidates, uint64_t &num_filtered) const {
+
+	candidates.clear();
+	num_filtered = 0;
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	// Every thread owns a slice of the id space and its own accumulator, so no synchronization is
+	// needed while counting.  The posting lists are sorted, so the part of a list inside a slice
+	// is found with two binary searches.
+	const uint64_t num_ids = inv_norms.size();
+	const int num_slices = omp_get_max_threads();
+	std::vector< std::vector<ScoreAccumulator::entry_t> > slice_candidates(num_slices);
+	uint64_t filtered = 0;
+
+	#pragma omp parallel for schedule(static, 1) num_threads(num_slices) reduction(+ : filtered)
+	for(int s=0; s<num_slices; s++) {
+		const uint64_t begin = num_ids * s / num_slices;
+		const uint64_t end = num_ids * (s + 1) / num_slices;
+
+		ScoreAccumulator &accumulator = ScoreAccumulator::thread_instance();
+		accumulator.reset(end - begin, num_postings / num_slices);
+		for(size_t i=0; i<lists.size(); i++) {
+			const ArrayView<uint64_t> &postings = lists[i].ids;
+			const uint64_t *first = std::lower_bound(postings.begin(), postings.end(), begin);
+			const uint64_t *last = std::lower_bound(first, postings.end(), end);
+			for(const uint64_t *posting = first; posting != last; posting++) {
+				if(filter && !filter->contains(*posting)) {
+					filtered++;
+					continue;
+				}
+				accumulator.add(*posting - begin);
+			}
+		}
+
+		// every slice selects its own top k, only these are merged
+		std::vector<ScoreAccumulator::entry_t> &top = slice_candidates[s];
+		accumulator.top(k, top);
+		accumulator.clear();
+		for(size_t i=0; i<top.size(); i++) top[i].second += begin;
+	}
+	num_filtered = filtered;
+
+	for(int s=0; s<num_slices; s++) {
+		candidates.insert(candidates.end(), slice_candidates[s].begin(), slice_candidates[s].end());
+	}
+	if(k < candidates.size()) {
+		std::nth_element(candidates.begin(), candidates.begin() + k, candidates.end(), match_greater<uint32_t>);
+		candidates.resize(k);
+	}
+	std::sort(candidates.begin(), candidates.end(), match_greater<uint32_t>);
+#endif
+}
+
+/// State of one query word while evaluating a query with dynamic pruning.
+struct PrunedTerm {
+	uint32_t cluster; /// visual word
+	size_t list; /// index of the postings of the word in the fetched lists
+	float query_weight; /// idf weighted L1 normalized query term frequency
+	float upper_bound; /// max score contribution of the word to any image
+	size_t position; /// cursor into the posting list
+	size_t block; /// block containing the cursor (for shallow seeks)
+};
+
+static bool pruned_term_less(const PrunedTerm &a, const PrunedTerm &b) {
+	return a.upper_bound < b.upper_bound;
+}
+
+PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search_pruned(const numerics::SparseVectorView &example_bow_descriptors,
+	const numerics::SparseVectorView &query_words, const std::vector<PostingList> &lists,
+	const PTR_LIB::shared_ptr<const SearchParams> &params) {
+
+	SCOPED_TIMER
+
+	PTR_LIB::shared_ptr<MatchResults> match_result = PTR_LIB::make_shared<MatchResults>();
+	const uint64_t k = params->max_matches > 0 ? params->max_matches : params->cutoff_idx;
+
+	// The score of an image d is the histogram intersection used by numerics::min_hist, which
+	// decomposes into a sum over the query words w of idf_w * min(q_w / |q|, tf_dw / |d|).
+	float query_norm = 0.f;
+	for(size_t i=0; i<example_bow_descriptors.size(); i++) {
+		query_norm += example_bow_descriptors.value(i) * idf_weights[example_bow_descriptors.index(i)];
+	}
+
+	std::vector<PrunedTerm> terms;
+	for(size_t i=0; i<query_words.size(); i++) {
+		uint32_t cluster = query_words.index(i);
+		match_result->num_postings += lists[i].ids.size();
+		if(lists[i].ids.empty() || idf_weights[cluster] <= 0.f || query_norm <= 0.f) continue;
+
+		PrunedTerm term;
+		term.cluster = cluster;
+		term.list = i;
+		term.query_weight = query_words.value(i) / query_norm;
+		term.upper_bound = idf_weights[cluster] * MIN(term.query_weight, 
+			*std::max_element(lists[i].block_max.begin(), lists[i].block_max.end()));
+		term.position = 0;
+		term.block = 0;
+		terms.push_back(term);
+	}
+	if(k == 0 || terms.empty()) {
+		match_result->num_postings_skipped = match_result->num_postings;
+		return std::static_pointer_cast<MatchResultsBase>(match_result);
+	}
+
+	// Words are ordered by increasing upper bound.  Words before first_essential are non
+	// essential: an image that only contains these words cannot beat the current threshold, so
+	// their lists are only probed for images found through the essential words.
+	std::sort(terms.begin(), terms.end(), pruned_term_less);
+	std::vector<float> bound_prefix(terms.size());
+	for(size_t i=0; i<terms.size(); i++) {
+		bound_prefix[i] = terms[i].upper_bound + (i > 0 ? bound_prefix[i - 1] : 0.f);
+	}
+
+	std::vector< std::pair<float, uint64_t> > top; // min-heap of the current top k matches
+	float threshold = 0.f;
+	size_t first_essential = 0;
+	uint64_t num_scored = 0;
+
+	while(true) {
+		uint64_t id = UINT64_MAX;
+		for(size_t i=first_essential; i<terms.size(); i++) {
+			const ArrayView<uint64_t> &postings = lists[terms[i].list].ids;
+			if(terms[i].position < postings.size()) id = MIN(id, postings[terms[i].position]);
+		}
+		if(id == UINT64_MAX) break;
+
+		if(params->filter && !params->filter->contains(id)) {
+			for(size_t i=first_essential; i<terms.size(); i++) {
+				const ArrayView<uint64_t> &postings = lists[terms[i].list].ids;
+				if(terms[i].position < postings.size() && postings[terms[i].position] == id) terms[i].position++;
+			}
+			continue;
+		}
+
+		const float inv_norm = inv_norms[id];
+		float score = 0.f;
+		for(size_t i=first_essential; i<terms.size(); i++) {
+			PrunedTerm &term = terms[i];
+			const ArrayView<uint64_t> &postings = lists[term.list].ids;
+			if(term.position < postings.size() && postings[term.position] == id) {
+				score += idf_weights[term.cluster] * MIN(term.query_weight, lists[term.list].frequencies[term.position] * inv_norm);
+				term.position++;
+				num_scored++;
+			}
+		}
+
+		for(size_t i=first_essential; i-- > 0 && score + bound_prefix[i] > threshold;) {
+			PrunedTerm &term = terms[i];
+			const ArrayView<uint64_t> &postings = lists[term.list].ids;
+			const ArrayView<float> &block_max = lists[term.list].block_max;
+
+			// shallow seek to the block which may contain the image and check its bound
+			while(term.block < block_max.size() && 
+				postings[MIN((term.block + 1) * block_size, postings.size()) - 1] < id) {
+				term.block++;
+			}
+			if(term.block >= block_max.size()) continue;
+			const float block_bound = idf_weights[term.cluster] * MIN(term.query_weight, block_max[term.block]);
+			if(score + block_bound + (i > 0 ? bound_prefix[i - 1] : 0.f) <= threshold) break;
+
+			term.position = std::lower_bound(postings.begin() + MAX(term.position, term.block * block_size),
+				postings.begin() + MIN((term.block + 1) * block_size, postings.size()), id) - postings.begin();
+			if(term.position < postings.size() && postings[term.position] == id) {
+				score += idf_weights[term.cluster] * MIN(term.query_weight, lists[term.list].frequencies[term.position] * inv_norm);
+				num_scored++;
+			}
+		}
+
+		if(top.size() < k || score > threshold) {
+			top.push_back(std::pair<float, uint64_t>(score, id));
+			std::push_heap(top.begin(), top.end(), match_greater<float>);
+			if(top.size() > k) {
+				std::pop_heap(top.begin(), top.end(), match_greater<float>);
+				top.pop_back();
+			}
+			if(top.size() == k) {
+				threshold = top.front().first;
+				while(first_essential < terms.size() && bound_prefix[first_essential] <= threshold) {
+					first_essential++;
+				}
+			}
+		}
+	}
+
+	std::sort_heap(top.begin(), top.end(), match_greater<float>);
+	match_result->matches.resize(top.size());
+	match_result->tfidf_scores.resize(top.size());
+	for(size_t i=0; i<top.size(); i++) {
+		match_result->tfidf_scores[i] = top[i].first;
+		match_result->matches[i] = top[i].second;
+	}
+	match_result->num_postings_skipped = match_result->num_postings - num_scored;
+
+	return std::static_pointer_cast<MatchResultsBase>(match_result);
+}
+
+PTR_LIB::shared_ptr<MatchResultsBase> InvertedIndex::search_filtered(const numerics::SparseVectorView &example_bow_descriptors,
+	const numerics::SparseVectorView &query_words, const std::vector<PostingList> &lists,
+	const PTR_LIB::shared_ptr<const SearchParams> &params) {
+
+	SCOPED_TIMER
+
+	PTR_LIB::shared_ptr<MatchResults> match_result = PTR_LIB::make_shared<MatchResults>();
+	const uint64_t k = params->max_matches > 0 ? params->max_matches : params->cutoff_idx;
+
+	float query_norm = 0.f;
+	for(size_t i=0; i<example_bow_descriptors.size(); i++) {
+		query_norm += example_bow_descriptors.value(i) * idf_weights[example_bow_descriptors.index(i)];
+	}
+
+	// The allowed ids and the postings are both sorted, so every list is probed with a cursor
+	// which only moves forward.  Each probe is a binary search over the rest of the list.
+	const std::vector<uint64_t> &allowed = params->filter->ids();
+	std::vector<float> scores(allowed.size(), 0.f);
+	std::vector<bool> matched(allowed.size(), false);
+	uint64_t num_scored = 0;
+	for(size_t i=0; i<query_words.size(); i++) {
+		const uint32_t cluster = query_words.index(i);
+		const ArrayView<uint64_t> &postings = lists[i].ids;
+		match_result->num_postings += postings.size();
+		if(query_norm <= 0.f) continue;
+
+		const float query_weight = query_words.value(i) / query_norm;
+		size_t position = 0;
+		for(size_t j=0; j<allowed.size() && position < postings.size(); j++) {
+			position = std::lower_bound(postings.begin() + position, postings.end(), allowed[j]) - postings.begin();
+			if(position < postings.size() && postings[position] == allowed[j]) {
+				scores[j] += idf_weights[cluster] * MIN(query_weight, lists[i].frequencies[position] * inv_norms[allowed[j]]);
+				matched[j] = true;
+				num_scored++;
+			}
+		}
+	}
+	match_result->num_postings_skipped = match_result->num_postings - num_scored;
+
+	std::vector< std::pair<float, uint64_t> > candidate_scores;
+	for(size_t i=0; i<allowed.size(); i++) {
+		if(matched[i]) candidate_scores.push_back(std::pair<float, uint64_t>(scores[i], allowed[i]));
+	}
+	if(k < candidate_scores.size()) {
+		std::partial_sort(candidate_scores.begin(), candidate_scores.begin() + k, candidate_scores.end(), match_greater<float>);
+		candidate_scores.resize(k);
+	} else {
+		std::sort(candidate_scores.begin(), candidate_scores.end(), match_greater<float>);
+	}
+
+	match_result->tfidf_scores.resize(candidate_scores.size());
+	match_result->matches.resize(candidate_scores.size());
+	for(size_t i=0; i<candidate_scores.size(); i++) {
+		match_result->tfidf_scores[i] = candidate_scores[i].first;
+		match_result->matches[i] = candidate_scores[i].second;
+	}
+
+	return std::static_pointer_cast<MatchResultsBase>(match_result);
+}
+
+static bool query_word_greater(const std::pair<float, size_t> &a, const std::pair<float, size_t> &b) {
+	return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+numerics::SparseVectorView InvertedIndex::select_query_words(const numerics::SparseVectorView &example_bow_descriptors,
+	const SearchParams &params) const {
+
+	if(params.max_query_words == 0 || example_bow_descriptors.size() <= params.max_query_words) return example_bow_descriptors;
+
+	// keep the words with the largest tf * idf weight, in their original (cluster) order
+	std::vector< std::pair<float, size_t> > weights(example_bow_descriptors.size());
+	for(size_t i=0; i<example_bow_descriptors.size(); i++) {
+		weights[i] = std::pair<float, size_t>(example_bow_descriptors.value(i) * idf_weights[example_bow_descriptors.index(i)], i);
+	}
+	std::nth_element(weights.begin(), weights.begin() + params.max_query_words, weights.end(), query_word_greater);
+	weights.resize(params.max_query_words);
+
+	std::vector<size_t> kept(weights.size());
+	for(size_t i=0; i<weights.size(); i++) kept[i] = weights[i].second;
+	std::sort(kept.begin(), kept.end());
+
+	PTR_LIB::shared_ptr<numerics::SparseVector> top_words = PTR_LIB::make_shared<numerics::SparseVector>();
+	top_words->reserve(kept.size());
+	for(size_t i=0; i<kept.size(); i++) top_words->push_back(example_bow_descriptors.index(kept[i]), example_bow_descriptors.value(kept[i]));
+	return numerics::SparseVectorView(PTR_LIB::shared_ptr<const numerics::SparseVector>(top_words));
+}
+
 uint32_t InvertedIndex::num_clusters() const {
 	return idf_weights.size();
 }
 
+uint64_t InvertedIndex::document_frequency(uint32_t word) const {
+	return posting_lists[word].size();
+}
+
+void InvertedIndex::set_idf_weights(const std::vector<float> &weights, const std::vector<bool> &stop_words) {
+	unmap();
+	idf_weights = weights;
+	for(size_t i=0; i<stop_words.size() && i<inverted_index.size(); i++) {
+		if(!stop_words[i]) continue;
+		std::vector<uint64_t>().swap(inverted_index[i]);
+		std::vector<float>().swap(term_frequencies[i]);
+		if(has_signatures()) {
+			std::vector<uint32_t>().swap(signature_offsets[i]);
+			std::vector<uint64_t>().swap(signatures[i]);
+		}
+		idf_weights[i] = 0.f;
+	}
+	compute_weights();
+}
+
+void InvertedIndex::remap_ids(const std::vector<uint64_t> &new_ids) {
+	unmap();
+
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int64_t i=0; i<(int64_t)inverted_index.size(); i++) {
+		std::vector<uint64_t> &postings = inverted_index[i];
+		std::vector<float> &frequencies = term_frequencies[i];
+		std::vector< std::pair<uint64_t, uint64_t> > remapped(postings.size());
+		for(size_t j=0; j<postings.size(); j++) {
+			remapped[j] = std::pair<uint64_t, uint64_t>(new_ids[postings[j]], j);
+		}
+		std::sort(remapped.begin(), remapped.end());
+		const std::vector<float> old_frequencies(frequencies);
+		for(size_t j=0; j<remapped.size(); j++) {
+			postings[j] = remapped[j].first;
+			frequencies[j] = old_frequencies[remapped[j].second];
+		}
+
+		if(!has_signatures() || signature_offsets[i].empty()) continue;
+		const std::vector<uint32_t> old_offsets(signature_offsets[i]);
+		const std::vector<uint64_t> old_signatures(signatures[i]);
+		std::vector<uint32_t> &offsets = signature_offsets[i];
+		for(size_t j=0; j<remapped.size(); j++) {
+			const uint32_t begin = old_offsets[remapped[j].second], end = old_offsets[remapped[j].second + 1];
+			std::copy(old_signatures.begin() + begin, old_signatures.begin() + end, signatures[i].begin() + offsets[j]);
+			offsets[j + 1] = offsets[j] + end - begin;
+		}
+	}
+
+	compute_weights();
+}
+
+bool InvertedIndex::is_mapped() const {
+	return (bool)mapped_file;
+}
+
+bool InvertedIndex::has_signatures() const {
+	return !signature_offsets.empty();
+}
+
+uint64_t InvertedIndex::num_postings() const {
+	uint64_t total = 0;
+	for(size_t i=0; i<posting_lists.size(); i++) total += posting_lists[i].size();
+	return total;
+}
+
 std::ostream& operator<< (std::ostream &out, const InvertedIndex::MatchResults &match_results) {
 	out << "[ ";
 	for(uint32_t i=0; i<MIN(8, match_results.matches.size()); i++) {
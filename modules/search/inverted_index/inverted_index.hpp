@@ -2,6 +2,12 @@
 
 #include <search/search_base/search_base.hpp>
 #include <search/bag_of_words/bag_of_words.hpp>
+#include <search/hamming_embedding/hamming_embedding.hpp>
+#include <utils/array_view.hpp>
+#include <utils/mapped_file.hpp>
+#include <utils/id_bitmap.hpp>
+#include <utils/accumulator.hpp>
+#include <utils/buffer_pool.hpp>
 
 /// Implements a Bag of Words based (BoW) image search using an inverted index.  The inverted
 /// index keeps track of a list of images associated with each visual word.  The images are
@@ -12,52 +18,321 @@ public:
 
 	/// Subclass of train params base which specifies inverted index training parameters.
 	struct TrainParams : public TrainParamsBase {
+		TrainParams(float max_document_frequency = 1.f, uint64_t max_memory_bytes = 1ULL << 30, const std::string &run_directory = "") :
+			max_document_frequency(max_document_frequency), max_memory_bytes(max_memory_bytes), run_directory(run_directory),
+			hamming_signatures(false), normalized_features(false) { }
+
 		PTR_LIB::shared_ptr<BagOfWords> bag_of_words;  /// bag of words to index on
+
+		/// Words which occur in more than this fraction of the training images are treated as stop
+		/// words: their posting lists are dropped and their idf weight is set to zero.  This bounds
+		/// the length of every posting list and therefore the index size.  1 keeps every word.
+		float max_document_frequency;
+
+		/// Training builds partial indexes (runs) over ranges of examples in parallel.  Once the
+		/// buffered runs exceed max_memory_bytes, further runs are written to run_directory (the
+		/// system temporary directory if empty) until they are merged.  0 never writes runs.
+		uint64_t max_memory_bytes;
+		std::string run_directory;
+
+		/// If true, the Hamming embedding signatures of every example (the "he_signatures" feature,
+		/// see HammingEmbedding) are stored with its postings, so that search can gate the postings
+		/// by Hamming distance (see SearchParams::max_hamming_distance).
+		bool hamming_signatures;
+
+		/// If true, the idf weighted, L1 normalized BoW vector of every image of the dataset is
+		/// written once the idf weights are known (see save_normalized_features).
+		bool normalized_features;
 	};
 
 	/// Subclass of train params base which specifies inverted index training parameters.
 	struct SearchParams : public SearchParamsBase {
-		SearchParams(uint64_t cutoff_idx = 4096) : cutoff_idx(cutoff_idx) { }
+		SearchParams(uint64_t cutoff_idx = 4096, uint64_t max_matches = 0, bool dynamic_pruning = false,
+			uint32_t max_query_words = 0, uint64_t max_postings_per_word = 0) :
+			cutoff_idx(cutoff_idx), max_matches(max_matches), dynamic_pruning(dynamic_pruning),
+			max_query_words(max_query_words), max_postings_per_word(max_postings_per_word),
+			direct_scoring_selectivity(0.01f), parallel_min_postings(1 << 18),
+			max_hamming_distance(HammingEmbedding::num_bits), normalized_scoring(false), prefetch_candidates(false) { }
 
 		uint64_t cutoff_idx; /// number of top matches to consider
+		uint64_t max_matches; /// number of scored matches to return, 0 returns all considered matches
+
+		/// If true, the query is evaluated directly on the postings with the block-max MaxScore 
+		/// algorithm, which returns the exact top matches by histogram intersection (min_hist) score
+		/// while skipping posting lists, or parts of them, which cannot change the result.  The
+		/// number of returned matches is max_matches if set, otherwise cutoff_idx.
+		bool dynamic_pruning;
+
+		/// If non zero, only the max_query_words query words with the largest tf * idf weight are
+		/// looked up in the index.  The remaining words still count towards the query norm.
+		uint32_t max_query_words;
+		/// If non zero, only this many postings are read for a query word with a longer posting
+		/// list: those of the blocks with the largest block-max weights, ie. the images in which
+		/// the word weighs the most.  The word stays in the query, which bounds the number of
+		/// postings read per word (and the query latency).
+		uint64_t max_postings_per_word;
+
+		/// If set, only images in the filter are matched.  The filter is applied while the postings
+		/// are scanned, so excluded images never become candidates.
+		PTR_LIB::shared_ptr<const IdBitmap> filter;
+		/// If the filter allows at most this fraction of the indexed images, the allowed images are
+		/// scored directly by looking them up in the posting lists of the query words instead of
+		/// scanning the lists.  The number of returned matches is then max_matches if set,
+		/// otherwise cutoff_idx.
+		float direct_scoring_selectivity;
+
+		/// Queries whose posting lists hold at least this many postings count the shared words in
+		/// parallel, each thread scanning one slice of the id space of every list.  This is only
+		/// done when the search is not already running inside a parallel region (ex. a batch
+		/// search).  0 always counts on the calling thread.
+		uint64_t parallel_min_postings;
+
+		/// If less than HammingEmbedding::num_bits and the index stores signatures, a posting only
+		/// counts as a shared word if one of its signatures is within this many bits of a query
+		/// signature of the same word.  Rejected votes never make an image a candidate, so a smaller
+		/// cutoff_idx gives the same precision.  The gate applies to the candidate count on the
+		/// calling thread, dynamic pruning and direct scoring of filtered queries ignore it.
+		uint32_t max_hamming_distance;
+
+		/// If true, the candidates are scored with their normalized BoW vectors
+		/// (Dataset::load_normalized_bow_feature) and the query is normalized once, so every score
+		/// is a single intersection pass.  If the normalized features of the dataset were not written
+		/// with the current idf weights (see normalized_stamp), the candidates are scored with their
+		/// BoW vectors instead.
+		bool normalized_scoring;
+
+		/// If true, the candidates are scored in id order, which is the order of their features on
+		/// disk, and the features of all candidates are prefetched (Dataset::prefetch_bow_features)
+		/// before scoring starts, so loading them overlaps with scoring the first blocks.  Off by
+		/// default.
+		bool prefetch_candidates;
 	};
 
 	/// Subclass of match results base which also returns scores
 	struct MatchResults : public MatchResultsBase {
+		MatchResults() : num_postings(0), num_postings_skipped(0), num_postings_rejected(0) { }
+
 		std::vector<float> tfidf_scores;
+		uint64_t num_postings; /// total length of the posting lists read for the query words
+		uint64_t num_postings_skipped; /// number of postings which were never scored
+		uint64_t num_postings_rejected; /// number of postings rejected by the Hamming gate
+	};
+
+	/// Memory use of an index loaded with load_tiered.
+	struct TierStats {
+		TierStats() : num_hot_lists(0), num_cold_lists(0), hot_bytes(0), pool_capacity(0), pool_bytes(0),
+			pool_hits(0), pool_misses(0) { }
+
+		uint32_t num_hot_lists; /// posting lists kept in memory
+		uint32_t num_cold_lists; /// non empty posting lists read on demand
+		uint64_t hot_bytes; /// bytes used by the lists kept in memory
+		uint64_t pool_capacity; /// byte budget of the buffer pool holding cold lists
+		uint64_t pool_bytes; /// bytes currently cached by the buffer pool
+		uint64_t pool_hits, pool_misses; /// cold list reads served from the pool and from disk
 	};
 
 	InvertedIndex();
 	InvertedIndex(const std::string &file_name);
+	InvertedIndex(const InvertedIndex &other);
+	InvertedIndex &operator=(const InvertedIndex &other);
 
-	/// Given a set of training parameters, list of images, trains.  Returns true if successful, false
-	/// if not successful.
+	/// Given a set of training parameters, list of images, trains.  The examples may come in any
+	/// order, they are indexed in id order.  Returns true if successful, false if not successful.
 	bool train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params,
-		 		const std::vector< PTR_LIB::shared_ptr<const Image > > &examples);
+		 		const ImageRange &examples);
 
-	/// Loads a trained search structure from the input filepath
+	/// Loads a trained search structure from the input filepath.  Files written by save_mapped
+	/// are memory mapped (see load_mapped with the default hints).
 	bool load (const std::string &file_path);
 
 	/// Saves a trained search structure to the input filepath
 	bool save (const std::string &file_path) const;
 
+	/// Saves the index in the memory mappable format: a header, the idf weights, an offset
+	/// table and the contiguous postings, term frequencies and precomputed weights.
+	bool save_mapped (const std::string &file_path) const;
+
+	/// Maps an index written by save_mapped.  The postings are used in place and are only read
+	/// from disk when a query touches them.  advice is applied to the postings, and the posting
+	/// lists of the num_prefault_words most frequent words are read ahead (see prefault).
+	bool load_mapped (const std::string &file_path, MappedFile::Advice advice = MappedFile::ADVICE_RANDOM,
+		uint32_t num_prefault_words = 0);
+
+	/// Loads an index written by save_mapped with at most memory_budget bytes in memory.  The
+	/// posting lists with the most accesses per byte are read into memory and pinned there, the
+	/// others are read with pread into a buffer pool (a quarter of the budget left after the
+	/// weights) when a query needs them.  Without access counts the shortest lists are kept in
+	/// memory.  Access counts are read from and saved to access_counts_path (file_path +
+	/// ".access" if empty) when the index is released, so the tiers adapt across restarts.
+	bool load_tiered (const std::string &file_path, uint64_t memory_budget,
+		const std::string &access_counts_path = "");
+
+	/// Saves the posting list access counts of an index loaded with load_tiered.  Returns false if
+	/// the index is not tiered or the counts could not be written.
+	bool save_access_counts() const;
+
+	/// Returns the memory use of an index loaded with load_tiered (all zeros otherwise).
+	TierStats tier_stats() const;
+
+	/// Merges index files written by save, each built on a disjoint set of images, into a single
+	/// index file.  The postings of every word are merged by id while streaming through the inputs,
+	/// so the memory used does not depend on the index sizes.  The idf weights are recomputed from
+	/// the merged document frequencies for a database of num_images images (the number of
+	/// distinct indexed images if 0).
+	static bool merge(const std::vector<std::string> &input_paths, const std::string &output_path, uint64_t num_images = 0);
+
+	/// Asks the kernel to read the posting lists of the num_words most frequent words ahead (see
+	/// MappedFile::prefault).  Does nothing if the index is not memory mapped.
+	void prefault(uint32_t num_words);
+
+	/// Writes the BoW vector of every image of the dataset weighted by the idf weights of the index
+	/// and normalized (see numerics::normalize and Dataset::write_normalized_bow_features), stamped
+	/// with normalized_stamp(norm).  Returns false if the features could not be written.
+	bool save_normalized_features(Dataset &dataset, numerics::Norm norm = numerics::NORM_L1) const;
+
+	/// Returns a hash of the idf weights and the norm, which changes whenever the idf weights
+	/// change (ex. merge, incremental updates), so that stale normalized features are detected.
+	/// Never 0.
+	uint64_t normalized_stamp(numerics::Norm norm) const;
+
 	/// Returns the number of clusters used in the inverted index descriptors
 	uint32_t num_clusters() const;
 
+	/// Returns the total number of postings stored in the index.
+	uint64_t num_postings() const;
+
+	/// Returns the number of indexed images containing the given word.
+	uint64_t document_frequency(uint32_t word) const;
+
+	/// Replaces the idf weights, ex. with weights computed over several indexes of a larger
+	/// database.  The postings of the words marked in stop_words are dropped and their weight is
+	/// set to zero.
+	void set_idf_weights(const std::vector<float> &idf_weights, const std::vector<bool> &stop_words = std::vector<bool>());
+
+	/// Renumbers the indexed images, image id i becomes new_ids[i].  new_ids must be a
+	/// permutation of the database ids (see SimpleDataset::remap_ids).
+	void remap_ids(const std::vector<uint64_t> &new_ids);
+
+	/// Returns true if the postings are memory mapped from a file written by save_mapped.
+	bool is_mapped() const;
+
+	/// Returns true if the postings carry Hamming embedding signatures.  Signatures are kept by save
+	/// and load, indexes written by save_mapped or merge do not have them.
+	bool has_signatures() const;
+
 	/// Given a set of search parameters, a query image, searches for matching images and returns the match.  If the match is 0, then the search failed 
 	/// (it will fail if the example image has missing features).
 	PTR_LIB::shared_ptr<MatchResultsBase> search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, const PTR_LIB::shared_ptr<const Image > &example);
 	
+	/// Given a set of search parameters and the BoW vector of a query, searches for matching images and returns the match.
+	PTR_LIB::shared_ptr<MatchResultsBase> search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, 
+		const numerics::sparse_vector_t &example_bow_descriptors);
+	/// Same as above for a view of the BoW vector (ex. Dataset::load_bow_feature), which is not copied.
+	PTR_LIB::shared_ptr<MatchResultsBase> search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, 
+		const numerics::SparseVectorView &example_bow_descriptors);
+
+	/// Given a set of search parameters, the BoW vector of a query and the Hamming embedding signatures
+	/// of its descriptors, searches for matching images and returns the match.
+	PTR_LIB::shared_ptr<MatchResultsBase> search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, 
+		const numerics::SparseVectorView &example_bow_descriptors, const HammingEmbedding::signatures_t &example_signatures);
+
 	/// Given a set of search parameters, a query image, searches for matching images and returns the match.  If the match is 0, then the search failed 
 	/// (it will fail if the example image has missing features).
 	std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > search(Dataset &dataset, const PTR_LIB::shared_ptr<SearchParamsBase> &params,
 															 const std::vector< PTR_LIB::shared_ptr<const Image > > &examples);
 
+	/// Number of postings summarized by one entry of the block-max metadata.
+	static const uint32_t block_size = 64;
+
 protected:
+	struct TieredStore;
+
+	/// Postings of one word, valid while the list (and the buffer holding it, if any) is alive.
+	struct PostingList {
+		ArrayView<uint64_t> ids;
+		ArrayView<float> frequencies;
+		ArrayView<float> block_max;
+		/// Position of every posting in the full list of the word, empty unless the list was
+		/// capped (see cap_list).
+		ArrayView<uint64_t> positions;
+		BufferPool::buffer_t buffer; /// set if the list was read from the on disk tier or capped
+	};
+
+	/// Returns the postings of a word, reading them from disk if they are not in memory.
+	PostingList fetch_list(uint32_t word) const;
+
+	/// Returns the postings of every query word (in the order of words), and counts the accesses
+	/// of a tiered index.
+	void fetch_lists(const numerics::SparseVectorView &words, std::vector<PostingList> &lists) const;
+
+	/// Returns the max_postings postings of list with the largest block-max weights, in id order,
+	/// with their positions in list and their own block-max metadata.
+	PostingList cap_list(const PostingList &list, uint64_t max_postings) const;
+
+	/// Evaluates the query with the block-max MaxScore algorithm, see SearchParams::dynamic_pruning.
+	/// query_words is the subset of the query which is looked up in the index, and lists holds
+	/// their postings.
+	PTR_LIB::shared_ptr<MatchResultsBase> search_pruned(const numerics::SparseVectorView &example_bow_descriptors,
+		const numerics::SparseVectorView &query_words, const std::vector<PostingList> &lists,
+		const PTR_LIB::shared_ptr<const SearchParams> &params);
+
+	/// Counts the query words shared by every indexed image with one thread per slice of the id
+	/// space, and writes the k images sharing the most words into candidates (see
+	/// ScoreAccumulator::top).  num_filtered is set to the number of postings rejected by filter.
+	void count_parallel(const std::vector<PostingList> &lists, const IdBitmap *filter, uint64_t num_postings,
+		uint64_t k, std::vector<ScoreAccumulator::entry_t> &candidates, uint64_t &num_filtered) const;
+
+	/// Scores the images allowed by params->filter by looking them up in the posting lists of the
+	/// query words, see SearchParams::direct_scoring_selectivity.
+	PTR_LIB::shared_ptr<MatchResultsBase> search_filtered(const numerics::SparseVectorView &example_bow_descriptors,
+		const numerics::SparseVectorView &query_words, const std::vector<PostingList> &lists,
+		const PTR_LIB::shared_ptr<const SearchParams> &params);
+
+	/// Returns the words of the query which are looked up in the index, after applying the
+	/// max_query_words limit of the search parameters.  The query itself is returned, without
+	/// copying it, when there is no limit.
+	numerics::SparseVectorView select_query_words(const numerics::SparseVectorView &example_bow_descriptors,
+		const SearchParams &params) const;
+
+	/// Computes the idf weighted L1 norm of every indexed image and the block-max metadata
+	/// from the postings, term frequencies and idf weights.  Must be called whenever any of
+	/// these change.
+	void compute_weights();
+
+	/// Reads the "he_signatures" feature of every example and stores the signatures with the
+	/// postings of the example, see TrainParams::hamming_signatures.
+	void gather_signatures(Dataset &dataset, const ImageRange &examples);
+
+	/// Points the posting, term frequency and weight views to the in memory arrays.  The views of
+	/// lists on the on disk tier have the size of the list and no data.
+	void update_views();
+
+	/// Copies a memory mapped or tiered index into the in memory arrays so that it can be modified.
+	void unmap();
 	
 	std::vector< std::vector<uint64_t> > inverted_index; /// Stores the inverted index, dimension one is the cluster index, dimension two holds a list of ids containing that word.
+	std::vector< std::vector<float> > term_frequencies; /// Term frequency of each posting, same layout as inverted_index.
 	std::vector<float> idf_weights; /// Stores the idf weights, one element per cluster
 
+	std::vector<float> inv_image_norms; /// Inverse idf weighted L1 norm of each image's BoW vector, indexed by image id.
+	std::vector< std::vector<float> > block_max_weights; /// Max normalized term frequency of every block_size postings of each word.
+
+	/// Hamming embedding signatures of the postings, empty if the index has none.  The signatures
+	/// of posting j of word i are signatures[i][signature_offsets[i][j]] up to
+	/// signatures[i][signature_offsets[i][j + 1]].
+	std::vector< std::vector<uint32_t> > signature_offsets;
+	std::vector< std::vector<uint64_t> > signatures;
+
+	/// Views used by search, they point either to the arrays above or into mapped_file.  Search
+	/// reads postings through fetch_list, since lists on the on disk tier have no data.
+	std::vector< ArrayView<uint64_t> > posting_lists;
+	std::vector< ArrayView<float> > frequency_lists;
+	std::vector< ArrayView<float> > block_max_lists;
+	ArrayView<float> inv_norms;
+
+	PTR_LIB::shared_ptr<MappedFile> mapped_file; /// Set if the index is memory mapped.
+	PTR_LIB::shared_ptr<TieredStore> tiered_store; /// Set if the index was loaded with load_tiered.
+
 };
 
 /// Prints out information about the match results.
@@ -35,8 +35,9 @@ public:
 	virtual ~SearchBase();
 
 	/// Given a set of training parameters, list of images, trains.  Returns true if successful, false
-	/// if not successful.
-	virtual bool train (Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params, const std::vector< PTR_LIB::shared_ptr<const Image > > &examples) = 0;
+	/// if not successful.  The examples are a lazy range, implementations should use examples.id(i)
+	/// rather than create the images.
+	virtual bool train (Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params, const ImageRange &examples) = 0;
 
 	/// Given a set of search parameters, list of query images, searches for matching images and returns the result
 	/// matches.
@@ -0,0 +1,265 @@
+#include <config.hpp>
+
+#include "sharded_inverted_index.hpp"
+
+#include <utils/accumulator.hpp>
+#include <utils/filesystem.hpp>
+#include <utils/hash.hpp>
+#include <utils/misc.hpp>
+#include <utils/numerics.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+ShardedInvertedIndex::ShardedInvertedIndex() : SearchBase(), partition(PARTITION_RANGE), min_id(0), max_id(0), max_document_frequency(1.f) {
+
+}
+
+ShardedInvertedIndex::ShardedInvertedIndex(const std::string &file_name) : SearchBase(file_name),
+	partition(PARTITION_RANGE), min_id(0), max_id(0), max_document_frequency(1.f) {
+	if(!filesystem::file_exists(file_name)) {
+		std::cerr << "Error reading sharded index from " << file_name << std::endl;
+		return;
+	}
+	if(!this->load(file_name)) {
+		std::cerr << "Error reading sharded index from " << file_name << std::endl;
+	}
+}
+
+uint32_t ShardedInvertedIndex::shard_of(uint64_t id) const {
+	if(shards.empty()) return 0;
+	if(partition == PARTITION_HASH) return hash_id(id) % shards.size();
+
+	if(id <= min_id) return 0;
+	if(id >= max_id) return shards.size() - 1;
+	return (uint32_t)((double)(id - min_id) * shards.size() / (double)(max_id - min_id + 1));
+}
+
+uint32_t ShardedInvertedIndex::num_shards() const {
+	return shards.size();
+}
+
+const PTR_LIB::shared_ptr<InvertedIndex> &ShardedInvertedIndex::shard(uint32_t shard) const {
+	return shards[shard];
+}
+
+std::string ShardedInvertedIndex::shard_path(const std::string &file_path, uint32_t shard) {
+	std::stringstream ss;
+	ss << file_path << ".shard" << shard;
+	return ss.str();
+}
+
+bool ShardedInvertedIndex::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params,
+	const ImageRange &examples) {
+
+	const PTR_LIB::shared_ptr<const TrainParams> &si_params = std::static_pointer_cast<const TrainParams>(params);
+	if(!si_params || si_params->num_shards == 0) return false;
+
+	shards.clear();
+	for(uint32_t i=0; i<si_params->num_shards; i++) {
+		if(!train_shard(dataset, si_params, examples, i)) return false;
+	}
+
+	update_global_weights();
+
+	return true;
+}
+
+bool ShardedInvertedIndex::train_shard(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParams> &params,
+	const ImageRange &examples, uint32_t shard) {
+
+	if(!params || !params->index_params || shard >= params->num_shards) return false;
+
+	// the partition only depends on the parameters and the examples, so every shard agrees on it
+	partition = params->partition;
+	max_document_frequency = params->index_params->max_document_frequency;
+	min_id = UINT64_MAX;
+	max_id = 0;
+	for(size_t i=0; i<examples.size(); i++) {
+		min_id = MIN(min_id, examples.id(i));
+		max_id = MAX(max_id, examples.id(i));
+	}
+	if(examples.empty()) min_id = 0;
+	shards.resize(params->num_shards);
+	shard_num_examples.resize(params->num_shards, 0);
+
+	std::vector<uint64_t> shard_ids;
+	for(size_t i=0; i<examples.size(); i++) {
+		if(shard_of(examples.id(i)) == shard) shard_ids.push_back(examples.id(i));
+	}
+	const ImageRange shard_examples(dataset, shard_ids);
+
+	// stop words are chosen over all shards in update_global_weights
+	PTR_LIB::shared_ptr<InvertedIndex::TrainParams> index_params = PTR_LIB::make_shared<InvertedIndex::TrainParams>(*params->index_params);
+	index_params->max_document_frequency = 1.f;
+
+	shards[shard] = PTR_LIB::make_shared<InvertedIndex>();
+	shard_num_examples[shard] = shard_examples.size();
+	return shards[shard]->train(dataset, index_params, shard_examples);
+}
+
+void ShardedInvertedIndex::update_global_weights() {
+	uint32_t num_clusters = 0;
+	uint64_t num_examples = 0;
+	for(size_t i=0; i<shards.size(); i++) {
+		if(!shards[i]) continue;
+		num_clusters = MAX(num_clusters, shards[i]->num_clusters());
+		num_examples += shard_num_examples[i];
+	}
+
+	std::vector<uint64_t> document_frequencies(num_clusters, 0);
+	for(size_t i=0; i<shards.size(); i++) {
+		if(!shards[i]) continue;
+		for(uint32_t j=0; j<shards[i]->num_clusters(); j++) {
+			document_frequencies[j] += shards[i]->document_frequency(j);
+		}
+	}
+
+	std::vector<float> idf_weights(num_clusters, 0.f);
+	std::vector<bool> stop_words(num_clusters, false);
+	const float max_document_count = max_document_frequency * (float)num_examples;
+	for(uint32_t i=0; i<num_clusters; i++) {
+		if(document_frequencies[i] == 0) continue;
+		if(max_document_frequency < 1.f && (float)document_frequencies[i] > max_document_count) {
+			stop_words[i] = true;
+			continue;
+		}
+		idf_weights[i] = logf((float)num_examples / (float)document_frequencies[i]);
+	}
+
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int64_t i=0; i<(int64_t)shards.size(); i++) {
+		if(shards[i]) shards[i]->set_idf_weights(idf_weights, stop_words);
+	}
+}
+
+bool ShardedInvertedIndex::load (const std::string &file_path) {
+	std::cout << "Reading sharded inverted index from " << file_path << "..." << std::endl;
+
+	std::ifstream ifs(file_path, std::ios::binary);
+	uint32_t num_shards = 0, partition_type = 0;
+	ifs.read((char *)&num_shards, sizeof(uint32_t));
+	ifs.read((char *)&partition_type, sizeof(uint32_t));
+	ifs.read((char *)&min_id, sizeof(uint64_t));
+	ifs.read((char *)&max_id, sizeof(uint64_t));
+	ifs.read((char *)&max_document_frequency, sizeof(float));
+	shard_num_examples.resize(num_shards);
+	if(num_shards > 0) ifs.read((char *)&shard_num_examples[0], sizeof(uint64_t) * num_shards);
+	partition = (Partition)partition_type;
+
+	if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+
+	shards.assign(num_shards, PTR_LIB::shared_ptr<InvertedIndex>());
+	for(uint32_t i=0; i<num_shards; i++) {
+		if(!load_shard(i, shard_path(file_path, i))) return false;
+	}
+
+	std::cout << "Done reading sharded inverted index." << std::endl;
+
+	return true;
+}
+
+bool ShardedInvertedIndex::save (const std::string &file_path) const {
+	std::cout << "Writing sharded inverted index to " << file_path << "..." << std::endl;
+
+	std::ofstream ofs(file_path, std::ios::binary | std::ios::trunc);
+	uint32_t num_shards = shards.size(), partition_type = partition;
+	ofs.write((const char *)&num_shards, sizeof(uint32_t));
+	ofs.write((const char *)&partition_type, sizeof(uint32_t));
+	ofs.write((const char *)&min_id, sizeof(uint64_t));
+	ofs.write((const char *)&max_id, sizeof(uint64_t));
+	ofs.write((const char *)&max_document_frequency, sizeof(float));
+	if(num_shards > 0) ofs.write((const char *)&shard_num_examples[0], sizeof(uint64_t) * num_shards);
+
+	if((ofs.rdstate() & std::ofstream::failbit) != 0) return false;
+
+	for(uint32_t i=0; i<num_shards; i++) {
+		if(!save_shard(i, shard_path(file_path, i))) return false;
+	}
+
+	std::cout << "Done writing sharded inverted index." << std::endl;
+
+	return true;
+}
+
+bool ShardedInvertedIndex::load_shard (uint32_t shard, const std::string &file_path) {
+	if(shard >= shards.size()) return false;
+
+	PTR_LIB::shared_ptr<InvertedIndex> index = PTR_LIB::make_shared<InvertedIndex>();
+	if(!index->load(file_path)) return false;
+	shards[shard] = index;
+	return true;
+}
+
+bool ShardedInvertedIndex::save_shard (uint32_t shard, const std::string &file_path) const {
+	if(shard >= shards.size() || !shards[shard]) return false;
+	return shards[shard]->save(file_path);
+}
+
+PTR_LIB::shared_ptr<MatchResultsBase> ShardedInvertedIndex::search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params,
+	const PTR_LIB::shared_ptr<const Image > &example) {
+
+	SCOPED_TIMER
+
+	const PTR_LIB::shared_ptr<const InvertedIndex::SearchParams> &ii_params = (!params) ?
+		PTR_LIB::make_shared<const InvertedIndex::SearchParams>()
+		: std::static_pointer_cast<const InvertedIndex::SearchParams>(params);
+
+	const numerics::SparseVectorView &example_bow_descriptors = dataset.load_bow_feature(example->id);
+
+	// every shard returns its own top matches, the shards run on the OpenMP thread pool
+	std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > shard_results(shards.size());
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int64_t i=0; i<(int64_t)shards.size(); i++) {
+		if(shards[i]) shard_results[i] = shards[i]->search(dataset, ii_params, example_bow_descriptors);
+	}
+
+	PTR_LIB::shared_ptr<InvertedIndex::MatchResults> match_result = PTR_LIB::make_shared<InvertedIndex::MatchResults>();
+	std::vector< std::pair<float, uint64_t> > scores;
+	for(size_t i=0; i<shard_results.size(); i++) {
+		if(!shard_results[i]) continue;
+		const PTR_LIB::shared_ptr<InvertedIndex::MatchResults> &shard_result =
+			std::static_pointer_cast<InvertedIndex::MatchResults>(shard_results[i]);
+		for(size_t j=0; j<shard_result->matches.size(); j++) {
+			scores.push_back(std::pair<float, uint64_t>(shard_result->tfidf_scores[j], shard_result->matches[j]));
+		}
+		match_result->num_postings += shard_result->num_postings;
+		match_result->num_postings_skipped += shard_result->num_postings_skipped;
+	}
+
+	const uint64_t k = ii_params->max_matches > 0 ? ii_params->max_matches : ii_params->cutoff_idx;
+	if(k < scores.size()) {
+		std::partial_sort(scores.begin(), scores.begin() + k, scores.end(), match_greater<float>);
+		scores.resize(k);
+	} else {
+		std::sort(scores.begin(), scores.end(), match_greater<float>);
+	}
+
+	match_result->tfidf_scores.resize(scores.size());
+	match_result->matches.resize(scores.size());
+	for(size_t i=0; i<scores.size(); i++) {
+		match_result->tfidf_scores[i] = scores[i].first;
+		match_result->matches[i] = scores[i].second;
+	}
+
+	return std::static_pointer_cast<MatchResultsBase>(match_result);
+}
+
+std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > ShardedInvertedIndex::search(Dataset &dataset, const PTR_LIB::shared_ptr<SearchParamsBase> &params,
+															 const std::vector< PTR_LIB::shared_ptr<const Image > > &examples) {
+	std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > match_results(examples.size());
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int64_t i=0; i<(int64_t)examples.size(); i++) {
+		match_results[i] = this->search(dataset, params, examples[i]);
+	}
+	return match_results;
+}
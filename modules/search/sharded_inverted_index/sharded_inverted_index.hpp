@@ -0,0 +1,91 @@
+#pragma once
+
+#include <search/search_base/search_base.hpp>
+#include <search/inverted_index/inverted_index.hpp>
+
+/// Implements a Bag of Words based image search over several inverted indexes (shards).  Images
+/// are partitioned between the shards by id range or by a hash of the id, and every shard holds
+/// the postings of its images only.  The idf weights are computed over the whole database so the
+/// scores of different shards are comparable.  A query is searched on all shards concurrently
+/// and the per-shard matches are merged by score.  Every shard is a regular InvertedIndex which
+/// can be trained, saved and loaded on its own.
+class ShardedInvertedIndex : public SearchBase {
+public:
+
+	/// How images are assigned to shards.
+	enum Partition {
+		PARTITION_RANGE = 0, /// contiguous ranges of ids
+		PARTITION_HASH = 1 /// hash of the id, spreads consecutive ids over all shards
+	};
+
+	/// Subclass of train params base which specifies sharded inverted index training parameters.
+	struct TrainParams : public TrainParamsBase {
+		TrainParams(uint32_t num_shards = 4, Partition partition = PARTITION_RANGE) :
+			num_shards(num_shards), partition(partition), index_params(PTR_LIB::make_shared<InvertedIndex::TrainParams>()) { }
+
+		uint32_t num_shards; /// number of shards to split the images into
+		Partition partition; /// how images are assigned to shards
+
+		/// Parameters used to train each shard.  The stop words given by max_document_frequency are
+		/// chosen from the document frequencies over all shards.
+		PTR_LIB::shared_ptr<InvertedIndex::TrainParams> index_params;
+	};
+
+	ShardedInvertedIndex();
+	ShardedInvertedIndex(const std::string &file_name);
+
+	/// Partitions the examples, trains every shard and computes the global weights.  Returns true
+	/// if successful, false if not successful.
+	bool train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params,
+		 		const ImageRange &examples);
+
+	/// Trains a single shard on its part of the examples (the same examples must be passed for
+	/// every shard).  The shard uses local weights until update_global_weights is called once all
+	/// shards are trained or loaded.
+	bool train_shard(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParams> &params,
+		 		const ImageRange &examples, uint32_t shard);
+
+	/// Recomputes the idf weights from the document frequencies of all shards and applies them
+	/// to every shard.
+	void update_global_weights();
+
+	/// Loads the shard list and every shard from the input filepath
+	bool load (const std::string &file_path);
+
+	/// Saves the shard list to the input filepath and every shard next to it (see shard_path)
+	bool save (const std::string &file_path) const;
+
+	/// Loads or saves a single shard.
+	bool load_shard (uint32_t shard, const std::string &file_path);
+	bool save_shard (uint32_t shard, const std::string &file_path) const;
+
+	/// Returns the file path a shard is saved to when the sharded index is saved to file_path.
+	static std::string shard_path(const std::string &file_path, uint32_t shard);
+
+	/// Returns the shard an image id belongs to.
+	uint32_t shard_of(uint64_t id) const;
+
+	/// Returns the number of shards.
+	uint32_t num_shards() const;
+
+	/// Returns a shard.
+	const PTR_LIB::shared_ptr<InvertedIndex> &shard(uint32_t shard) const;
+
+	/// Given a set of search parameters (InvertedIndex::SearchParams), a query image, searches all shards and returns the
+	/// merged InvertedIndex::MatchResults.  If the match is 0, then the search failed.
+	PTR_LIB::shared_ptr<MatchResultsBase> search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params, const PTR_LIB::shared_ptr<const Image > &example);
+
+	/// Given a set of search parameters, query images, searches for matching images and returns the matches.
+	std::vector< PTR_LIB::shared_ptr<MatchResultsBase> > search(Dataset &dataset, const PTR_LIB::shared_ptr<SearchParamsBase> &params,
+															 const std::vector< PTR_LIB::shared_ptr<const Image > > &examples);
+
+protected:
+
+	Partition partition;
+	uint64_t min_id, max_id; /// id range used by PARTITION_RANGE
+	float max_document_frequency; /// stop word threshold over all shards
+
+	std::vector< PTR_LIB::shared_ptr<InvertedIndex> > shards;
+	std::vector<uint64_t> shard_num_examples; /// number of training examples of each shard, used for the idf weights
+
+};
@@ -18,7 +18,7 @@ enum { index_tag, levelIndex_tag, meanHeader_tag, mean_tag, indicesCount_tag, in
 
 
 
-VocabTree::VocabTree() : SearchBase() {
+VocabTree::VocabTree() : SearchBase(), numIndexedImages(0) {
 
 
 }
@@ -30,6 +30,10 @@ struct cvmat_header {
   uint32_t rows, cols;
 };
 
+/// "HESG", starts the optional section after the tree holding the Hamming embedding and the
+/// signatures of every leaf.  Files written before the section existed end after the tree.
+static const uint32_t s_hamming_signatures_tag = 0x47534548;
+
 bool VocabTree::load (const std::string &file_path) {
   std::cout << "Reading vocab tree from " << file_path << "..." << std::endl;
 
@@ -68,6 +72,12 @@ bool VocabTree::load (const std::string &file_path) {
       invertedFiles[i][imageId] = imageCount;
     }
   }
+  std::unordered_set<uint64_t> indexedImages;
+  for (uint32_t i = 0; i < invertedFileCount; i++) {
+    for (std::unordered_map<uint64_t, uint32_t>::const_iterator it = invertedFiles[i].begin(); it != invertedFiles[i].end(); it++)
+      indexedImages.insert(it->first);
+  }
+  numIndexedImages = indexedImages.size();
 
   // read in tree
   tree.resize(numberOfNodes);
@@ -86,9 +96,35 @@ bool VocabTree::load (const std::string &file_path) {
     ifs.read((char *)tree[i].mean.ptr(), h.rows * h.cols * h.elem_size);
   }
 
+  bool success = (ifs.rdstate() & std::ifstream::failbit) == 0;
+
+  // optional signatures
+  embedding = HammingEmbedding();
+  leafSignatures.clear();
+  uint32_t tag;
+  if (success && ifs.read((char *)&tag, sizeof(uint32_t)) && tag == s_hamming_signatures_tag) {
+    success = embedding.read(ifs);
+    leafSignatures.resize(invertedFileCount);
+    for (uint32_t i = 0; success && i < invertedFileCount; i++) {
+      uint32_t size;
+      ifs.read((char *)&size, sizeof(uint32_t));
+      for (uint32_t j = 0; j < size; j++) {
+        uint64_t imageId;
+        uint32_t signatureCount;
+        ifs.read((char *)&imageId, sizeof(uint64_t));
+        ifs.read((char *)&signatureCount, sizeof(uint32_t));
+        std::vector<uint64_t> &signatures = leafSignatures[i][imageId];
+        signatures.resize(signatureCount);
+        if (signatureCount > 0)
+          ifs.read((char *)&signatures[0], sizeof(uint64_t)*signatureCount);
+      }
+      success = (ifs.rdstate() & std::ifstream::failbit) == 0;
+    }
+  }
+
   std::cout << "Done reading vocab tree." << std::endl;
   
-  return (ifs.rdstate() & std::ifstream::failbit) == 0;
+  return success;
 }
 
 bool VocabTree::save (const std::string &file_path) const {
@@ -145,13 +181,31 @@ bool VocabTree::save (const std::string &file_path) const {
     ofs.write((char *)t.mean.ptr(), h.rows * h.cols * h.elem_size);
   }
 
+  // write out signatures
+  if (!embedding.empty()) {
+    ofs.write((const char *)&s_hamming_signatures_tag, sizeof(uint32_t));
+    embedding.write(ofs);
+    for (size_t i = 0; i < invertedFiles.size(); i++) {
+      uint32_t size = i < leafSignatures.size() ? leafSignatures[i].size() : 0;
+      ofs.write((const char *)&size, sizeof(uint32_t));
+      if (size == 0) continue;
+      for (std::unordered_map<uint64_t, std::vector<uint64_t>>::const_iterator it = leafSignatures[i].begin(); it != leafSignatures[i].end(); it++) {
+        uint32_t signatureCount = it->second.size();
+        ofs.write((const char *)&it->first, sizeof(uint64_t));
+        ofs.write((const char *)&signatureCount, sizeof(uint32_t));
+        if (signatureCount > 0)
+          ofs.write((const char *)&it->second[0], sizeof(uint64_t)*signatureCount);
+      }
+    }
+  }
+
   std::cout << "Done writing vocab tree." << std::endl;
 
   return (ofs.rdstate() & std::ofstream::failbit) == 0;
 }
 
 bool VocabTree::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params,
-  const std::vector< PTR_LIB::shared_ptr<const Image > > &examples) {
+  const ImageRange &examples) {
   
   SCOPED_TIMER
 
@@ -186,11 +240,13 @@ bool VocabTree::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainPar
   weights.resize(numberOfNodes);
   tree.resize(numberOfNodes);
   invertedFiles.resize((uint32_t)pow(split, maxLevel - 1));
+  embedding = HammingEmbedding();
+  leafSignatures.clear();
 
   // took the following from bag_of_words
   std::vector<uint64_t> all_ids(examples.size());
   for (uint32_t i = 0; i < examples.size(); i++) {
-    all_ids[i] = examples[i]->id;
+    all_ids[i] = examples.id(i);
   }
 
   // don't shuffle if using mpi because need to pass along image id's in the same order on all nodes
@@ -202,14 +258,8 @@ bool VocabTree::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainPar
   std::vector<uint64_t> new_ids;
 
   for (size_t i = 0; i < all_ids.size(); i++) {
-    PTR_LIB::shared_ptr<Image> image = std::static_pointer_cast<Image>(dataset.image(all_ids[i]));
-    if (image == PTR_LIB::shared_ptr<Image>()) continue;
-
-    const std::string &descriptors_location = dataset.location(image->feature_path("descriptors"));
-    if (!filesystem::file_exists(descriptors_location)) continue;
-
     cv::Mat descriptors, descriptorsf;
-    if (filesystem::load_cvmat(descriptors_location, descriptors)) {
+    if (dataset.load_mat_feature(all_ids[i], "descriptors", descriptors)) {
       descriptors.convertTo(descriptorsf, CV_32FC1);
       num_features += descriptors.rows;
       
@@ -437,6 +487,7 @@ bool VocabTree::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainPar
       weights[i] = log(((float)all_ids.size()) / ((float)counts[i]));
     // printf("Node %d, count %d, total %d, size %d, weight %f \n", i, counts[i], all_ids.size(), tree[i].invertedFileLength, weights[i]);
   }
+  numIndexedImages = all_ids.size();
 
   // generate datavectors, normalize, then write to disk
   for (int i = 0; i < all_ids.size(); i++) {
@@ -499,6 +550,9 @@ bool VocabTree::train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainPar
     }
   }*/
 
+  if (vt_params->hamming_signatures)
+    trainHammingEmbedding(all_ids, all_descriptors, merged_descriptor);
+
   // synchronize leaf and vector information, everything send to node 0
   
 #if ENABLE_MULTITHREADING && ENABLE_MPI && ENABLE_MULTINODE_TRAIN
@@ -853,6 +907,86 @@ void VocabTree::generateVectorHelper(uint32_t nodeIndex, const cv::Mat &descript
   }
 }
 
+uint32_t VocabTree::leafIndex(const cv::Mat &descriptor) const {
+  uint32_t nodeIndex = 0;
+  while (tree[nodeIndex].firstChildIndex > 0) {
+    uint32_t maxChild = tree[nodeIndex].firstChildIndex;
+    double max = (tree[maxChild].mean.dims == 0 || descriptor.dims == 0 ||
+     tree[maxChild].mean.type() != descriptor.type() || tree[maxChild].mean.size() !=
+     descriptor.size() ) ? 0 : descriptor.dot(tree[maxChild].mean);
+
+    for (uint32_t i = 1; i < split; i++) {
+      if (tree[nodeIndex].invertedFileLength == 0)
+        continue;
+      uint32_t childIndex = tree[nodeIndex].firstChildIndex + i;
+      if (tree[childIndex].mean.dims == 0 || descriptor.dims == 0 ||
+     tree[childIndex].mean.type() != descriptor.type() || tree[childIndex].mean.size() !=
+     descriptor.size())
+        continue;
+      double dot = descriptor.dot(tree[childIndex].mean);
+
+      if (dot>max) {
+        max = dot;
+        maxChild = childIndex;
+      }
+    }
+    nodeIndex = maxChild;
+  }
+  return tree[nodeIndex].levelIndex;
+}
+
+void VocabTree::trainHammingEmbedding(const std::vector<uint64_t> &ids, const std::vector<cv::Mat> &descriptors,
+  const cv::Mat &mergedDescriptors) {
+
+  std::vector<uint32_t> leaves(mergedDescriptors.rows);
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+  for (int r = 0; r < mergedDescriptors.rows; r++)
+    leaves[r] = leafIndex(mergedDescriptors.row(r));
+
+  if (!embedding.train(mergedDescriptors, leaves, invertedFiles.size()))
+    return;
+
+  leafSignatures.assign(invertedFiles.size(), std::unordered_map<uint64_t, std::vector<uint64_t>>());
+  std::vector<uint64_t> signatures;
+  for (size_t i = 0, start = 0; i < ids.size(); i++) {
+    const std::vector<uint32_t> imageLeaves(leaves.begin() + start, leaves.begin() + start + descriptors[i].rows);
+    embedding.compute_signatures(descriptors[i], imageLeaves, signatures);
+    for (size_t j = 0; j < signatures.size(); j++)
+      leafSignatures[imageLeaves[j]][ids[i]].push_back(signatures[j]);
+    start += descriptors[i].rows;
+  }
+}
+
+void VocabTree::computeSignatures(const cv::Mat &descriptors, std::unordered_map<uint32_t, std::vector<uint64_t>> &signatures) const {
+  signatures.clear();
+  std::vector<uint32_t> leaves(descriptors.rows);
+  for (int r = 0; r < descriptors.rows; r++)
+    leaves[r] = leafIndex(descriptors.row(r));
+
+  std::vector<uint64_t> codes;
+  embedding.compute_signatures(descriptors, leaves, codes);
+  for (size_t i = 0; i < codes.size(); i++)
+    signatures[leaves[i]].push_back(codes[i]);
+}
+
+/// Returns the query signatures in a leaf, without inserting an empty list for the leaves which
+/// have none.
+static const std::vector<uint64_t> &leafQuerySignatures(const std::unordered_map<uint32_t, std::vector<uint64_t>> &signatures, uint32_t leaf) {
+  static const std::vector<uint64_t> noSignatures;
+  std::unordered_map<uint32_t, std::vector<uint64_t>>::const_iterator it = signatures.find(leaf);
+  return it == signatures.end() ? noSignatures : it->second;
+}
+
+bool VocabTree::passesHammingGate(uint32_t leaf, uint64_t id, const std::vector<uint64_t> &querySignatures, uint32_t maxDistance) const {
+  if (querySignatures.empty() || leaf >= leafSignatures.size())
+    return true;
+  std::unordered_map<uint64_t, std::vector<uint64_t>>::const_iterator it = leafSignatures[leaf].find(id);
+  if (it == leafSignatures[leaf].end() || it->second.empty())
+    return true;
+  return HammingEmbedding::any_within(&querySignatures[0], querySignatures.size(), &it->second[0], it->second.size(), maxDistance);
+}
 
 PTR_LIB::shared_ptr<MatchResultsBase> VocabTree::search(Dataset &dataset, const PTR_LIB::shared_ptr<const SearchParamsBase> &params,
   const PTR_LIB::shared_ptr<const Image > &example) {
@@ -865,11 +999,8 @@ PTR_LIB::shared_ptr<MatchResultsBase> VocabTree::search(Dataset &dataset, const
 
   // get descriptors for example
   if (!example) return PTR_LIB::shared_ptr<MatchResultsBase>();
-  const std::string &descriptors_location = dataset.location(example->feature_path("descriptors"));
-  if (!filesystem::file_exists(descriptors_location)) return PTR_LIB::shared_ptr<MatchResultsBase>();
-
   cv::Mat descriptors, descriptorsf;
-  if (!filesystem::load_cvmat(descriptors_location, descriptors)) return PTR_LIB::shared_ptr<MatchResultsBase>();
+  if (!dataset.load_mat_feature(example->id, "descriptors", descriptors)) return PTR_LIB::shared_ptr<MatchResultsBase>();
 
   std::unordered_set<uint32_t> possibleMatches;
   descriptors.convertTo(descriptorsf, CV_32FC1);
@@ -898,16 +1029,45 @@ PTR_LIB::shared_ptr<MatchResultsBase> VocabTree::search(Dataset &dataset, const
     scored_leaves[value] = index;
   }
 
-  int imAdded = 0;
-  for (std::map<float, uint32_t>::reverse_iterator it = scored_leaves.rbegin(); 
-    it != scored_leaves.rend() && imAdded < ii_params->cutoff; it++) {
-    
-    std::unordered_map<uint64_t, uint32_t> & invFile = invertedFiles[it->second];
-
-    typedef std::unordered_map<uint64_t, uint32_t>::iterator it_type;
-    for (it_type iterator = invFile.begin(); iterator != invFile.end() && (imAdded++) < ii_params->cutoff; iterator++)
-    if (possibleImages.count(iterator->first) == 0)
-      possibleImages.insert(iterator->first);
+  // signatures of the query descriptors in each leaf, used to reject the images whose descriptors
+  // in a leaf are all far from the query descriptors
+  const bool gated = !embedding.empty() && ii_params->max_hamming_distance < HammingEmbedding::num_bits;
+  std::unordered_map<uint32_t, std::vector<uint64_t>> querySignatures;
+  if (gated)
+    computeSignatures(descriptorsf, querySignatures);
+
+  const IdBitmap *filter = ii_params->filter.get();
+  if (filter && filter->cardinality() <= ii_params->direct_scoring_selectivity * numIndexedImages) {
+    // very selective filter, look the allowed images up in the inverted files of the query leaves
+    const std::vector<uint64_t> &allowed = filter->ids();
+    for (size_t i = 0; i < allowed.size(); i++) {
+      for (std::unordered_set<uint32_t>::iterator it = possibleMatches.begin(); it != possibleMatches.end(); it++) {
+        if (invertedFiles[*it].count(allowed[i]) > 0 &&
+          (!gated || passesHammingGate(*it, allowed[i], leafQuerySignatures(querySignatures, *it), ii_params->max_hamming_distance))) {
+          possibleImages.insert(allowed[i]);
+          break;
+        }
+      }
+    }
+  }
+  else {
+    int imAdded = 0;
+    for (std::map<float, uint32_t>::reverse_iterator it = scored_leaves.rbegin(); 
+      it != scored_leaves.rend() && imAdded < ii_params->cutoff; it++) {
+      
+      std::unordered_map<uint64_t, uint32_t> & invFile = invertedFiles[it->second];
+
+      typedef std::unordered_map<uint64_t, uint32_t>::iterator it_type;
+      for (it_type iterator = invFile.begin(); iterator != invFile.end() && imAdded < ii_params->cutoff; iterator++) {
+        if (filter && !filter->contains(iterator->first))
+          continue;
+        if (gated && !passesHammingGate(it->second, iterator->first, leafQuerySignatures(querySignatures, it->second), ii_params->max_hamming_distance))
+          continue;
+        imAdded++;
+        if (possibleImages.count(iterator->first) == 0)
+          possibleImages.insert(iterator->first);
+      }
+    }
   }
 
 
@@ -921,6 +1081,13 @@ PTR_LIB::shared_ptr<MatchResultsBase> VocabTree::search(Dataset &dataset, const
     possImagesVec[asdf++] = *it;
   }
 
+  Prefetcher::Ticket prefetch_ticket;
+  if (ii_params->prefetch_candidates) {
+    // score in id order, which is the order of the vectors on disk, behind the prefetched reads
+    std::sort(possImagesVec.begin(), possImagesVec.end());
+    prefetch_ticket = dataset.prefetch_vec_features(possImagesVec);
+  }
+
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
 #pragma omp parallel for schedule(dynamic)
 #endif
@@ -929,9 +1096,7 @@ PTR_LIB::shared_ptr<MatchResultsBase> VocabTree::search(Dataset &dataset, const
     float score = 0;
 
     // load datavec from disk
-    PTR_LIB::shared_ptr<Image> image = std::static_pointer_cast<Image>(dataset.image(imID));
-
-    const std::vector<float> &dbVec = dataset.load_vec_feature(imID);
+    const SharedArrayView<float> &dbVec = dataset.load_vec_feature(imID);
 
     for (uint32_t i = 0; i < numberOfNodes; i++) {
       float t = vec[i] - dbVec[i];
@@ -940,6 +1105,8 @@ PTR_LIB::shared_ptr<MatchResultsBase> VocabTree::search(Dataset &dataset, const
 
     values[i] = matchPair(imID, sqrt(score));
   }
+  // every candidate is scored, the prefetches still queued would only be reloads
+  prefetch_ticket.cancel();
 
   std::sort(values.begin(), values.end(), 
           boost::bind(&std::pair<uint64_t, float>::second, _1) <
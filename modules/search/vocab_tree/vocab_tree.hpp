@@ -1,6 +1,8 @@
 #pragma once
 
 #include <search/search_base/search_base.hpp>
+#include <search/hamming_embedding/hamming_embedding.hpp>
+#include <utils/id_bitmap.hpp>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -9,16 +11,40 @@ public:
 
 	/// Subclass of train params base which specifies vocab tree training parameters.
 	struct TrainParams : public TrainParamsBase {
+		TrainParams() : hamming_signatures(false) { }
+
 		uint32_t depth; // tree depth
 		uint32_t split; // number of children per node
+
+		/// If true, a Hamming embedding is learned on the leaves and the signatures of the
+		/// descriptors of every image are stored with its entries in the inverted files.
+		bool hamming_signatures;
 	};
 
 	/// Subclass of train params base which specifies Vocab Tree training parameters.
 	struct SearchParams : public SearchParamsBase {
-    SearchParams(uint64_t cutoff = 4096) : cutoff(cutoff) { }
+    SearchParams(uint64_t cutoff = 4096) : cutoff(cutoff), direct_scoring_selectivity(0.01f),
+      max_hamming_distance(HammingEmbedding::num_bits), prefetch_candidates(false) { }
     
     uint32_t amountToReturn;
     uint32_t cutoff;
+
+    /// If set, only images in the filter are matched.  Excluded images are skipped while the
+    /// inverted files are scanned and do not count towards cutoff.
+    PTR_LIB::shared_ptr<const IdBitmap> filter;
+    /// If the filter allows at most this fraction of the indexed images, the allowed images found in
+    /// the inverted files of the query leaves are all scored instead of scanning the files.
+    float direct_scoring_selectivity;
+
+    /// If less than HammingEmbedding::num_bits and the tree stores signatures, an image in the
+    /// inverted file of a query leaf is only a candidate if one of its signatures in that leaf is
+    /// within this many bits of a query signature of the leaf.  Rejected images do not count
+    /// towards cutoff.
+    uint32_t max_hamming_distance;
+
+    /// If true, the candidates are scored in id order and their vectors are prefetched
+    /// (Dataset::prefetch_vec_features) before scoring starts.  Off by default.
+    bool prefetch_candidates;
 	};
 
 	/// Subclass of match results base which also returns scores
@@ -31,7 +57,7 @@ public:
 	/// Given a set of training parameters, list of images, trains.  Returns true if successful, false
 	/// if not successful.
 	bool train(Dataset &dataset, const PTR_LIB::shared_ptr<const TrainParamsBase> &params,
-		 		const std::vector< PTR_LIB::shared_ptr<const Image > > &examples);
+		 		const ImageRange &examples);
 
 	/// Loads a trained search structure from the input filepath
 	bool load (const std::string &file_path);
@@ -83,10 +109,17 @@ protected:
   uint32_t numberOfNodes;
 
   std::vector<float> weights;
+  /// number of images in the inverted files, the N of the weights
+  uint64_t numIndexedImages;
 
   std::vector<TreeNode> tree;
   std::vector<std::unordered_map<uint64_t, uint32_t>> invertedFiles;
 
+  /// Hamming embedding learned on the leaves, empty if the tree was trained without signatures
+  HammingEmbedding embedding;
+  /// Signatures of the descriptors of each image in each leaf, same layout as invertedFiles
+  std::vector<std::unordered_map<uint64_t, std::vector<uint64_t>>> leafSignatures;
+
   /// Stores the database vectors for all images in the database - d_i in the paper
   /// Indexes by the image id
   //std::unordered_map<uint64_t, std::vector<float>> databaseVectors;
@@ -116,5 +149,21 @@ protected:
   /// Picks the child to traverse down based on the max dot product
   void generateVectorHelper(uint32_t nodeIndex, const cv::Mat &descriptor, std::vector<float> & counts,
     std::unordered_set<uint32_t> & possibleMatches, bool building, int64_t id = -1);
+
+  /// Returns the index of the leaf (its levelIndex) a single descriptor ends up in, following the
+  /// same path as generateVectorHelper
+  uint32_t leafIndex(const cv::Mat &descriptor) const;
+
+  /// Learns the Hamming embedding on the leaves from the descriptors of the database images and
+  /// stores the signatures of every image in leafSignatures.  mergedDescriptors holds the descriptors of
+  /// all images in order
+  void trainHammingEmbedding(const std::vector<uint64_t> &ids, const std::vector<cv::Mat> &descriptors,
+    const cv::Mat &mergedDescriptors);
+
+  /// Computes the leaf and signature of every descriptor and groups the signatures by leaf
+  void computeSignatures(const cv::Mat &descriptors, std::unordered_map<uint32_t, std::vector<uint64_t>> &signatures) const;
+
+  /// Returns true if the image passes the Hamming gate of a leaf given the query signatures of the leaf
+  bool passesHammingGate(uint32_t leaf, uint64_t id, const std::vector<uint64_t> &querySignatures, uint32_t maxDistance) const;
 	
 };
@@ -0,0 +1,89 @@
+#include <config.hpp>
+
+#include <utils/accumulator.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <random>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Compares an accumulator with the expected scores.  Returns the number of failed checks.
+static uint32_t check_scores(const ScoreAccumulator &accumulator, const std::map<uint64_t, uint32_t> &expected,
+	uint64_t num_ids, const char *mode) {
+
+	uint32_t num_failed = 0;
+	if(accumulator.num_touched() != expected.size()) {
+		LERROR << mode << ": " << accumulator.num_touched() << " ids touched instead of " << expected.size();
+		num_failed++;
+	}
+	for(uint64_t id=0; id<num_ids; id++) {
+		std::map<uint64_t, uint32_t>::const_iterator it = expected.find(id);
+		const uint32_t score = it != expected.end() ? it->second : 0;
+		if(accumulator.score(id) != score) {
+			LERROR << mode << ": score of " << id << " is " << accumulator.score(id) << " instead of " << score;
+			num_failed++;
+			break;
+		}
+	}
+	return num_failed;
+}
+
+/// Checks that the hashed and the dense storage of ScoreAccumulator hold the same scores and
+/// return the same top entries, including ties, across queries reusing the accumulators.
+int main(int argc, char *argv[]) {
+	std::mt19937 rng(7);
+
+	// (number of ids, number of adds): tiny queries, queries growing the hash table past its
+	// initial capacity, and queries touching most ids
+	const uint64_t configurations[][2] = {
+		{ 100, 0 }, { 100, 1 }, { 1000, 37 }, { 100000, 300 }, { 100000, 5000 }, { 1 << 20, 20000 }, { 4096, 50000 }
+	};
+	const size_t num_configurations = sizeof(configurations) / sizeof(configurations[0]);
+	const size_t ks[] = { 0, 1, 3, 10, 100, 1000000 };
+	const size_t num_ks = sizeof(ks) / sizeof(ks[0]);
+
+	ScoreAccumulator dense, hashed;
+	uint32_t num_checks = 0, num_failed = 0;
+	for(uint32_t round=0; round<3; round++) {
+		for(size_t c=0; c<num_configurations; c++) {
+			const uint64_t num_ids = configurations[c][0], num_adds = configurations[c][1];
+
+			// the dense counters are used when the expected touched count is a large part of the
+			// ids, the hash table when it is a tiny part, and the hash table grows past it
+			dense.reset(num_ids, num_ids);
+			hashed.reset(num_ids, 1);
+
+			// a few ids get most of the adds, so scores tie and repeat
+			std::uniform_int_distribution<uint64_t> any_id(0, num_ids - 1), hot_id(0, std::min<uint64_t>(num_ids, 64) - 1);
+			std::uniform_int_distribution<uint32_t> value(1, 3);
+			std::map<uint64_t, uint32_t> expected;
+			for(uint64_t i=0; i<num_adds; i++) {
+				const uint64_t id = (i % 4 == 0) ? hot_id(rng) : any_id(rng);
+				const uint32_t v = value(rng);
+				dense.add(id, v);
+				hashed.add(id, v);
+				expected[id] += v;
+			}
+
+			num_failed += check_scores(dense, expected, num_ids, "dense");
+			num_failed += check_scores(hashed, expected, num_ids, "hashed");
+			for(size_t k=0; k<num_ks; k++) {
+				std::vector<ScoreAccumulator::entry_t> dense_top, hashed_top;
+				dense.top(ks[k], dense_top);
+				hashed.top(ks[k], hashed_top);
+				if(dense_top != hashed_top || dense_top.size() != std::min(ks[k], expected.size())) {
+					LERROR << "top " << ks[k] << " differs for " << num_ids << " ids and " << num_adds << " adds";
+					num_failed++;
+				}
+			}
+			num_checks++;
+		}
+	}
+
+	LINFO << num_checks << " queries checked, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
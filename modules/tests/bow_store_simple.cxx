@@ -0,0 +1,173 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/bow_store.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <set>
+#include <random>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Number of visual words of the generated vectors.
+static const uint32_t s_num_words = 5000;
+/// Size of the header of the version 1 stores, which have no stamp, and of the current ones.
+static const size_t s_v1_header_size = 32;
+static const size_t s_header_size = 40;
+
+/// Returns BoW vectors for ids up to num_ids, some of which have none.  The frequencies are
+/// integers up to max_frequency, or fractions if max_frequency is 0.
+static std::vector<numerics::SparseVector> random_vectors(std::mt19937 &rng, uint64_t num_ids, uint32_t max_frequency) {
+	std::uniform_int_distribution<uint32_t> word(0, s_num_words - 1), size(1, 60), frequency(1, MAX(max_frequency, 1));
+	std::uniform_real_distribution<float> fraction(0.f, 1.f);
+	std::vector<numerics::SparseVector> vectors(num_ids);
+	for(uint64_t id=0; id<num_ids; id++) {
+		if(id % 7 == 3) continue;
+		std::set<uint32_t> words;
+		for(uint32_t n = size(rng); words.size() < n; ) words.insert(word(rng));
+		for(std::set<uint32_t>::const_iterator it = words.begin(); it != words.end(); it++) {
+			vectors[id].push_back(*it, max_frequency > 0 ? (float)frequency(rng) : fraction(rng));
+		}
+	}
+	// the largest frequency decides the encoding
+	if(max_frequency > 0) vectors[0].values()[0] = (float)max_frequency;
+	return vectors;
+}
+
+static bool same_vector(const numerics::SparseVectorView &a, const numerics::SparseVector &b) {
+	if(a.size() != b.size()) return false;
+	for(size_t i=0; i<a.size(); i++) {
+		if(a.index(i) != b.index(i) || a.value(i) != b.value(i)) return false;
+	}
+	return true;
+}
+
+/// Checks every vector of an opened store, and that ids past the store are empty.  Returns the
+/// number of failed checks.
+static uint32_t check_store(const BowStore &store, const std::vector<numerics::SparseVector> &vectors, const char *step) {
+	uint64_t num_entries = 0;
+	for(size_t id=0; id<vectors.size(); id++) num_entries += vectors[id].size();
+	if(store.num_images() != vectors.size() || store.num_entries() != num_entries) {
+		LERROR << step << ": the store has " << store.num_images() << " images and " << store.num_entries() << " entries";
+		return 1;
+	}
+
+	for(uint64_t id=0; id<vectors.size() + 10; id++) {
+		const numerics::SparseVector &expected = id < vectors.size() ? vectors[id] : numerics::SparseVector();
+		if(!(store.load(id) == expected) || !same_vector(store.view(id), expected)) {
+			LERROR << step << ": the vector of image " << id << " differs";
+			return 1;
+		}
+	}
+
+	std::vector<uint64_t> ids;
+	for(uint64_t id=0; id<vectors.size() + 10; id+=3) ids.push_back(id);
+	store.prefetch(ids);
+	return 0;
+}
+
+/// Writes a store of the vectors and checks it.  Returns the number of failed checks.
+static uint32_t check_encoding(const std::vector<numerics::SparseVector> &vectors, BowStore::Encoding encoding, const char *step) {
+	const std::string path = filesystem::temp_file_path();
+	const uint64_t stamp = 0x123456789abcdefull;
+	{
+		BowStoreWriter writer(path, stamp);
+		for(uint64_t id=0; id<vectors.size(); id++) {
+			// skipped ids have empty vectors
+			if(!vectors[id].empty() && !writer.add(id, vectors[id])) {
+				LERROR << step << ": error adding image " << id;
+				return 1;
+			}
+		}
+		if(writer.add(vectors.size() - 2, vectors[1])) {
+			LERROR << step << ": the writer accepted a decreasing id";
+			return 1;
+		}
+		if(!writer.close()) {
+			LERROR << step << ": error writing the store";
+			return 1;
+		}
+	}
+	if(filesystem::file_exists(path + ".words") || filesystem::file_exists(path + ".frequencies")) {
+		LERROR << step << ": the temporary files were not removed";
+		return 1;
+	}
+
+	uint32_t num_failed = 0;
+	numerics::SparseVectorView kept;
+	{
+		BowStore store;
+		if(!store.open(path)) {
+			LERROR << step << ": error opening the store";
+			filesystem::remove_file(path);
+			return 1;
+		}
+		if(store.encoding() != encoding || store.stamp() != stamp) {
+			LERROR << step << ": the store has encoding " << store.encoding() << " and stamp " << store.stamp();
+			num_failed++;
+		}
+		num_failed += check_store(store, vectors, step);
+		kept = store.view(1);
+	}
+	// views keep the mapped file or their decoded copy alive
+	if(!same_vector(kept, vectors[1])) {
+		LERROR << step << ": a view did not outlive its store";
+		num_failed++;
+	}
+
+	// a version 1 store is the same file with a shorter header and no stamp
+	std::ifstream ifs(path, std::ios::binary);
+	std::stringstream contents;
+	contents << ifs.rdbuf();
+	ifs.close();
+	std::string v1 = contents.str().substr(0, s_v1_header_size) + contents.str().substr(s_header_size);
+	v1[4] = 1;
+	std::ofstream(path, std::ios::binary | std::ios::trunc).write(v1.data(), v1.size());
+	BowStore v1_store;
+	if(!v1_store.open(path) || v1_store.stamp() != 0) {
+		LERROR << step << ": error opening the version 1 store";
+		num_failed++;
+	} else {
+		num_failed += check_store(v1_store, vectors, step);
+	}
+	v1_store.close();
+
+	// a truncated store is rejected
+	std::ofstream(path, std::ios::binary | std::ios::trunc).write(contents.str().data(), contents.str().size() - 1);
+	if(v1_store.open(path)) {
+		LERROR << step << ": a truncated store was opened";
+		num_failed++;
+	}
+
+	filesystem::remove_file(path);
+	return num_failed;
+}
+
+/// Writes and reads back stores whose term frequencies use each of the encodings, with images
+/// without vectors, and checks that version 1 stores still open.  Also checks that a writer which
+/// is not closed leaves no file behind.
+int main(int argc, char *argv[]) {
+	std::mt19937 rng(3);
+	uint32_t num_failed = 0;
+
+	num_failed += check_encoding(random_vectors(rng, 500, 200), BowStore::ENCODING_UINT8, "uint8");
+	num_failed += check_encoding(random_vectors(rng, 500, 60000), BowStore::ENCODING_UINT16, "uint16");
+	num_failed += check_encoding(random_vectors(rng, 2000, 0), BowStore::ENCODING_FLOAT, "float");
+
+	const std::string unclosed_path = filesystem::temp_file_path();
+	{
+		BowStoreWriter writer(unclosed_path);
+		writer.add(0, random_vectors(rng, 1, 10)[0]);
+	}
+	if(filesystem::file_exists(unclosed_path) || filesystem::file_exists(unclosed_path + ".words")) {
+		LERROR << "a writer which was not closed left files behind";
+		num_failed++;
+	}
+
+	LINFO << "3 encodings checked, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
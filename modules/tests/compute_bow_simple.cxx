@@ -27,7 +27,7 @@ int main(int argc, char *argv[]) {
 	BagOfWords bow;
 	
 	PTR_LIB::shared_ptr<BagOfWords::TrainParams> train_params = PTR_LIB::make_shared<BagOfWords::TrainParams>();
-	const std::vector<  PTR_LIB::shared_ptr<const Image> > &all_images = simple_dataset.random_images(128);
+	const ImageRange &all_images = simple_dataset.random_images(128);
 	bow.train(simple_dataset, train_params, all_images);
 	
 #if ENABLE_MULTITHREADING && ENABLE_MPI
@@ -54,12 +54,10 @@ int main(int argc, char *argv[]) {
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
 		const cv::Ptr<cv::DescriptorMatcher> &matcher = matchers[omp_get_thread_num()];
 #endif
-		const std::string &sift_descriptor_location = simple_dataset.location(all_images[i]->feature_path("descriptors"));
 		const std::string &bow_descriptor_location = simple_dataset.location(all_images[i]->feature_path("bow_descriptors"));
 
 		cv::Mat descriptors, bow_descriptors, descriptorsf;
-		if (!filesystem::file_exists(sift_descriptor_location)) continue;
-		if (!filesystem::load_cvmat(sift_descriptor_location, descriptors)) continue;
+		if (!simple_dataset.load_mat_feature(all_images.id(i), "descriptors", descriptors)) continue;
 		descriptors.convertTo(descriptorsf, CV_32FC1);
 		filesystem::create_file_directory(bow_descriptor_location);
 
@@ -69,6 +67,11 @@ int main(int argc, char *argv[]) {
 		
 		LINFO << "Wrote " << bow_descriptor_location;
 	}
+
+	// pack the features into the store which the dataset serves them from
+	if (!simple_dataset.write_bow_store(simple_dataset.bow_store_location())) {
+		LERROR << "Failed to write the BoW store to " << simple_dataset.bow_store_location();
+	}
 #if ENABLE_MULTITHREADING && ENABLE_MPI
 	}
 	MPI::Finalize();
@@ -29,6 +29,7 @@ int main(int argc, char *argv[]) {
 	InvertedIndex ii(index_output_file.str());
 
 	for(uint32_t i=0; i<3; i++) {
+		if(!simple_dataset.has_image(i)) continue;
 		PTR_LIB::shared_ptr<InvertedIndex::MatchResults> matches = 
 		std::static_pointer_cast<InvertedIndex::MatchResults>(ii.search(simple_dataset, PTR_LIB::shared_ptr<SearchParamsBase>(), simple_dataset.image(i) ));	
 		LINFO << "Query " << i << ": " << *matches;
@@ -24,15 +24,12 @@ int main(int argc, char *argv[]) {
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
 #pragma omp parallel for schedule(dynamic)
 #endif
-	for (int64_t i = 0; i < simple_dataset.num_images(); i++) {
+	for (int64_t i = 0; i < simple_dataset.num_ids(); i++) {
+		if (!simple_dataset.has_image(i)) continue;
 
 		PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> image = std::static_pointer_cast<SimpleDataset::SimpleImage>(simple_dataset.image(i));
 		if (image == PTR_LIB::shared_ptr<SimpleDataset::SimpleImage>()) continue;
 
-		const std::string &keypoints_location = simple_dataset.location(image->feature_path("keypoints"));
-		const std::string &descriptors_location = simple_dataset.location(image->feature_path("descriptors"));
-		// if (filesystem::file_exists(keypoints_location) && filesystem::file_exists(descriptors_location)) continue;
-		
 		const std::string &image_location = simple_dataset.location(image->location());
 
 		if (!filesystem::file_exists(image_location)) continue;
@@ -42,12 +39,10 @@ int main(int argc, char *argv[]) {
 		cv::Mat keypoints, descriptors;
 		if (!vision::compute_sparse_sift_feature(im,  std::shared_ptr<const vision::SIFTParams>(), keypoints, descriptors)) continue;
 
-		filesystem::create_file_directory(keypoints_location);
-		filesystem::create_file_directory(descriptors_location);
-
-		filesystem::write_cvmat(keypoints_location, keypoints);
-		filesystem::write_cvmat(descriptors_location, descriptors);
+		simple_dataset.write_mat_feature(image->id, "keypoints", keypoints);
+		simple_dataset.write_mat_feature(image->id, "descriptors", descriptors);
 	}
+	simple_dataset.flush_mat_features();
 #if ENABLE_MULTITHREADING && ENABLE_MPI
 	}
 	MPI::Finalize();
@@ -0,0 +1,151 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/feature_store.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <random>
+#include <cstring>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Size of the header at the start of a feature store file, before the blocks.
+static const size_t s_store_header_size = 16;
+
+typedef std::map<uint64_t, cv::Mat> features_t;
+
+/// Returns a random matrix shaped like the keypoints (floats) or the descriptors (bytes) of an image.
+static cv::Mat random_mat(std::mt19937 &rng, bool keypoints) {
+	const int rows = std::uniform_int_distribution<int>(1, 300)(rng), cols = keypoints ? 4 : 128;
+	cv::Mat data(rows, cols, keypoints ? CV_32FC1 : CV_8UC1);
+	for(int r=0; r<rows; r++) {
+		for(int c=0; c<cols; c++) {
+			if(keypoints) data.at<float>(r, c) = std::uniform_real_distribution<float>(0.f, 1000.f)(rng);
+			else data.at<uint8_t>(r, c) = (uint8_t)std::uniform_int_distribution<int>(0, 255)(rng);
+		}
+	}
+	return data;
+}
+
+static bool same_mat(const cv::Mat &a, const cv::Mat &b) {
+	return a.rows == b.rows && a.cols == b.cols && a.type() == b.type() &&
+		memcmp(a.ptr(), b.ptr(), a.total() * a.elemSize()) == 0;
+}
+
+static uint64_t file_size(const std::string &file_path) {
+	std::ifstream ifs(file_path, std::ios::binary | std::ios::ate);
+	return (uint64_t)ifs.tellg();
+}
+
+/// Opens the store and checks that it holds exactly the expected matrices, and that ids lists
+/// them in storage order.  Returns the number of failed checks.
+static uint32_t check_store(const std::string &path, const features_t &expected, const std::vector<uint64_t> &storage_order,
+	const char *step) {
+
+	FeatureStore store;
+	if(!store.open(path)) {
+		LERROR << step << ": error opening the store";
+		return 1;
+	}
+	if(store.num_blocks() != expected.size() || store.ids() != storage_order) {
+		LERROR << step << ": the store has " << store.num_blocks() << " blocks instead of " << expected.size();
+		return 1;
+	}
+	for(features_t::const_iterator it = expected.begin(); it != expected.end(); it++) {
+		cv::Mat data;
+		const bool loaded = store.load(it->first, data);
+		if(!store.contains(it->first) || loaded != !it->second.empty() || (loaded && !same_mat(data, it->second))) {
+			LERROR << step << ": the matrix of image " << it->first << " differs";
+			return 1;
+		}
+	}
+	cv::Mat data;
+	if(store.contains(1000) || store.load(1000, data)) {
+		LERROR << step << ": an image without a block was loaded";
+		return 1;
+	}
+	return 0;
+}
+
+/// Writes feature stores in several sessions, and checks that the latest block of every image is
+/// loaded, that the index is rebuilt when it is missing or stale, and that a block cut off by an
+/// interrupted writer is dropped.
+int main(int argc, char *argv[]) {
+	std::mt19937 rng(5);
+	uint32_t num_failed = 0;
+
+	const bool keypoints[] = { true, false };
+	for(int k=0; k<2; k++) {
+		const std::string path = filesystem::temp_file_path(), cut_path = filesystem::temp_file_path();
+		features_t expected;
+		std::vector<uint64_t> order;
+
+		// out of order ids, a replaced block and an empty matrix
+		{
+			FeatureStoreWriter writer(path);
+			const uint64_t ids[] = { 5, 2, 9, 12, 2, 7 };
+			for(int i=0; i<6; i++) {
+				expected[ids[i]] = ids[i] == 7 ? cv::Mat() : random_mat(rng, keypoints[k]);
+				if(!writer.add(ids[i], expected[ids[i]])) num_failed++;
+			}
+			if(!writer.close()) num_failed++;
+		}
+		const uint64_t first_order[] = { 5, 9, 12, 2, 7 };
+		order.assign(first_order, first_order + 5);
+		num_failed += check_store(path, expected, order, "written");
+
+		// appended by a second session
+		{
+			FeatureStoreWriter writer(path);
+			expected[3] = random_mat(rng, keypoints[k]);
+			if(!writer.add(3, expected[3]) || !writer.close()) num_failed++;
+			order.push_back(3);
+		}
+		num_failed += check_store(path, expected, order, "appended");
+
+		// without the index the blocks are walked
+		filesystem::remove_file(FeatureStore::index_location(path));
+		num_failed += check_store(path, expected, order, "rebuilt");
+
+		// a block cut off by an interrupted writer, which makes the index stale
+		const uint64_t valid_size = file_size(path);
+		{
+			std::ofstream ofs(path, std::ios::binary | std::ios::app);
+			const cv::Mat &cut = random_mat(rng, keypoints[k]);
+			FeatureStoreWriter(cut_path).add(20, cut);
+			std::ifstream ifs(cut_path, std::ios::binary);
+			std::vector<char> block(file_size(cut_path));
+			ifs.read(&block[0], block.size());
+			ofs.write(&block[s_store_header_size], (block.size() - s_store_header_size) / 2);
+		}
+		filesystem::remove_file(cut_path);
+		filesystem::remove_file(FeatureStore::index_location(cut_path));
+		num_failed += check_store(path, expected, order, "interrupted");
+		{
+			FeatureStore store;
+			if(!store.open(path) || store.valid_size() != valid_size) {
+				LERROR << "the cut off block is counted as valid";
+				num_failed++;
+			}
+		}
+
+		// the next session drops the cut off block before appending
+		{
+			FeatureStoreWriter writer(path);
+			expected[11] = random_mat(rng, keypoints[k]);
+			if(!writer.add(11, expected[11]) || !writer.close()) num_failed++;
+			order.push_back(11);
+		}
+		num_failed += check_store(path, expected, order, "resumed");
+
+		filesystem::remove_file(path);
+		filesystem::remove_file(FeatureStore::index_location(path));
+	}
+
+	LINFO << "2 feature types checked, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
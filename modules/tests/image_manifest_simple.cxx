@@ -0,0 +1,143 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/image_manifest.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <ctime>
+#include <utime.h>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Sets the modification time of a file or directory, so that the scans see directories which
+/// were not modified in the second of their listing.
+static void set_mtime(const std::string &path, time_t mtime) {
+	struct utimbuf times;
+	times.actime = times.modtime = mtime;
+	utime(path.c_str(), &times);
+}
+
+static void write_file(const std::string &path, const std::string &contents) {
+	filesystem::create_file_directory(path);
+	std::ofstream(path.c_str(), std::ios::binary | std::ios::trunc) << contents;
+}
+
+/// Returns the id of the file with the given path, UINT64_MAX if the manifest does not have it.
+static uint64_t file_id(const ImageManifest &manifest, const std::string &path) {
+	for(size_t i=0; i<manifest.files().size(); i++) {
+		if(manifest.files()[i].path == path) return manifest.files()[i].id;
+	}
+	return UINT64_MAX;
+}
+
+/// Scans root and compares the changes with the expected ones.  Returns the number of failed
+/// checks.
+static uint32_t check_scan(ImageManifest &manifest, const std::string &root, bool full, const std::vector<uint64_t> &added,
+	const std::vector<uint64_t> &removed, const std::vector<uint64_t> &modified, uint64_t num_listed, const char *step) {
+
+	ImageManifest::ScanResult result;
+	if(!manifest.scan(root, ".jpg", result, full, 4)) {
+		LERROR << step << ": the scan failed";
+		return 1;
+	}
+	if(result.added != added || result.removed != removed || result.modified != modified || result.num_listed != num_listed) {
+		LERROR << step << ": " << result.added.size() << " added, " << result.removed.size() << " removed, " <<
+			result.modified.size() << " modified and " << result.num_listed << " listed directories";
+		return 1;
+	}
+	return 0;
+}
+
+/// Scans a small tree through a series of changes, and checks the ids assigned to the files, the
+/// reported changes, which directories are listed again, and reading back a written manifest.
+int main(int argc, char *argv[]) {
+	uint32_t num_failed = 0;
+	const std::string root = filesystem::temp_file_path();
+	const std::string files[] = { "0.jpg", "a/1.jpg", "a/2.jpg", "b/c/3.jpg", "b/c/4.jpg", "a/notes.txt" };
+	for(int i=0; i<6; i++) write_file(root + "/" + files[i], files[i]);
+	const std::string directories[] = { "/b/c", "/b", "/a", "" };
+	const time_t past = time(0) - 1000;
+	for(int i=0; i<4; i++) set_mtime(root + directories[i], past);
+
+	// new files are numbered in path order, other extensions are skipped
+	ImageManifest manifest;
+	const std::vector<uint64_t> none;
+	const uint64_t all[] = { 0, 1, 2, 3, 4 };
+	num_failed += check_scan(manifest, root, false, std::vector<uint64_t>(all, all + 5), none, none, 4, "first scan");
+	for(uint64_t id=0; id<5; id++) {
+		if(file_id(manifest, files[id]) != id) {
+			LERROR << files[id] << " has id " << file_id(manifest, files[id]);
+			num_failed++;
+		}
+	}
+
+	// unchanged directories are not listed
+	num_failed += check_scan(manifest, root, false, none, none, none, 0, "unchanged");
+
+	// a file added to a and one removed from b/c, only these two directories are listed
+	write_file(root + "/a/0.jpg", "new");
+	filesystem::remove_file(root + "/b/c/3.jpg");
+	set_mtime(root + "/a", past + 10);
+	set_mtime(root + "/b/c", past + 10);
+	num_failed += check_scan(manifest, root, false, std::vector<uint64_t>(1, 5), std::vector<uint64_t>(1, 3), none, 2, "changed");
+	if(file_id(manifest, "a/0.jpg") != 5 || file_id(manifest, "a/1.jpg") != 1 || file_id(manifest, "b/c/3.jpg") != UINT64_MAX) {
+		LERROR << "the ids changed with the directories";
+		num_failed++;
+	}
+
+	// a file modified in place is only found by a full scan
+	write_file(root + "/a/1.jpg", "modified contents");
+	set_mtime(root + "/a", past + 10);
+	num_failed += check_scan(manifest, root, false, none, none, none, 0, "modified in place");
+	num_failed += check_scan(manifest, root, true, none, none, std::vector<uint64_t>(1, 1), 4, "full scan");
+
+	// the manifest read back gives the same scans
+	const std::string manifest_path = filesystem::temp_file_path();
+	ImageManifest read_manifest;
+	if(!manifest.write(manifest_path) || !read_manifest.read(manifest_path) || read_manifest.next_id() != 6 ||
+		read_manifest.files().size() != manifest.files().size()) {
+		LERROR << "Error writing or reading the manifest";
+		num_failed++;
+	}
+	filesystem::remove_file(manifest_path);
+	num_failed += check_scan(read_manifest, root, false, none, none, none, 0, "read back");
+
+	// removing a directory removes its files, the ids of removed files are not reused
+	filesystem::remove_file(root + "/b/c/4.jpg");
+	std::remove((root + "/b/c").c_str());
+	set_mtime(root + "/b", past + 20);
+	num_failed += check_scan(read_manifest, root, false, none, std::vector<uint64_t>(1, 4), none, 1, "removed directory");
+	write_file(root + "/b/5.jpg", "added");
+	set_mtime(root + "/b", past + 30);
+	num_failed += check_scan(read_manifest, root, false, std::vector<uint64_t>(1, 6), none, none, 1, "after removal");
+
+	// renumbering
+	std::vector<uint64_t> new_ids(7);
+	for(uint64_t id=0; id<7; id++) new_ids[id] = 6 - id;
+	read_manifest.remap_ids(new_ids);
+	if(file_id(read_manifest, "0.jpg") != 6 || file_id(read_manifest, "b/5.jpg") != 0) {
+		LERROR << "the ids were not remapped";
+		num_failed++;
+	}
+
+	// a missing root fails and leaves the manifest unchanged
+	ImageManifest::ScanResult result;
+	if(read_manifest.scan(root + "/missing", ".jpg", result) || file_id(read_manifest, "a/0.jpg") != 1) {
+		LERROR << "scanning a missing directory changed the manifest";
+		num_failed++;
+	}
+
+	const std::string remaining[] = { "0.jpg", "a/0.jpg", "a/1.jpg", "a/2.jpg", "a/notes.txt", "b/5.jpg" };
+	for(int i=0; i<6; i++) filesystem::remove_file(root + "/" + remaining[i]);
+	std::remove((root + "/a").c_str());
+	std::remove((root + "/b").c_str());
+	std::remove(root.c_str());
+
+	LINFO << read_manifest.files().size() << " files scanned, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
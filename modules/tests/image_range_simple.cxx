@@ -0,0 +1,163 @@
+#include <config.hpp>
+
+#include <utils/dataset.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <vector>
+#include <set>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Dataset without any data whose images are the ids for which id % stride == 1 (all ids below
+/// num_ids if stride is 1), so that ranges and samples can be checked against the ids alone.
+/// Counts the has_image calls, to check that sampling does not enumerate the ids.
+class GappedDataset : public Dataset {
+public:
+	GappedDataset(uint64_t num_ids, uint64_t stride) : Dataset(""), num_lookups(0), ids(num_ids), stride(stride) { }
+
+	bool write(const std::string &db_data_location) { return false; }
+	bool read(const std::string &db_data_location) { return false; }
+	PTR_LIB::shared_ptr<Image> image(uint64_t id) const { return PTR_LIB::make_shared<SimpleDataset::SimpleImage>("", id); }
+	uint64_t num_images() const { return stride == 1 ? ids : (ids + stride - 2) / stride; }
+	uint64_t num_ids() const { return ids; }
+	bool has_image(uint64_t id) const { num_lookups++; return id < ids && (stride == 1 || id % stride == 1); }
+	bool add_image(const PTR_LIB::shared_ptr<const Image> &image) { return false; }
+
+	numerics::SparseVectorView load_bow_feature(uint64_t id) const { return numerics::SparseVectorView(); }
+	SharedArrayView<float> load_vec_feature(uint64_t id) const { return SharedArrayView<float>(); }
+	numerics::SparseVectorView load_normalized_bow_feature(uint64_t id) const { return numerics::SparseVectorView(); }
+	bool write_normalized_bow_features(const std::vector<float> &idf_weights, numerics::Norm norm, uint64_t stamp) { return false; }
+	uint64_t normalized_bow_stamp() const { return 0; }
+	Prefetcher::Ticket prefetch_bow_features(const std::vector<uint64_t> &ids) const { return Prefetcher::Ticket(); }
+	Prefetcher::Ticket prefetch_vec_features(const std::vector<uint64_t> &ids) const { return Prefetcher::Ticket(); }
+	Prefetcher::Ticket prefetch_normalized_bow_features(const std::vector<uint64_t> &ids) const { return Prefetcher::Ticket(); }
+	bool load_mat_feature(uint64_t id, const std::string &feat_name, cv::Mat &data) const { return false; }
+	bool write_mat_feature(uint64_t id, const std::string &feat_name, const cv::Mat &data) { return false; }
+	bool flush_mat_features() { return true; }
+
+	mutable uint64_t num_lookups;
+
+protected:
+	uint64_t ids, stride;
+};
+
+/// Returns the ids of a range.
+static std::vector<uint64_t> range_ids(const ImageRange &range) {
+	std::vector<uint64_t> ids;
+	for(ImageRange::const_iterator it = range.begin(); it != range.end(); it++) ids.push_back(it.id());
+	return ids;
+}
+
+/// Checks the range of all images and its chunks, and that the ImageShuffler visits every image
+/// once.  Returns the number of failed checks.
+static uint32_t check_enumeration(const GappedDataset &dataset, const char *step) {
+	std::vector<uint64_t> expected;
+	for(uint64_t id=0; id<dataset.num_ids(); id++) {
+		if(dataset.has_image(id)) expected.push_back(id);
+	}
+
+	const ImageRange &all = dataset.all_images();
+	if(range_ids(all) != expected || all.size() != dataset.num_images()) {
+		LERROR << step << ": all_images does not list the ids with an image";
+		return 1;
+	}
+
+	std::vector<uint64_t> chunked;
+	for(uint64_t c=0; c<all.num_chunks(7); c++) {
+		const ImageRange &chunk = all.chunk(c, 7);
+		if(chunk.size() > 7 || (chunk.size() > 0 && chunk[0]->id != chunk.id(0))) {
+			LERROR << step << ": chunk " << c << " is invalid";
+			return 1;
+		}
+		const std::vector<uint64_t> &ids = range_ids(chunk);
+		chunked.insert(chunked.end(), ids.begin(), ids.end());
+	}
+	if(chunked != expected) {
+		LERROR << step << ": the chunks do not cover the range";
+		return 1;
+	}
+
+	ImageShuffler shuffler(all, 3);
+	std::vector<uint64_t> shuffled;
+	for(uint64_t id; shuffler.next(id); ) shuffled.push_back(id);
+	const std::set<uint64_t> visited(shuffled.begin(), shuffled.end());
+	if(shuffled.size() != expected.size() || visited != std::set<uint64_t>(expected.begin(), expected.end()) || shuffled == expected) {
+		LERROR << step << ": the shuffler does not visit every image once in random order";
+		return 1;
+	}
+	return 0;
+}
+
+/// Checks that random_images draws distinct images sorted by id, depends only on the seed, returns
+/// all images when more are asked for, and picks every image about equally often.  Returns the
+/// number of failed checks.
+static uint32_t check_sampling(const GappedDataset &dataset, const char *step) {
+	const size_t count = 10;
+	const uint32_t num_seeds = 2000;
+	std::vector<uint32_t> picked(dataset.num_ids(), 0);
+
+	for(uint32_t seed=0; seed<num_seeds; seed++) {
+		const std::vector<uint64_t> &ids = range_ids(dataset.random_images(count, seed));
+		if(ids.size() != count) {
+			LERROR << step << ": " << ids.size() << " images drawn instead of " << count;
+			return 1;
+		}
+		for(size_t i=0; i<ids.size(); i++) {
+			if(!dataset.has_image(ids[i]) || (i > 0 && ids[i] <= ids[i - 1])) {
+				LERROR << step << ": the sample of seed " << seed << " has invalid, repeated or unsorted ids";
+				return 1;
+			}
+			picked[ids[i]]++;
+		}
+		if(seed < 10 && range_ids(dataset.random_images(count, seed)) != ids) {
+			LERROR << step << ": the sample of seed " << seed << " is not reproducible";
+			return 1;
+		}
+	}
+
+	// every image is expected num_seeds * count / num_images times, the bounds are 5 standard
+	// deviations away
+	const double expected = (double)num_seeds * count / dataset.num_images();
+	for(uint64_t id=0; id<dataset.num_ids(); id++) {
+		if(!dataset.has_image(id)) continue;
+		if(picked[id] < expected / 2 || picked[id] > expected * 3 / 2) {
+			LERROR << step << ": image " << id << " drawn " << picked[id] << " times, expected about " << expected;
+			return 1;
+		}
+	}
+
+	if(range_ids(dataset.random_images(dataset.num_images() + 5)) != range_ids(dataset.all_images())) {
+		LERROR << step << ": asking for more images than the dataset has does not return all of them";
+		return 1;
+	}
+	const std::vector<uint64_t> &most = range_ids(dataset.random_images(dataset.num_images() - 3, 1));
+	if(most.size() != dataset.num_images() - 3 || std::set<uint64_t>(most.begin(), most.end()).size() != most.size()) {
+		LERROR << step << ": drawing most of the images returned " << most.size() << " distinct images";
+		return 1;
+	}
+	return 0;
+}
+
+/// Checks the lazy enumeration and the sampling of dataset images, on dense ids and on ids with
+/// gaps (which are sampled without listing the ids).
+int main(int argc, char *argv[]) {
+	uint32_t num_failed = 0;
+
+	const GappedDataset dense(200, 1), gapped(600, 3), sparse(6000, 30);
+	num_failed += check_enumeration(dense, "dense");
+	num_failed += check_enumeration(gapped, "gapped");
+	num_failed += check_sampling(dense, "dense");
+	num_failed += check_sampling(gapped, "gapped");
+	num_failed += check_sampling(sparse, "sparse");
+
+	// sampling a few images of a large dataset with gaps does not go through all of its ids
+	const GappedDataset large(1 << 24, 4);
+	if(large.random_images(100, 5).size() != 100 || large.num_lookups > 10000) {
+		LERROR << "sampling 100 images looked up " << large.num_lookups << " ids";
+		num_failed++;
+	}
+
+	LINFO << "4 datasets checked, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/image_table.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <random>
+
+_INITIALIZE_EASYLOGGINGPP
+
+typedef std::map<uint64_t, std::string> paths_t;
+
+/// Checks that the table holds exactly the expected paths, and that every path is found by find.
+/// Returns the number of failed checks.
+static uint32_t check_table(const ImageTable &table, const paths_t &expected, const char *step) {
+	const uint64_t num_ids = expected.empty() ? 0 : expected.rbegin()->first + 1;
+	if(table.size() != expected.size() || table.num_ids() < num_ids) {
+		LERROR << step << ": the table has " << table.size() << " images and " << table.num_ids() << " ids";
+		return 1;
+	}
+	for(uint64_t id=0; id<table.num_ids() + 5; id++) {
+		paths_t::const_iterator it = expected.find(id);
+		if(table.contains(id) != (it != expected.end()) || (it == expected.end() && table.path(id) != 0) ||
+			(it != expected.end() && (!table.path(id) || it->second != table.path(id)))) {
+			LERROR << step << ": the path of image " << id << " differs";
+			return 1;
+		}
+	}
+	for(paths_t::const_iterator it = expected.begin(); it != expected.end(); it++) {
+		uint64_t id;
+		if(!table.find(it->second.c_str(), id) || id != it->first) {
+			LERROR << step << ": the image of " << it->second << " is not found";
+			return 1;
+		}
+	}
+	uint64_t id;
+	if(table.find("images/missing.jpg", id) || table.find("", id)) {
+		LERROR << step << ": a missing path is found";
+		return 1;
+	}
+	return 0;
+}
+
+/// Builds a table with gaps in the ids, and checks lookups through the path index and without it,
+/// writing and mapping the table, modifying a mapped table (which must not change the file until
+/// it is written again), renumbering the images, and rejecting files which are not tables.
+int main(int argc, char *argv[]) {
+	std::mt19937 rng(9);
+	uint32_t num_failed = 0;
+	const std::string path = filesystem::temp_file_path();
+
+	ImageTable table;
+	paths_t expected;
+	std::uniform_int_distribution<uint32_t> directory(0, 50);
+	for(uint64_t id=0; id<3000; id++) {
+		if(id % 5 == 2) continue;
+		std::stringstream image_path;
+		image_path << "images/" << directory(rng) << "/" << (id * 7919) % 10007 << ".jpg";
+		expected[id] = image_path.str();
+		if(!table.insert(id, expected[id].c_str(), expected[id].size())) num_failed++;
+	}
+	if(table.insert(3, "images/taken.jpg", 16)) {
+		LERROR << "an image was inserted with a taken id";
+		num_failed++;
+	}
+	num_failed += check_table(table, expected, "unindexed");
+	table.build_index();
+	if(!table.is_indexed()) num_failed++;
+	num_failed += check_table(table, expected, "indexed");
+
+	if(!table.write(path)) {
+		LERROR << "Error writing the table";
+		return 1;
+	}
+	ImageTable mapped;
+	if(!mapped.open(path) || !mapped.is_mapped() || !mapped.is_indexed()) {
+		LERROR << "Error mapping the table";
+		return 1;
+	}
+	num_failed += check_table(mapped, expected, "mapped");
+
+	// modifying the mapped table copies it, the file keeps the written table
+	const paths_t written = expected;
+	for(uint64_t id=0; id<3000; id+=11) {
+		if(expected.erase(id) && !mapped.remove(id)) num_failed++;
+	}
+	expected[4000] = "images/new.jpg";
+	mapped.insert(4000, "images/new.jpg", 14);
+	if(mapped.is_mapped() || mapped.remove(11)) {
+		LERROR << "the modified table is still mapped, or a removed image was removed again";
+		num_failed++;
+	}
+	num_failed += check_table(mapped, expected, "modified");
+	{
+		ImageTable original;
+		if(!original.open(path)) num_failed++;
+		else num_failed += check_table(original, written, "unmodified file");
+	}
+
+	// the file of a mapped table can be rewritten, removed paths are dropped from the arena
+	ImageTable rewritten;
+	if(!rewritten.open(path) || !mapped.write(path) || !rewritten.open(path)) {
+		LERROR << "Error rewriting the mapped table";
+		num_failed++;
+	} else {
+		num_failed += check_table(rewritten, expected, "rewritten");
+	}
+
+	// renumbering reverses the ids
+	std::vector<uint64_t> new_ids(mapped.num_ids());
+	for(uint64_t id=0; id<new_ids.size(); id++) new_ids[id] = new_ids.size() - 1 - id;
+	mapped.remap_ids(new_ids);
+	paths_t remapped;
+	for(paths_t::const_iterator it = expected.begin(); it != expected.end(); it++) remapped[new_ids[it->first]] = it->second;
+	num_failed += check_table(mapped, remapped, "remapped");
+
+	// files which are not tables, ex. the text dataset files, are rejected
+	const std::string text_path = filesystem::temp_file_path();
+	std::ofstream(text_path, std::ios::trunc) << "0 images/0.jpg\n1 images/1.jpg\n";
+	if(rewritten.open(text_path)) {
+		LERROR << "a text file was opened as a table";
+		num_failed++;
+	}
+	num_failed += check_table(rewritten, expected, "after rejected file");
+
+	filesystem::remove_file(path);
+	filesystem::remove_file(text_path);
+	LINFO << expected.size() << " paths checked, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
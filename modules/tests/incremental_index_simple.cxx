@@ -0,0 +1,196 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/numerics.hpp>
+#include <utils/logger.hpp>
+#include <search/incremental_inverted_index/incremental_inverted_index.hpp>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Number of visual words of the generated vectors.
+static const uint32_t s_num_words = 2000;
+/// Largest allowed difference between the scores of the index and the reference.
+static const float s_tolerance = 1e-4f;
+
+typedef std::map<uint64_t, numerics::sparse_vector_t> images_t;
+
+/// Returns a BoW vector with 10 to 40 distinct random words and small integer frequencies.
+static numerics::sparse_vector_t random_vector(std::mt19937 &rng) {
+	std::uniform_int_distribution<uint32_t> word(0, s_num_words - 1), size(10, 40), frequency(1, 4);
+	std::set<uint32_t> words;
+	for(uint32_t n = size(rng); words.size() < n; ) words.insert(word(rng));
+
+	numerics::sparse_vector_t vector;
+	for(std::set<uint32_t>::const_iterator it = words.begin(); it != words.end(); it++) {
+		vector.push_back(std::pair<uint32_t, float>(*it, (float)frequency(rng)));
+	}
+	return vector;
+}
+
+/// Searches for every image sharing a word with the query.
+static PTR_LIB::shared_ptr<InvertedIndex::MatchResults> search_all(IncrementalInvertedIndex &index,
+	const numerics::sparse_vector_t &query) {
+
+	PTR_LIB::shared_ptr<InvertedIndex::SearchParams> params = PTR_LIB::make_shared<InvertedIndex::SearchParams>(1 << 20, 0);
+	return std::static_pointer_cast<InvertedIndex::MatchResults>(index.search(params, query));
+}
+
+/// Checks the index against a brute force search of the indexed images with the same idf
+/// weights, for a few queries.  Returns the number of failed checks.
+static uint32_t check_index(IncrementalInvertedIndex &index, const images_t &images, std::mt19937 &rng, const char *step) {
+	if(index.num_images() != images.size()) {
+		LERROR << step << ": " << index.num_images() << " images indexed instead of " << images.size();
+		return 1;
+	}
+
+	std::vector<uint32_t> document_frequencies(s_num_words, 0);
+	for(images_t::const_iterator it = images.begin(); it != images.end(); it++) {
+		for(size_t i=0; i<it->second.size(); i++) document_frequencies[it->second[i].first]++;
+	}
+	std::vector<float> idf_weights(s_num_words, 0.f);
+	for(uint32_t i=0; i<s_num_words; i++) {
+		if(document_frequencies[i] > 0) idf_weights[i] = logf((float)images.size() / (float)document_frequencies[i]);
+	}
+
+	for(uint32_t q=0; q<5; q++) {
+		const numerics::sparse_vector_t &query = random_vector(rng);
+		std::map<uint64_t, float> expected;
+		for(images_t::const_iterator it = images.begin(); it != images.end(); it++) {
+			uint32_t shared = 0;
+			for(size_t i=0, j=0; i<query.size() && j<it->second.size(); ) {
+				if(query[i].first == it->second[j].first) { shared++; i++; j++; }
+				else if(query[i].first < it->second[j].first) i++;
+				else j++;
+			}
+			if(shared > 0) expected[it->first] = numerics::min_hist(query, it->second, idf_weights);
+		}
+
+		const PTR_LIB::shared_ptr<InvertedIndex::MatchResults> &matches = search_all(index, query);
+		if(matches->matches.size() != expected.size()) {
+			LERROR << step << ": " << matches->matches.size() << " matches instead of " << expected.size();
+			return 1;
+		}
+		for(size_t i=0; i<matches->matches.size(); i++) {
+			std::map<uint64_t, float>::const_iterator it = expected.find(matches->matches[i]);
+			if(it == expected.end() || fabs(it->second - matches->tfidf_scores[i]) > s_tolerance) {
+				LERROR << step << ": image " << matches->matches[i] << " is not expected or scored differently";
+				return 1;
+			}
+			if(i > 0 && matches->tfidf_scores[i] > matches->tfidf_scores[i - 1]) {
+				LERROR << step << ": matches are not sorted by score";
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/// Checks adding, replacing and removing images of the incremental index, against a brute force
+/// search: while the added images are buffered, once they are in segments merged by the
+/// background compaction while another thread searches, after removed images were merged, and
+/// after saving and loading the index.
+int main(int argc, char *argv[]) {
+	std::mt19937 rng(11);
+	uint32_t num_failed = 0;
+	images_t images;
+
+	{
+		IncrementalInvertedIndex index(2);
+
+		// queries score the buffered images, they are not turned into a segment per query
+		for(uint64_t id=0; id<300; id++) {
+			images[id] = random_vector(rng);
+			index.add(id, images[id]);
+			if(id % 50 == 0) num_failed += check_index(index, images, rng, "buffered");
+		}
+		if(index.num_segments() != 0) {
+			LERROR << "searching the buffered images created " << index.num_segments() << " segments";
+			num_failed++;
+		}
+
+		// enough images to fill the buffer several times, the segments are merged in the background
+		// while a second thread searches
+		std::atomic<bool> updating(true);
+		std::atomic<uint32_t> num_concurrent_failed(0), num_concurrent_searches(0);
+		std::thread searcher([&index, &updating, &num_concurrent_failed, &num_concurrent_searches] {
+			std::mt19937 searcher_rng(5);
+			while(updating) {
+				const PTR_LIB::shared_ptr<InvertedIndex::MatchResults> &matches = search_all(index, random_vector(searcher_rng));
+				for(size_t i=0; i<matches->matches.size(); i++) {
+					if(matches->matches[i] >= 6000 || (i > 0 && matches->tfidf_scores[i] > matches->tfidf_scores[i - 1])) {
+						num_concurrent_failed++;
+						break;
+					}
+				}
+				num_concurrent_searches++;
+			}
+		});
+		for(uint64_t id=300; id<6000; id++) {
+			images[id] = random_vector(rng);
+			index.add(id, images[id]);
+			// replaced images are removed from their segment or from the buffer
+			if(id % 11 == 0) {
+				images[id / 2] = random_vector(rng);
+				index.add(id / 2, images[id / 2]);
+			}
+			if(id % 7 == 0 && images.count(id / 3)) {
+				images.erase(id / 3);
+				if(!index.remove(id / 3)) num_failed++;
+			}
+		}
+		updating = false;
+		searcher.join();
+		if(num_concurrent_failed > 0) {
+			LERROR << num_concurrent_failed << " of " << num_concurrent_searches << " concurrent searches returned invalid matches";
+			num_failed++;
+		}
+		num_failed += check_index(index, images, rng, "segments");
+
+		// images removed from segments stay removed once the segments are merged
+		for(uint64_t id=1; id<6000; id+=5) {
+			if(images.erase(id) && !index.remove(id)) num_failed++;
+		}
+		if(index.remove(1)) {
+			LERROR << "an image was removed twice";
+			num_failed++;
+		}
+		num_failed += check_index(index, images, rng, "removed");
+		index.compact();
+		if(index.num_segments() != 1) {
+			LERROR << "compact left " << index.num_segments() << " segments";
+			num_failed++;
+		}
+		num_failed += check_index(index, images, rng, "compacted");
+
+		// images added after the compaction are buffered again
+		for(uint64_t id=6000; id<6100; id++) {
+			images[id] = random_vector(rng);
+			index.add(id, images[id]);
+		}
+		if(!index.save("incremental_index_simple.index")) {
+			LERROR << "Error saving the index";
+			num_failed++;
+		}
+	}
+
+	IncrementalInvertedIndex loaded(8, false);
+	if(!loaded.load("incremental_index_simple.index")) {
+		LERROR << "Error loading the index";
+		num_failed++;
+	}
+	filesystem::remove_file("incremental_index_simple.index");
+	num_failed += check_index(loaded, images, rng, "loaded");
+
+	LINFO << images.size() << " images checked, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/logger.hpp>
+#include <search/inverted_index/inverted_index.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Number of visual words of the generated indexes, the last words have no postings.
+static const uint32_t s_num_words = 600;
+static const uint32_t s_num_used_words = 550;
+/// Number of images, and of index files they are partitioned into by id.
+static const uint64_t s_num_images = 3000;
+static const uint32_t s_num_partitions = 3;
+/// Tag of the term frequency section of the files written by InvertedIndex::save ("TFRQ").
+static const uint32_t s_term_frequencies_tag = 0x51524654;
+
+/// Postings of every word, sorted by id.
+struct Postings {
+	std::vector< std::vector<uint64_t> > ids;
+	std::vector< std::vector<float> > frequencies;
+
+	Postings() : ids(s_num_words), frequencies(s_num_words) { }
+};
+
+/// Writes postings in the format of InvertedIndex::save.
+static void write_index(const std::string &file_path, const Postings &postings, const std::vector<float> &idf_weights) {
+	std::ofstream ofs(file_path, std::ios::binary | std::ios::trunc);
+	ofs.write((const char *)&s_num_words, sizeof(uint32_t));
+	ofs.write((const char *)&idf_weights[0], sizeof(float) * s_num_words);
+	uint64_t total_entries = 0;
+	for(uint32_t i=0; i<s_num_words; i++) {
+		uint64_t num_entries = postings.ids[i].size();
+		ofs.write((const char *)&num_entries, sizeof(uint64_t));
+		if(num_entries != 0) ofs.write((const char *)&postings.ids[i][0], sizeof(uint64_t) * num_entries);
+		total_entries += num_entries;
+	}
+	uint32_t tag = s_term_frequencies_tag;
+	uint64_t section_size = sizeof(float) * total_entries;
+	ofs.write((const char *)&tag, sizeof(uint32_t));
+	ofs.write((const char *)&section_size, sizeof(uint64_t));
+	for(uint32_t i=0; i<s_num_words; i++) {
+		if(!postings.frequencies[i].empty()) ofs.write((const char *)&postings.frequencies[i][0], sizeof(float) * postings.frequencies[i].size());
+	}
+}
+
+static std::string read_file(const std::string &file_path) {
+	std::ifstream ifs(file_path, std::ios::binary);
+	std::stringstream contents;
+	contents << ifs.rdbuf();
+	return contents.str();
+}
+
+/// Returns the idf weights of the postings for a database of num_images images, zero for the
+/// words without postings.
+static std::vector<float> idf_weights(const Postings &postings, uint64_t num_images) {
+	std::vector<float> weights(s_num_words, 0.f);
+	for(uint32_t i=0; i<s_num_words; i++) {
+		if(!postings.ids[i].empty()) weights[i] = logf((float)num_images / (float)postings.ids[i].size());
+	}
+	return weights;
+}
+
+/// Merges the index files and compares the result with the index written from all postings.
+/// Returns the number of failed checks.
+static uint32_t check_merge(const std::vector<std::string> &input_paths, const Postings &all, uint64_t num_images,
+	uint64_t expected_images, const char *step) {
+
+	const std::string merged_path = "merge_index_simple_merged.index", expected_path = "merge_index_simple_expected.index";
+	if(!InvertedIndex::merge(input_paths, merged_path, num_images)) {
+		LERROR << step << ": merge failed";
+		return 1;
+	}
+	write_index(expected_path, all, idf_weights(all, expected_images));
+
+	uint32_t num_failed = 0;
+	if(read_file(merged_path) != read_file(expected_path)) {
+		LERROR << step << ": the merged index differs from the index of all postings";
+		num_failed++;
+	}
+
+	InvertedIndex loaded;
+	if(!loaded.load(merged_path)) {
+		LERROR << step << ": error loading the merged index";
+		num_failed++;
+	} else {
+		for(uint32_t i=0; i<s_num_words; i++) {
+			if(loaded.document_frequency(i) != all.ids[i].size()) {
+				LERROR << step << ": word " << i << " has " << loaded.document_frequency(i) << " postings instead of " << all.ids[i].size();
+				num_failed++;
+				break;
+			}
+		}
+	}
+
+	filesystem::remove_file(merged_path);
+	filesystem::remove_file(expected_path);
+	return num_failed;
+}
+
+/// Partitions random postings between several index files by id, so the postings of a word
+/// interleave between the files, merges them and checks that the merged file is the index of all
+/// the postings, with finite idf weights for the words that have no postings.  The postings
+/// exceed the merge buffers, so the ids and term frequencies are written in several pieces.
+int main(int argc, char *argv[]) {
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<uint32_t> word(0, s_num_used_words - 1), frequency(1, 5);
+
+	std::vector<Postings> partitions(s_num_partitions);
+	Postings all;
+	for(uint64_t id=0; id<s_num_images; id++) {
+		std::vector<bool> used(s_num_words, false);
+		for(uint32_t n=0; n<40; n++) used[word(rng)] = true;
+		Postings &partition = partitions[id % s_num_partitions];
+		for(uint32_t i=0; i<s_num_words; i++) {
+			if(!used[i]) continue;
+			const float f = (float)frequency(rng);
+			partition.ids[i].push_back(id);
+			partition.frequencies[i].push_back(f);
+			all.ids[i].push_back(id);
+			all.frequencies[i].push_back(f);
+		}
+	}
+
+	std::vector<std::string> input_paths;
+	for(uint32_t p=0; p<s_num_partitions; p++) {
+		std::stringstream path;
+		path << "merge_index_simple_" << p << ".index";
+		input_paths.push_back(path.str());
+		write_index(input_paths.back(), partitions[p], idf_weights(partitions[p], s_num_images / s_num_partitions));
+	}
+
+	uint32_t num_failed = 0;
+	num_failed += check_merge(input_paths, all, 0, s_num_images, "counted images");
+	num_failed += check_merge(input_paths, all, 2 * s_num_images, 2 * s_num_images, "given images");
+
+	for(size_t i=0; i<input_paths.size(); i++) filesystem::remove_file(input_paths[i]);
+
+	LINFO << input_paths.size() << " indexes merged, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
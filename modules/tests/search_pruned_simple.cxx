@@ -0,0 +1,172 @@
+#include <config.hpp>
+#include "tests_config.hpp"
+
+#include <utils/filesystem.hpp>
+#include <utils/dataset.hpp>
+#include <utils/id_bitmap.hpp>
+#include <utils/logger.hpp>
+#include <search/inverted_index/inverted_index.hpp>
+
+#include <iostream>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Number of matches compared per query.
+static const uint64_t s_top_k = 20;
+/// Largest allowed difference between the scores of two searches.
+static const float s_tolerance = 1e-4f;
+
+typedef std::vector< std::pair<float, uint64_t> > scored_matches_t;
+
+/// Returns the matches of a search with their scores, dropping zero scores which only some of
+/// the search strategies return.
+static scored_matches_t scored_matches(const PTR_LIB::shared_ptr<MatchResultsBase> &matches) {
+	const PTR_LIB::shared_ptr<InvertedIndex::MatchResults> &ii_matches = std::static_pointer_cast<InvertedIndex::MatchResults>(matches);
+	scored_matches_t scored;
+	for(size_t i=0; i<ii_matches->matches.size(); i++) {
+		if(ii_matches->tfidf_scores[i] > s_tolerance) {
+			scored.push_back(std::pair<float, uint64_t>(ii_matches->tfidf_scores[i], ii_matches->matches[i]));
+		}
+	}
+	return scored;
+}
+
+/// Returns true if matches are the top k of reference, which is sorted by decreasing score.
+/// Images whose scores tie with the k-th score may be swapped.
+static bool same_top(const scored_matches_t &matches, const scored_matches_t &reference, uint64_t k) {
+	const size_t size = MIN(reference.size(), k);
+	if(matches.size() != size) return false;
+	if(size == 0) return true;
+
+	std::set<uint64_t> ids;
+	for(size_t i=0; i<size; i++) {
+		if(fabs(matches[i].first - reference[i].first) > s_tolerance) return false;
+		ids.insert(matches[i].second);
+	}
+	for(size_t i=0; i<size; i++) {
+		if(reference[i].first > reference[size - 1].first + s_tolerance && ids.count(reference[i].second) == 0) return false;
+	}
+	return true;
+}
+
+/// Checks that the longest scored posting list of the query words still scores the images it
+/// keeps when it is capped by max_postings_per_word, with the same scores as without the cap.
+/// Returns the number of failed checks.
+static uint32_t check_capped_word(InvertedIndex &ii, Dataset &dataset, const numerics::sparse_vector_t &query) {
+	std::vector< std::pair<uint64_t, size_t> > words(query.size()); // (document frequency, position)
+	for(size_t i=0; i<query.size(); i++) words[i] = std::pair<uint64_t, size_t>(ii.document_frequency(query[i].first), i);
+	std::sort(words.begin(), words.end(), std::greater< std::pair<uint64_t, size_t> >());
+
+	for(size_t w=0; w<words.size() && words[w].first >= 2; w++) {
+		const numerics::sparse_vector_t word(1, query[words[w].second]);
+		const uint64_t df = words[w].first, cap = df / 2;
+		PTR_LIB::shared_ptr<InvertedIndex::SearchParams> full = PTR_LIB::make_shared<InvertedIndex::SearchParams>(dataset.num_ids(), df, true);
+		const scored_matches_t &uncapped = scored_matches(ii.search(dataset, full, word));
+		if(uncapped.empty()) continue; // a word with zero idf scores nothing
+
+		PTR_LIB::shared_ptr<InvertedIndex::SearchParams> capped = PTR_LIB::make_shared<InvertedIndex::SearchParams>(*full);
+		capped->max_postings_per_word = cap;
+		const scored_matches_t &matches = scored_matches(ii.search(dataset, capped, word));
+		if(matches.empty() || matches.size() > cap) {
+			LERROR << "Word " << word[0].first << " capped to " << cap << " of " << df << " postings scores " << matches.size() << " images";
+			return 1;
+		}
+
+		std::map<uint64_t, float> scores;
+		for(size_t i=0; i<uncapped.size(); i++) scores[uncapped[i].second] = uncapped[i].first;
+		for(size_t i=0; i<matches.size(); i++) {
+			if(!scores.count(matches[i].second) || fabs(scores[matches[i].second] - matches[i].first) > s_tolerance) {
+				LERROR << "Word " << word[0].first << " capped to " << cap << " postings scores image " << matches[i].second << " differently";
+				return 1;
+			}
+		}
+		return 0;
+	}
+	return 0;
+}
+
+/// Checks that dynamic pruning, and the filtered searches with and without direct scoring,
+/// return the same top matches as the exhaustive search, which scores every image sharing a word
+/// with the query, and that words capped by max_postings_per_word still count.
+int main(int argc, char *argv[]) {
+#if ENABLE_MULTITHREADING && ENABLE_MPI
+	MPI::Init(argc, argv);
+	int rank = MPI::COMM_WORLD.Get_rank();
+	if(rank == 0) {
+#endif
+	const uint32_t num_clusters = 512;
+	const uint32_t num_queries = 10;
+
+	SimpleDataset simple_dataset(s_oxfordmini_data_dir, s_oxfordmini_database_location);
+	LINFO << simple_dataset;
+
+	std::stringstream index_output_file;
+	index_output_file << simple_dataset.location() << "/index/" << num_clusters << ".index";
+	InvertedIndex ii(index_output_file.str());
+
+	// every third image
+	PTR_LIB::shared_ptr<IdBitmap> filter = PTR_LIB::make_shared<IdBitmap>();
+	for(uint64_t id=0; id<simple_dataset.num_ids(); id+=3) {
+		if(simple_dataset.has_image(id)) filter->add(id);
+	}
+
+	PTR_LIB::shared_ptr<InvertedIndex::SearchParams> exhaustive = PTR_LIB::make_shared<InvertedIndex::SearchParams>(simple_dataset.num_ids(), 0);
+	exhaustive->direct_scoring_selectivity = 0.f;
+
+	PTR_LIB::shared_ptr<InvertedIndex::SearchParams> pruned = PTR_LIB::make_shared<InvertedIndex::SearchParams>(simple_dataset.num_ids(), s_top_k, true);
+	pruned->direct_scoring_selectivity = 0.f;
+
+	PTR_LIB::shared_ptr<InvertedIndex::SearchParams> scanned_filtered = PTR_LIB::make_shared<InvertedIndex::SearchParams>(*exhaustive);
+	scanned_filtered->max_matches = s_top_k;
+	scanned_filtered->filter = filter;
+
+	PTR_LIB::shared_ptr<InvertedIndex::SearchParams> direct_filtered = PTR_LIB::make_shared<InvertedIndex::SearchParams>(*scanned_filtered);
+	direct_filtered->direct_scoring_selectivity = 1.f;
+
+	PTR_LIB::shared_ptr<InvertedIndex::SearchParams> pruned_filtered = PTR_LIB::make_shared<InvertedIndex::SearchParams>(*pruned);
+	pruned_filtered->filter = filter;
+
+	uint32_t num_checked = 0, num_failed = 0;
+	for(uint64_t i=0; i<simple_dataset.num_ids() && num_checked<num_queries; i++) {
+		if(!simple_dataset.has_image(i)) continue;
+		const PTR_LIB::shared_ptr<Image> &query = simple_dataset.image(i);
+
+		const scored_matches_t &reference = scored_matches(ii.search(simple_dataset, exhaustive, query));
+		scored_matches_t filtered_reference;
+		for(size_t j=0; j<reference.size(); j++) {
+			if(filter->contains(reference[j].second)) filtered_reference.push_back(reference[j]);
+		}
+
+		if(!same_top(scored_matches(ii.search(simple_dataset, pruned, query)), reference, s_top_k)) {
+			LERROR << "Query " << i << ": dynamic pruning differs from the exhaustive search";
+			num_failed++;
+		}
+		if(!same_top(scored_matches(ii.search(simple_dataset, scanned_filtered, query)), filtered_reference, s_top_k)) {
+			LERROR << "Query " << i << ": the filtered search differs from the exhaustive search";
+			num_failed++;
+		}
+		if(!same_top(scored_matches(ii.search(simple_dataset, direct_filtered, query)), filtered_reference, s_top_k)) {
+			LERROR << "Query " << i << ": direct scoring differs from the exhaustive search";
+			num_failed++;
+		}
+		if(!same_top(scored_matches(ii.search(simple_dataset, pruned_filtered, query)), filtered_reference, s_top_k)) {
+			LERROR << "Query " << i << ": filtered dynamic pruning differs from the exhaustive search";
+			num_failed++;
+		}
+		num_failed += check_capped_word(ii, simple_dataset, numerics::sparse_vector_t(simple_dataset.load_bow_feature(i)));
+		num_checked++;
+	}
+
+	LINFO << num_checked << " queries checked, " << num_failed << " failures";
+#if ENABLE_MULTITHREADING && ENABLE_MPI
+	}
+	MPI::Finalize();
+#endif
+	return num_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/dataset.hpp>
+#include <utils/sharded_dataset.hpp>
+#include <utils/hash.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <cstdio>
+
+#include <boost/filesystem.hpp>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Number of images of the dataset, and of shards it is split into.
+static const uint64_t s_num_images = 40;
+static const uint32_t s_num_shards = 3;
+
+typedef std::map<uint64_t, std::string> paths_t;
+
+/// Returns the BoW vector of an image, which is made of its id.
+static numerics::SparseVector id_vector(uint64_t id) {
+	numerics::SparseVector bow_descriptors;
+	bow_descriptors.push_back((uint32_t)id, 1.f);
+	bow_descriptors.push_back((uint32_t)id + 1000, 2.f);
+	return bow_descriptors;
+}
+
+static bool same_vector(const numerics::SparseVectorView &a, const numerics::SparseVector &b) {
+	if(a.size() != b.size()) return false;
+	for(size_t i=0; i<a.size(); i++) {
+		if(a.index(i) != b.index(i) || a.value(i) != b.value(i)) return false;
+	}
+	return true;
+}
+
+/// Creates a dataset of empty images, each with a BoW feature file, with a packed store of the
+/// features, and without the image of id 7, so that the ids have a gap.
+static void create_dataset(const std::string &root, paths_t &expected) {
+	for(uint64_t id=0; id<s_num_images; id++) {
+		char name[32];
+		snprintf(name, sizeof(name), "/images/%02u/%04u.jpg", (uint32_t)(id / 10), (uint32_t)id);
+		filesystem::create_file_directory(root + name);
+		std::ofstream((root + name).c_str(), std::ios::binary | std::ios::trunc) << name;
+		expected[id] = name;
+	}
+	SimpleDataset dataset(root, 0);
+	ImageManifest::ScanResult result;
+	filesystem::remove_file(root + expected[7]);
+	expected.erase(7);
+	dataset.rescan(result, true);
+
+	for(paths_t::const_iterator it = expected.begin(); it != expected.end(); it++) {
+		const std::string &bow_path = root + dataset.image(it->first)->feature_path("bow_descriptors");
+		filesystem::create_file_directory(bow_path);
+		filesystem::write_sparse_vector(bow_path, id_vector(it->first));
+	}
+	dataset.write_bow_store(dataset.bow_store_location());
+}
+
+/// Checks that the sharded dataset holds the images of the original dataset with the same ids,
+/// reached through the links to the shards, that the ids are partitioned as asked, and that the
+/// features and the local ids of the shards match.  Returns the number of failed checks.
+static uint32_t check_sharded(const ShardedDataset &sharded, const std::string &base, const paths_t &expected,
+	SimpleDataset::Partition partition, const char *step) {
+
+	if(sharded.num_shards() != s_num_shards || sharded.num_images() != expected.size() ||
+		sharded.num_ids() != expected.rbegin()->first + 1) {
+		LERROR << step << ": the sharded dataset has " << sharded.num_shards() << " shards and " << sharded.num_images() << " images";
+		return 1;
+	}
+
+	uint32_t previous_shard = 0;
+	for(uint64_t id=0; id<sharded.num_ids() + 5; id++) {
+		paths_t::const_iterator it = expected.find(id);
+		uint32_t s;
+		uint64_t local_id;
+		if(sharded.has_image(id) != (it != expected.end()) || sharded.find_shard(id, s, local_id) != (it != expected.end())) {
+			LERROR << step << ": the sharded dataset does not have the same ids, differs at " << id;
+			return 1;
+		}
+		if(it == expected.end()) continue;
+
+		const std::string &location = sharded.image(id)->location();
+		char shard_path[32];
+		snprintf(shard_path, sizeof(shard_path), "/shards/%04u", s);
+		if(location != shard_path + it->second || !filesystem::file_exists(base + location) ||
+			!sharded.shard(s)->image_location(local_id) || it->second != sharded.shard(s)->image_location(local_id)) {
+			LERROR << step << ": image " << id << " is at " << location;
+			return 1;
+		}
+		if(sharded.global_id(s, local_id) != id || !same_vector(sharded.load_bow_feature(id), id_vector(id)) ||
+			!same_vector(sharded.shard(s)->load_bow_feature(local_id), id_vector(id))) {
+			LERROR << step << ": the ids or the features of image " << id << " differ in shard " << s;
+			return 1;
+		}
+
+		// the ranges are in shard order, the local ids follow the global ones
+		if((partition == SimpleDataset::PARTITION_HASH && s != hash_id(id) % s_num_shards) ||
+			(partition == SimpleDataset::PARTITION_RANGE && s < previous_shard) ||
+			(local_id > 0 && sharded.global_id(s, local_id - 1) >= id)) {
+			LERROR << step << ": image " << id << " is not in the expected shard";
+			return 1;
+		}
+		previous_shard = s;
+	}
+	for(uint32_t s=0; s<s_num_shards; s++) {
+		if(sharded.shard(s)->num_images() == 0) {
+			LERROR << step << ": shard " << s << " is empty";
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/// Shards a dataset by id ranges and by hashes, linking and moving the files, and checks the
+/// shards opened together as a ShardedDataset, from their locations and from a dataset file.
+int main(int argc, char *argv[]) {
+	uint32_t num_failed = 0;
+	const std::string root = filesystem::temp_file_path();
+	paths_t expected;
+	create_dataset(root, expected);
+
+	const SimpleDataset::Partition partitions[] = { SimpleDataset::PARTITION_RANGE, SimpleDataset::PARTITION_HASH };
+	const SimpleDataset::Transfer transfers[] = { SimpleDataset::TRANSFER_LINK, SimpleDataset::TRANSFER_MOVE };
+	const char *steps[] = { "range", "hash" };
+	std::vector<std::string> temp_paths(1, root);
+	for(int p=0; p<2; p++) {
+		std::vector<std::string> shard_locations;
+		for(uint32_t s=0; s<s_num_shards; s++) shard_locations.push_back(filesystem::temp_file_path());
+		const std::string base = filesystem::temp_file_path(), db_path = filesystem::temp_file_path();
+		temp_paths.insert(temp_paths.end(), shard_locations.begin(), shard_locations.end());
+		temp_paths.push_back(base);
+		temp_paths.push_back(db_path);
+
+		{
+			SimpleDataset dataset(root, 0);
+			if(!dataset.shard(shard_locations, partitions[p], transfers[p], 4)) {
+				LERROR << steps[p] << ": error sharding the dataset";
+				num_failed++;
+				continue;
+			}
+		}
+
+		// linked files stay in the dataset, moved ones do not
+		for(paths_t::const_iterator it = expected.begin(); it != expected.end(); it++) {
+			if(filesystem::file_exists(root + it->second) != (transfers[p] == SimpleDataset::TRANSFER_LINK)) {
+				LERROR << steps[p] << ": the image " << it->second << " was not linked or moved";
+				num_failed++;
+				break;
+			}
+		}
+
+		ShardedDataset sharded(base, shard_locations);
+		num_failed += check_sharded(sharded, base, expected, partitions[p], steps[p]);
+		if(!sharded.write(db_path)) {
+			LERROR << steps[p] << ": error writing the sharded dataset";
+			num_failed++;
+		} else {
+			ShardedDataset read_sharded(base, db_path);
+			num_failed += check_sharded(read_sharded, base, expected, partitions[p], steps[p]);
+		}
+	}
+
+	// shards holding the same images cannot be opened together
+	std::vector<std::string> repeated(2, temp_paths[1]);
+	temp_paths.push_back(filesystem::temp_file_path());
+	ShardedDataset invalid(temp_paths.back(), repeated);
+	if(invalid.num_shards() != 0 || invalid.num_images() != 0) {
+		LERROR << "shards with the same images were opened together";
+		num_failed++;
+	}
+
+	boost::system::error_code ec;
+	for(size_t i=0; i<temp_paths.size(); i++) boost::filesystem::remove_all(temp_paths[i], ec);
+
+	LINFO << expected.size() << " images sharded twice, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include <config.hpp>
+
+#include <utils/filesystem.hpp>
+#include <utils/dataset.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <cstdio>
+
+_INITIALIZE_EASYLOGGINGPP
+
+typedef std::map<uint64_t, std::string> paths_t;
+
+static bool same_vector(const numerics::SparseVectorView &a, const numerics::SparseVector &b) {
+	if(a.size() != b.size()) return false;
+	for(size_t i=0; i<a.size(); i++) {
+		if(a.index(i) != b.index(i) || a.value(i) != b.value(i)) return false;
+	}
+	return true;
+}
+
+/// Checks that the dataset holds exactly the expected image paths, through the id lookups, the
+/// path lookups and the images.  Returns the number of failed checks.
+static uint32_t check_dataset(const SimpleDataset &dataset, const paths_t &expected, const char *step) {
+	const uint64_t num_ids = expected.empty() ? 0 : expected.rbegin()->first + 1;
+	if(dataset.num_images() != expected.size() || dataset.num_ids() < num_ids) {
+		LERROR << step << ": the dataset has " << dataset.num_images() << " images and " << dataset.num_ids() << " ids";
+		return 1;
+	}
+	for(uint64_t id=0; id<dataset.num_ids() + 5; id++) {
+		paths_t::const_iterator it = expected.find(id);
+		const char *location = dataset.image_location(id);
+		if(dataset.has_image(id) != (it != expected.end()) || (it == expected.end() && location != 0) ||
+			(it != expected.end() && (!location || it->second != location || dataset.image(id)->location() != it->second))) {
+			LERROR << step << ": the location of image " << id << " differs";
+			return 1;
+		}
+	}
+	for(paths_t::const_iterator it = expected.begin(); it != expected.end(); it++) {
+		uint64_t id;
+		if(!dataset.find_image(it->second.c_str(), id) || id != it->first) {
+			LERROR << step << ": the image of " << it->second << " is not found";
+			return 1;
+		}
+	}
+	uint64_t id;
+	if(dataset.find_image("/images/missing.jpg", id)) {
+		LERROR << step << ": a missing image is found";
+		return 1;
+	}
+	return 0;
+}
+
+/// Scans a directory of images into a SimpleDataset, and checks the image lookups, the feature
+/// paths, loading features from their files, writing and reading the dataset file, adding images
+/// and renumbering the images.
+int main(int argc, char *argv[]) {
+	uint32_t num_failed = 0;
+	const std::string root = filesystem::temp_file_path();
+	const std::string names[] = { "0.jpg", "a/1.jpg", "a/2.jpg", "b/3.jpg", "b/4.jpg" };
+	paths_t expected;
+	for(uint64_t id=0; id<5; id++) {
+		const std::string path = root + "/images/" + names[id];
+		filesystem::create_file_directory(path);
+		std::ofstream(path.c_str(), std::ios::binary | std::ios::trunc) << names[id];
+		expected[id] = "/images/" + names[id];
+	}
+
+	// the images are numbered in path order
+	SimpleDataset dataset(root, 0);
+	num_failed += check_dataset(dataset, expected, "scanned");
+
+	// the feature paths spread the ids over two directory levels
+	const char *feature_paths[][2] = {
+		{ "0", "/feats/sift/0000/0000/000000000.sift" },
+		{ "1027", "/feats/sift/0000/0001/000001027.sift" },
+		{ "3146754", "/feats/sift/0003/0001/003146754.sift" },
+	};
+	for(int i=0; i<3; i++) {
+		const SimpleDataset::SimpleImage image("", strtoull(feature_paths[i][0], 0, 10));
+		if(image.feature_path("sift") != feature_paths[i][1]) {
+			LERROR << "the feature path of image " << image.id << " is " << image.feature_path("sift");
+			num_failed++;
+		}
+	}
+
+	// without a packed store, the BoW features are loaded from their files
+	numerics::SparseVector bow_descriptors;
+	bow_descriptors.push_back(3, 2.f);
+	bow_descriptors.push_back(17, 1.f);
+	const std::string bow_path = root + dataset.image(3)->feature_path("bow_descriptors");
+	filesystem::create_file_directory(bow_path);
+	if(!filesystem::write_sparse_vector(bow_path, bow_descriptors) || !same_vector(dataset.load_bow_feature(3), bow_descriptors) ||
+		dataset.load_bow_feature(2).size() != 0) {
+		LERROR << "the BoW features are not loaded from their files";
+		num_failed++;
+	}
+
+	// the dataset file is read back by the constructor
+	const std::string db_path = filesystem::temp_file_path();
+	if(!dataset.write(db_path)) {
+		LERROR << "Error writing the dataset";
+		num_failed++;
+	}
+	{
+		SimpleDataset read_dataset(root, db_path, 0);
+		num_failed += check_dataset(read_dataset, expected, "read");
+	}
+
+	// added images extend the ids
+	expected[9] = "/images/d/9.jpg";
+	if(!dataset.add_image(PTR_LIB::make_shared<SimpleDataset::SimpleImage>(expected[9], 9)) ||
+		dataset.add_image(PTR_LIB::make_shared<SimpleDataset::SimpleImage>("/images/taken.jpg", 2))) {
+		LERROR << "an image was not added, or was added with a taken id";
+		num_failed++;
+	}
+	num_failed += check_dataset(dataset, expected, "added");
+
+	// renumbering reverses the ids, and the manifest with them
+	std::vector<uint64_t> new_ids(dataset.num_ids());
+	for(uint64_t id=0; id<new_ids.size(); id++) new_ids[id] = new_ids.size() - 1 - id;
+	dataset.remap_ids(new_ids);
+	paths_t remapped;
+	for(paths_t::const_iterator it = expected.begin(); it != expected.end(); it++) remapped[new_ids[it->first]] = it->second;
+	num_failed += check_dataset(dataset, remapped, "remapped");
+	{
+		// the added image has no file, it is not in the manifest
+		remapped.erase(new_ids[9]);
+		SimpleDataset rescanned(root, 0);
+		num_failed += check_dataset(rescanned, remapped, "rescanned after remapping");
+	}
+
+	filesystem::remove_file(db_path);
+	filesystem::remove_file(bow_path);
+	filesystem::remove_file(root + "/images.manifest");
+	for(int i=0; i<5; i++) filesystem::remove_file(root + "/images/" + names[i]);
+	const std::string directories[] = { "/images/a", "/images/b", "/images", "/feats/bow_descriptors/0000/0000",
+		"/feats/bow_descriptors/0000", "/feats/bow_descriptors", "/feats", "" };
+	for(int i=0; i<8; i++) std::remove((root + directories[i]).c_str());
+
+	LINFO << expected.size() << " images checked, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+#include <config.hpp>
+
+#include <utils/numerics.hpp>
+#include <utils/sparse_vector.hpp>
+#include <utils/logger.hpp>
+
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+_INITIALIZE_EASYLOGGINGPP
+
+/// Number of visual words of the generated vectors.
+static const uint32_t s_num_words = 4096;
+/// Largest allowed difference between the pair based and the structure of arrays scores.
+static const float s_tolerance = 1e-5f;
+
+/// Records the position pairs an intersection reports.
+struct PositionRecorder {
+	std::vector< std::pair<size_t, size_t> > positions;
+
+	inline void operator()(size_t i, size_t j) {
+		positions.push_back(std::pair<size_t, size_t>(i, j));
+	}
+};
+
+/// Returns a sparse vector with size distinct random indices and positive values.
+static numerics::sparse_vector_t random_vector(size_t size, std::mt19937 &rng) {
+	std::vector<uint32_t> words(s_num_words);
+	for(uint32_t i=0; i<s_num_words; i++) words[i] = i;
+	std::shuffle(words.begin(), words.end(), rng);
+	words.resize(MIN(size, (size_t)s_num_words));
+	std::sort(words.begin(), words.end());
+
+	std::uniform_real_distribution<float> value(0.5f, 8.f);
+	numerics::sparse_vector_t vector(words.size());
+	for(size_t i=0; i<words.size(); i++) vector[i] = std::pair<uint32_t, float>(words[i], value(rng));
+	return vector;
+}
+
+/// Checks the intersection kernels and the scores of a pair of vectors against the plain merge
+/// and the pair based functions.  Returns the number of failed checks.
+static uint32_t check_pair(const numerics::sparse_vector_t &pairs0, const numerics::sparse_vector_t &pairs1,
+	const std::vector<float> &idf_weights) {
+
+	const numerics::SparseVector vector0(pairs0), vector1(pairs1);
+	const numerics::SparseVectorView view0(vector0), view1(vector1);
+	uint32_t num_failed = 0;
+
+	PositionRecorder merged;
+	numerics::intersect_merge(vector0.indices(), vector0.size(), vector1.indices(), vector1.size(), 0, 0, merged);
+
+	PositionRecorder dispatched;
+	numerics::intersect(view0, view1, dispatched);
+	if(dispatched.positions != merged.positions) {
+		LERROR << "intersect differs from the merge for sizes " << pairs0.size() << " and " << pairs1.size();
+		num_failed++;
+	}
+
+	// both galloping directions, whatever intersect would have picked for these sizes
+	PositionRecorder galloping, galloping_swapped;
+	numerics::intersect_galloping(vector0.indices(), vector0.size(), vector1.indices(), vector1.size(), false, galloping);
+	numerics::intersect_galloping(vector1.indices(), vector1.size(), vector0.indices(), vector0.size(), true, galloping_swapped);
+	if(galloping.positions != merged.positions || galloping_swapped.positions != merged.positions) {
+		LERROR << "intersect_galloping differs from the merge for sizes " << pairs0.size() << " and " << pairs1.size();
+		num_failed++;
+	}
+
+#if defined(__SSE2__) && defined(__GNUC__)
+	PositionRecorder blocks;
+	numerics::intersect_blocks(vector0.indices(), vector0.size(), vector1.indices(), vector1.size(), blocks);
+	if(blocks.positions != merged.positions) {
+		LERROR << "intersect_blocks differs from the merge for sizes " << pairs0.size() << " and " << pairs1.size();
+		num_failed++;
+	}
+#endif
+
+	// an empty vector scores 0 / 0 with the pair based functions, so only the intersection is compared
+	if(pairs0.empty() || pairs1.empty()) {
+		if(!merged.positions.empty()) num_failed++;
+		return num_failed;
+	}
+
+	const float min_hist_pairs = numerics::min_hist(pairs0, pairs1, idf_weights);
+	const float min_hist = numerics::min_hist(view0, view1, idf_weights);
+	if(fabs(min_hist - min_hist_pairs) > s_tolerance) {
+		LERROR << "min_hist is " << min_hist << " instead of " << min_hist_pairs << " for sizes " << pairs0.size() <<
+			" and " << pairs1.size();
+		num_failed++;
+	}
+
+	const float cos_sim_pairs = numerics::cos_sim(pairs0, pairs1, idf_weights);
+	const float cos_sim = numerics::cos_sim(view0, view1, idf_weights);
+	if(fabs(cos_sim - cos_sim_pairs) > s_tolerance) {
+		LERROR << "cos_sim is " << cos_sim << " instead of " << cos_sim_pairs << " for sizes " << pairs0.size() <<
+			" and " << pairs1.size();
+		num_failed++;
+	}
+
+	const numerics::SparseVector &l1_0 = numerics::normalize(view0, idf_weights, numerics::NORM_L1);
+	const numerics::SparseVector &l1_1 = numerics::normalize(view1, idf_weights, numerics::NORM_L1);
+	const float min_hist_normalized = numerics::min_hist_normalized(l1_0, l1_1);
+	if(fabs(min_hist_normalized - min_hist_pairs) > s_tolerance) {
+		LERROR << "min_hist_normalized is " << min_hist_normalized << " instead of " << min_hist_pairs << " for sizes " <<
+			pairs0.size() << " and " << pairs1.size();
+		num_failed++;
+	}
+
+	return num_failed;
+}
+
+/// Checks that the structure of arrays intersections and scores equal the pair based ones, for
+/// sizes which are not multiples of the SSE2 block size, sizes skewed past s_galloping_ratio and
+/// empty vectors.
+int main(int argc, char *argv[]) {
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> idf(0.f, 4.f);
+	std::vector<float> idf_weights(s_num_words);
+	for(uint32_t i=0; i<s_num_words; i++) idf_weights[i] = idf(rng);
+
+	const size_t sizes[] = { 0, 1, 3, 4, 5, 7, 8, 13, 64, 127, 500, 1021 };
+	const size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+	const size_t skewed_sizes[][2] = {
+		{ 1, numerics::s_galloping_ratio + 1 },
+		{ 3, 3 * numerics::s_galloping_ratio + 5 },
+		{ 7, 7 * numerics::s_galloping_ratio + 1 },
+		{ 13, 13 * numerics::s_galloping_ratio + 3 },
+		{ 2, 4000 }
+	};
+	const size_t num_skewed_sizes = sizeof(skewed_sizes) / sizeof(skewed_sizes[0]);
+	const uint32_t num_trials = 20;
+
+	uint32_t num_checks = 0, num_failed = 0;
+	for(uint32_t trial=0; trial<num_trials; trial++) {
+		for(size_t a=0; a<num_sizes; a++) {
+			for(size_t b=0; b<num_sizes; b++) {
+				const numerics::sparse_vector_t &pairs0 = random_vector(sizes[a], rng);
+				const numerics::sparse_vector_t &pairs1 = random_vector(sizes[b], rng);
+				num_failed += check_pair(pairs0, pairs1, idf_weights);
+				num_checks++;
+			}
+		}
+		for(size_t s=0; s<num_skewed_sizes; s++) {
+			const numerics::sparse_vector_t &pairs0 = random_vector(skewed_sizes[s][0], rng);
+			const numerics::sparse_vector_t &pairs1 = random_vector(skewed_sizes[s][1], rng);
+			num_failed += check_pair(pairs0, pairs1, idf_weights);
+			num_failed += check_pair(pairs1, pairs0, idf_weights);
+			num_checks += 2;
+		}
+	}
+
+	// a vector intersected with itself matches at every position
+	const numerics::sparse_vector_t &pairs = random_vector(257, rng);
+	num_failed += check_pair(pairs, pairs, idf_weights);
+	num_checks++;
+
+	LINFO << num_checks << " vector pairs checked, " << num_failed << " failures";
+	return num_failed == 0 ? 0 : 1;
+}
@@ -62,7 +62,8 @@ int main(int argc, char *argv[]) {
   int numImages = 50;
   std::vector<PTR_LIB::shared_ptr<const Image> > images(numImages);
   if(rank==0) {
-    images = simple_dataset.random_images(numImages);
+    const ImageRange &sample = simple_dataset.random_images(numImages);
+    images.assign(sample.begin(), sample.end());
     std::vector<MPI_Request> requests(numImages*(procs - 1));
     std::vector<uint64_t> ids(numImages);
     for (int i = 0; i < numImages; i++) {
@@ -80,7 +81,8 @@ int main(int argc, char *argv[]) {
     }
   }
 #else
-  std::vector<PTR_LIB::shared_ptr<const Image> > images = simple_dataset.random_images(200);
+  const ImageRange &sample = simple_dataset.random_images(200);
+  std::vector<PTR_LIB::shared_ptr<const Image> > images(sample.begin(), sample.end());
 #endif
   vt.train(simple_dataset, train_params, images);
 
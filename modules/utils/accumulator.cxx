@@ -0,0 +1,123 @@
+#include "accumulator.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+
+/// Use the hash table when a query is expected to touch fewer than 1 / s_hash_ratio of the ids.
+static const uint64_t s_hash_ratio = 32;
+/// Smallest hash table capacity, must be a power of two.
+static const uint64_t s_min_hash_capacity = 1024;
+
+ScoreAccumulator::ScoreAccumulator() : hashed(false), hash_mask(0) {
+
+}
+
+void ScoreAccumulator::reset(uint64_t num_ids, uint64_t expected_touched) {
+	this->clear();
+
+	hashed = expected_touched * s_hash_ratio < num_ids;
+	if (hashed) {
+		uint64_t capacity = s_min_hash_capacity;
+		while (capacity < 2 * expected_touched) capacity <<= 1;
+		if (hash_keys.size() < capacity) {
+			hash_keys.assign(capacity, 0);
+			hash_counts.assign(capacity, 0);
+		}
+		hash_mask = hash_keys.size() - 1;
+	} else if (dense_counts.size() < num_ids) {
+		dense_counts.resize(num_ids, 0);
+	}
+}
+
+void ScoreAccumulator::hash_add(uint64_t id, uint32_t value) {
+	uint64_t slot = hash_id(id) & hash_mask;
+	while (hash_keys[slot] != 0 && hash_keys[slot] != id + 1) {
+		slot = (slot + 1) & hash_mask;
+	}
+	if (hash_keys[slot] == 0) {
+		hash_keys[slot] = id + 1;
+		touched.push_back(slot);
+		if (2 * touched.size() > hash_keys.size()) {
+			hash_counts[slot] = value;
+			hash_grow();
+			return;
+		}
+	}
+	hash_counts[slot] += value;
+}
+
+void ScoreAccumulator::hash_grow() {
+	std::vector<uint64_t> old_keys(hash_keys.size() * 2, 0);
+	std::vector<uint32_t> old_counts(hash_counts.size() * 2, 0);
+	old_keys.swap(hash_keys);
+	old_counts.swap(hash_counts);
+	hash_mask = hash_keys.size() - 1;
+
+	std::vector<uint64_t> old_touched;
+	old_touched.swap(touched);
+	touched.reserve(old_touched.size());
+	for (size_t i = 0; i < old_touched.size(); i++) {
+		uint64_t key = old_keys[old_touched[i]];
+		uint64_t slot = hash_id(key - 1) & hash_mask;
+		while (hash_keys[slot] != 0) slot = (slot + 1) & hash_mask;
+		hash_keys[slot] = key;
+		hash_counts[slot] = old_counts[old_touched[i]];
+		touched.push_back(slot);
+	}
+}
+
+uint32_t ScoreAccumulator::score(uint64_t id) const {
+	if (!hashed) {
+		return id < dense_counts.size() ? dense_counts[id] : 0;
+	}
+	if (hash_keys.empty()) return 0;
+	uint64_t slot = hash_id(id) & hash_mask;
+	while (hash_keys[slot] != 0) {
+		if (hash_keys[slot] == id + 1) return hash_counts[slot];
+		slot = (slot + 1) & hash_mask;
+	}
+	return 0;
+}
+
+uint64_t ScoreAccumulator::num_touched() const {
+	return touched.size();
+}
+
+void ScoreAccumulator::top(size_t k, std::vector<entry_t> &top) const {
+	top.resize(touched.size());
+	if (!hashed) {
+		for (size_t i = 0; i < touched.size(); i++) {
+			top[i] = entry_t(dense_counts[touched[i]], touched[i]);
+		}
+	} else {
+		for (size_t i = 0; i < touched.size(); i++) {
+			top[i] = entry_t(hash_counts[touched[i]], hash_keys[touched[i]] - 1);
+		}
+	}
+
+	if (k < top.size()) {
+		std::nth_element(top.begin(), top.begin() + k, top.end(), match_greater<uint32_t>);
+		top.resize(k);
+	}
+	std::sort(top.begin(), top.end(), match_greater<uint32_t>);
+}
+
+void ScoreAccumulator::clear() {
+	if (!hashed) {
+		for (size_t i = 0; i < touched.size(); i++) {
+			dense_counts[touched[i]] = 0;
+		}
+	} else {
+		for (size_t i = 0; i < touched.size(); i++) {
+			hash_keys[touched[i]] = 0;
+			hash_counts[touched[i]] = 0;
+		}
+	}
+	touched.clear();
+}
+
+ScoreAccumulator &ScoreAccumulator::thread_instance() {
+	static thread_local ScoreAccumulator accumulator;
+	accumulator.clear();
+	return accumulator;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+/// Orders (score, id) matches by descending score and then by ascending id.  Every search ranks
+/// its matches with it, so equal scores come out in the same order whichever path scored them.
+template<class Score>
+inline bool match_greater(const std::pair<Score, uint64_t> &a, const std::pair<Score, uint64_t> &b) {
+	return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+/// Accumulates integer scores for a sparse set of image ids, for example the number of visual
+/// words an image shares with a query.  Two storage modes are supported: a dense array of
+/// counters indexed by id (plus a list of the touched ids), and a small open addressing hash
+/// table used when a query is expected to touch only a tiny fraction of the id space.  In both
+/// cases clearing the accumulator costs O(touched) rather than O(number of ids), so the
+/// accumulator can be reused across queries without depending on the database size.
+class ScoreAccumulator {
+public:
+	typedef std::pair<uint32_t, uint64_t> entry_t; /// (score, id)
+
+	ScoreAccumulator();
+
+	/// Prepares the accumulator for scoring ids in the range [0, num_ids).  expected_touched is
+	/// an upper bound on the number of add(...) calls (ex. the total length of the posting lists
+	/// that will be scanned) and is used to choose between the dense and the hashed storage.
+	void reset(uint64_t num_ids, uint64_t expected_touched);
+
+	/// Adds value to the score of the given id.
+	inline void add(uint64_t id, uint32_t value = 1) {
+		if (!hashed) {
+			uint32_t &count = dense_counts[id];
+			if (count == 0) touched.push_back(id);
+			count += value;
+		} else {
+			hash_add(id, value);
+		}
+	}
+
+	/// Returns the score of the given id (zero if it was never added to).
+	uint32_t score(uint64_t id) const;
+
+	/// Returns the number of distinct ids with a non zero score.
+	uint64_t num_touched() const;
+
+	/// Writes the k highest scoring (score, id) entries into top, sorted by descending score and
+	/// then by ascending id (see match_greater).  Uses a partial selection so the cost is O(touched + k log k).
+	void top(size_t k, std::vector<entry_t> &top) const;
+
+	/// Zeros all touched entries, the cost is proportional to the number of touched ids.
+	void clear();
+
+	/// Returns an accumulator owned by the calling thread, which allows search calls to reuse
+	/// their scratch memory between queries.  The returned accumulator is cleared.
+	static ScoreAccumulator &thread_instance();
+
+protected:
+
+	void hash_add(uint64_t id, uint32_t value);
+	void hash_grow();
+
+	bool hashed; /// True if the hash table is used instead of the dense counters.
+
+	std::vector<uint32_t> dense_counts; /// Dense counters, grows to the largest id space seen.
+	std::vector<uint64_t> touched; /// Ids (dense mode) or slot indices (hash mode) with non zero scores.
+
+	std::vector<uint64_t> hash_keys; /// Hash table keys, stored as id + 1 so that zero marks an empty slot.
+	std::vector<uint32_t> hash_counts; /// Hash table values.
+	uint64_t hash_mask; /// Hash table capacity - 1, the capacity is a power of two.
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+
+/// Read only view of a contiguous array which is owned elsewhere (ex. a std::vector or a memory
+/// mapped file).  Provides the subset of the std::vector interface used to read arrays, so code
+/// can work on either storage.  The view must not outlive the storage it points to.
+template <typename T>
+class ArrayView {
+public:
+	typedef T value_type;
+	typedef const T *iterator;
+	typedef const T *const_iterator;
+
+	ArrayView() : ptr(0), length(0) { }
+	ArrayView(const T *data, size_t size) : ptr(data), length(size) { }
+	ArrayView(const std::vector<T> &data) : ptr(data.empty() ? 0 : &data[0]), length(data.size()) { }
+
+	inline const T *data() const { return ptr; }
+	inline size_t size() const { return length; }
+	inline bool empty() const { return length == 0; }
+
+	inline const T *begin() const { return ptr; }
+	inline const T *end() const { return ptr + length; }
+
+	inline const T &operator[](size_t i) const { return ptr[i]; }
+	inline const T &front() const { return ptr[0]; }
+	inline const T &back() const { return ptr[length - 1]; }
+
+protected:
+	const T *ptr;
+	size_t length;
+};
+
+/// ArrayView which optionally shares the ownership of the viewed array, so it can be returned by
+/// functions (ex. Dataset::load_vec_feature) without copying the array and stays valid after a
+/// cache evicted it.  Copying the view never allocates.
+template <typename T>
+class SharedArrayView : public ArrayView<T> {
+public:
+	SharedArrayView() { }
+	/// Views the array and keeps it alive.
+	SharedArrayView(const PTR_LIB::shared_ptr<const std::vector<T> > &data) : owner(data) {
+		if(data) {
+			this->ptr = data->empty() ? 0 : &(*data)[0];
+			this->length = data->size();
+		}
+	}
+	/// Views size elements starting at data, which are kept alive by owner.
+	SharedArrayView(const T *data, size_t size, const PTR_LIB::shared_ptr<const void> &owner) :
+		ArrayView<T>(data, size), owner(owner) { }
+
+protected:
+	PTR_LIB::shared_ptr<const void> owner; /// Keeps the viewed array alive, may be empty.
+};
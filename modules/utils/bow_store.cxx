@@ -0,0 +1,258 @@
+#include "bow_store.hpp"
+#include "filesystem.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+/// "BOWS"
+static const uint32_t s_bow_store_magic = 0x53574f42;
+static const uint32_t s_bow_store_version = 2;
+/// Size of the header of version 1 stores, which have no stamp.
+static const uint64_t s_bow_store_v1_header_size = 32;
+/// Number of frequencies converted at a time when the store is written.
+static const size_t s_copy_chunk_size = 1 << 16;
+
+struct BowStoreHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t encoding;
+	uint32_t reserved;
+	uint64_t num_images;
+	uint64_t num_entries;
+	uint64_t stamp; /// Since version 2.
+};
+
+/// Byte offsets of the arrays of a store.
+struct BowStoreLayout {
+	uint64_t offsets, words, frequencies, total_size;
+
+	static uint64_t align(uint64_t offset) { return (offset + 7) & ~(uint64_t)7; }
+
+	BowStoreLayout(const BowStoreHeader &header) {
+		offsets = align(header.version == 1 ? s_bow_store_v1_header_size : sizeof(BowStoreHeader));
+		words = offsets + sizeof(uint64_t) * (header.num_images + 1);
+		frequencies = align(words + sizeof(uint32_t) * header.num_entries);
+		total_size = frequencies + (uint64_t)header.encoding * header.num_entries;
+	}
+};
+
+BowStore::BowStore() : store_num_images(0), store_num_entries(0), store_stamp(0), tf_encoding(ENCODING_FLOAT),
+	offsets(0), words(0), frequencies(0) {
+
+}
+
+bool BowStore::open(const std::string &file_path) {
+	close();
+
+	PTR_LIB::shared_ptr<MappedFile> file = PTR_LIB::make_shared<MappedFile>();
+	if(!file->open(file_path) || file->size() < s_bow_store_v1_header_size) return false;
+
+	const BowStoreHeader &header = *(const BowStoreHeader *)file->data();
+	if(header.magic != s_bow_store_magic || (header.version != 1 && header.version != s_bow_store_version)) return false;
+	if(header.version != 1 && file->size() < sizeof(BowStoreHeader)) return false;
+	if(header.encoding != ENCODING_UINT8 && header.encoding != ENCODING_UINT16 && header.encoding != ENCODING_FLOAT) return false;
+	const BowStoreLayout layout(header);
+	if(file->size() < layout.total_size) return false;
+
+	// candidates are loaded in random order
+	file->advise(MappedFile::ADVICE_RANDOM);
+
+	mapped_file = file;
+	store_num_images = header.num_images;
+	store_num_entries = header.num_entries;
+	store_stamp = header.version == 1 ? 0 : header.stamp;
+	tf_encoding = (Encoding)header.encoding;
+	offsets = (const uint64_t *)(file->data() + layout.offsets);
+	words = (const uint32_t *)(file->data() + layout.words);
+	frequencies = file->data() + layout.frequencies;
+	return true;
+}
+
+void BowStore::close() {
+	mapped_file.reset();
+	store_num_images = store_num_entries = store_stamp = 0;
+	offsets = 0;
+	words = 0;
+	frequencies = 0;
+}
+
+bool BowStore::is_open() const {
+	return (bool)mapped_file;
+}
+
+uint64_t BowStore::num_images() const {
+	return store_num_images;
+}
+
+uint64_t BowStore::num_entries() const {
+	return store_num_entries;
+}
+
+BowStore::Encoding BowStore::encoding() const {
+	return tf_encoding;
+}
+
+uint64_t BowStore::stamp() const {
+	return store_stamp;
+}
+
+numerics::SparseVector BowStore::load(uint64_t id) const {
+	numerics::SparseVector bow_descriptors;
+	if(id >= store_num_images) return bow_descriptors;
+
+	const uint64_t begin = offsets[id], size = offsets[id + 1] - begin;
+	bow_descriptors.resize(size);
+	if(size == 0) return bow_descriptors;
+
+	memcpy(bow_descriptors.indices(), words + begin, sizeof(uint32_t) * size);
+	float *values = bow_descriptors.values();
+	switch(tf_encoding) {
+		case ENCODING_UINT8: {
+			const uint8_t *counts = (const uint8_t *)frequencies + begin;
+			for(uint64_t i=0; i<size; i++) values[i] = counts[i];
+			break;
+		}
+		case ENCODING_UINT16: {
+			const uint16_t *counts = (const uint16_t *)frequencies + begin;
+			for(uint64_t i=0; i<size; i++) values[i] = counts[i];
+			break;
+		}
+		case ENCODING_FLOAT:
+			memcpy(values, (const float *)frequencies + begin, sizeof(float) * size);
+			break;
+	}
+	return bow_descriptors;
+}
+
+numerics::SparseVectorView BowStore::view(uint64_t id) const {
+	if(tf_encoding != ENCODING_FLOAT) return numerics::SparseVectorView(PTR_LIB::make_shared<const numerics::SparseVector>(load(id)));
+	if(id >= store_num_images) return numerics::SparseVectorView();
+
+	const uint64_t begin = offsets[id], size = offsets[id + 1] - begin;
+	return numerics::SparseVectorView(words + begin, (const float *)frequencies + begin, size, mapped_file);
+}
+
+void BowStore::prefetch(const std::vector<uint64_t> &ids) const {
+	if(!mapped_file) return;
+
+	// (begin, end) entry ranges, merged when the vectors are adjacent in the store
+	std::vector< std::pair<uint64_t, uint64_t> > entries;
+	for(size_t i=0; i<ids.size(); i++) {
+		if(ids[i] >= store_num_images || offsets[ids[i]] == offsets[ids[i] + 1]) continue;
+		if(!entries.empty() && entries.back().second == offsets[ids[i]]) entries.back().second = offsets[ids[i] + 1];
+		else entries.push_back(std::make_pair(offsets[ids[i]], offsets[ids[i] + 1]));
+	}
+	if(entries.empty()) return;
+
+	const uint64_t words_offset = (const char *)words - mapped_file->data();
+	const uint64_t frequencies_offset = frequencies - mapped_file->data();
+	std::vector< std::pair<uint64_t, uint64_t> > ranges;
+	ranges.reserve(2 * entries.size());
+	for(size_t i=0; i<entries.size(); i++) {
+		const uint64_t count = entries[i].second - entries[i].first;
+		ranges.push_back(std::make_pair(words_offset + sizeof(uint32_t) * entries[i].first, sizeof(uint32_t) * count));
+		ranges.push_back(std::make_pair(frequencies_offset + (uint64_t)tf_encoding * entries[i].first, (uint64_t)tf_encoding * count));
+	}
+	mapped_file->prefault(ranges);
+}
+
+BowStoreWriter::BowStoreWriter(const std::string &file_path, uint64_t stamp) : file_path(file_path), stamp(stamp),
+	tf_encoding(BowStore::ENCODING_UINT8), success(true) {
+
+	filesystem::create_file_directory(file_path);
+	words_path = file_path + ".words";
+	frequencies_path = file_path + ".frequencies";
+	words_stream.open(words_path.c_str(), std::ios::binary | std::ios::trunc);
+	frequencies_stream.open(frequencies_path.c_str(), std::ios::binary | std::ios::trunc);
+	success = words_stream.is_open() && frequencies_stream.is_open();
+	offsets.push_back(0);
+}
+
+BowStoreWriter::~BowStoreWriter() {
+	if(words_stream.is_open()) words_stream.close();
+	if(frequencies_stream.is_open()) frequencies_stream.close();
+	filesystem::remove_file(words_path);
+	filesystem::remove_file(frequencies_path);
+}
+
+bool BowStoreWriter::add(uint64_t id, const numerics::SparseVectorView &bow_descriptors) {
+	if(!success || id + 1 < offsets.size()) return false;
+
+	// skipped ids have empty vectors
+	const uint64_t begin = offsets.back();
+	offsets.resize(id + 1, begin);
+	offsets.push_back(begin + bow_descriptors.size());
+	if(bow_descriptors.empty()) return true;
+
+	const float *values = bow_descriptors.values();
+	for(size_t i=0; i<bow_descriptors.size() && tf_encoding != BowStore::ENCODING_FLOAT; i++) {
+		if(values[i] < 0.f || values[i] != floorf(values[i]) || values[i] > 65535.f) tf_encoding = BowStore::ENCODING_FLOAT;
+		else if(values[i] > 255.f) tf_encoding = BowStore::ENCODING_UINT16;
+	}
+
+	words_stream.write((const char *)bow_descriptors.indices(), sizeof(uint32_t) * bow_descriptors.size());
+	frequencies_stream.write((const char *)values, sizeof(float) * bow_descriptors.size());
+	success = (words_stream.rdstate() & std::ofstream::failbit) == 0 &&
+		(frequencies_stream.rdstate() & std::ofstream::failbit) == 0;
+	return success;
+}
+
+bool BowStoreWriter::close() {
+	words_stream.close();
+	frequencies_stream.close();
+	if(!success) return false;
+
+	BowStoreHeader header;
+	memset(&header, 0, sizeof(BowStoreHeader));
+	header.magic = s_bow_store_magic;
+	header.version = s_bow_store_version;
+	header.encoding = tf_encoding;
+	header.num_images = offsets.size() - 1;
+	header.num_entries = offsets.back();
+	header.stamp = stamp;
+	const BowStoreLayout layout(header);
+
+	std::ofstream ofs(file_path.c_str(), std::ios::binary | std::ios::trunc);
+	std::ifstream words_input(words_path.c_str(), std::ios::binary);
+	std::ifstream frequencies_input(frequencies_path.c_str(), std::ios::binary);
+	const char padding[8] = { 0 };
+
+	ofs.write((const char *)&header, sizeof(BowStoreHeader));
+	ofs.write(padding, layout.offsets - sizeof(BowStoreHeader));
+	ofs.write((const char *)&offsets[0], sizeof(uint64_t) * offsets.size());
+
+	std::vector<uint32_t> word_chunk(s_copy_chunk_size);
+	for(uint64_t i=0; i<header.num_entries; i+=s_copy_chunk_size) {
+		const size_t n = (size_t)MIN(header.num_entries - i, s_copy_chunk_size);
+		words_input.read((char *)&word_chunk[0], sizeof(uint32_t) * n);
+		ofs.write((const char *)&word_chunk[0], sizeof(uint32_t) * n);
+	}
+	ofs.write(padding, layout.frequencies - (layout.words + sizeof(uint32_t) * header.num_entries));
+
+	std::vector<float> frequency_chunk(s_copy_chunk_size);
+	std::vector<uint8_t> uint8_chunk(s_copy_chunk_size);
+	std::vector<uint16_t> uint16_chunk(s_copy_chunk_size);
+	for(uint64_t i=0; i<header.num_entries; i+=s_copy_chunk_size) {
+		const size_t n = (size_t)MIN(header.num_entries - i, s_copy_chunk_size);
+		frequencies_input.read((char *)&frequency_chunk[0], sizeof(float) * n);
+		switch(tf_encoding) {
+			case BowStore::ENCODING_UINT8:
+				for(size_t j=0; j<n; j++) uint8_chunk[j] = (uint8_t)frequency_chunk[j];
+				ofs.write((const char *)&uint8_chunk[0], sizeof(uint8_t) * n);
+				break;
+			case BowStore::ENCODING_UINT16:
+				for(size_t j=0; j<n; j++) uint16_chunk[j] = (uint16_t)frequency_chunk[j];
+				ofs.write((const char *)&uint16_chunk[0], sizeof(uint16_t) * n);
+				break;
+			case BowStore::ENCODING_FLOAT:
+				ofs.write((const char *)&frequency_chunk[0], sizeof(float) * n);
+				break;
+		}
+	}
+
+	success = (words_input.rdstate() & std::ifstream::failbit) == 0 &&
+		(frequencies_input.rdstate() & std::ifstream::failbit) == 0 &&
+		(ofs.rdstate() & std::ofstream::failbit) == 0;
+	return success;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "config.hpp"
+#include "sparse_vector.hpp"
+#include "mapped_file.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <memory>
+
+/// Packed store holding the BoW vectors of all images of a dataset in one file, in compressed
+/// sparse row layout: an offset array indexed by image id, the words of all vectors, and their
+/// term frequencies encoded with the smallest type which holds them exactly (uint8, uint16 or
+/// float).  The file is memory mapped, so loading a vector touches its pages instead of opening
+/// a file per image.
+class BowStore {
+public:
+	/// Encodings of the term frequencies.
+	enum Encoding {
+		ENCODING_UINT8 = 1,
+		ENCODING_UINT16 = 2,
+		ENCODING_FLOAT = 4
+	};
+
+	BowStore();
+
+	/// Maps the store at the specified location.  Returns true if successful, false otherwise.
+	bool open(const std::string &file_path);
+
+	/// Unmaps the store.
+	void close();
+
+	/// Returns true if a store is mapped.
+	bool is_open() const;
+
+	/// Returns the number of image ids covered by the store, ie. the largest id + 1.
+	uint64_t num_images() const;
+
+	/// Returns the total number of (word, frequency) entries.
+	uint64_t num_entries() const;
+
+	/// Returns the encoding of the term frequencies.
+	Encoding encoding() const;
+
+	/// Returns the stamp the store was written with (see BowStoreWriter), 0 if it has none.
+	uint64_t stamp() const;
+
+	/// Returns the BoW vector of an image, empty if it has none or the id is not in the store.
+	numerics::SparseVector load(uint64_t id) const;
+
+	/// Returns a view of the BoW vector of an image.  With ENCODING_FLOAT the view points into the
+	/// mapped file and keeps it alive, otherwise it owns a decoded copy.
+	numerics::SparseVectorView view(uint64_t id) const;
+
+	/// Starts reading the vectors of the given images in the background (see MappedFile::prefault)
+	/// and returns immediately.  Ids should be sorted, vectors of consecutive ids are read as one
+	/// range.
+	void prefetch(const std::vector<uint64_t> &ids) const;
+
+protected:
+	BowStore(const BowStore &);
+	BowStore &operator=(const BowStore &);
+
+	PTR_LIB::shared_ptr<MappedFile> mapped_file;
+	uint64_t store_num_images, store_num_entries, store_stamp;
+	Encoding tf_encoding;
+	const uint64_t *offsets;
+	const uint32_t *words;
+	const char *frequencies;
+};
+
+/// Writes a BowStore one image at a time, so that the vectors of a dataset never have to be held
+/// in memory together.  The words and frequencies are buffered in temporary files next to the
+/// output, the store itself is written by close once the encoding of the frequencies is known.
+class BowStoreWriter {
+public:
+	/// Starts a store at the specified location.  stamp is written to the header, so that readers
+	/// can tell which version of the data the vectors were computed from (ex. the idf weights
+	/// of normalized vectors).
+	BowStoreWriter(const std::string &file_path, uint64_t stamp = 0);
+
+	/// Removes the temporary files, the store is only written by close.
+	~BowStoreWriter();
+
+	/// Adds the BoW vector of an image.  Ids must be increasing, skipped ids have empty vectors.
+	/// Returns false if the id is not larger than the previous one or a write failed.
+	bool add(uint64_t id, const numerics::SparseVectorView &bow_descriptors);
+
+	/// Writes the store.  Returns true if successful, false otherwise.
+	bool close();
+
+protected:
+	BowStoreWriter(const BowStoreWriter &);
+	BowStoreWriter &operator=(const BowStoreWriter &);
+
+	std::string file_path, words_path, frequencies_path;
+	std::ofstream words_stream, frequencies_stream;
+	std::vector<uint64_t> offsets; /// Offset of the vector of every id added so far, plus the end.
+	uint64_t stamp;
+	BowStore::Encoding tf_encoding; /// Smallest encoding holding every frequency added so far.
+	bool success;
+};
@@ -0,0 +1,123 @@
+#include "buffer_pool.hpp"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+BufferPool::BufferPool() : fd(-1), capacity_bytes(0), cached_bytes(0), num_hits(0), num_misses(0) {
+
+}
+
+BufferPool::~BufferPool() {
+	close();
+}
+
+bool BufferPool::open(const std::string &file_path, uint64_t capacity) {
+	close();
+
+#ifndef WIN32
+	fd = ::open(file_path.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+#else
+	stream.open(file_path.c_str(), std::ios::binary);
+	if(!stream.is_open()) return false;
+#endif
+
+	capacity_bytes = capacity;
+	return true;
+}
+
+void BufferPool::close() {
+	std::lock_guard<std::mutex> lock(mutex);
+#ifndef WIN32
+	if(fd >= 0) ::close(fd);
+#else
+	if(stream.is_open()) stream.close();
+#endif
+	fd = -1;
+	lru.clear();
+	entries.clear();
+	cached_bytes = 0;
+	num_hits = 0;
+	num_misses = 0;
+}
+
+bool BufferPool::read(uint64_t offset, uint64_t length, void *data) const {
+#ifndef WIN32
+	char *output = (char *)data;
+	while(length > 0) {
+		const ssize_t num_read = pread(fd, output, length, offset);
+		if(num_read <= 0) return false;
+		output += num_read;
+		offset += num_read;
+		length -= num_read;
+	}
+	return true;
+#else
+	std::lock_guard<std::mutex> lock(mutex);
+	stream.clear();
+	stream.seekg(offset, std::ios::beg);
+	stream.read((char *)data, length);
+	return (stream.rdstate() & std::ifstream::failbit) == 0;
+#endif
+}
+
+BufferPool::buffer_t BufferPool::read(uint64_t key, const std::vector<range_t> &ranges) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::unordered_map<uint64_t, Entry>::iterator it = entries.find(key);
+		if(it != entries.end()) {
+			lru.splice(lru.begin(), lru, it->second.position);
+			num_hits++;
+			return it->second.buffer;
+		}
+	}
+
+	// read without holding the lock, so that cached buffers can be served meanwhile
+	num_misses++;
+	uint64_t length = 0;
+	for(size_t i=0; i<ranges.size(); i++) length += ranges[i].second;
+	PTR_LIB::shared_ptr< std::vector<char> > buffer = PTR_LIB::make_shared< std::vector<char> >(length);
+	uint64_t position = 0;
+	for(size_t i=0; i<ranges.size(); i++) {
+		if(ranges[i].second > 0 && !read(ranges[i].first, ranges[i].second, &(*buffer)[position])) return buffer_t();
+		position += ranges[i].second;
+	}
+	if(length > capacity_bytes) return buffer;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::unordered_map<uint64_t, Entry>::iterator it = entries.find(key);
+	if(it != entries.end()) return it->second.buffer; // read by another thread meanwhile
+
+	while(cached_bytes + length > capacity_bytes && !lru.empty()) {
+		std::unordered_map<uint64_t, Entry>::iterator evicted = entries.find(lru.back());
+		cached_bytes -= evicted->second.buffer->size();
+		entries.erase(evicted);
+		lru.pop_back();
+	}
+
+	lru.push_front(key);
+	Entry &entry = entries[key];
+	entry.buffer = buffer;
+	entry.position = lru.begin();
+	cached_bytes += length;
+	return buffer;
+}
+
+uint64_t BufferPool::capacity() const {
+	return capacity_bytes;
+}
+
+uint64_t BufferPool::size() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return cached_bytes;
+}
+
+uint64_t BufferPool::hits() const {
+	return num_hits;
+}
+
+uint64_t BufferPool::misses() const {
+	return num_misses;
+}
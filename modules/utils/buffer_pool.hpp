@@ -0,0 +1,67 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <unordered_map>
+
+/// Cache of byte ranges of a read only file, bounded by a byte budget.  Ranges are read with pread
+/// on a miss and the least recently used ones are dropped once the budget is exceeded.  Returned
+/// buffers are reference counted, so a buffer which is still in use stays valid after it is
+/// evicted (the memory used can then briefly exceed the budget).  Safe to use from several threads.
+class BufferPool {
+public:
+	typedef PTR_LIB::shared_ptr<const std::vector<char> > buffer_t;
+	typedef std::pair<uint64_t, uint64_t> range_t; /// (offset, length) in bytes
+
+	BufferPool();
+	~BufferPool();
+
+	/// Opens the file at the specified location, at most capacity bytes are cached.  Returns true
+	/// if successful, false otherwise.
+	bool open(const std::string &file_path, uint64_t capacity);
+
+	/// Closes the file and drops all cached buffers.
+	void close();
+
+	/// Returns the concatenated contents of the given ranges, cached under key.  Returns 0 if the
+	/// file could not be read.  Buffers larger than the capacity are returned without caching.
+	buffer_t read(uint64_t key, const std::vector<range_t> &ranges);
+
+	/// Reads length bytes at offset into data, without caching.  Returns true if successful.
+	bool read(uint64_t offset, uint64_t length, void *data) const;
+
+	/// Returns the maximum and the current number of cached bytes.
+	uint64_t capacity() const;
+	uint64_t size() const;
+
+	/// Returns the number of reads served from the cache and from the file.
+	uint64_t hits() const;
+	uint64_t misses() const;
+
+protected:
+	BufferPool(const BufferPool &);
+	BufferPool &operator=(const BufferPool &);
+
+	struct Entry {
+		buffer_t buffer;
+		std::list<uint64_t>::iterator position; /// position in lru
+	};
+
+	int fd; /// file descriptor used by pread
+	mutable std::mutex mutex; /// guards the members below, and the stream on platforms without pread
+	mutable std::ifstream stream; /// file stream on platforms without pread
+	uint64_t capacity_bytes, cached_bytes;
+	std::list<uint64_t> lru; /// cached keys, most recently used first
+	std::unordered_map<uint64_t, Entry> entries;
+
+	std::atomic<uint64_t> num_hits, num_misses;
+};
@@ -105,6 +105,30 @@ class SingleCache {
     return u;
   } 
 
+  // Loads k into the cache if it is missing.  Unlike operator(), the value is loaded without
+  // holding the lock, so several threads (ex. the I/O threads of a Prefetcher) load in parallel.
+  // Only the locking version can be prefetched into.
+  template<bool L = B> typename std::enable_if<L>::type prefetch(const K& k) { 
+    bool cached;
+    #pragma omp critical
+    {
+      cached = _container.left.find(k) != _container.left.end();
+    }
+    if (cached) return;
+
+    V v = _fn(k);
+    #pragma omp critical
+    {
+      if (_container.left.find(k) == _container.left.end()) insert(k,v); 
+    }
+  }
+
+  template<bool L = B> typename std::enable_if<L>::type prefetch(const std::vector<K> &k) { 
+    for(size_t i=0; i<k.size(); i++) {
+      prefetch(k[i]);
+    }
+  }
+
   uint64_t capacity()         const { return _capacity; }
   // uint64_t hits() const { return _hits; }
   // uint64_t misses() const { return _misses; }
@@ -123,6 +147,11 @@ class SingleCache {
   uint64_t _hits, _misses;
 }; 
 
+/// The feature caches hold shared pointers, so a cache hit only copies the pointer and the
+/// returned feature stays valid after it is evicted.
+typedef PTR_LIB::shared_ptr<const numerics::SparseVector> bow_feature_ptr_t;
+typedef PTR_LIB::shared_ptr<const std::vector<float> > vec_feature_ptr_t;
+
 #if ENABLE_MULTITHREADING && ENABLE_OPENMP
 /// Implements a SingleCache for each OpenMP thread.
 template <typename K, typename V> 
@@ -229,16 +258,16 @@ class MultiRingPriorityCache {
   double _lookup_time_total;
 }; 
 
-typedef MultiRingPriorityCache<uint64_t, numerics::sparse_vector_t> bow_ring_priority_cache_t;
-typedef MultiRingCache<uint64_t, numerics::sparse_vector_t> bow_ring_cache_t;
-typedef MultiCache<uint64_t, numerics::sparse_vector_t> bow_multi_cache_t;
+typedef MultiRingPriorityCache<uint64_t, bow_feature_ptr_t> bow_ring_priority_cache_t;
+typedef MultiRingCache<uint64_t, bow_feature_ptr_t> bow_ring_cache_t;
+typedef MultiCache<uint64_t, bow_feature_ptr_t> bow_multi_cache_t;
 
-typedef MultiRingPriorityCache<uint64_t,  std::vector<float>> vec_ring_priority_cache_t;
-typedef MultiRingCache<uint64_t,  std::vector<float>> vec_ring_cache_t;
-typedef MultiCache<uint64_t, std::vector<float>> vec_multi_cache_t;
+typedef MultiRingPriorityCache<uint64_t, vec_feature_ptr_t> vec_ring_priority_cache_t;
+typedef MultiRingCache<uint64_t, vec_feature_ptr_t> vec_ring_cache_t;
+typedef MultiCache<uint64_t, vec_feature_ptr_t> vec_multi_cache_t;
 
 #endif
 
-typedef SingleCache<true, uint64_t, numerics::sparse_vector_t> bow_single_cache_t;
-typedef SingleCache<true, uint64_t, std::vector<float>> vec_single_cache_t;
+typedef SingleCache<true, uint64_t, bow_feature_ptr_t> bow_single_cache_t;
+typedef SingleCache<true, uint64_t, vec_feature_ptr_t> vec_single_cache_t;
 
@@ -1,8 +1,37 @@
 #include "dataset.hpp"
 #include "filesystem.hpp"
+#include "hash.hpp"
 #include "vision.hpp"
+#include "sharded_dataset.hpp"
 
 #include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_set>
+#include <atomic>
+
+/// Matrix features whose packed stores are opened by the SimpleDataset constructors.
+static const char *const s_mat_features[] = { "keypoints", "descriptors" };
+/// Size of the stack buffers feature paths are formatted into.
+static const size_t s_max_path_length = 4096;
+/// Image paths are relative to the data directory and start with the scanned directory.
+static const char s_images_prefix[] = "/images/";
+static const size_t s_images_prefix_length = sizeof(s_images_prefix) - 1;
+/// Location of the manifest of the images directory relative to the data directory.
+static const char s_manifest_file[] = "/images.manifest";
+
+/// Formats <prefix>/feats/<feat_name>/<level0>/<level1>/<id>.<feat_name> into buffer, where
+/// level0 and level1 are the bits 20+ and 10-19 of the id.  Returns false if it does not fit.
+static bool format_feature_path(char *buffer, size_t size, const char *prefix, uint64_t id, const char *feat_name) {
+	const uint32_t level0 = id >> 20;
+	const uint32_t level1 = (id - ((uint64_t)level0 << 20)) >> 10;
+	const int length = snprintf(buffer, size, "%s/feats/%s/%04u/%04u/%09llu.%s", prefix, feat_name,
+		level0, level1, (unsigned long long)id, feat_name);
+	return length >= 0 && (size_t)length < size;
+}
 
 Dataset::Dataset(const std::string &base_location) {
 	data_directory = base_location;
@@ -23,19 +52,134 @@ std::string Dataset::location(const std::string &relative_path) const {
 }
 
 
-std::vector< PTR_LIB::shared_ptr<const Image> > Dataset::all_images() const {
-	std::vector< PTR_LIB::shared_ptr< const Image> > images(this->num_images());
-	for (uint64_t i = 0; i < this->num_images(); i++) {
-		images[i] = this->image(i);
+ImageRange::ImageRange() : dataset(0), first(0), count(0) {
+
+}
+
+ImageRange::ImageRange(const Dataset &dataset, uint64_t first, uint64_t count) : dataset(&dataset), first(first), count(count) {
+
+}
+
+ImageRange::ImageRange(const Dataset &dataset, const std::vector<uint64_t> &ids) : dataset(&dataset),
+	id_list(PTR_LIB::make_shared< const std::vector<uint64_t> >(ids)), first(0), count(ids.size()) {
+
+}
+
+ImageRange::ImageRange(const std::vector< PTR_LIB::shared_ptr<const Image> > &images) : dataset(0),
+	image_list(PTR_LIB::make_shared< const std::vector< PTR_LIB::shared_ptr<const Image> > >(images)), first(0), count(images.size()) {
+
+}
+
+PTR_LIB::shared_ptr<const Image> ImageRange::operator[](uint64_t i) const {
+	if(image_list) return (*image_list)[first + i];
+	return dataset->image(id(i));
+}
+
+uint64_t ImageRange::num_chunks(uint64_t chunk_size) const {
+	return (count + chunk_size - 1) / chunk_size;
+}
+
+ImageRange ImageRange::chunk(uint64_t index, uint64_t chunk_size) const {
+	ImageRange range = *this;
+	const uint64_t begin = MIN(index * chunk_size, count);
+	range.first = first + begin;
+	range.count = MIN(chunk_size, count - begin);
+	return range;
+}
+
+ImageRange ImageRange::sample(uint64_t count, uint64_t seed) const {
+	if(count >= this->count) return *this;
+
+	// Floyd's algorithm: the j-th draw picks a position in [0, n - count + j], and takes the
+	// largest one instead if it was already drawn, which leaves every subset equally likely.
+	std::mt19937_64 generator(seed);
+	std::unordered_set<uint64_t> drawn;
+	drawn.reserve(count);
+	std::vector<uint64_t> positions;
+	positions.reserve(count);
+	for(uint64_t j=this->count - count; j<this->count; j++) {
+		uint64_t position = std::uniform_int_distribution<uint64_t>(0, j)(generator);
+		if(!drawn.insert(position).second) {
+			position = j;
+			drawn.insert(j);
+		}
+		positions.push_back(position);
 	}
-	return images;
+	std::sort(positions.begin(), positions.end());
+
+	if(image_list) {
+		std::vector< PTR_LIB::shared_ptr<const Image> > images(count);
+		for(uint64_t i=0; i<count; i++) images[i] = (*image_list)[first + positions[i]];
+		return ImageRange(images);
+	}
+	for(uint64_t i=0; i<count; i++) positions[i] = id(positions[i]);
+	return ImageRange(*dataset, positions);
 }
 
-std::vector< PTR_LIB::shared_ptr<const Image> > Dataset::random_images(size_t count) const {
-	std::vector< PTR_LIB::shared_ptr< const Image> > all = this->all_images();
-	std::random_shuffle(all.begin(), all.end());
-	std::vector< PTR_LIB::shared_ptr< const Image> > images(all.begin(), all.begin() + count);
-	return images;
+ImageShuffler::ImageShuffler(const ImageRange &range, uint64_t seed) : range(range), generator(seed), num_drawn(0) {
+
+}
+
+bool ImageShuffler::next(uint64_t &id) {
+	if(num_drawn == range.size()) return false;
+
+	// swaps position num_drawn with a random later one, positions missing from swapped still
+	// hold their own image
+	const uint64_t position = std::uniform_int_distribution<uint64_t>(num_drawn, range.size() - 1)(generator);
+	std::unordered_map<uint64_t, uint64_t>::iterator it = swapped.find(position);
+	const uint64_t chosen = it == swapped.end() ? position : it->second;
+	if(position != num_drawn) {
+		std::unordered_map<uint64_t, uint64_t>::iterator current = swapped.find(num_drawn);
+		swapped[position] = current == swapped.end() ? num_drawn : current->second;
+	}
+	swapped.erase(num_drawn);
+	num_drawn++;
+
+	id = range.id(chosen);
+	return true;
+}
+
+uint64_t Dataset::num_ids() const {
+	return this->num_images();
+}
+
+bool Dataset::has_image(uint64_t id) const {
+	return id < this->num_images();
+}
+
+ImageRange Dataset::all_images() const {
+	const uint64_t num_ids = this->num_ids();
+	if(num_ids == this->num_images()) return ImageRange(*this, 0, num_ids);
+
+	// removed images leave gaps in the ids
+	std::vector<uint64_t> ids;
+	ids.reserve(this->num_images());
+	for(uint64_t id=0; id<num_ids; id++) {
+		if(this->has_image(id)) ids.push_back(id);
+	}
+	return ImageRange(*this, ids);
+}
+
+ImageRange Dataset::random_images(size_t count, uint64_t seed) const {
+	const uint64_t num_ids = this->num_ids(), num_images = this->num_images();
+	// dense ids are a span, sampled with Floyd's algorithm; when more than half of the images
+	// are drawn, listing the ids is not more expensive than drawing them
+	if(num_ids == num_images || 2 * (uint64_t)count > num_images) return this->all_images().sample(count, seed);
+
+	// draws ids uniformly and retries on gaps and on ids already drawn, every draw hits a new image
+	// with probability at least (num_images - count) / num_ids >= num_images / (2 * num_ids)
+	std::mt19937_64 generator(seed);
+	std::uniform_int_distribution<uint64_t> id_distribution(0, num_ids - 1);
+	std::unordered_set<uint64_t> drawn;
+	drawn.reserve(count);
+	std::vector<uint64_t> ids;
+	ids.reserve(count);
+	while(ids.size() < count) {
+		const uint64_t id = id_distribution(generator);
+		if(this->has_image(id) && drawn.insert(id).second) ids.push_back(id);
+	}
+	std::sort(ids.begin(), ids.end());
+	return ImageRange(*this, ids);
 }
 
 std::ostream& operator<< (std::ostream &out, const Dataset &dataset) {
@@ -45,13 +189,20 @@ std::ostream& operator<< (std::ostream &out, const Dataset &dataset) {
 
 SimpleDataset::SimpleDataset(const std::string &base_location, size_t cache_size) : Dataset(base_location) { 
 	this->construct_dataset();
+	this->open_bow_store(bow_store_location());
+	this->open_feature_stores();
+	if(filesystem::file_exists(normalized_bow_store_location())) {
+		normalized_store = PTR_LIB::make_shared<BowStore>();
+		if(!normalized_store->open(normalized_bow_store_location())) normalized_store.reset();
+	}
 	if(cache_size > 0) {
 		bow_feature_cache = PTR_LIB::make_shared<bow_feature_cache_t>(
-			boost::function<numerics::sparse_vector_t(uint64_t)>(boost::bind(&SimpleDataset::load_bow_feature_cache, this, _1)),
+			boost::function<bow_feature_ptr_t(uint64_t)>(boost::bind(&SimpleDataset::load_bow_feature_cache, this, _1)),
 			 cache_size);
 		vec_feature_cache = PTR_LIB::make_shared<vec_feature_cache_t>(
-			boost::function< std::vector<float>(uint64_t) >(boost::bind(&SimpleDataset::load_vec_feature_cache, this, _1)),
+			boost::function<vec_feature_ptr_t(uint64_t)>(boost::bind(&SimpleDataset::load_vec_feature_cache, this, _1)),
 			 cache_size);
+		this->set_prefetch_queue_depth(Prefetcher::s_default_queue_depth);
 	}
 }
 
@@ -64,80 +215,132 @@ SimpleDataset::SimpleDataset(const std::string &base_location, const std::string
 		this->construct_dataset();
 		this->write(db_data_location);
 	}
+	this->open_bow_store(bow_store_location());
+	this->open_feature_stores();
+	if(filesystem::file_exists(normalized_bow_store_location())) {
+		normalized_store = PTR_LIB::make_shared<BowStore>();
+		if(!normalized_store->open(normalized_bow_store_location())) normalized_store.reset();
+	}
 	if(cache_size > 0) {
 		bow_feature_cache = PTR_LIB::make_shared<bow_feature_cache_t>(
-			boost::function<numerics::sparse_vector_t(uint64_t)>(boost::bind(&SimpleDataset::load_bow_feature_cache, this, _1)),
+			boost::function<bow_feature_ptr_t(uint64_t)>(boost::bind(&SimpleDataset::load_bow_feature_cache, this, _1)),
 			 cache_size);
 
 		vec_feature_cache = PTR_LIB::make_shared<vec_feature_cache_t>(
-			boost::function< std::vector<float>(uint64_t) >(boost::bind(&SimpleDataset::load_vec_feature_cache, this, _1)),
+			boost::function<vec_feature_ptr_t(uint64_t)>(boost::bind(&SimpleDataset::load_vec_feature_cache, this, _1)),
 			 cache_size);
+		this->set_prefetch_queue_depth(Prefetcher::s_default_queue_depth);
 	}
 }
 
 SimpleDataset::~SimpleDataset() { }
 
 PTR_LIB::shared_ptr<Image> SimpleDataset::image(uint64_t id) const {
-	const std::string &image_path = id_image_map.right.at(id);
+	const char *image_path = image_location(id);
+	if (!image_path) throw std::out_of_range("SimpleDataset::image");
 
 	PTR_LIB::shared_ptr<Image> current_image = PTR_LIB::make_shared<SimpleImage>(image_path, id);
 	return current_image;
 }
 
+bool SimpleDataset::has_image(uint64_t id) const {
+	return image_table.contains(id);
+}
+
+const char *SimpleDataset::image_location(uint64_t id) const {
+	return image_table.path(id);
+}
+
+bool SimpleDataset::find_image(const char *location, uint64_t &id) const {
+	return image_table.find(location, id);
+}
+
+bool SimpleDataset::insert_image(uint64_t id, const char *path, size_t length) {
+	return image_table.insert(id, path, length);
+}
+
+bool SimpleDataset::remove_image(uint64_t id) {
+	return image_table.remove(id);
+}
+
 void SimpleDataset::construct_dataset() {
-	const std::vector<std::string> &image_file_paths = filesystem::list_files(data_directory + "/images/", ".jpg");
-	for (size_t i = 0; i < image_file_paths.size(); i++) {
-		id_image_map.insert(boost::bimap<std::string, uint64_t>::value_type( image_file_paths[i].substr(data_directory.size(), image_file_paths[i].size() - data_directory.size()), i));
+	// the manifest may not be writable, the images are found all the same
+	ImageManifest::ScanResult result;
+	this->rescan(result);
+}
+
+std::string SimpleDataset::manifest_location() const {
+	return this->location() + s_manifest_file;
+}
+
+bool SimpleDataset::rescan(ImageManifest::ScanResult &result, bool full) {
+	ImageManifest manifest;
+	if (!manifest.read(manifest_location())) {
+		std::vector<ImageManifest::File> files;
+		for (uint64_t id = 0; id < image_table.num_ids(); id++) {
+			const char *path = image_location(id);
+			if (!path || strncmp(path, s_images_prefix, s_images_prefix_length) != 0) continue;
+			ImageManifest::File file;
+			file.path = path + s_images_prefix_length;
+			file.id = id;
+			files.push_back(file);
+		}
+		manifest.reset(files, image_table.num_ids());
 	}
+	if (!manifest.scan(data_directory + "/images", ".jpg", result, full)) return false;
+
+	for (size_t i = 0; i < result.removed.size(); i++) this->remove_image(result.removed[i]);
+	const std::vector<ImageManifest::File> &files = manifest.files();
+	if (!result.added.empty()) image_table.reserve(manifest.next_id());
+	std::string path(s_images_prefix);
+	for (size_t i = 0; i < files.size(); i++) {
+		if (has_image(files[i].id)) continue;
+		path.resize(s_images_prefix_length);
+		path.append(files[i].path);
+		this->insert_image(files[i].id, path.c_str(), path.size());
+	}
+	return manifest.write(manifest_location());
 }
 
 bool SimpleDataset::read(const std::string &db_data_location) {
 	if (!filesystem::file_exists(db_data_location)) return false;
+	if (image_table.open(db_data_location)) return true;
+
+	// dataset files written before the image table
 	std::ifstream ifs(db_data_location, std::ios::binary);
 	
 	uint64_t num_images;
 	ifs.read((char *)&num_images, sizeof(uint64_t));
+	if ((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+	image_table.clear();
+	image_table.reserve(num_images);
 
+	char image_location[UINT16_MAX];
 	for (uint64_t i = 0; i < num_images; i++) {
 		
 		uint64_t image_id;
 		uint16_t length;
 		ifs.read((char *)&image_id, sizeof(uint64_t));
 		ifs.read((char *)&length, sizeof(uint16_t));
-
-		std::string image_location;
-		image_location.resize(length);
-		
-		ifs.read((char *)&image_location[0], sizeof(char)* length);
-		PTR_LIB::shared_ptr<const SimpleImage> simage = PTR_LIB::make_shared<const SimpleImage>(image_location, image_id);
-		this->add_image(simage);
+		ifs.read(image_location, sizeof(char)* length);
+		if ((ifs.rdstate() & std::ifstream::failbit) != 0) break;
+		this->insert_image(image_id, image_location, length);
 
 	}
+	image_table.build_index();
 	return (ifs.rdstate() & std::ifstream::failbit) == 0;
 }
 
 bool SimpleDataset::write(const std::string &db_data_location) {
-	filesystem::create_file_directory(db_data_location);
-	
-	std::ofstream ofs(db_data_location, std::ios::binary | std::ios::trunc);
-	uint64_t num_images = this->num_images();
-	ofs.write((const char *)&num_images, sizeof(uint64_t));
-
-	for (uint64_t i = 0; i < this->num_images(); i++) {
-		PTR_LIB::shared_ptr<SimpleDataset::SimpleImage> image = std::static_pointer_cast<SimpleDataset::SimpleImage>(this->image(i));
-		const std::string &image_location = image->location();
-		uint64_t image_id = image->id;
-		uint16_t length = image_location.size();
-		ofs.write((const char *)&image_id, sizeof(uint64_t));
-		ofs.write((const char *)&length, sizeof(uint16_t));
-		ofs.write((const char *)&image_location[0], sizeof(char)* length);
-	}
-
-	return (ofs.rdstate() & std::ofstream::failbit) == 0;
+	return image_table.write(db_data_location);
 }
 
 uint64_t SimpleDataset::num_images() const {
-	return id_image_map.size();
+	return image_table.size();
+}
+
+uint64_t SimpleDataset::num_ids() const {
+	return image_table.num_ids();
 }
 
 SimpleDataset::SimpleImage::SimpleImage(const std::string &path, uint64_t imageid) : Image(imageid) {
@@ -145,23 +348,20 @@ SimpleDataset::SimpleImage::SimpleImage(const std::string &path, uint64_t imagei
 }
 
 std::string SimpleDataset::SimpleImage::feature_path(const std::string &feat_name) const {
-	uint32_t level0 = id >> 20;
-	uint32_t level1 = (id - (level0 << 20)) >> 10;
-
-	std::stringstream ss;
-	ss << "/feats/" << feat_name << "/" << 
-		std::setw(4) << std::setfill('0') << level0 << "/" <<
-		std::setw(4) << std::setfill('0') << level1 << "/" <<
-		std::setw(9) << std::setfill('0') << id << "." << feat_name;
-		
-	return ss.str();
+	char path[s_max_path_length];
+	if (!format_feature_path(path, sizeof(path), "", id, feat_name.c_str())) return std::string();
+	return path;
 }
 
 std::string SimpleDataset::SimpleImage::location() const {
 	return image_path;
 }
 
-numerics::sparse_vector_t SimpleDataset::load_bow_feature(uint64_t id) const {
+numerics::SparseVectorView SimpleDataset::load_bow_feature(uint64_t id) const {
+	// a store with float frequencies is viewed in place, caching it would only copy it
+	if(bow_store && id < bow_store->num_images() && bow_store->encoding() == BowStore::ENCODING_FLOAT) {
+		return bow_store->view(id);
+	}
 	if(bow_feature_cache) {
 		return (*bow_feature_cache)(id);
 	} else {
@@ -169,7 +369,7 @@ numerics::sparse_vector_t SimpleDataset::load_bow_feature(uint64_t id) const {
 	}
 }
 
-std::vector<float> SimpleDataset::load_vec_feature(uint64_t id) const {
+SharedArrayView<float> SimpleDataset::load_vec_feature(uint64_t id) const {
 	if(vec_feature_cache) {
 		return (*vec_feature_cache)(id);
 	} else {
@@ -177,54 +377,455 @@ std::vector<float> SimpleDataset::load_vec_feature(uint64_t id) const {
 	}
 }
 
-numerics::sparse_vector_t SimpleDataset::load_bow_feature_cache(uint64_t id) const {
+numerics::SparseVectorView SimpleDataset::load_normalized_bow_feature(uint64_t id) const {
+	if(!normalized_store) return numerics::SparseVectorView();
+	return normalized_store->view(id);
+}
+
+bool SimpleDataset::write_normalized_bow_features(const std::vector<float> &idf_weights, numerics::Norm norm, uint64_t stamp) {
+	// readers may still map the previous store, so it is replaced by a rename instead of in place
+	const std::string &store_path = normalized_bow_store_location();
+	const std::string packing_path = store_path + ".packing";
+	bool written = true;
+	{
+		BowStoreWriter writer(packing_path, stamp);
+		for(uint64_t id=0; id<image_table.num_ids() && written; id++) {
+			if(!has_image(id)) continue;
+			const numerics::SparseVectorView &bow_descriptors = load_bow_feature(id);
+			for(size_t i=0; i<bow_descriptors.size() && written; i++) written = bow_descriptors.index(i) < idf_weights.size();
+			if(written) written = writer.add(id, numerics::normalize(bow_descriptors, idf_weights, norm));
+		}
+		written = writer.close() && written;
+	}
+	PTR_LIB::shared_ptr<BowStore> store = PTR_LIB::make_shared<BowStore>();
+	if(!written || !filesystem::move_file(packing_path, store_path) || !store->open(store_path)) {
+		filesystem::remove_file(packing_path);
+		std::cerr << "Error writing the normalized BoW store " << store_path << std::endl;
+		return false;
+	}
+	normalized_store = store;
+	return true;
+}
+
+uint64_t SimpleDataset::normalized_bow_stamp() const {
+	return normalized_store ? normalized_store->stamp() : 0;
+}
+
+std::string SimpleDataset::normalized_bow_store_location() const {
+	return this->location() + "/feats/bow_normalized.bowstore";
+}
+
+Prefetcher::Ticket SimpleDataset::prefetch_bow_features(const std::vector<uint64_t> &ids) const {
+	if(bow_store) {
+		bow_store->prefetch(ids);
+		return Prefetcher::Ticket();
+	}
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	// the caches are only locked when OpenMP is enabled
+	if(bow_feature_cache) {
+		const PTR_LIB::shared_ptr<bow_feature_cache_t> cache = bow_feature_cache;
+		return submit_prefetch(ids, cache->capacity(), [cache](uint64_t id) { cache->prefetch(id); });
+	}
+#endif
+	return Prefetcher::Ticket();
+}
+
+Prefetcher::Ticket SimpleDataset::prefetch_vec_features(const std::vector<uint64_t> &ids) const {
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	if(vec_feature_cache) {
+		const PTR_LIB::shared_ptr<vec_feature_cache_t> cache = vec_feature_cache;
+		return submit_prefetch(ids, cache->capacity(), [cache](uint64_t id) { cache->prefetch(id); });
+	}
+#endif
+	return Prefetcher::Ticket();
+}
+
+Prefetcher::Ticket SimpleDataset::prefetch_normalized_bow_features(const std::vector<uint64_t> &ids) const {
+	if(normalized_store) normalized_store->prefetch(ids);
+	return Prefetcher::Ticket();
+}
+
+Prefetcher::Ticket SimpleDataset::submit_prefetch(const std::vector<uint64_t> &ids, uint64_t capacity, const Prefetcher::load_function_t &load) const {
+	if(!prefetcher || ids.empty()) return Prefetcher::Ticket();
+	if(ids.size() <= capacity) return prefetcher->submit(ids, load);
+	return prefetcher->submit(std::vector<uint64_t>(ids.begin(), ids.begin() + capacity), load);
+}
+
+void SimpleDataset::set_prefetch_queue_depth(uint32_t queue_depth) {
+	prefetcher.reset();
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	// features are only prefetched into the caches, which are only locked when OpenMP is enabled
+	if(queue_depth > 0 && (bow_feature_cache || vec_feature_cache)) {
+		prefetcher = PTR_LIB::make_shared<Prefetcher>(queue_depth);
+	}
+#endif
+}
+
+bool SimpleDataset::feature_location(uint64_t id, const char *feat_name, char *buffer, size_t size) const {
+	return format_feature_path(buffer, size, data_directory.c_str(), id, feat_name);
+}
+
+bow_feature_ptr_t SimpleDataset::load_bow_feature_cache(uint64_t id) const {
 	
 	SCOPED_TIMER_NOLOCK
 
-	numerics::sparse_vector_t bow_descriptors;
-	uint32_t level0 = id >> 20;
-	uint32_t level1 = (id - (level0 << 20)) >> 10;
-	std::stringstream ss;
-	ss <<  this->location() << "/feats/" << "bow_descriptors" << "/" << 
-	std::setw(4) << std::setfill('0') << level0 << "/" <<
-	std::setw(4) << std::setfill('0') << level1 << "/" <<
-	std::setw(9) << std::setfill('0') << id << "." << "bow_descriptors";
-	std::string location = ss.str();
-	// std::cout << "couldnt find " << location << std::endl;
-	if (!filesystem::file_exists(location)) return bow_descriptors;	
-	filesystem::load_sparse_vector(location, bow_descriptors);
+	if(bow_store && id < bow_store->num_images()) return PTR_LIB::make_shared<const numerics::SparseVector>(bow_store->load(id));
+	return load_bow_feature_file(id);
+}
+
+bow_feature_ptr_t SimpleDataset::load_bow_feature_file(uint64_t id) const {
+	PTR_LIB::shared_ptr<numerics::SparseVector> bow_descriptors = PTR_LIB::make_shared<numerics::SparseVector>();
+	char location[s_max_path_length];
+	if (!feature_location(id, "bow_descriptors", location, sizeof(location)) || !filesystem::file_exists(location)) return bow_descriptors;
+	filesystem::load_sparse_vector(location, *bow_descriptors);
 	return bow_descriptors;
 }
 
-std::vector<float> SimpleDataset::load_vec_feature_cache(uint64_t id) const {
+vec_feature_ptr_t SimpleDataset::load_vec_feature_cache(uint64_t id) const {
 	SCOPED_TIMER_NOLOCK
 
-	std::vector<float> vec_feature;
-	uint32_t level0 = id >> 20;
-	uint32_t level1 = (id - (level0 << 20)) >> 10;
-	std::stringstream ss;
-	ss <<  this->location() << "/feats/" << "datavec" << "/" << 
-	std::setw(4) << std::setfill('0') << level0 << "/" <<
-	std::setw(4) << std::setfill('0') << level1 << "/" <<
-	std::setw(9) << std::setfill('0') << id << "." << "datavec";
-	std::string location = ss.str();
-	if (!filesystem::file_exists(location)) return vec_feature;	
+	PTR_LIB::shared_ptr< std::vector<float> > vec_feature = PTR_LIB::make_shared< std::vector<float> >();
+	char location[s_max_path_length];
+	if (!feature_location(id, "datavec", location, sizeof(location)) || !filesystem::file_exists(location)) return vec_feature;
 	
-	filesystem::load_vector(location, vec_feature);
+	filesystem::load_vector(location, *vec_feature);
 	return vec_feature;
 }
 
+bool SimpleDataset::load_mat_feature(uint64_t id, const std::string &feat_name, cv::Mat &data) const {
+	SCOPED_TIMER_NOLOCK
+
+	std::map<std::string, PTR_LIB::shared_ptr<FeatureStore> >::const_iterator it = feature_stores.find(feat_name);
+	if(it != feature_stores.end() && it->second->contains(id)) return it->second->load(id, data);
+	char location[s_max_path_length];
+	if (!feature_location(id, feat_name.c_str(), location, sizeof(location)) || !filesystem::file_exists(location)) return false;
+	return filesystem::load_cvmat(location, data);
+}
+
+bool SimpleDataset::write_mat_feature(uint64_t id, const std::string &feat_name, const cv::Mat &data) {
+	bool written = false;
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+#pragma omp critical (simple_dataset_feature_writers)
+#endif
+	{
+		PTR_LIB::shared_ptr<FeatureStoreWriter> &writer = feature_writers[feat_name];
+		if(!writer) writer = PTR_LIB::make_shared<FeatureStoreWriter>(feature_store_location(feat_name));
+		written = writer->add(id, data);
+	}
+	return written;
+}
+
 bool SimpleDataset::add_image(const PTR_LIB::shared_ptr<const Image> &image) {
-	if (id_image_map.right.find(image->id) != id_image_map.right.end()) return false;
-	const PTR_LIB::shared_ptr<const SimpleDataset::SimpleImage> simage = std::static_pointer_cast<const SimpleDataset::SimpleImage>(image);
-	id_image_map.insert(boost::bimap<std::string, uint64_t>::value_type(simage->location(), simage->id));
-	return true;
+	const std::string &path = image->location();
+	return this->insert_image(image->id, path.c_str(), path.size());
 }
 
 PTR_LIB::shared_ptr<bow_feature_cache_t> SimpleDataset::cache() {
 	return bow_feature_cache;
 }
 
+bool SimpleDataset::open_bow_store(const std::string &file_path) {
+	if (!filesystem::file_exists(file_path)) return false;
+	PTR_LIB::shared_ptr<BowStore> store = PTR_LIB::make_shared<BowStore>();
+	if (!store->open(file_path)) return false;
+	bow_store = store;
+	bow_store_path = file_path;
+	return true;
+}
+
+bool SimpleDataset::write_bow_store(const std::string &file_path) {
+	// the store is built from the feature files, not from a previous store, and replaces it by a
+	// rename, so that readers still mapping the previous store keep reading its data
+	const std::string packing_path = file_path + ".packing";
+	bool written = true;
+	{
+		BowStoreWriter writer(packing_path);
+		for(uint64_t id=0; id<image_table.num_ids() && written; id++) {
+			if(has_image(id)) written = writer.add(id, *load_bow_feature_file(id));
+		}
+		written = writer.close() && written;
+	}
+	if(!written || !filesystem::move_file(packing_path, file_path)) {
+		filesystem::remove_file(packing_path);
+		return false;
+	}
+	return open_bow_store(file_path);
+}
+
+std::string SimpleDataset::bow_store_location() const {
+	return this->location() + "/feats/bow_descriptors.bowstore";
+}
+
+std::string SimpleDataset::feature_store_location(const std::string &feat_name) const {
+	return this->location() + "/feats/" + feat_name + ".featstore";
+}
+
+bool SimpleDataset::open_feature_store(const std::string &feat_name, const std::string &file_path) {
+	if (!filesystem::file_exists(file_path)) return false;
+	PTR_LIB::shared_ptr<FeatureStore> store = PTR_LIB::make_shared<FeatureStore>();
+	if (!store->open(file_path)) return false;
+	feature_stores[feat_name] = store;
+	feature_store_paths[feat_name] = file_path;
+	return true;
+}
+
+void SimpleDataset::open_feature_stores() {
+	for(size_t i=0; i<sizeof(s_mat_features) / sizeof(s_mat_features[0]); i++) {
+		this->open_feature_store(s_mat_features[i], feature_store_location(s_mat_features[i]));
+	}
+}
+
+bool SimpleDataset::write_feature_store(const std::string &feat_name, const std::string &file_path) {
+	flush_mat_features();
+
+	// images already in an open store keep their block, the others are read from their files
+	const std::string packing_path = file_path + ".packing";
+	filesystem::remove_file(packing_path);
+	bool written = true;
+	{
+		FeatureStoreWriter writer(packing_path);
+		for(uint64_t id=0; id<image_table.num_ids() && written; id++) {
+			cv::Mat data;
+			if(!has_image(id) || !load_mat_feature(id, feat_name, data)) continue;
+			written = writer.add(id, data);
+		}
+		written = writer.close() && written;
+	}
+
+	feature_stores.erase(feat_name);
+	feature_store_paths.erase(feat_name);
+	if(!written || !filesystem::move_file(packing_path, file_path) ||
+		!filesystem::move_file(FeatureStore::index_location(packing_path), FeatureStore::index_location(file_path))) {
+		filesystem::remove_file(packing_path);
+		filesystem::remove_file(FeatureStore::index_location(packing_path));
+		return false;
+	}
+	return open_feature_store(feat_name, file_path);
+}
+
+bool SimpleDataset::flush_mat_features() {
+	bool success = true;
+	typedef std::map<std::string, PTR_LIB::shared_ptr<FeatureStoreWriter> >::iterator it_type;
+	for(it_type it = feature_writers.begin(); it != feature_writers.end(); it++) {
+		success = it->second->close() && open_feature_store(it->first, feature_store_location(it->first)) && success;
+	}
+	feature_writers.clear();
+	return success;
+}
+
+/// Links or moves a file.  Hard links and renames do not cross filesystems, the file is then
+/// copied (and removed if moved).
+static bool transfer_file(const char *from, const char *to, SimpleDataset::Transfer transfer) {
+	if(transfer == SimpleDataset::TRANSFER_MOVE && filesystem::move_file(from, to)) return true;
+	if(!filesystem::link_file(from, to)) return false;
+	return transfer == SimpleDataset::TRANSFER_LINK || filesystem::remove_file(from);
+}
+
+bool SimpleDataset::shard(const std::vector<std::string> &new_locations, Partition partition, Transfer transfer, uint32_t num_threads) {
+	if(new_locations.empty()) return false;
+	// prefetches read the files which are moved, and written features must be in the stores
+	if(prefetcher) {
+		prefetcher->cancel();
+		prefetcher->wait();
+	}
+	if(!flush_mat_features()) return false;
+
+	const uint32_t num_shards = new_locations.size();
+	uint64_t min_id = UINT64_MAX, max_id = 0;
+	for(uint64_t id=0; id<image_table.num_ids(); id++) {
+		if(!has_image(id)) continue;
+		min_id = MIN(min_id, id);
+		max_id = id;
+	}
+
+	// the local ids of a shard follow the order of the global ids
+	std::vector< std::vector<uint64_t> > global_ids(num_shards);
+	for(uint64_t id=0; id<image_table.num_ids(); id++) {
+		if(!has_image(id)) continue;
+		const uint32_t shard = partition == PARTITION_HASH ? hash_id(id) % num_shards :
+			(uint32_t)((double)(id - min_id) * num_shards / (double)(max_id - min_id + 1));
+		global_ids[shard].push_back(id);
+	}
+
+	for(uint32_t s=0; s<num_shards; s++) {
+		ImageTable table;
+		std::vector<ImageManifest::File> files;
+		for(uint64_t local_id=0; local_id<global_ids[s].size(); local_id++) {
+			const char *path = image_location(global_ids[s][local_id]);
+			table.insert(local_id, path, strlen(path));
+			if(strncmp(path, s_images_prefix, s_images_prefix_length) != 0) continue;
+			ImageManifest::File file;
+			file.path = path + s_images_prefix_length;
+			file.id = local_id;
+			files.push_back(file);
+		}
+		table.build_index();
+		// the manifest records the ids, the first rescan of the shard stats its files
+		ImageManifest manifest;
+		manifest.reset(files, global_ids[s].size());
+		if(!table.write(ShardedDataset::dataset_location(new_locations[s])) ||
+			!manifest.write(new_locations[s] + s_manifest_file) ||
+			!ShardedDataset::write_global_ids(new_locations[s], global_ids[s])) {
+			std::cerr << "Error writing shard " << new_locations[s] << std::endl;
+			return false;
+		}
+	}
+
+	std::vector<std::string> feat_names;
+	const std::vector<std::string> &feature_directories = filesystem::list_directories(data_directory + "/feats");
+	for(size_t i=0; i<feature_directories.size(); i++) feat_names.push_back(filesystem::basename(feature_directories[i], true));
+
+	// every file is a separate round trip to the filesystem, so they are transferred by a pool
+	// of I/O threads
+	std::atomic<uint64_t> num_failed(0);
+	{
+		Prefetcher pool(MAX(num_threads, 1u));
+		for(uint32_t s=0; s<num_shards; s++) {
+			std::vector<uint64_t> local_ids(global_ids[s].size());
+			for(uint64_t i=0; i<local_ids.size(); i++) local_ids[i] = i;
+			const std::vector<uint64_t> &shard_global_ids = global_ids[s];
+			const std::string &shard_location = new_locations[s];
+			pool.submit(local_ids, [&, transfer](uint64_t local_id) {
+				const uint64_t id = shard_global_ids[local_id];
+				const char *path = image_location(id);
+				const std::string &from = data_directory + path, &to = shard_location + path;
+				if(!transfer_file(from.c_str(), to.c_str(), transfer)) num_failed++;
+
+				char from_feature[s_max_path_length], to_feature[s_max_path_length];
+				for(size_t f=0; f<feat_names.size(); f++) {
+					if(!feature_location(id, feat_names[f].c_str(), from_feature, sizeof(from_feature)) ||
+						!filesystem::file_exists(from_feature)) continue;
+					if(!format_feature_path(to_feature, sizeof(to_feature), shard_location.c_str(), local_id, feat_names[f].c_str()) ||
+						!transfer_file(from_feature, to_feature, transfer)) num_failed++;
+				}
+			});
+		}
+		pool.wait();
+	}
+	if(num_failed > 0) {
+		std::cerr << "Error transferring " << num_failed << " files to the shards" << std::endl;
+		return false;
+	}
+
+	std::vector<char> written(num_shards, 0);
+#if ENABLE_MULTITHREADING && ENABLE_OPENMP
+	#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int64_t s=0; s<(int64_t)num_shards; s++) {
+		written[s] = write_shard_stores(new_locations[s], global_ids[s]);
+	}
+	for(uint32_t s=0; s<num_shards; s++) {
+		if(written[s]) continue;
+		std::cerr << "Error writing the feature stores of shard " << new_locations[s] << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool SimpleDataset::write_shard_stores(const std::string &shard_location, const std::vector<uint64_t> &global_ids) const {
+	bool written = true;
+	if(bow_store) {
+		BowStoreWriter writer(shard_location + "/feats/bow_descriptors.bowstore");
+		for(uint64_t i=0; i<global_ids.size() && written; i++) written = writer.add(i, bow_store->view(global_ids[i]));
+		written = writer.close() && written;
+	}
+	if(normalized_store && written) {
+		BowStoreWriter writer(shard_location + "/feats/bow_normalized.bowstore", normalized_store->stamp());
+		for(uint64_t i=0; i<global_ids.size() && written; i++) written = writer.add(i, normalized_store->view(global_ids[i]));
+		written = writer.close() && written;
+	}
+	typedef std::map<std::string, PTR_LIB::shared_ptr<FeatureStore> >::const_iterator store_it_type;
+	for(store_it_type it = feature_stores.begin(); it != feature_stores.end() && written; it++) {
+		// the writer appends to an existing store
+		const std::string &store_path = shard_location + "/feats/" + it->first + ".featstore";
+		filesystem::remove_file(store_path);
+		filesystem::remove_file(FeatureStore::index_location(store_path));
+		FeatureStoreWriter writer(store_path);
+		for(uint64_t i=0; i<global_ids.size() && written; i++) {
+			cv::Mat data;
+			if(it->second->load(global_ids[i], data)) written = writer.add(i, data);
+		}
+		written = writer.close() && written;
+	}
+	return written;
+}
+
+void SimpleDataset::remap_ids(const std::vector<uint64_t> &new_ids) {
+	// prefetches load by the old ids
+	if(prefetcher) {
+		prefetcher->cancel();
+		prefetcher->wait();
+	}
+
+	image_table.remap_ids(new_ids);
+
+	ImageManifest manifest;
+	if(manifest.read(manifest_location())) {
+		manifest.remap_ids(new_ids);
+		if(!manifest.write(manifest_location())) std::cerr << "Error rewriting the manifest " << manifest_location() << std::endl;
+	}
+
+	std::vector<uint64_t> old_ids(new_ids.size());
+	for(uint64_t i=0; i<new_ids.size(); i++) old_ids[new_ids[i]] = i;
+
+	// the packed stores are keyed by the old ids, they are rewritten in the new order
+	if(bow_store) {
+		const std::string remapped_path = bow_store_path + ".remapped";
+		BowStoreWriter writer(remapped_path);
+		for(uint64_t i=0; i<old_ids.size(); i++) writer.add(i, bow_store->view(old_ids[i]));
+		const bool written = writer.close();
+		bow_store.reset();
+		if(!written || !filesystem::move_file(remapped_path, bow_store_path) || !open_bow_store(bow_store_path)) {
+			std::cerr << "Error rewriting the BoW store " << bow_store_path << std::endl;
+		}
+	}
+	if(normalized_store) {
+		const std::string &store_path = normalized_bow_store_location();
+		const std::string remapped_path = store_path + ".remapped";
+		BowStoreWriter writer(remapped_path, normalized_store->stamp());
+		for(uint64_t i=0; i<old_ids.size(); i++) writer.add(i, normalized_store->view(old_ids[i]));
+		const bool written = writer.close();
+		normalized_store.reset();
+		PTR_LIB::shared_ptr<BowStore> store = PTR_LIB::make_shared<BowStore>();
+		if(written && filesystem::move_file(remapped_path, store_path) && store->open(store_path)) normalized_store = store;
+		else std::cerr << "Error rewriting the normalized BoW store " << store_path << std::endl;
+	}
+	flush_mat_features();
+	typedef std::map<std::string, PTR_LIB::shared_ptr<FeatureStore> >::iterator store_it_type;
+	for(store_it_type it = feature_stores.begin(); it != feature_stores.end(); it++) {
+		const std::string &store_path = feature_store_paths[it->first];
+		const std::string remapped_path = store_path + ".remapped";
+		filesystem::remove_file(remapped_path);
+		bool written = true;
+		{
+			FeatureStoreWriter writer(remapped_path);
+			for(uint64_t i=0; i<old_ids.size() && written; i++) {
+				cv::Mat data;
+				if(it->second->load(old_ids[i], data)) written = writer.add(i, data);
+			}
+			written = writer.close() && written;
+		}
+		it->second->close();
+		if(!written || !filesystem::move_file(remapped_path, store_path) ||
+			!filesystem::move_file(FeatureStore::index_location(remapped_path), FeatureStore::index_location(store_path)) ||
+			!it->second->open(store_path)) {
+			std::cerr << "Error rewriting the feature store " << store_path << std::endl;
+		}
+	}
+
+	// cached features are keyed by the old ids
+	if(bow_feature_cache) {
+		bow_feature_cache = PTR_LIB::make_shared<bow_feature_cache_t>(
+			boost::function<bow_feature_ptr_t(uint64_t)>(boost::bind(&SimpleDataset::load_bow_feature_cache, this, _1)),
+			 bow_feature_cache->capacity());
+	}
+	if(vec_feature_cache) {
+		vec_feature_cache = PTR_LIB::make_shared<vec_feature_cache_t>(
+			boost::function<vec_feature_ptr_t(uint64_t)>(boost::bind(&SimpleDataset::load_vec_feature_cache, this, _1)),
+			 vec_feature_cache->capacity());
+	}
+}
+
 // std::vector<char> Dataset::load_data(const std::string &filename) {
 // 	std::ifstream input(filename, std::ios::binary);
 //     // copies all data into buffer
@@ -3,15 +3,127 @@
 
 #include "image.hpp"
 #include "cache.hpp"
+#include "bow_store.hpp"
+#include "feature_store.hpp"
+#include "prefetcher.hpp"
+#include "image_manifest.hpp"
+#include "image_table.hpp"
+#include "array_view.hpp"
 
 #include <memory>
-#include <boost/bimap.hpp>
+#include <map>
+#include <iterator>
+#include <random>
+#include <unordered_map>
 #include <sstream>
 #include <iomanip>
 
 typedef bow_single_cache_t bow_feature_cache_t;
 typedef vec_single_cache_t vec_feature_cache_t;
 
+class Dataset;
+
+/// Read only list of dataset images which creates the Image objects only when they are accessed,
+/// so that enumerating or sampling a dataset with millions of images does not allocate an Image
+/// per entry.  A range is either a span of consecutive ids, a list of ids, or a list of already
+/// constructed images.  Copies and chunks of a range share its list.
+class ImageRange {
+public:
+	/// Forward iterator over the images of a range.  Dereferencing creates the image, id() does not.
+	class const_iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef PTR_LIB::shared_ptr<const Image> value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const value_type *pointer;
+		typedef value_type reference;
+
+		const_iterator(const ImageRange *range, uint64_t position) : range(range), position(position) { }
+
+		value_type operator*() const { return (*range)[position]; }
+		uint64_t id() const { return range->id(position); }
+		const_iterator &operator++() { position++; return *this; }
+		const_iterator operator++(int) { const_iterator it = *this; position++; return it; }
+		bool operator==(const const_iterator &other) const { return position == other.position; }
+		bool operator!=(const const_iterator &other) const { return position != other.position; }
+
+	protected:
+		const ImageRange *range;
+		uint64_t position;
+	};
+
+	/// Constructs an empty range.
+	ImageRange();
+
+	/// Constructs the range of the count images with ids first, first + 1, ...
+	ImageRange(const Dataset &dataset, uint64_t first, uint64_t count);
+
+	/// Constructs the range of the given ids, in the given order.
+	ImageRange(const Dataset &dataset, const std::vector<uint64_t> &ids);
+
+	/// Constructs the range of the given images, so that code which already holds a list of
+	/// images can pass it wherever a range is expected.
+	ImageRange(const std::vector< PTR_LIB::shared_ptr<const Image> > &images);
+
+	/// Returns the number of images in the range.
+	uint64_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	/// Returns the id of the i-th image without creating the image.
+	uint64_t id(uint64_t i) const {
+		if(id_list) return (*id_list)[first + i];
+		if(image_list) return (*image_list)[first + i]->id;
+		return first + i;
+	}
+
+	/// Returns the i-th image.  The image is created by the dataset unless the range was
+	/// constructed from images.  Safe to call from several threads.
+	PTR_LIB::shared_ptr<const Image> operator[](uint64_t i) const;
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, count); }
+
+	/// Returns the number of chunks of chunk_size images the range splits into, the last one may
+	/// be shorter.  Chunks are the unit of work for parallel loops over a range:
+	///
+	///		for(int64_t c=0; c<(int64_t)range.num_chunks(chunk_size); c++) {
+	///			const ImageRange &images = range.chunk(c, chunk_size);
+	///			...
+	///		}
+	uint64_t num_chunks(uint64_t chunk_size) const;
+
+	/// Returns the images [index * chunk_size, (index + 1) * chunk_size) of the range.
+	ImageRange chunk(uint64_t index, uint64_t chunk_size) const;
+
+	/// Returns count distinct images of the range drawn uniformly at random from the seed, in
+	/// range order.  Uses Floyd's algorithm, so the cost is O(count) whatever the range size.
+	ImageRange sample(uint64_t count, uint64_t seed = 0) const;
+
+protected:
+	const Dataset *dataset;
+	PTR_LIB::shared_ptr<const std::vector<uint64_t> > id_list; /// set if the range is a list of ids
+	PTR_LIB::shared_ptr<const std::vector< PTR_LIB::shared_ptr<const Image> > > image_list; /// set if the range is a list of images
+	uint64_t first; /// first id of a span, or position of the range in its list
+	uint64_t count;
+};
+
+/// Visits the images of a range in random order, without materialising the permutation.  The
+/// draws are a Fisher-Yates shuffle which only records the positions it swapped, so drawing k
+/// images of a range costs O(k) time and memory.
+class ImageShuffler {
+public:
+	ImageShuffler(const ImageRange &range, uint64_t seed = 0);
+
+	/// Sets id to the next image id and returns true, returns false once every image was drawn.
+	bool next(uint64_t &id);
+
+protected:
+	ImageRange range;
+	std::mt19937_64 generator;
+	uint64_t num_drawn;
+	std::unordered_map<uint64_t, uint64_t> swapped; /// position -> position of the image moved there
+};
+
 /// The Dataset class is an abstract wrapper describing a dataset.  A dataset consiste of the actual
 /// data, plus a way to convert the images, or frames of a video into an integer index.  The dataset
 /// should at minimum provide an easy way to map image paths to unique integers.  For a sample implementation
@@ -49,6 +161,14 @@ public:
 	/// Returns the number of images in the dataset.
 	virtual uint64_t num_images() const = 0;
 
+	/// Returns the largest image id + 1.  Removed images leave gaps in the ids, so this may be
+	/// larger than num_images(): loops over the ids and arrays indexed by id use this bound, and
+	/// skip the ids for which has_image is false.  Defaults to num_images(), for dense ids.
+	virtual uint64_t num_ids() const;
+
+	/// Returns true if an image has the id.  Defaults to id < num_images(), for dense ids.
+	virtual bool has_image(uint64_t id) const;
+
 	/// Returns the absolute path of the data directory
 	std::string location() const;
 
@@ -59,17 +179,52 @@ public:
 	/// return false, otherwise returns true.
 	virtual bool add_image(const PTR_LIB::shared_ptr<const Image> &image) = 0 ;
 
-	/// Returns a vector of all images in the dataset.
-	std::vector<  PTR_LIB::shared_ptr< const Image> > all_images() const;
-
-	/// Returns a vector of random images in the dataset of size count.
-	std::vector<  PTR_LIB::shared_ptr< const Image> > random_images(size_t count) const;
-
-	/// @TODO: Shards the dataset to the new input locations, and returns the sharded datasets
-	std::vector<Dataset> shard(const std::vector<std::string> &new_locations);
-
-	virtual numerics::sparse_vector_t load_bow_feature(uint64_t id) const = 0;
-	virtual std::vector<float> load_vec_feature(uint64_t id) const = 0;
+	/// Returns the range of all images in the dataset, in id order.  The images are created as they
+	/// are accessed.  Dense ids give a span, otherwise the range lists the ids which have an image.
+	ImageRange all_images() const;
+
+	/// Returns count distinct random images of the dataset (all of them if count is larger), sorted
+	/// by id.  The sample only depends on the seed.  It costs O(count) for dense ids; with gaps in
+	/// the ids it costs O(count * num_ids() / num_images()) expected draws, and O(num_ids()) when
+	/// more than half of the images are drawn.
+	ImageRange random_images(size_t count, uint64_t seed = 0) const;
+
+	/// Returns the BoW feature of an image, empty if it has none.  The features are returned as
+	/// read only views which share the ownership of the cached or mapped data, so loading a cached
+	/// feature does not copy it.  The result converts to numerics::sparse_vector_t for code using
+	/// the pair layout.
+	virtual numerics::SparseVectorView load_bow_feature(uint64_t id) const = 0;
+	virtual SharedArrayView<float> load_vec_feature(uint64_t id) const = 0;
+	/// Returns the idf weighted, normalized BoW feature of an image written by
+	/// write_normalized_bow_features, empty if it has none.
+	virtual numerics::SparseVectorView load_normalized_bow_feature(uint64_t id) const = 0;
+	/// Writes the BoW feature of every image weighted by idf_weights and normalized (see
+	/// numerics::normalize), replacing the previous normalized features.  stamp identifies the
+	/// weights and the norm (see InvertedIndex::normalized_stamp) and is returned by
+	/// normalized_bow_stamp.  Returns true if successful, false otherwise.
+	virtual bool write_normalized_bow_features(const std::vector<float> &idf_weights, numerics::Norm norm, uint64_t stamp) = 0;
+	/// Returns the stamp the normalized BoW features were written with, 0 if there are none.
+	/// Normalized features with another stamp than the one of the current idf weights are stale.
+	virtual uint64_t normalized_bow_stamp() const = 0;
+
+	/// Starts loading the features of the given images in the background and returns
+	/// immediately, so that the later load_*_feature calls for them overlap with the reads
+	/// instead of waiting on each one in turn.  Ids should be sorted in the order the features
+	/// are used, and loaded in that order.  Returns the ticket to cancel the loads which have not
+	/// started yet, ex. once the caller is done with the features.
+	virtual Prefetcher::Ticket prefetch_bow_features(const std::vector<uint64_t> &ids) const = 0;
+	virtual Prefetcher::Ticket prefetch_vec_features(const std::vector<uint64_t> &ids) const = 0;
+	virtual Prefetcher::Ticket prefetch_normalized_bow_features(const std::vector<uint64_t> &ids) const = 0;
+
+	/// Loads a matrix feature of an image (ex. "keypoints" or "descriptors").  Returns false if
+	/// the image has none.
+	virtual bool load_mat_feature(uint64_t id, const std::string &feat_name, cv::Mat &data) const = 0;
+	/// Stores a matrix feature of an image.  Safe to call from several threads.  Returns true if
+	/// successful, false otherwise.
+	virtual bool write_mat_feature(uint64_t id, const std::string &feat_name, const cv::Mat &data) = 0;
+	/// Makes the features stored by write_mat_feature visible to load_mat_feature.  Must not run
+	/// concurrently with loads.  Returns true if successful, false otherwise.
+	virtual bool flush_mat_features() = 0;
 
 protected:
 	std::string	data_directory;  /// Holds the absolute path of the data.
@@ -106,7 +261,8 @@ public:
 
 	/// Creates a simple dataset from the images in base_location/images.  It is recommended
 	/// to then call write(...) to save the dataset so that it does not have to traverse the HDD
-	/// everytime we load the dataset.
+	/// everytime we load the dataset.  The images are found with rescan(...), so when the manifest
+	/// of an earlier scan exists only the changed directories are listed.
 	SimpleDataset(const std::string &base_location, size_t cache_size = 0);
 	
 	/// If a dataset file is location at db_data_location, will load that file from.  Otherwise,
@@ -115,15 +271,15 @@ public:
 	~SimpleDataset();
 
 	/// Writes the SimpleDataset out to the specified file.  If the containing directory does not 
-	/// exist, it will be automatically created.  The Dataset data is stored in a binary format
-	/// with num_images() entries of the form uint64_t, uint16_t, char * corresponding to an
-	/// image id, string length, and the image location string respectively.  Returns true if 
-	/// success, fail otherwise (checks the ofstream error bit).
+	/// exist, it will be automatically created.  The file is an ImageTable, which read maps
+	/// instead of parsing.  Returns true if success, fail otherwise.
 	bool write(const std::string &db_data_location);
 	
-	/// Reads the specified SimpleDataset.  See write(const std::string &db_data_location) for
-	/// more information about the binary format.  Returns true if success, false otherwise. 
-	/// (checks the ifstream error bit).
+	/// Reads the specified SimpleDataset.  Files written by write are memory mapped, the images
+	/// are then served from the file without parsing it (see ImageTable).  Files in the earlier
+	/// format, with num_images() entries of the form uint64_t, uint16_t, char * corresponding to
+	/// an image id, string length and image location, are parsed.  Returns true if success,
+	/// false otherwise.
 	bool read(const std::string &db_data_location);
 
 	/// Given a unique integer ID, returns an Image associated with that ID.
@@ -136,24 +292,181 @@ public:
 	/// Returns the number of images in the dataset.
 	uint64_t num_images() const;
 
+	/// Returns the largest image id + 1, see Dataset::num_ids.
+	uint64_t num_ids() const;
+
+	/// Returns true if an image has the id.
+	bool has_image(uint64_t id) const;
+
+	/// Returns the path of an image relative to the data directory (see SimpleImage::location),
+	/// or 0 if no image has the id.  Unlike image, this does not allocate.  The pointer is valid
+	/// until an image is added or removed.
+	const char *image_location(uint64_t id) const;
+
+	/// Sets id to the id of the image at the given location relative to the data directory (ex.
+	/// "/images/0001.jpg") and returns true, returns false if there is no such image.  A binary
+	/// search for datasets read from a file, a linear scan after images were added or removed.
+	bool find_image(const char *location, uint64_t &id) const;
+
 	/// Returns the corresponding feature path given a feature name (ex. "sift").
-	numerics::sparse_vector_t load_bow_feature(uint64_t id) const;
-	std::vector<float> load_vec_feature(uint64_t id) const;
+	numerics::SparseVectorView load_bow_feature(uint64_t id) const;
+	SharedArrayView<float> load_vec_feature(uint64_t id) const;
+	numerics::SparseVectorView load_normalized_bow_feature(uint64_t id) const;
+
+	/// Writes the normalized features to a packed store at normalized_bow_store_location(),
+	/// which is opened by the constructors if it exists.
+	bool write_normalized_bow_features(const std::vector<float> &idf_weights, numerics::Norm norm, uint64_t stamp);
+	uint64_t normalized_bow_stamp() const;
+
+	/// Returns the location of the packed store of the normalized BoW features,
+	/// <data_dir>/feats/bow_normalized.bowstore.
+	std::string normalized_bow_store_location() const;
+
+	/// Prefetches the features.  Features in a packed BoW store are read ahead by the kernel,
+	/// the others are loaded into the feature caches by a pool of I/O threads (see Prefetcher).
+	/// Without a cache nothing is prefetched, as the loaded features would be parsed again when
+	/// they are used.  At most the cache capacity is prefetched, so the prefetched features are
+	/// not evicted before they are used.
+	Prefetcher::Ticket prefetch_bow_features(const std::vector<uint64_t> &ids) const;
+	Prefetcher::Ticket prefetch_vec_features(const std::vector<uint64_t> &ids) const;
+	Prefetcher::Ticket prefetch_normalized_bow_features(const std::vector<uint64_t> &ids) const;
+
+	/// Sets the number of I/O threads used by the prefetch_*_features functions, 0 disables
+	/// prefetching.  Defaults to Prefetcher::s_default_queue_depth.  The threads are only started
+	/// if the dataset has feature caches (cache_size > 0) and OpenMP is enabled.
+	void set_prefetch_queue_depth(uint32_t queue_depth);
+
+	/// Loads a matrix feature from its packed store (see FeatureStore), or from the per image file
+	/// if the store does not hold the image.
+	bool load_mat_feature(uint64_t id, const std::string &feat_name, cv::Mat &data) const;
+	/// Appends a matrix feature to the store at feature_store_location(feat_name).  The appended
+	/// features are loaded from the store after flush_mat_features.  Only one process may write
+	/// a store at a time.
+	bool write_mat_feature(uint64_t id, const std::string &feat_name, const cv::Mat &data);
+	/// Closes the stores written by write_mat_feature, writing their index, and serves the
+	/// features from them.
+	bool flush_mat_features();
 
 	PTR_LIB::shared_ptr<bow_feature_cache_t> cache();
 
+	/// Serves the BoW features from the packed store at the specified location (see BowStore)
+	/// instead of the per image files.  The store at bow_store_location() is opened by the
+	/// constructors if it exists.  Returns true if successful, false otherwise.
+	bool open_bow_store(const std::string &file_path);
+
+	/// Returns the default location of the packed BoW store, <data_dir>/feats/bow_descriptors.bowstore.
+	std::string bow_store_location() const;
+
+	/// Packs the per image BoW feature files of all images into a store at the specified location
+	/// and serves the features from it.  Converts datasets written before the store existed, and
+	/// rebuilds the store after the feature files changed.  The store is written to a temporary
+	/// file renamed over file_path, so processes mapping the previous store keep its data.
+	/// Returns true if successful.
+	bool write_bow_store(const std::string &file_path);
+
+	/// Returns the location of the manifest of the images directory (see ImageManifest),
+	/// <data_dir>/images.manifest.
+	std::string manifest_location() const;
+
+	/// Scans base_location/images for .jpg files added or removed since the last scan, adds and
+	/// removes the images accordingly and updates the manifest.  Images keep their ids, new images
+	/// get unused ids.  Without a manifest the images in the dataset are recorded first, so they
+	/// keep their ids too.  If full is true every file is stat'ed to find modified images.  The
+	/// changes are returned in result.  Returns true if successful, false otherwise.
+	bool rescan(ImageManifest::ScanResult &result, bool full = false);
+
+	/// Renumbers the images, image id i becomes new_ids[i].  new_ids must be a permutation of
+	/// the image ids.  Feature files are stored by id, so they have to be moved accordingly.  An
+	/// open packed BoW store and the manifest are rewritten in the new id order.
+	void remap_ids(const std::vector<uint64_t> &new_ids);
+
+	/// How shard(...) assigns the images to the shards, the same partitions as ShardedInvertedIndex
+	/// so that shard i of the dataset holds the images of shard i of an index.
+	enum Partition {
+		PARTITION_RANGE = 0, /// contiguous ranges of ids
+		PARTITION_HASH = 1 /// hash of the id, spreads consecutive ids over all shards
+	};
+
+	/// How shard(...) places the image and feature files in the shards.
+	enum Transfer {
+		TRANSFER_LINK = 0, /// hard links, or copies across filesystems, the dataset stays intact
+		TRANSFER_MOVE = 1 /// moves the files, the dataset is left without them
+	};
+
+	/// Splits the dataset into one self-contained dataset per location, which can be indexed on
+	/// its own or opened together with the others as a ShardedDataset.  Every shard gets its images,
+	/// with their paths unchanged, under local ids 0, 1, ... in global id order, its dataset file
+	/// (see ShardedDataset::dataset_location), a manifest, the global id of every local id (see
+	/// ShardedDataset::global_ids_location), and its per image feature files renamed to the local
+	/// ids.  The files are linked or moved by num_threads I/O threads.  The packed stores are
+	/// rewritten per shard in local ids.  Returns true if successful, false otherwise.
+	bool shard(const std::vector<std::string> &new_locations, Partition partition = PARTITION_RANGE,
+		Transfer transfer = TRANSFER_LINK, uint32_t num_threads = s_default_num_shard_threads);
+
+	/// Default number of I/O threads of shard.
+	static const uint32_t s_default_num_shard_threads = 16;
+
+	/// Returns the default location of the packed store of a matrix feature,
+	/// <data_dir>/feats/<feat_name>.featstore.  The constructors open the keypoints and
+	/// descriptors stores found there.
+	std::string feature_store_location(const std::string &feat_name) const;
+
+	/// Serves a matrix feature from the packed store at the specified location.  Returns true if
+	/// successful, false otherwise.
+	bool open_feature_store(const std::string &feat_name, const std::string &file_path);
+
+	/// Packs the per image files of a matrix feature of all images into a store at the specified
+	/// location and serves the feature from it.  Converts datasets written before the stores
+	/// existed.  Returns true if successful, false otherwise.
+	bool write_feature_store(const std::string &feat_name, const std::string &file_path);
+
 private:
 	
 	/// Constructs the dataset an fills in the image id map.
-	numerics::sparse_vector_t load_bow_feature_cache(uint64_t id) const;
-	std::vector<float> load_vec_feature_cache(uint64_t id) const;
+	bow_feature_ptr_t load_bow_feature_cache(uint64_t id) const;
+	vec_feature_ptr_t load_vec_feature_cache(uint64_t id) const;
+	/// Loads the BoW feature of an image from its file, ignoring the packed store.
+	bow_feature_ptr_t load_bow_feature_file(uint64_t id) const;
+
+	/// Formats the absolute path of the feature file of an image (see SimpleImage::feature_path)
+	/// into a buffer of size bytes, so that locating a feature file does not allocate.  Returns
+	/// false if the path does not fit.
+	bool feature_location(uint64_t id, const char *feat_name, char *buffer, size_t size) const;
+
+	/// Adds an image to the image table.  Returns false if the id is taken.
+	bool insert_image(uint64_t id, const char *path, size_t length);
+
+	/// Removes an image from the image table, its path stays in the arena until the dataset is
+	/// written and read again.  Returns false if no image has the id.
+	bool remove_image(uint64_t id);
 
 	void construct_dataset();
 
-	boost::bimap<std::string, uint64_t> id_image_map; /// Map which holds the image path and id
+	/// Writes the packed stores of a shard with the images of the given global ids, in local id
+	/// order.  Returns true if successful, false otherwise.
+	bool write_shard_stores(const std::string &shard_location, const std::vector<uint64_t> &global_ids) const;
+
+	/// Submits load for the first capacity ids to the prefetcher.
+	Prefetcher::Ticket submit_prefetch(const std::vector<uint64_t> &ids, uint64_t capacity, const Prefetcher::load_function_t &load) const;
+
+	/// Opens the keypoints and descriptors stores at their default locations, if they exist.
+	void open_feature_stores();
+
+	/// Paths of the images by id, mapped from the dataset file by read.  Image ids are expected
+	/// to be dense.
+	ImageTable image_table;
 
 	PTR_LIB::shared_ptr<bow_feature_cache_t> bow_feature_cache;
 	PTR_LIB::shared_ptr<vec_feature_cache_t> vec_feature_cache;
+	PTR_LIB::shared_ptr<BowStore> bow_store; /// Set if the BoW features are served from a packed store.
+	std::string bow_store_path; /// Location of bow_store.
+	PTR_LIB::shared_ptr<BowStore> normalized_store; /// Set if normalized BoW features were written.
+	std::map<std::string, PTR_LIB::shared_ptr<FeatureStore> > feature_stores; /// Open matrix feature stores by feature name.
+	std::map<std::string, std::string> feature_store_paths; /// Locations of feature_stores.
+	std::map<std::string, PTR_LIB::shared_ptr<FeatureStoreWriter> > feature_writers; /// Stores written by write_mat_feature.
+	/// I/O threads of the prefetch_*_features functions.  Declared last, so the threads are
+	/// joined before the caches they load into are destroyed.
+	PTR_LIB::shared_ptr<Prefetcher> prefetcher;
 
 
 };
\ No newline at end of file
@@ -0,0 +1,250 @@
+#include "feature_store.hpp"
+#include "filesystem.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+/// "FEAT"
+static const uint32_t s_feature_store_magic = 0x54414546;
+/// "BLCK", marks the start of every block so that a zero filled tail is not read as blocks
+static const uint32_t s_feature_block_magic = 0x4b434c42;
+/// "FIDX"
+static const uint32_t s_feature_index_magic = 0x58444946;
+static const uint32_t s_feature_store_version = 1;
+
+struct FeatureStoreHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t reserved;
+};
+
+struct FeatureBlockHeader {
+	uint32_t magic;
+	int32_t type;
+	uint64_t id;
+	uint32_t rows, cols;
+	uint64_t data_size; /// Bytes of matrix data following the header, the block is padded to 8 bytes.
+};
+
+struct FeatureIndexHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t num_entries;
+	uint64_t blocks_size; /// FeatureStore::valid_size of the blocks the index describes.
+};
+
+static inline uint64_t align(uint64_t offset) {
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+/// Sorts the entries by id and keeps the last written block of every id.
+static void normalize_index(std::vector<FeatureStore::index_entry_t> &entries) {
+	std::sort(entries.begin(), entries.end());
+	size_t n = 0;
+	for(size_t i=0; i<entries.size(); i++) {
+		if(i + 1 < entries.size() && entries[i + 1].first == entries[i].first) continue;
+		entries[n++] = entries[i];
+	}
+	entries.resize(n);
+}
+
+FeatureStore::FeatureStore() : blocks_size(0) {
+
+}
+
+bool FeatureStore::open(const std::string &file_path, MappedFile::Advice advice) {
+	close();
+
+	PTR_LIB::shared_ptr<MappedFile> file = PTR_LIB::make_shared<MappedFile>();
+	if(!file->open(file_path) || file->size() < sizeof(FeatureStoreHeader)) return false;
+
+	const FeatureStoreHeader &header = *(const FeatureStoreHeader *)file->data();
+	if(header.magic != s_feature_store_magic || header.version != s_feature_store_version) return false;
+
+	file->advise(advice);
+	mapped_file = file;
+	if(!read_index(index_location(file_path))) build_index();
+	return true;
+}
+
+void FeatureStore::close() {
+	mapped_file.reset();
+	entries.clear();
+	blocks_size = 0;
+}
+
+bool FeatureStore::is_open() const {
+	return (bool)mapped_file;
+}
+
+uint64_t FeatureStore::num_blocks() const {
+	return entries.size();
+}
+
+bool FeatureStore::contains(uint64_t id) const {
+	std::vector<index_entry_t>::const_iterator it = std::lower_bound(entries.begin(), entries.end(), index_entry_t(id, 0));
+	return it != entries.end() && it->first == id;
+}
+
+bool FeatureStore::load(uint64_t id, cv::Mat &data) const {
+	std::vector<index_entry_t>::const_iterator it = std::lower_bound(entries.begin(), entries.end(), index_entry_t(id, 0));
+	if(it == entries.end() || it->first != id) return false;
+
+	const FeatureBlockHeader &header = *(const FeatureBlockHeader *)(mapped_file->data() + it->second);
+	if(header.rows == 0 || header.cols == 0) return false;
+	data.create(header.rows, header.cols, header.type);
+	memcpy(data.ptr(), mapped_file->data() + it->second + sizeof(FeatureBlockHeader), header.data_size);
+	return true;
+}
+
+std::vector<uint64_t> FeatureStore::ids() const {
+	std::vector< std::pair<uint64_t, uint64_t> > by_offset(entries.size());
+	for(size_t i=0; i<entries.size(); i++) by_offset[i] = std::make_pair(entries[i].second, entries[i].first);
+	std::sort(by_offset.begin(), by_offset.end());
+
+	std::vector<uint64_t> ordered_ids(by_offset.size());
+	for(size_t i=0; i<by_offset.size(); i++) ordered_ids[i] = by_offset[i].second;
+	return ordered_ids;
+}
+
+uint64_t FeatureStore::valid_size() const {
+	return blocks_size;
+}
+
+const std::vector<FeatureStore::index_entry_t> &FeatureStore::index() const {
+	return entries;
+}
+
+std::string FeatureStore::index_location(const std::string &file_path) {
+	return file_path + ".index";
+}
+
+bool FeatureStore::read_index(const std::string &index_path) {
+	if(!filesystem::file_exists(index_path)) return false;
+	std::ifstream ifs(index_path.c_str(), std::ios::binary);
+	FeatureIndexHeader header;
+	ifs.read((char *)&header, sizeof(FeatureIndexHeader));
+	if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+	if(header.magic != s_feature_index_magic || header.version != s_feature_store_version) return false;
+	// blocks were appended after the index was written
+	if(header.blocks_size != mapped_file->size()) return false;
+
+	entries.resize(header.num_entries);
+	if(header.num_entries > 0) ifs.read((char *)&entries[0], sizeof(index_entry_t) * header.num_entries);
+	if((ifs.rdstate() & std::ifstream::failbit) != 0) {
+		entries.clear();
+		return false;
+	}
+	blocks_size = header.blocks_size;
+	return true;
+}
+
+void FeatureStore::build_index() {
+	entries.clear();
+	const char *data = mapped_file->data();
+	const uint64_t size = mapped_file->size();
+
+	uint64_t offset = sizeof(FeatureStoreHeader);
+	while(offset + sizeof(FeatureBlockHeader) <= size) {
+		const FeatureBlockHeader &header = *(const FeatureBlockHeader *)(data + offset);
+		if(header.magic != s_feature_block_magic) break;
+		if(header.data_size != (uint64_t)header.rows * header.cols * CV_ELEM_SIZE(header.type)) break;
+		const uint64_t end = offset + sizeof(FeatureBlockHeader) + header.data_size;
+		if(end > size) break;
+		entries.push_back(index_entry_t(header.id, offset));
+		offset = MIN(align(end), size);
+	}
+	blocks_size = offset;
+	normalize_index(entries);
+}
+
+FeatureStoreWriter::FeatureStoreWriter(const std::string &file_path) : file_path(file_path),
+	end_offset(sizeof(FeatureStoreHeader)), success(true), closed(false) {
+
+	if(filesystem::file_exists(file_path)) {
+		FeatureStore store;
+		if(!store.open(file_path)) {
+			std::cerr << "Not a feature store: " << file_path << std::endl;
+			success = false;
+			return;
+		}
+		entries = store.index();
+		end_offset = store.valid_size();
+		store.close();
+
+		// drops a block cut off by an interrupted writer
+		if(!filesystem::resize_file(file_path, end_offset)) {
+			success = false;
+			return;
+		}
+		ofs.open(file_path.c_str(), std::ios::binary | std::ios::app);
+	} else {
+		filesystem::create_file_directory(file_path);
+		ofs.open(file_path.c_str(), std::ios::binary | std::ios::trunc);
+
+		FeatureStoreHeader header;
+		memset(&header, 0, sizeof(FeatureStoreHeader));
+		header.magic = s_feature_store_magic;
+		header.version = s_feature_store_version;
+		ofs.write((const char *)&header, sizeof(FeatureStoreHeader));
+	}
+	success = ofs.is_open() && (ofs.rdstate() & std::ofstream::failbit) == 0;
+}
+
+FeatureStoreWriter::~FeatureStoreWriter() {
+	close();
+}
+
+bool FeatureStoreWriter::good() const {
+	return success && !closed;
+}
+
+bool FeatureStoreWriter::add(uint64_t id, const cv::Mat &data) {
+	if(!good()) return false;
+
+	const cv::Mat &continuous = data.isContinuous() ? data : data.clone();
+	FeatureBlockHeader header;
+	memset(&header, 0, sizeof(FeatureBlockHeader));
+	header.magic = s_feature_block_magic;
+	header.id = id;
+	header.type = continuous.type();
+	header.rows = continuous.rows;
+	header.cols = continuous.cols;
+	header.data_size = (uint64_t)continuous.total() * continuous.elemSize();
+
+	const char padding[8] = { 0 };
+	const uint64_t end = end_offset + sizeof(FeatureBlockHeader) + header.data_size;
+	ofs.write((const char *)&header, sizeof(FeatureBlockHeader));
+	if(header.data_size > 0) ofs.write((const char *)continuous.ptr(), header.data_size);
+	ofs.write(padding, align(end) - end);
+
+	success = (ofs.rdstate() & std::ofstream::failbit) == 0;
+	if(success) {
+		entries.push_back(FeatureStore::index_entry_t(id, end_offset));
+		end_offset = align(end);
+	}
+	return success;
+}
+
+bool FeatureStoreWriter::close() {
+	if(closed) return success;
+	closed = true;
+	if(!ofs.is_open()) return false;
+	ofs.close();
+	if(!success) return false;
+
+	normalize_index(entries);
+	FeatureIndexHeader header;
+	memset(&header, 0, sizeof(FeatureIndexHeader));
+	header.magic = s_feature_index_magic;
+	header.version = s_feature_store_version;
+	header.num_entries = entries.size();
+	header.blocks_size = end_offset;
+
+	std::ofstream index_ofs(FeatureStore::index_location(file_path).c_str(), std::ios::binary | std::ios::trunc);
+	index_ofs.write((const char *)&header, sizeof(FeatureIndexHeader));
+	if(!entries.empty()) index_ofs.write((const char *)&entries[0], sizeof(FeatureStore::index_entry_t) * entries.size());
+	success = (index_ofs.rdstate() & std::ofstream::failbit) == 0;
+	return success;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "config.hpp"
+#include "mapped_file.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <utility>
+#include <memory>
+#include <opencv2/opencv.hpp>
+
+/// Packed container holding a matrix feature (ex. the keypoints or the descriptors) of many images
+/// in one file, instead of one small file per image.  The file is a sequence of blocks, each
+/// holding the matrix of one image behind a header with the image id, type and size, so blocks
+/// are appended as the features are extracted.  The index from image id to block offset is kept
+/// in a side file (<file>.index) written when the writer is closed, and rebuilt by walking the
+/// blocks if it is missing or older than the blocks.  The file is memory mapped: loading a block
+/// touches only its pages, and loading the blocks in storage order (see ids) reads the file
+/// sequentially.
+class FeatureStore {
+public:
+	/// (image id, byte offset of the block) pair of the index.
+	typedef std::pair<uint64_t, uint64_t> index_entry_t;
+
+	FeatureStore();
+
+	/// Maps the store at the specified location, advice describes how the blocks will be accessed.
+	/// Returns true if successful, false otherwise.
+	bool open(const std::string &file_path, MappedFile::Advice advice = MappedFile::ADVICE_RANDOM);
+
+	/// Unmaps the store.
+	void close();
+
+	/// Returns true if a store is mapped.
+	bool is_open() const;
+
+	/// Returns the number of images with a block.
+	uint64_t num_blocks() const;
+
+	/// Returns true if the image has a block.
+	bool contains(uint64_t id) const;
+
+	/// Loads the matrix of an image.  Returns false if the image has no block or an empty matrix,
+	/// like filesystem::load_cvmat.
+	bool load(uint64_t id, cv::Mat &data) const;
+
+	/// Returns the ids of all images with a block, in storage order.  Parallel scans should give
+	/// every thread a contiguous range of the ids, so that each one reads sequentially.
+	std::vector<uint64_t> ids() const;
+
+	/// Returns the size in bytes of the complete blocks (and the file header).  Anything after it
+	/// is a block cut off by an interrupted writer.
+	uint64_t valid_size() const;
+
+	/// Returns the index entries, sorted by image id.
+	const std::vector<index_entry_t> &index() const;
+
+	/// Returns the location of the index file of the store at the specified location.
+	static std::string index_location(const std::string &file_path);
+
+protected:
+	FeatureStore(const FeatureStore &);
+	FeatureStore &operator=(const FeatureStore &);
+
+	/// Reads the index file, returns false if it is missing or does not describe the mapped blocks.
+	bool read_index(const std::string &index_path);
+
+	/// Rebuilds the index by walking the blocks.
+	void build_index();
+
+	PTR_LIB::shared_ptr<MappedFile> mapped_file;
+	std::vector<index_entry_t> entries; /// Sorted by image id, one entry per image.
+	uint64_t blocks_size; /// See valid_size.
+};
+
+/// Appends blocks to a FeatureStore, creating it if needed.  A block cut off by an interrupted
+/// writer is dropped.  If an image is added again, its latest block is used.  Adding is not
+/// thread safe; callers extracting features in parallel must serialize the calls.
+class FeatureStoreWriter {
+public:
+	/// Opens the store at the specified location for appending.
+	FeatureStoreWriter(const std::string &file_path);
+
+	/// Closes the writer, see close.
+	~FeatureStoreWriter();
+
+	/// Returns true if the store could be opened and no write failed so far.
+	bool good() const;
+
+	/// Appends the matrix of an image.  Returns true if successful, false otherwise.
+	bool add(uint64_t id, const cv::Mat &data);
+
+	/// Writes the index and closes the store, the blocks become visible to FeatureStore::open.
+	/// Returns true if successful, false otherwise.
+	bool close();
+
+protected:
+	FeatureStoreWriter(const FeatureStoreWriter &);
+	FeatureStoreWriter &operator=(const FeatureStoreWriter &);
+
+	std::string file_path;
+	std::ofstream ofs;
+	std::vector<FeatureStore::index_entry_t> entries; /// Blocks of the store, in storage order.
+	uint64_t end_offset; /// Offset of the next block.
+	bool success;
+	bool closed;
+};
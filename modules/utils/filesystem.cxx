@@ -4,14 +4,19 @@
 #include <fcntl.h>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
 
 namespace filesystem {
 
 	bool file_exists(const std::string& name) {
+	  return file_exists(name.c_str());
+	}
+
+	bool file_exists(const char *name) {
 	  struct stat buffer;
-	  return (stat (name.c_str(), &buffer) == 0);
+	  return (stat (name, &buffer) == 0);
 	}
 
 	void create_file_directory(const std::string &absfilepath) {
@@ -21,6 +26,58 @@ namespace filesystem {
 			boost::filesystem::create_directories(d);
 		}
 	}
+
+	bool remove_file(const std::string &name) {
+		boost::system::error_code ec;
+		return boost::filesystem::remove(boost::filesystem::path(name.c_str()), ec);
+	}
+
+	bool move_file(const std::string &from, const std::string &to) {
+		create_file_directory(to);
+		boost::system::error_code ec;
+		boost::filesystem::rename(boost::filesystem::path(from.c_str()), boost::filesystem::path(to.c_str()), ec);
+		return !ec;
+	}
+
+	bool link_file(const std::string &from, const std::string &to) {
+		create_file_directory(to);
+		boost::system::error_code ec;
+		boost::filesystem::remove(boost::filesystem::path(to.c_str()), ec);
+		boost::filesystem::create_hard_link(boost::filesystem::path(from.c_str()), boost::filesystem::path(to.c_str()), ec);
+		if(!ec) return true;
+		ec.clear();
+		boost::filesystem::copy_file(boost::filesystem::path(from.c_str()), boost::filesystem::path(to.c_str()), ec);
+		return !ec;
+	}
+
+	bool link_directory(const std::string &from, const std::string &to) {
+		create_file_directory(to);
+		boost::system::error_code ec;
+		boost::filesystem::remove(boost::filesystem::path(to.c_str()), ec);
+		boost::filesystem::create_directory_symlink(boost::filesystem::path(from.c_str()), boost::filesystem::path(to.c_str()), ec);
+		return !ec;
+	}
+
+	bool resize_file(const std::string &name, uint64_t size) {
+		boost::system::error_code ec;
+		boost::filesystem::resize_file(boost::filesystem::path(name.c_str()), size, ec);
+		return !ec;
+	}
+
+	std::vector<std::string> list_directories(const std::string &path) {
+		std::vector<std::string> directories;
+		boost::system::error_code ec;
+		for(boost::filesystem::directory_iterator it(boost::filesystem::path(path.c_str()), ec), end; !ec && it != end; it.increment(ec)) {
+			if(boost::filesystem::is_directory(it->status())) directories.push_back(it->path().string());
+		}
+		std::sort(directories.begin(), directories.end());
+		return directories;
+	}
+
+	std::string temp_file_path(const std::string &directory) {
+		boost::filesystem::path d = directory.empty() ? boost::filesystem::temp_directory_path() : boost::filesystem::path(directory.c_str());
+		return (d / boost::filesystem::unique_path("%%%%-%%%%-%%%%-%%%%.tmp")).string();
+	}
 	struct cvmat_header {
 		uint64_t elem_size;
 		int32_t elem_type;
@@ -78,6 +135,35 @@ namespace filesystem {
 		return (ifs.rdstate() & std::ifstream::failbit) == 0;
 	}
 
+	bool write_sparse_vector(const std::string &fname, const numerics::SparseVector &data) {
+		return write_sparse_vector(fname, (numerics::sparse_vector_t)data);
+	}
+
+	bool load_sparse_vector(const std::string &fname, numerics::SparseVector &data) {
+		if(!file_exists(fname)) return false;
+
+		SCOPED_TIMER_NOLOCK
+
+		// the file holds (index, value) pairs, they are read in chunks and split into the two arrays
+		std::ifstream ifs(fname.c_str(), std::ios::binary);
+		uint32_t dim0;
+		ifs.read((char *)&dim0, sizeof(uint32_t));
+		if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+		data.resize(dim0);
+		uint32_t *indices = data.indices();
+		float *values = data.values();
+		std::pair<uint32_t, float> chunk[1024];
+		for(uint32_t i=0; i<dim0; i+=1024) {
+			const uint32_t n = MIN(dim0 - i, 1024);
+			ifs.read((char *)chunk, sizeof(std::pair<uint32_t, float >) * n);
+			for(uint32_t j=0; j<n; j++) {
+				indices[i + j] = chunk[j].first;
+				values[i + j] = chunk[j].second;
+			}
+		}
+		return (ifs.rdstate() & std::ifstream::failbit) == 0;
+	}
+
 	std::vector<std::string> list_files(const std::string &path, const std::string &ext, bool recursive) {
 		boost::filesystem::path input_path(path);
 		std::vector<std::string> file_list;
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <opencv2/opencv.hpp>
 
+#include "sparse_vector.hpp"
+
 /// Provides useful wrappers around many filesystem related functionality, including reading writing
 /// certain common data structures as well as common operations (ex. file_exists).
 namespace filesystem {
@@ -12,8 +14,28 @@ namespace filesystem {
 	std::string basename(const std::string &path, bool include_extension = false);
 	/// Returns true if file exists at location, else returns false.
 	bool file_exists(const std::string& name);
+	bool file_exists(const char *name);
 	/// Recursively creates all directories if needed up to the specified file.
 	void create_file_directory(const std::string &absfilepath);
+	/// Removes the file at the specified location.  Returns true if a file was removed.
+	bool remove_file(const std::string &name);
+	/// Moves the file from one location to another, creating the target directories if needed.
+	/// Returns true if successful.
+	bool move_file(const std::string &from, const std::string &to);
+	/// Creates a hard link at to for the file at from, creating the target directories if needed
+	/// and replacing an existing file.  Copies the file if the two locations are on different
+	/// filesystems.  Returns true if successful.
+	bool link_file(const std::string &from, const std::string &to);
+	/// Creates a symbolic link at to pointing to the directory from, replacing an existing link.
+	/// Returns true if successful.
+	bool link_directory(const std::string &from, const std::string &to);
+	/// Truncates or extends the file at the specified location to size bytes.  Returns true if successful.
+	bool resize_file(const std::string &name, uint64_t size);
+	/// Returns the paths of the directories directly inside the given directory.
+	std::vector<std::string> list_directories(const std::string &path);
+	/// Returns a unique, not yet existing file path in the given directory, or in the system
+	/// temporary directory if directory is empty.
+	std::string temp_file_path(const std::string &directory = "");
 	/// Writes a cv::Mat structure to the specified location.
 	bool write_cvmat(const std::string &fname, const cv::Mat &data);
 	/// Loads a cv::Mat structure from the specified location.  Returns true if file exists,
@@ -25,6 +47,9 @@ namespace filesystem {
 	/// Loads the BoW feature from the specified location.  First dimension of data is cluster index,
 	/// second dimension is TF score.
 	bool load_sparse_vector(const std::string &fname, std::vector<std::pair<uint32_t, float > > &data);
+	/// Writes and loads a BoW feature stored as a SparseVector, the file format is the same.
+	bool write_sparse_vector(const std::string &fname, const numerics::SparseVector &data);
+	bool load_sparse_vector(const std::string &fname, numerics::SparseVector &data);
 	/// Lists all files in the given directory with an optional extension.  The extension must include
 	/// the dot (ie. ext=".txt").  If recursive is true (default), will recursively enter all directories
 	std::vector<std::string> list_files(const std::string &path, const std::string &ext = "", bool recursive = true) ;
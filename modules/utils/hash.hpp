@@ -0,0 +1,15 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+
+/// Mixes the bits of an image id (the finalizer of MurmurHash3), so that consecutive ids spread
+/// over the slots of a hash table or over shards.  Used by ScoreAccumulator, and by
+/// SimpleDataset::shard and ShardedInvertedIndex, which must partition the ids alike.
+inline uint64_t hash_id(uint64_t id) {
+	id ^= id >> 33;
+	id *= 0xff51afd7ed558ccdULL;
+	id ^= id >> 33;
+	return id;
+}
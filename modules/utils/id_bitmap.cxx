@@ -0,0 +1,178 @@
+#include "id_bitmap.hpp"
+
+/// Number of 64 bit words in a dense chunk.
+static const uint32_t s_chunk_words = (1 << 16) / 64;
+
+void IdBitmap::Chunk::add(uint16_t low) {
+	if(!bits.empty()) {
+		uint64_t &word = bits[low >> 6];
+		const uint64_t mask = 1ULL << (low & 63);
+		if((word & mask) == 0) cardinality++;
+		word |= mask;
+		return;
+	}
+
+	std::vector<uint16_t>::iterator it = std::lower_bound(values.begin(), values.end(), low);
+	if(it != values.end() && *it == low) return;
+	values.insert(it, low);
+	cardinality++;
+	if(cardinality > s_max_array_size) to_bitmap();
+}
+
+void IdBitmap::Chunk::add_range(uint32_t begin, uint32_t end) {
+	if(begin >= end) return;
+	if(bits.empty() && cardinality + (end - begin) > s_max_array_size) to_bitmap();
+
+	if(bits.empty()) {
+		for(uint32_t v=begin; v<end; v++) add((uint16_t)v);
+		return;
+	}
+
+	for(uint32_t v=begin; v<end;) {
+		const uint32_t word = v >> 6;
+		const uint32_t first = v & 63;
+		const uint32_t last = std::min(64u, first + (end - v));
+		const uint64_t mask = (last - first == 64) ? ~0ULL : (((1ULL << (last - first)) - 1) << first);
+		cardinality += __builtin_popcountll(mask & ~bits[word]);
+		bits[word] |= mask;
+		v += last - first;
+	}
+}
+
+void IdBitmap::Chunk::remove(uint16_t low) {
+	if(!bits.empty()) {
+		uint64_t &word = bits[low >> 6];
+		const uint64_t mask = 1ULL << (low & 63);
+		if(word & mask) cardinality--;
+		word &= ~mask;
+		if(cardinality <= s_max_array_size / 2) to_array();
+		return;
+	}
+
+	std::vector<uint16_t>::iterator it = std::lower_bound(values.begin(), values.end(), low);
+	if(it == values.end() || *it != low) return;
+	values.erase(it);
+	cardinality--;
+}
+
+void IdBitmap::Chunk::to_bitmap() {
+	bits.assign(s_chunk_words, 0);
+	for(size_t i=0; i<values.size(); i++) {
+		bits[values[i] >> 6] |= 1ULL << (values[i] & 63);
+	}
+	std::vector<uint16_t>().swap(values);
+}
+
+void IdBitmap::Chunk::to_array() {
+	values.clear();
+	values.reserve(cardinality);
+	for(uint32_t w=0; w<bits.size(); w++) {
+		for(uint64_t word = bits[w]; word != 0; word &= word - 1) {
+			values.push_back((uint16_t)(w * 64 + __builtin_ctzll(word)));
+		}
+	}
+	std::vector<uint64_t>().swap(bits);
+}
+
+IdBitmap::IdBitmap() {
+
+}
+
+IdBitmap::IdBitmap(const std::vector<uint64_t> &ids) {
+	std::vector<uint64_t> sorted_ids(ids);
+	std::sort(sorted_ids.begin(), sorted_ids.end());
+	sorted_ids.erase(std::unique(sorted_ids.begin(), sorted_ids.end()), sorted_ids.end());
+
+	// ids are sorted, so every chunk is built by appending
+	for(size_t i=0; i<sorted_ids.size();) {
+		const uint64_t key = sorted_ids[i] >> 16;
+		size_t end = i;
+		while(end < sorted_ids.size() && (sorted_ids[end] >> 16) == key) end++;
+
+		keys.push_back(key);
+		chunks.push_back(Chunk());
+		Chunk &c = chunks.back();
+		c.cardinality = end - i;
+		c.values.resize(end - i);
+		for(size_t j=i; j<end; j++) c.values[j - i] = (uint16_t)sorted_ids[j];
+		if(c.cardinality > s_max_array_size) c.to_bitmap();
+		i = end;
+	}
+}
+
+IdBitmap::Chunk &IdBitmap::chunk(uint64_t key) {
+	std::vector<uint64_t>::iterator it = std::lower_bound(keys.begin(), keys.end(), key);
+	const size_t index = it - keys.begin();
+	if(it == keys.end() || *it != key) {
+		keys.insert(it, key);
+		chunks.insert(chunks.begin() + index, Chunk());
+	}
+	return chunks[index];
+}
+
+void IdBitmap::add(uint64_t id) {
+	chunk(id >> 16).add((uint16_t)id);
+}
+
+void IdBitmap::add_range(uint64_t begin, uint64_t end) {
+	while(begin < end) {
+		const uint64_t key = begin >> 16;
+		const uint64_t chunk_end = std::min(end, (key + 1) << 16);
+		chunk(key).add_range((uint32_t)(begin & 0xffff), (uint32_t)(chunk_end - (key << 16)));
+		begin = chunk_end;
+	}
+}
+
+void IdBitmap::remove(uint64_t id) {
+	const uint64_t key = id >> 16;
+	std::vector<uint64_t>::iterator it = std::lower_bound(keys.begin(), keys.end(), key);
+	if(it == keys.end() || *it != key) return;
+	const size_t index = it - keys.begin();
+	chunks[index].remove((uint16_t)id);
+	if(chunks[index].cardinality == 0) {
+		keys.erase(it);
+		chunks.erase(chunks.begin() + index);
+	}
+}
+
+uint64_t IdBitmap::cardinality() const {
+	uint64_t count = 0;
+	for(size_t i=0; i<chunks.size(); i++) count += chunks[i].cardinality;
+	return count;
+}
+
+bool IdBitmap::empty() const {
+	return chunks.empty();
+}
+
+std::vector<uint64_t> IdBitmap::ids() const {
+	std::vector<uint64_t> result;
+	result.reserve(cardinality());
+	for(size_t i=0; i<chunks.size(); i++) {
+		const Chunk &c = chunks[i];
+		const uint64_t base = keys[i] << 16;
+		if(c.bits.empty()) {
+			for(size_t j=0; j<c.values.size(); j++) result.push_back(base + c.values[j]);
+		} else {
+			for(uint32_t w=0; w<c.bits.size(); w++) {
+				for(uint64_t word = c.bits[w]; word != 0; word &= word - 1) {
+					result.push_back(base + w * 64 + __builtin_ctzll(word));
+				}
+			}
+		}
+	}
+	return result;
+}
+
+uint64_t IdBitmap::size_in_bytes() const {
+	uint64_t bytes = keys.size() * (sizeof(uint64_t) + sizeof(Chunk));
+	for(size_t i=0; i<chunks.size(); i++) {
+		bytes += chunks[i].values.size() * sizeof(uint16_t) + chunks[i].bits.size() * sizeof(uint64_t);
+	}
+	return bytes;
+}
+
+void IdBitmap::clear() {
+	keys.clear();
+	chunks.clear();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+/// Compressed set of image ids, organized like a Roaring bitmap: the id space is split into
+/// chunks of 2^16 ids, and each non empty chunk stores its low 16 bits either as a sorted array
+/// (sparse chunks) or as a 2^16 bit bitmap (dense chunks).  Membership tests cost a binary search
+/// over the chunks plus a binary search or a bit test inside the chunk, and the memory used is
+/// proportional to the number of ids for sparse sets and bounded by 8KB per chunk for dense ones.
+class IdBitmap {
+public:
+	IdBitmap();
+
+	/// Creates a set from a list of ids (in any order).
+	IdBitmap(const std::vector<uint64_t> &ids);
+
+	/// Adds an id to the set.
+	void add(uint64_t id);
+
+	/// Adds the ids [begin, end) to the set.
+	void add_range(uint64_t begin, uint64_t end);
+
+	/// Removes an id from the set.
+	void remove(uint64_t id);
+
+	/// Returns true if the id is in the set.
+	inline bool contains(uint64_t id) const {
+		const uint64_t key = id >> 16;
+		std::vector<uint64_t>::const_iterator it = std::lower_bound(keys.begin(), keys.end(), key);
+		if(it == keys.end() || *it != key) return false;
+		return chunks[it - keys.begin()].contains((uint16_t)id);
+	}
+
+	/// Returns the number of ids in the set.
+	uint64_t cardinality() const;
+
+	/// Returns true if the set is empty.
+	bool empty() const;
+
+	/// Returns the ids of the set in increasing order.
+	std::vector<uint64_t> ids() const;
+
+	/// Returns the number of bytes used by the chunks.
+	uint64_t size_in_bytes() const;
+
+	/// Removes all ids.
+	void clear();
+
+protected:
+	/// Sorted arrays are converted to bitmaps when they grow past this size, at which point both
+	/// use 8KB.
+	static const uint32_t s_max_array_size = 4096;
+
+	struct Chunk {
+		Chunk() : cardinality(0) { }
+
+		inline bool contains(uint16_t low) const {
+			if(!bits.empty()) return (bits[low >> 6] >> (low & 63)) & 1;
+			return std::binary_search(values.begin(), values.end(), low);
+		}
+
+		void add(uint16_t low);
+		void add_range(uint32_t begin, uint32_t end); /// adds [begin, end), end <= 2^16
+		void remove(uint16_t low);
+		void to_bitmap();
+		void to_array();
+
+		uint32_t cardinality;
+		std::vector<uint16_t> values; /// sorted low bits, used while the chunk is sparse
+		std::vector<uint64_t> bits; /// 1024 words, used once the chunk is dense
+	};
+
+	/// Returns the chunk holding the ids with the given high bits, creating it if necessary.
+	Chunk &chunk(uint64_t key);
+
+	std::vector<uint64_t> keys; /// sorted high 48 bits of the ids of every chunk
+	std::vector<Chunk> chunks;
+};
@@ -0,0 +1,394 @@
+#include "image_manifest.hpp"
+#include "filesystem.hpp"
+#include "prefetcher.hpp"
+
+#include <sys/stat.h>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+
+/// "IMFT"
+static const uint32_t s_manifest_magic = 0x54464d49;
+static const uint32_t s_manifest_version = 1;
+
+struct ManifestHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t next_id;
+	uint64_t num_directories;
+	uint64_t num_files;
+};
+
+static inline std::string join_path(const std::string &directory, const std::string &name) {
+	return directory.empty() ? name : directory + "/" + name;
+}
+
+static inline bool path_less(const ImageManifest::File &a, const ImageManifest::File &b) {
+	return a.path < b.path;
+}
+
+static void write_string(std::ofstream &ofs, const std::string &value) {
+	const uint16_t length = value.size();
+	ofs.write((const char *)&length, sizeof(uint16_t));
+	ofs.write(value.c_str(), length);
+}
+
+static void read_string(std::ifstream &ifs, std::string &value) {
+	uint16_t length = 0;
+	ifs.read((char *)&length, sizeof(uint16_t));
+	value.resize(length);
+	if(length > 0) ifs.read(&value[0], length);
+}
+
+/// Directory visited by a scan.
+struct ScannedDirectory {
+	ScannedDirectory(const std::string &path) : path(path), mtime(-1), listed(false), failed(false) { }
+
+	std::string path;
+	int64_t mtime;
+	std::vector<std::string> subdirectories;
+	std::vector<ImageManifest::File> files; /// Sorted by path, new files have the id UINT64_MAX.
+	std::vector<uint64_t> removed, modified;
+	bool listed, failed;
+};
+
+class ImageManifest::Scan {
+public:
+	Scan(const ImageManifest &previous, const std::string &root, const std::string &ext, bool full, uint32_t num_threads)
+		: previous(previous), root(root), ext(ext), full(full), pool(num_threads) {
+
+	}
+
+	/// Scans the tree and returns the visited directories, or false if one could not be read.
+	bool run(std::vector<const ScannedDirectory *> &visited) {
+		directories.push_back(ScannedDirectory(""));
+		pool.submit(std::vector<uint64_t>(1, 0), boost::bind(&Scan::visit, this, _1));
+		pool.wait();
+
+		visited.clear();
+		for(size_t i=0; i<directories.size(); i++) {
+			if(directories[i].failed) return false;
+			visited.push_back(&directories[i]);
+		}
+		return true;
+	}
+
+protected:
+	/// Scans one directory and queues its subdirectories.
+	void visit(uint64_t index) {
+		ScannedDirectory *directory;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			directory = &directories[index];
+		}
+
+		const std::string &absolute_path = directory->path.empty() ? root : root + "/" + directory->path;
+		// taken before the directory is read, so that a change made while reading it is caught
+		const int64_t visit_time = (int64_t)time(0);
+		struct stat directory_stat;
+		if(stat(absolute_path.c_str(), &directory_stat) != 0 || !S_ISDIR(directory_stat.st_mode)) {
+			std::cerr << "Cannot read directory " << absolute_path << std::endl;
+			directory->failed = true;
+			return;
+		}
+		directory->mtime = directory_stat.st_mtime;
+
+		const Directory *known = previous.find_directory(directory->path);
+		if(!full && known && known->mtime == directory->mtime) {
+			directory->subdirectories = known->subdirectories;
+			directory->files.assign(previous.file_list.begin() + known->first_file,
+				previous.file_list.begin() + known->first_file + known->num_files);
+		} else if(!list(absolute_path, known, visit_time, *directory)) {
+			std::cerr << "Cannot read directory " << absolute_path << std::endl;
+			directory->failed = true;
+			return;
+		}
+
+		std::vector<uint64_t> subdirectory_indices;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for(size_t i=0; i<directory->subdirectories.size(); i++) {
+				subdirectory_indices.push_back(directories.size());
+				directories.push_back(ScannedDirectory(join_path(directory->path, directory->subdirectories[i])));
+			}
+		}
+		pool.submit(subdirectory_indices, boost::bind(&Scan::visit, this, _1));
+	}
+
+	/// Lists a directory and matches its files with the known ones.  visit_time is the time at
+	/// which the directory was stat'ed.
+	bool list(const std::string &absolute_path, const Directory *known, int64_t visit_time, ScannedDirectory &directory) {
+		directory.listed = true;
+		boost::system::error_code ec;
+		boost::filesystem::directory_iterator it(absolute_path, ec), end;
+		if(ec) return false;
+		for(; it != end; it.increment(ec)) {
+			if(ec) return false;
+			const std::string &name = it->path().filename().string();
+			// symbolic links to directories are not followed, as in filesystem::list_files
+			if(boost::filesystem::is_directory(it->symlink_status(ec))) {
+				directory.subdirectories.push_back(name);
+				continue;
+			}
+			if(!ext.empty() && it->path().extension() != boost::filesystem::path(ext)) continue;
+
+			struct stat file_stat;
+			if(stat(it->path().c_str(), &file_stat) != 0 || S_ISDIR(file_stat.st_mode)) continue;
+			File file;
+			file.path = join_path(directory.path, name);
+			file.id = UINT64_MAX;
+			file.size = file_stat.st_size;
+			file.mtime = file_stat.st_mtime;
+			directory.files.push_back(file);
+		}
+		std::sort(directory.subdirectories.begin(), directory.subdirectories.end());
+		std::sort(directory.files.begin(), directory.files.end(), path_less);
+
+		// An entry added in the same second as the listing may be missing from it without
+		// changing the time of the directory, so such a directory is listed again next time.
+		if(directory.mtime >= visit_time - 1) directory.mtime = -1;
+
+		if(!known) return true;
+		std::vector<File>::const_iterator previous_file = previous.file_list.begin() + known->first_file;
+		const std::vector<File>::const_iterator previous_end = previous_file + known->num_files;
+		std::vector<File>::iterator file = directory.files.begin();
+		while(previous_file != previous_end) {
+			if(file == directory.files.end() || previous_file->path < file->path) {
+				directory.removed.push_back((previous_file++)->id);
+			} else if(file->path < previous_file->path) {
+				file++;
+			} else {
+				file->id = previous_file->id;
+				if(previous_file->mtime >= 0 && (previous_file->size != file->size || previous_file->mtime != file->mtime)) {
+					directory.modified.push_back(file->id);
+				}
+				file++;
+				previous_file++;
+			}
+		}
+		return true;
+	}
+
+	const ImageManifest &previous;
+	const std::string root, ext;
+	const bool full;
+	std::deque<ScannedDirectory> directories; /// Grows while scanning, elements do not move.
+	std::mutex mutex; /// Protects directories.
+	Prefetcher pool; /// Declared last, so the I/O threads are joined first.
+};
+
+ImageManifest::ImageManifest() : next_free_id(0) {
+
+}
+
+bool ImageManifest::read(const std::string &file_path) {
+	directories.clear();
+	file_list.clear();
+	next_free_id = 0;
+
+	std::ifstream ifs(file_path.c_str(), std::ios::binary);
+	ManifestHeader header;
+	ifs.read((char *)&header, sizeof(ManifestHeader));
+	if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+	if(header.magic != s_manifest_magic || header.version != s_manifest_version) return false;
+
+	directories.resize(header.num_directories);
+	uint64_t first_file = 0;
+	for(uint64_t i=0; i<header.num_directories; i++) {
+		Directory &directory = directories[i];
+		read_string(ifs, directory.path);
+		ifs.read((char *)&directory.mtime, sizeof(int64_t));
+		ifs.read((char *)&directory.num_files, sizeof(uint64_t));
+		uint32_t num_subdirectories = 0;
+		ifs.read((char *)&num_subdirectories, sizeof(uint32_t));
+		if((ifs.rdstate() & std::ifstream::failbit) != 0) break;
+		directory.subdirectories.resize(num_subdirectories);
+		for(uint32_t j=0; j<num_subdirectories; j++) read_string(ifs, directory.subdirectories[j]);
+		directory.first_file = first_file;
+		first_file += directory.num_files;
+	}
+
+	if(first_file == header.num_files && (ifs.rdstate() & std::ifstream::failbit) == 0) {
+		file_list.resize(header.num_files);
+		for(uint64_t i=0; i<header.num_directories; i++) {
+			const Directory &directory = directories[i];
+			for(uint64_t j=directory.first_file; j<directory.first_file + directory.num_files; j++) {
+				File &file = file_list[j];
+				read_string(ifs, file.path);
+				file.path = join_path(directory.path, file.path);
+				ifs.read((char *)&file.id, sizeof(uint64_t));
+				ifs.read((char *)&file.size, sizeof(uint64_t));
+				ifs.read((char *)&file.mtime, sizeof(int64_t));
+			}
+		}
+	}
+
+	if(first_file != header.num_files || (ifs.rdstate() & std::ifstream::failbit) != 0) {
+		directories.clear();
+		file_list.clear();
+		return false;
+	}
+	next_free_id = header.next_id;
+	return true;
+}
+
+bool ImageManifest::write(const std::string &file_path) const {
+	const std::string temp_path = file_path + ".tmp";
+	filesystem::create_file_directory(file_path);
+	{
+		std::ofstream ofs(temp_path.c_str(), std::ios::binary | std::ios::trunc);
+		ManifestHeader header;
+		header.magic = s_manifest_magic;
+		header.version = s_manifest_version;
+		header.next_id = next_free_id;
+		header.num_directories = directories.size();
+		header.num_files = file_list.size();
+		ofs.write((const char *)&header, sizeof(ManifestHeader));
+
+		for(size_t i=0; i<directories.size(); i++) {
+			const Directory &directory = directories[i];
+			write_string(ofs, directory.path);
+			ofs.write((const char *)&directory.mtime, sizeof(int64_t));
+			ofs.write((const char *)&directory.num_files, sizeof(uint64_t));
+			const uint32_t num_subdirectories = directory.subdirectories.size();
+			ofs.write((const char *)&num_subdirectories, sizeof(uint32_t));
+			for(size_t j=0; j<directory.subdirectories.size(); j++) write_string(ofs, directory.subdirectories[j]);
+		}
+		// file names are stored relative to their directory
+		for(size_t i=0; i<directories.size(); i++) {
+			const Directory &directory = directories[i];
+			const size_t prefix_length = directory.path.empty() ? 0 : directory.path.size() + 1;
+			for(uint64_t j=directory.first_file; j<directory.first_file + directory.num_files; j++) {
+				const File &file = file_list[j];
+				write_string(ofs, file.path.substr(prefix_length));
+				ofs.write((const char *)&file.id, sizeof(uint64_t));
+				ofs.write((const char *)&file.size, sizeof(uint64_t));
+				ofs.write((const char *)&file.mtime, sizeof(int64_t));
+			}
+		}
+		if((ofs.rdstate() & std::ofstream::failbit) != 0) {
+			ofs.close();
+			filesystem::remove_file(temp_path);
+			return false;
+		}
+	}
+	return filesystem::move_file(temp_path, file_path);
+}
+
+bool ImageManifest::scan(const std::string &root, const std::string &ext, ScanResult &result, bool full, uint32_t num_threads) {
+	result.added.clear();
+	result.removed.clear();
+	result.modified.clear();
+	result.num_listed = 0;
+	result.num_reused = 0;
+
+	Scan scan(*this, root, ext, full, MAX(num_threads, 1));
+	std::vector<const ScannedDirectory *> visited;
+	if(!scan.run(visited)) return false;
+
+	std::sort(visited.begin(), visited.end(),
+		[](const ScannedDirectory *a, const ScannedDirectory *b) { return a->path < b->path; });
+
+	// directories which are gone lose all their files
+	std::vector<Directory>::const_iterator known = directories.begin();
+	for(size_t i=0; i<visited.size() || known != directories.end(); ) {
+		if(known == directories.end() || (i < visited.size() && visited[i]->path < known->path)) {
+			i++;
+		} else if(i == visited.size() || known->path < visited[i]->path) {
+			for(uint64_t j=known->first_file; j<known->first_file + known->num_files; j++) {
+				result.removed.push_back(file_list[j].id);
+			}
+			known++;
+		} else {
+			i++;
+			known++;
+		}
+	}
+
+	std::vector<Directory> scanned_directories(visited.size());
+	std::vector<File> scanned_files;
+	for(size_t i=0; i<visited.size(); i++) {
+		const ScannedDirectory &directory = *visited[i];
+		if(directory.listed) result.num_listed++;
+		else result.num_reused++;
+		result.removed.insert(result.removed.end(), directory.removed.begin(), directory.removed.end());
+		result.modified.insert(result.modified.end(), directory.modified.begin(), directory.modified.end());
+
+		Directory &scanned = scanned_directories[i];
+		scanned.path = directory.path;
+		scanned.mtime = directory.mtime;
+		scanned.subdirectories = directory.subdirectories;
+		scanned.first_file = scanned_files.size();
+		scanned.num_files = directory.files.size();
+		for(size_t j=0; j<directory.files.size(); j++) {
+			scanned_files.push_back(directory.files[j]);
+			if(scanned_files.back().id == UINT64_MAX) {
+				scanned_files.back().id = next_free_id++;
+				result.added.push_back(scanned_files.back().id);
+			}
+		}
+	}
+	std::sort(result.removed.begin(), result.removed.end());
+	std::sort(result.modified.begin(), result.modified.end());
+
+	directories.swap(scanned_directories);
+	file_list.swap(scanned_files);
+	return true;
+}
+
+void ImageManifest::reset(const std::vector<File> &files, uint64_t next_id) {
+	std::vector<File> sorted_files(files);
+	for(size_t i=0; i<sorted_files.size(); i++) {
+		sorted_files[i].size = 0;
+		sorted_files[i].mtime = -1;
+	}
+	// groups the files by directory, with the directories in path order
+	std::sort(sorted_files.begin(), sorted_files.end(), [](const File &a, const File &b) {
+		const size_t a_end = a.path.rfind('/'), b_end = b.path.rfind('/');
+		const std::string &a_directory = a_end == std::string::npos ? std::string() : a.path.substr(0, a_end);
+		const std::string &b_directory = b_end == std::string::npos ? std::string() : b.path.substr(0, b_end);
+		return a_directory != b_directory ? a_directory < b_directory : a.path < b.path;
+	});
+
+	directories.clear();
+	file_list.swap(sorted_files);
+	for(size_t i=0; i<file_list.size(); i++) {
+		const size_t end = file_list[i].path.rfind('/');
+		const std::string &path = end == std::string::npos ? std::string() : file_list[i].path.substr(0, end);
+		if(directories.empty() || directories.back().path != path) {
+			Directory directory;
+			directory.path = path;
+			directory.mtime = -1;
+			directory.first_file = i;
+			directory.num_files = 0;
+			directories.push_back(directory);
+		}
+		directories.back().num_files++;
+	}
+	next_free_id = next_id;
+}
+
+void ImageManifest::remap_ids(const std::vector<uint64_t> &new_ids) {
+	for(size_t i=0; i<file_list.size(); i++) {
+		if(file_list[i].id < new_ids.size()) file_list[i].id = new_ids[file_list[i].id];
+	}
+}
+
+const std::vector<ImageManifest::File> &ImageManifest::files() const {
+	return file_list;
+}
+
+uint64_t ImageManifest::next_id() const {
+	return next_free_id;
+}
+
+const ImageManifest::Directory *ImageManifest::find_directory(const std::string &path) const {
+	std::vector<Directory>::const_iterator it = std::lower_bound(directories.begin(), directories.end(), path,
+		[](const Directory &directory, const std::string &path) { return directory.path < path; });
+	return it != directories.end() && it->path == path ? &*it : 0;
+}
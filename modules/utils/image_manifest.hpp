@@ -0,0 +1,88 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// Record of the image files below a directory: the path, size and modification time of every
+/// file and the id assigned to it, plus the modification time and subdirectories of every
+/// directory.  scan(...) brings the record up to date with the disk.  Adding, removing or renaming
+/// a file changes the modification time of its directory, so a directory whose time did not change
+/// is not listed again and its files are not stat'ed: on an unchanged tree a scan only stats the
+/// directories.  Directories are scanned by a pool of I/O threads, one directory per work item, so
+/// that the latency of a network filesystem is paid once per batch of directories instead of once
+/// per directory.
+class ImageManifest {
+public:
+	struct File {
+		std::string path; /// Path relative to the scanned root, ex. "a/b/0001.jpg".
+		uint64_t id;
+		uint64_t size;
+		int64_t mtime; /// Modification time in seconds, -1 if unknown.
+	};
+
+	/// Changes found by a scan.  The id vectors are sorted.
+	struct ScanResult {
+		std::vector<uint64_t> added;
+		std::vector<uint64_t> removed;
+		std::vector<uint64_t> modified; /// Files whose size or modification time changed, they keep their id.
+		uint64_t num_listed; /// Number of directories which were listed.
+		uint64_t num_reused; /// Number of unchanged directories whose entries were taken from the manifest.
+	};
+
+	ImageManifest();
+
+	/// Reads a manifest written by write.  Returns true if successful, false otherwise, the
+	/// manifest is then empty.
+	bool read(const std::string &file_path);
+
+	/// Writes the manifest to a temporary file which then replaces file_path, so that an
+	/// interrupted write leaves the previous manifest.  Returns true if successful.
+	bool write(const std::string &file_path) const;
+
+	/// Updates the manifest with the files with extension ext (including the dot, ie. ".jpg", or
+	/// empty for all files) below root.  Files which were already in the manifest keep their id,
+	/// new files get the next unused ids in path order, and the ids of removed files are never
+	/// reused.  If full is true every directory is listed and every file stat'ed, which also finds
+	/// files modified in place.  Returns false if a directory cannot be read, the manifest is then
+	/// unchanged.
+	bool scan(const std::string &root, const std::string &ext, ScanResult &result, bool full = false,
+		uint32_t num_threads = s_default_num_threads);
+
+	/// Replaces the manifest with the given files, with unknown sizes and times, so that the next
+	/// scan lists every directory and keeps the ids of these files.  New ids start at next_id.
+	void reset(const std::vector<File> &files, uint64_t next_id);
+
+	/// Renumbers the files, id i becomes new_ids[i].
+	void remap_ids(const std::vector<uint64_t> &new_ids);
+
+	/// Returns the files grouped by directory, in path order.
+	const std::vector<File> &files() const;
+
+	/// Returns the id the next new file gets.
+	uint64_t next_id() const;
+
+	/// Default number of I/O threads of scan.  Scanning waits on the filesystem rather than on the
+	/// CPU, so this is larger than the number of cores.
+	static const uint32_t s_default_num_threads = 16;
+
+protected:
+	struct Directory {
+		std::string path; /// Path relative to the root, empty for the root.
+		int64_t mtime; /// Modification time when listed, -1 if the directory must be listed again.
+		std::vector<std::string> subdirectories; /// Sorted names of the subdirectories.
+		uint64_t first_file, num_files; /// Files of the directory in file_list.
+	};
+
+	/// State shared by the I/O threads of a scan.
+	class Scan;
+
+	/// Returns the directory with the given path, or 0.
+	const Directory *find_directory(const std::string &path) const;
+
+	std::vector<Directory> directories; /// Sorted by path.
+	std::vector<File> file_list; /// Files of every directory sorted by path, in directory order.
+	uint64_t next_free_id;
+};
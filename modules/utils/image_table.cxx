@@ -0,0 +1,242 @@
+#include "image_table.hpp"
+#include "filesystem.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+/// "DSET"
+static const uint32_t s_image_table_magic = 0x54455344;
+static const uint32_t s_image_table_version = 1;
+/// Offset of unused ids.
+static const uint64_t s_no_image = UINT64_MAX;
+
+struct ImageTableHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t num_images;
+	uint64_t num_ids;
+	uint64_t num_indexed; /// Number of ids in the path index, 0 if the file has no index.
+	uint64_t arena_size;
+};
+
+/// Byte offsets of the arrays of a table.
+struct ImageTableLayout {
+	uint64_t offsets, index, arena, total_size;
+
+	ImageTableLayout(const ImageTableHeader &header) {
+		offsets = sizeof(ImageTableHeader);
+		index = offsets + sizeof(uint64_t) * header.num_ids;
+		arena = index + sizeof(uint64_t) * header.num_indexed;
+		total_size = arena + header.arena_size;
+	}
+};
+
+/// Orders ids by the path of their image.
+struct PathLess {
+	PathLess(const ImageTable &table) : table(table) { }
+	bool operator()(uint64_t a, uint64_t b) const { return strcmp(table.path(a), table.path(b)) < 0; }
+	bool operator()(uint64_t a, const char *b) const { return strcmp(table.path(a), b) < 0; }
+	const ImageTable &table;
+};
+
+ImageTable::ImageTable() : offsets(0), offsets_size(0), arena(0), arena_size(0), index(0), indexed(true), count(0) {
+
+}
+
+bool ImageTable::open(const std::string &file_path) {
+	PTR_LIB::shared_ptr<MappedFile> file = PTR_LIB::make_shared<MappedFile>();
+	if(!file->open(file_path) || file->size() < sizeof(ImageTableHeader)) return false;
+
+	const ImageTableHeader &header = *(const ImageTableHeader *)file->data();
+	if(header.magic != s_image_table_magic || header.version != s_image_table_version) return false;
+	if(header.num_ids > file->size() / sizeof(uint64_t) || header.num_indexed > file->size() / sizeof(uint64_t)) return false;
+	const ImageTableLayout layout(header);
+	if(file->size() < layout.total_size) return false;
+	// paths are null terminated, so a path can not run past the arena
+	if(header.arena_size > 0 && file->data()[layout.arena + header.arena_size - 1] != '\0') return false;
+
+	clear();
+	mapped_file = file;
+	offsets = (const uint64_t *)(file->data() + layout.offsets);
+	offsets_size = header.num_ids;
+	index = (const uint64_t *)(file->data() + layout.index);
+	indexed = header.num_indexed == header.num_images;
+	arena = file->data() + layout.arena;
+	arena_size = header.arena_size;
+	count = header.num_images;
+	return true;
+}
+
+bool ImageTable::write(const std::string &file_path) const {
+	// the paths of the images are written back to back, in id order
+	std::vector<uint64_t> compact_offsets(offsets_size, s_no_image);
+	uint64_t compact_arena_size = 0;
+	for(uint64_t id=0; id<offsets_size; id++) {
+		const char *image_path = path(id);
+		if(!image_path) continue;
+		compact_offsets[id] = compact_arena_size;
+		compact_arena_size += strlen(image_path) + 1;
+	}
+	const std::vector<uint64_t> &sorted = indexed ? std::vector<uint64_t>(index, index + count) : sorted_ids();
+
+	ImageTableHeader header;
+	memset(&header, 0, sizeof(ImageTableHeader));
+	header.magic = s_image_table_magic;
+	header.version = s_image_table_version;
+	header.num_images = count;
+	header.num_ids = offsets_size;
+	header.num_indexed = sorted.size();
+	header.arena_size = compact_arena_size;
+
+	const std::string temp_path = file_path + ".tmp";
+	filesystem::create_file_directory(file_path);
+	{
+		std::ofstream ofs(temp_path.c_str(), std::ios::binary | std::ios::trunc);
+		ofs.write((const char *)&header, sizeof(ImageTableHeader));
+		if(!compact_offsets.empty()) ofs.write((const char *)&compact_offsets[0], sizeof(uint64_t) * compact_offsets.size());
+		if(!sorted.empty()) ofs.write((const char *)&sorted[0], sizeof(uint64_t) * sorted.size());
+		for(uint64_t id=0; id<offsets_size; id++) {
+			const char *image_path = path(id);
+			if(image_path) ofs.write(image_path, strlen(image_path) + 1);
+		}
+		if((ofs.rdstate() & std::ofstream::failbit) != 0) {
+			ofs.close();
+			filesystem::remove_file(temp_path);
+			return false;
+		}
+	}
+	// a mapped file keeps its contents when it is replaced
+	return filesystem::move_file(temp_path, file_path);
+}
+
+void ImageTable::clear() {
+	mapped_file.reset();
+	std::vector<uint64_t>().swap(offset_storage);
+	std::vector<char>().swap(arena_storage);
+	std::vector<uint64_t>().swap(index_storage);
+	indexed = true;
+	count = 0;
+	update_views();
+}
+
+bool ImageTable::is_mapped() const {
+	return (bool)mapped_file;
+}
+
+uint64_t ImageTable::size() const {
+	return count;
+}
+
+uint64_t ImageTable::num_ids() const {
+	return offsets_size;
+}
+
+bool ImageTable::contains(uint64_t id) const {
+	return id < offsets_size && offsets[id] < arena_size;
+}
+
+const char *ImageTable::path(uint64_t id) const {
+	if(!contains(id)) return 0;
+	return arena + offsets[id];
+}
+
+bool ImageTable::find(const char *path, uint64_t &id) const {
+	if(indexed) {
+		const uint64_t *it = std::lower_bound(index, index + count, path, PathLess(*this));
+		if(it == index + count || strcmp(this->path(*it), path) != 0) return false;
+		id = *it;
+		return true;
+	}
+	for(uint64_t i=0; i<offsets_size; i++) {
+		const char *image_path = this->path(i);
+		if(image_path && strcmp(image_path, path) == 0) {
+			id = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ImageTable::insert(uint64_t id, const char *path, size_t length) {
+	if(contains(id)) return false;
+	detach();
+	if(id >= offset_storage.size()) offset_storage.resize(id + 1, s_no_image);
+	offset_storage[id] = arena_storage.size();
+	arena_storage.insert(arena_storage.end(), path, path + length);
+	arena_storage.push_back('\0');
+	count++;
+	indexed = false;
+	index_storage.clear();
+	update_views();
+	return true;
+}
+
+bool ImageTable::remove(uint64_t id) {
+	if(!contains(id)) return false;
+	detach();
+	offset_storage[id] = s_no_image;
+	count--;
+	indexed = false;
+	index_storage.clear();
+	update_views();
+	return true;
+}
+
+void ImageTable::remap_ids(const std::vector<uint64_t> &new_ids) {
+	detach();
+	// the paths stay in the arena, only their offsets move
+	std::vector<uint64_t> remapped(offset_storage.size(), s_no_image);
+	for(uint64_t id=0; id<offset_storage.size(); id++) {
+		if(offset_storage[id] != s_no_image) remapped[new_ids[id]] = offset_storage[id];
+	}
+	offset_storage.swap(remapped);
+	// the path order does not change
+	for(size_t i=0; i<index_storage.size(); i++) index_storage[i] = new_ids[index_storage[i]];
+	update_views();
+}
+
+void ImageTable::reserve(uint64_t num_ids) {
+	if(is_mapped()) return;
+	offset_storage.reserve(num_ids);
+	update_views();
+}
+
+void ImageTable::build_index() {
+	if(indexed) return;
+	detach();
+	index_storage = sorted_ids();
+	indexed = true;
+	update_views();
+}
+
+bool ImageTable::is_indexed() const {
+	return indexed;
+}
+
+void ImageTable::detach() {
+	if(!mapped_file) return;
+	offset_storage.assign(offsets, offsets + offsets_size);
+	arena_storage.assign(arena, arena + arena_size);
+	if(indexed) index_storage.assign(index, index + count);
+	mapped_file.reset();
+	update_views();
+}
+
+void ImageTable::update_views() {
+	offsets = offset_storage.empty() ? 0 : &offset_storage[0];
+	offsets_size = offset_storage.size();
+	arena = arena_storage.empty() ? 0 : &arena_storage[0];
+	arena_size = arena_storage.size();
+	index = index_storage.empty() ? 0 : &index_storage[0];
+}
+
+std::vector<uint64_t> ImageTable::sorted_ids() const {
+	std::vector<uint64_t> ids;
+	ids.reserve(count);
+	for(uint64_t id=0; id<offsets_size; id++) {
+		if(contains(id)) ids.push_back(id);
+	}
+	std::sort(ids.begin(), ids.end(), PathLess(*this));
+	return ids;
+}
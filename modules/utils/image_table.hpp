@@ -0,0 +1,95 @@
+#pragma once
+
+#include "config.hpp"
+#include "mapped_file.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+/// Table of the image paths of a dataset by image id.  The paths are stored back to back and null
+/// terminated in an arena, with an offset into the arena per id, so looking up a path is an array
+/// access.  The ids sorted by path form the index of reverse lookups.  The file written by write
+/// holds these three arrays as they are in memory, and open maps it, so a table of millions of
+/// images opens without parsing or allocating anything per image.  Modifying a mapped table first
+/// copies it to memory.
+class ImageTable {
+public:
+	ImageTable();
+
+	/// Maps the table written by write at the specified location.  Returns false if the file is
+	/// not an image table, the table is then unchanged.
+	bool open(const std::string &file_path);
+
+	/// Writes the table to a temporary file which then replaces file_path, so that the file of a
+	/// mapped table can be rewritten.  Paths of removed images are dropped from the arena.
+	/// Returns true if successful, false otherwise.
+	bool write(const std::string &file_path) const;
+
+	/// Removes all images.
+	void clear();
+
+	/// Returns true if the table is served from a mapped file.
+	bool is_mapped() const;
+
+	/// Returns the number of images.
+	uint64_t size() const;
+
+	/// Returns the largest id + 1.
+	uint64_t num_ids() const;
+
+	/// Returns true if an image has the id.
+	bool contains(uint64_t id) const;
+
+	/// Returns the path of an image, or 0 if no image has the id.  The pointer is valid until the
+	/// table is modified.
+	const char *path(uint64_t id) const;
+
+	/// Sets id to the id of the image with the given path and returns true, returns false if no
+	/// image has the path.  Binary search if the table is indexed (see build_index), linear scan
+	/// otherwise.
+	bool find(const char *path, uint64_t &id) const;
+
+	/// Adds an image.  Returns false if the id is taken.
+	bool insert(uint64_t id, const char *path, size_t length);
+
+	/// Removes an image.  Returns false if no image has the id.
+	bool remove(uint64_t id);
+
+	/// Renumbers the images, id i becomes new_ids[i].  new_ids must be a permutation of the ids.
+	void remap_ids(const std::vector<uint64_t> &new_ids);
+
+	/// Reserves space for ids up to num_ids.
+	void reserve(uint64_t num_ids);
+
+	/// Sorts the ids by path for find.  Tables read by open are indexed, inserting or removing an
+	/// image drops the index.
+	void build_index();
+
+	/// Returns true if find uses the index.
+	bool is_indexed() const;
+
+protected:
+	/// Copies a mapped table to memory.
+	void detach();
+
+	/// Points the arrays at the owned storage.
+	void update_views();
+
+	/// Returns the ids of the images sorted by path.
+	std::vector<uint64_t> sorted_ids() const;
+
+	std::vector<uint64_t> offset_storage;
+	std::vector<char> arena_storage;
+	std::vector<uint64_t> index_storage;
+	PTR_LIB::shared_ptr<MappedFile> mapped_file; /// Set if the arrays point into a mapped file.
+
+	const uint64_t *offsets; /// Offset of the path of every id in arena, UINT64_MAX for unused ids.
+	uint64_t offsets_size;
+	const char *arena;
+	uint64_t arena_size;
+	const uint64_t *index; /// Ids sorted by path, valid if indexed.
+	bool indexed;
+	uint64_t count;
+};
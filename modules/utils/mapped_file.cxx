@@ -0,0 +1,112 @@
+#include "mapped_file.hpp"
+
+#include <fstream>
+#include <algorithm>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : mapped_data(0), mapped_size(0) {
+
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const std::string &file_path) {
+	close();
+
+#ifndef WIN32
+	int fd = ::open(file_path.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+
+	struct stat file_stat;
+	if(fstat(fd, &file_stat) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	if(file_stat.st_size > 0) {
+		void *ptr = mmap(0, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(ptr == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+		mapped_data = (const char *)ptr;
+	}
+	mapped_size = file_stat.st_size;
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+#else
+	std::ifstream ifs(file_path.c_str(), std::ios::binary | std::ios::ate);
+	if(!ifs.is_open()) return false;
+	buffer.resize((size_t)ifs.tellg());
+	ifs.seekg(0, std::ios::beg);
+	if(!buffer.empty()) ifs.read(&buffer[0], buffer.size());
+	if((ifs.rdstate() & std::ifstream::failbit) != 0) {
+		std::vector<char>().swap(buffer);
+		return false;
+	}
+	mapped_data = buffer.empty() ? 0 : &buffer[0];
+	mapped_size = buffer.size();
+#endif
+
+	return true;
+}
+
+void MappedFile::close() {
+#ifndef WIN32
+	if(mapped_data) munmap((void *)mapped_data, mapped_size);
+#else
+	std::vector<char>().swap(buffer);
+#endif
+	mapped_data = 0;
+	mapped_size = 0;
+}
+
+bool MappedFile::is_open() const {
+	return mapped_data != 0;
+}
+
+const char *MappedFile::data() const {
+	return mapped_data;
+}
+
+uint64_t MappedFile::size() const {
+	return mapped_size;
+}
+
+void MappedFile::advise(Advice advice, uint64_t offset, uint64_t length) const {
+#ifndef WIN32
+	if(!mapped_data || offset >= mapped_size) return;
+	length = std::min(length, mapped_size - offset);
+
+	// madvise needs a page aligned start address
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+	const uint64_t aligned_offset = offset - offset % page_size;
+	length += offset - aligned_offset;
+
+	int flag = MADV_NORMAL;
+	switch(advice) {
+		case ADVICE_RANDOM: flag = MADV_RANDOM; break;
+		case ADVICE_SEQUENTIAL: flag = MADV_SEQUENTIAL; break;
+		case ADVICE_WILLNEED: flag = MADV_WILLNEED; break;
+		case ADVICE_DONTNEED: flag = MADV_DONTNEED; break;
+		default: break;
+	}
+	madvise((void *)(mapped_data + aligned_offset), length, flag);
+#endif
+}
+
+void MappedFile::prefault(const std::vector< std::pair<uint64_t, uint64_t> > &ranges) {
+	if(!mapped_data || ranges.empty()) return;
+
+	for(size_t i=0; i<ranges.size(); i++) {
+		advise(ADVICE_WILLNEED, ranges[i].first, ranges[i].second);
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <memory>
+
+/// Read only memory mapping of a file.  The contents are paged in by the operating system on
+/// first access, so mapping a large file is cheap and parts which are never read stay on disk.
+/// On platforms without mmap the file is read into memory instead.
+class MappedFile {
+public:
+	/// Access pattern hints, forwarded to madvise.
+	enum Advice {
+		ADVICE_NORMAL = 0,
+		ADVICE_RANDOM, /// pages are accessed in random order, disables read ahead
+		ADVICE_SEQUENTIAL, /// pages are accessed sequentially, aggressive read ahead
+		ADVICE_WILLNEED, /// pages will be needed soon, starts reading them in
+		ADVICE_DONTNEED /// pages will not be needed soon, they may be dropped from memory
+	};
+
+	MappedFile();
+	~MappedFile();
+
+	/// Maps the file at the specified location.  Returns true if successful, false otherwise.
+	bool open(const std::string &file_path);
+
+	/// Unmaps the file.
+	void close();
+
+	/// Returns true if a file is mapped.
+	bool is_open() const;
+
+	/// Returns the mapped contents and their size in bytes.
+	const char *data() const;
+	uint64_t size() const;
+
+	/// Gives a hint about how the bytes [offset, offset + length) will be accessed.
+	void advise(Advice advice, uint64_t offset = 0, uint64_t length = UINT64_MAX) const;
+
+	/// Asks the kernel to read the pages of the given (offset, length) ranges ahead (see
+	/// ADVICE_WILLNEED) and returns immediately, so that later accesses do not wait on the reads.
+	void prefault(const std::vector< std::pair<uint64_t, uint64_t> > &ranges);
+
+protected:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	const char *mapped_data;
+	uint64_t mapped_size;
+	std::vector<char> buffer; /// file contents on platforms without mmap
+};
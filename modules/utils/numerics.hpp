@@ -5,11 +5,11 @@
 #include <vector>
 #include <opencv2/opencv.hpp>
 
+#include "sparse_vector.hpp"
+
 /// Provides useful wrappers around many numerical functionality, such as dealing with sparse
 /// and dense matrix / vector data.
 namespace numerics {
-	typedef std::vector< std::pair<uint32_t, float > > sparse_vector_t;
-
 	/// Converts the input 1D cv::Mat to a sparse format, where each pair in the vector
 	/// is index, value.  This is useful for BoW features which are usually zero.
 	std::vector< std::pair<uint32_t, float> > sparsify(const cv::Mat &dense);
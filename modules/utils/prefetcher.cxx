@@ -0,0 +1,82 @@
+#include "prefetcher.hpp"
+
+Prefetcher::Prefetcher(uint32_t queue_depth) : num_running(0), stopping(false) {
+	for(uint32_t i=0; i<queue_depth; i++) {
+		threads.push_back(std::thread(&Prefetcher::run, this));
+	}
+}
+
+Prefetcher::~Prefetcher() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		batches.clear();
+		stopping = true;
+	}
+	work_available.notify_all();
+	for(size_t i=0; i<threads.size(); i++) threads[i].join();
+}
+
+void Prefetcher::Ticket::add(const Ticket &other) {
+	batches.insert(batches.end(), other.batches.begin(), other.batches.end());
+}
+
+void Prefetcher::Ticket::cancel() const {
+	for(size_t i=0; i<batches.size(); i++) batches[i]->cancelled = true;
+}
+
+Prefetcher::Ticket Prefetcher::submit(const std::vector<uint64_t> &ids, const load_function_t &load) {
+	Ticket ticket;
+	if(ids.empty() || threads.empty()) return ticket;
+
+	PTR_LIB::shared_ptr<Batch> batch = PTR_LIB::make_shared<Batch>();
+	batch->ids = ids;
+	batch->load = load;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		batches.push_back(batch);
+	}
+	work_available.notify_all();
+	ticket.batches.push_back(batch);
+	return ticket;
+}
+
+void Prefetcher::cancel() {
+	std::lock_guard<std::mutex> lock(mutex);
+	batches.clear();
+	if(num_running == 0) work_done.notify_all();
+}
+
+void Prefetcher::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while(!batches.empty() || num_running > 0) work_done.wait(lock);
+}
+
+uint32_t Prefetcher::queue_depth() const {
+	return threads.size();
+}
+
+void Prefetcher::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true) {
+		while(batches.empty() && !stopping) work_available.wait(lock);
+		if(stopping) return;
+
+		// the batch is shared, so a load outlives a cancel of its batch
+		PTR_LIB::shared_ptr<Batch> batch = batches.front();
+		if(batch->cancelled) {
+			batches.pop_front();
+			if(batches.empty() && num_running == 0) work_done.notify_all();
+			continue;
+		}
+		const uint64_t id = batch->ids[batch->next++];
+		if(batch->next == batch->ids.size()) batches.pop_front();
+		num_running++;
+
+		lock.unlock();
+		batch->load(id);
+		lock.lock();
+
+		num_running--;
+		if(batches.empty() && num_running == 0) work_done.notify_all();
+	}
+}
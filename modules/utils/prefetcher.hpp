@@ -0,0 +1,89 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <boost/function.hpp>
+
+/// Small pool of I/O threads which loads features ahead of their use, so that scoring a list of
+/// candidates overlaps with reading their features instead of waiting on every read in turn.
+/// The queue depth is the number of I/O threads, ie. the number of reads in flight.  Loads start
+/// in the order they were submitted, so submitting ids in the order of their features on disk
+/// reads the features mostly sequentially.  Every submit returns a Ticket, with which its
+/// submitter cancels its own loads without dropping those of other users of the pool.
+class Prefetcher {
+protected:
+	struct Batch;
+
+public:
+	typedef boost::function<void(uint64_t)> load_function_t;
+
+	/// Handle to the loads of one or more submits, possibly to different prefetchers (ex. the
+	/// candidates of a query over the shards of a dataset).  Copies share the loads.
+	class Ticket {
+	public:
+		/// Adds the loads of another ticket to this one.
+		void add(const Ticket &other);
+
+		/// Drops the loads of the ticket which have not started yet.
+		void cancel() const;
+
+	protected:
+		friend class Prefetcher;
+		std::vector< PTR_LIB::shared_ptr<Batch> > batches;
+	};
+
+	/// Starts queue_depth I/O threads.
+	Prefetcher(uint32_t queue_depth = s_default_queue_depth);
+
+	/// Drops the queued loads and joins the I/O threads.
+	~Prefetcher();
+
+	/// Queues load(id) for every id and returns immediately, with the ticket to cancel them.
+	/// load runs on the I/O threads, so it must be thread safe.
+	Ticket submit(const std::vector<uint64_t> &ids, const load_function_t &load);
+
+	/// Drops the queued loads of every ticket which have not started yet.
+	void cancel();
+
+	/// Blocks until every queued load is done.
+	void wait();
+
+	/// Returns the number of I/O threads.
+	uint32_t queue_depth() const;
+
+	/// Default number of I/O threads.
+	static const uint32_t s_default_queue_depth = 8;
+
+protected:
+	Prefetcher(const Prefetcher &);
+	Prefetcher &operator=(const Prefetcher &);
+
+	/// Ids submitted together, loaded front to back.  A cancelled batch is dropped when it
+	/// reaches the front of the queue.
+	struct Batch {
+		Batch() : next(0), cancelled(false) { }
+
+		std::vector<uint64_t> ids;
+		size_t next;
+		load_function_t load;
+		std::atomic<bool> cancelled;
+	};
+
+	/// Loop of an I/O thread.
+	void run();
+
+	std::vector<std::thread> threads;
+	std::deque< PTR_LIB::shared_ptr<Batch> > batches; /// Batches with loads which have not started yet.
+	std::mutex mutex; /// Protects batches, num_running and stopping.
+	std::condition_variable work_available, work_done;
+	uint32_t num_running; /// Number of loads running.
+	bool stopping;
+};
@@ -0,0 +1,123 @@
+#include "query_table.hpp"
+
+/// Smallest hash table capacity, must be a power of two.
+static const uint32_t s_min_hash_capacity = 1024;
+/// Number of candidate words ahead of the current one whose table entry is prefetched.
+static const size_t s_prefetch_distance = 16;
+
+static inline void prefetch(const void *address) {
+#if defined(__GNUC__)
+	__builtin_prefetch(address);
+#endif
+}
+
+/// Prefetches the start of the arrays of a candidate.
+static inline void prefetch_candidate(const numerics::SparseVectorView &candidate) {
+	if (candidate.empty()) return;
+	prefetch(candidate.indices());
+	prefetch(candidate.values());
+}
+
+QueryTable::QueryTable() : hashed(false), hash_mask(0) {
+
+}
+
+void QueryTable::set(const numerics::SparseVectorView &query, const std::vector<float> &idfw) {
+	this->clear();
+
+	const uint32_t *indices = query.indices();
+	const float *values = query.values();
+	const float norm = numerics::weighted_sum(query, idfw);
+	const float inv_norm = norm > 0.f ? 1.f / norm : 0.f;
+
+	hashed = idfw.size() > s_max_dense_words;
+	if (!hashed) {
+		if (dense_values.size() < idfw.size()) dense_values.resize(idfw.size(), 0.f);
+		for (size_t k = 0; k < query.size(); k++) {
+			dense_values[indices[k]] = values[k] * idfw[indices[k]] * inv_norm;
+			words.push_back(indices[k]);
+		}
+		return;
+	}
+
+	uint32_t capacity = s_min_hash_capacity;
+	while (capacity < 2 * query.size()) capacity <<= 1;
+	if (hash_keys.size() < capacity) {
+		hash_keys.assign(capacity, 0);
+		hash_values.assign(capacity, 0.f);
+	}
+	hash_mask = hash_keys.size() - 1;
+	for (size_t k = 0; k < query.size(); k++) {
+		// the query words are distinct, so every word takes a new slot
+		uint32_t slot = hash_word(indices[k]) & hash_mask;
+		while (hash_keys[slot] != 0) slot = (slot + 1) & hash_mask;
+		hash_keys[slot] = indices[k] + 1;
+		hash_values[slot] = values[k] * idfw[indices[k]] * inv_norm;
+		words.push_back(slot);
+	}
+}
+
+float QueryTable::min_hist(const numerics::SparseVectorView &candidate, const std::vector<float> &idfw) const {
+	const uint32_t *indices = candidate.indices();
+	const float *values = candidate.values();
+	const size_t size = candidate.size();
+	const float norm = numerics::weighted_sum(candidate, idfw);
+	const float inv_norm = norm > 0.f ? 1.f / norm : 0.f;
+
+	float sum = 0.f;
+	for (size_t k = 0; k < size; k++) {
+		if (!hashed && k + s_prefetch_distance < size) prefetch(&dense_values[indices[k + s_prefetch_distance]]);
+		const float query_value = lookup(indices[k]);
+		const float candidate_value = values[k] * idfw[indices[k]] * inv_norm;
+		sum += query_value < candidate_value ? query_value : candidate_value;
+	}
+	return sum;
+}
+
+float QueryTable::min_hist_normalized(const numerics::SparseVectorView &candidate) const {
+	const uint32_t *indices = candidate.indices();
+	const float *values = candidate.values();
+	const size_t size = candidate.size();
+
+	float sum = 0.f;
+	for (size_t k = 0; k < size; k++) {
+		if (!hashed && k + s_prefetch_distance < size) prefetch(&dense_values[indices[k + s_prefetch_distance]]);
+		const float query_value = lookup(indices[k]);
+		sum += query_value < values[k] ? query_value : values[k];
+	}
+	return sum;
+}
+
+void QueryTable::min_hist(const numerics::SparseVectorView *candidates, size_t count, const std::vector<float> &idfw, float *scores) const {
+	for (size_t i = 0; i < count; i++) {
+		if (i + 1 < count) prefetch_candidate(candidates[i + 1]);
+		scores[i] = this->min_hist(candidates[i], idfw);
+	}
+}
+
+void QueryTable::min_hist_normalized(const numerics::SparseVectorView *candidates, size_t count, float *scores) const {
+	for (size_t i = 0; i < count; i++) {
+		if (i + 1 < count) prefetch_candidate(candidates[i + 1]);
+		scores[i] = this->min_hist_normalized(candidates[i]);
+	}
+}
+
+void QueryTable::clear() {
+	if (!hashed) {
+		for (size_t i = 0; i < words.size(); i++) {
+			dense_values[words[i]] = 0.f;
+		}
+	} else {
+		for (size_t i = 0; i < words.size(); i++) {
+			hash_keys[words[i]] = 0;
+			hash_values[words[i]] = 0.f;
+		}
+	}
+	words.clear();
+}
+
+QueryTable &QueryTable::thread_instance() {
+	static thread_local QueryTable table;
+	table.clear();
+	return table;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "config.hpp"
+#include "sparse_vector.hpp"
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+/// Scores many candidate BoW vectors against one query.  The query is scattered once into a
+/// table indexed by word, holding its idf weighted, L1 normalized values, and every candidate
+/// is then scored by looking up its words in the table instead of merging it with the query.
+/// The table is dense (one float per word) for vocabularies of up to s_max_dense_words words and
+/// a small open addressing hash table otherwise.  Words missing from the query read as zero, so
+/// the histogram intersection needs no branch per word.  Clearing the table costs O(query size).
+class QueryTable {
+public:
+	QueryTable();
+
+	/// Scatters the query into the table, weighted by idfw and normalized like
+	/// numerics::normalize with NORM_L1.  The vocabulary size is idfw.size().
+	void set(const numerics::SparseVectorView &query, const std::vector<float> &idfw);
+
+	/// Returns the histogram intersection of the query and a candidate, equal to numerics::min_hist
+	/// of the query and the candidate.
+	float min_hist(const numerics::SparseVectorView &candidate, const std::vector<float> &idfw) const;
+
+	/// Returns the histogram intersection of the query and a candidate returned by
+	/// numerics::normalize with NORM_L1, equal to numerics::min_hist_normalized.
+	float min_hist_normalized(const numerics::SparseVectorView &candidate) const;
+
+	/// Scores count candidates into scores, see min_hist.  The arrays of the next candidate are
+	/// prefetched while the current one is scored.
+	void min_hist(const numerics::SparseVectorView *candidates, size_t count, const std::vector<float> &idfw, float *scores) const;
+
+	/// Scores count normalized candidates into scores, see min_hist_normalized.
+	void min_hist_normalized(const numerics::SparseVectorView *candidates, size_t count, float *scores) const;
+
+	/// Zeros the entries of the query, the cost is proportional to the number of query words.
+	void clear();
+
+	/// Returns a table owned by the calling thread, which allows search calls to reuse the table
+	/// between queries.  The returned table is cleared.
+	static QueryTable &thread_instance();
+
+	/// Largest vocabulary stored in a dense table (64MB per thread).
+	static const uint32_t s_max_dense_words = 1 << 24;
+
+protected:
+
+	/// Returns the table value of a word, zero if it is not a query word.
+	inline float lookup(uint32_t word) const {
+		if (!hashed) return dense_values[word];
+		uint32_t slot = hash_word(word) & hash_mask;
+		while (hash_keys[slot] != 0) {
+			if (hash_keys[slot] == word + 1) return hash_values[slot];
+			slot = (slot + 1) & hash_mask;
+		}
+		return 0.f;
+	}
+
+	static inline uint32_t hash_word(uint32_t word) {
+		word ^= word >> 16;
+		word *= 0x45d9f3bU;
+		word ^= word >> 16;
+		return word;
+	}
+
+	bool hashed; /// True if the hash table is used instead of the dense values.
+
+	std::vector<float> dense_values; /// Dense values, grows to the largest vocabulary seen.
+	std::vector<uint32_t> words; /// Query words (dense mode) or slot indices (hash mode) set in the table.
+
+	std::vector<uint32_t> hash_keys; /// Hash table keys, stored as word + 1 so that zero marks an empty slot.
+	std::vector<float> hash_values; /// Hash table values.
+	uint32_t hash_mask; /// Hash table capacity - 1, the capacity is a power of two.
+};
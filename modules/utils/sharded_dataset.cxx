@@ -0,0 +1,285 @@
+#include "sharded_dataset.hpp"
+#include "filesystem.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <stdexcept>
+
+/// Shard of the global ids which have no image.
+static const uint32_t s_no_shard = UINT32_MAX;
+
+ShardedDataset::ShardImage::ShardImage(uint64_t id, const std::string &shard_path, const PTR_LIB::shared_ptr<Image> &image) :
+	Image(id), shard_path(shard_path), image(image) {
+
+}
+
+std::string ShardedDataset::ShardImage::feature_path(const std::string &feat_name) const {
+	return shard_path + image->feature_path(feat_name);
+}
+
+std::string ShardedDataset::ShardImage::location() const {
+	return shard_path + image->location();
+}
+
+const PTR_LIB::shared_ptr<Image> &ShardedDataset::ShardImage::shard_image() const {
+	return image;
+}
+
+ShardedDataset::ShardedDataset(const std::string &base_location, const std::vector<std::string> &shard_locations, size_t cache_size) :
+	Dataset(base_location), cache_size(cache_size), count(0) {
+	if(!this->open_shards(shard_locations)) {
+		std::cerr << "Error opening the shards of " << base_location << std::endl;
+	}
+}
+
+ShardedDataset::ShardedDataset(const std::string &base_location, const std::string &db_data_location, size_t cache_size) :
+	Dataset(base_location, db_data_location), cache_size(cache_size), count(0) {
+	if(!this->read(db_data_location)) {
+		std::cerr << "Error reading sharded dataset from " << db_data_location << std::endl;
+	}
+}
+
+ShardedDataset::~ShardedDataset() { }
+
+bool ShardedDataset::write(const std::string &db_data_location) {
+	std::string text;
+	for(size_t i=0; i<shard_locations.size(); i++) text += shard_locations[i] + "\n";
+	filesystem::create_file_directory(db_data_location);
+	return filesystem::write_text(db_data_location, text);
+}
+
+bool ShardedDataset::read(const std::string &db_data_location) {
+	std::ifstream ifs(db_data_location.c_str());
+	if(!ifs.is_open()) {
+		this->clear();
+		return false;
+	}
+	std::vector<std::string> locations;
+	std::string line;
+	while(std::getline(ifs, line)) {
+		if(!line.empty()) locations.push_back(line);
+	}
+	return this->open_shards(locations);
+}
+
+void ShardedDataset::clear() {
+	shard_locations.clear();
+	shards.clear();
+	shard_global_ids.clear();
+	id_shards.clear();
+	id_local_ids.clear();
+	count = 0;
+}
+
+bool ShardedDataset::open_shards(const std::vector<std::string> &locations) {
+	this->clear();
+
+	std::vector< PTR_LIB::shared_ptr<SimpleDataset> > opened(locations.size());
+	std::vector< std::vector<uint64_t> > global_ids(locations.size());
+	for(uint32_t s=0; s<locations.size(); s++) {
+		// a shard without its dataset file would be rebuilt from its images with other ids
+		if(!filesystem::file_exists(dataset_location(locations[s])) || !read_global_ids(locations[s], global_ids[s])) {
+			std::cerr << "Error reading shard " << locations[s] << std::endl;
+			this->clear();
+			return false;
+		}
+		opened[s] = PTR_LIB::make_shared<SimpleDataset>(locations[s], dataset_location(locations[s]), cache_size);
+		for(uint64_t local_id=0; local_id<global_ids[s].size(); local_id++) {
+			if(!opened[s]->has_image(local_id)) continue;
+			const uint64_t id = global_ids[s][local_id];
+			if(id >= id_shards.size()) {
+				id_shards.resize(id + 1, s_no_shard);
+				id_local_ids.resize(id + 1, 0);
+			}
+			if(id_shards[id] != s_no_shard) {
+				std::cerr << "Image " << id << " is in shards " << locations[id_shards[id]] << " and " << locations[s] << std::endl;
+				this->clear();
+				return false;
+			}
+			id_shards[id] = s;
+			id_local_ids[id] = local_id;
+			count++;
+		}
+		if(!filesystem::link_directory(locations[s], data_directory + shard_path(s))) {
+			std::cerr << "Error linking shard " << locations[s] << " to " << data_directory + shard_path(s) << std::endl;
+		}
+	}
+
+	shard_locations = locations;
+	shards.swap(opened);
+	shard_global_ids.swap(global_ids);
+	return true;
+}
+
+PTR_LIB::shared_ptr<Image> ShardedDataset::image(uint64_t id) const {
+	uint32_t s;
+	uint64_t local_id;
+	if(!find_shard(id, s, local_id)) throw std::out_of_range("ShardedDataset::image");
+
+	return PTR_LIB::make_shared<ShardImage>(id, shard_path(s), shards[s]->image(local_id));
+}
+
+uint64_t ShardedDataset::num_images() const {
+	return count;
+}
+
+uint64_t ShardedDataset::num_ids() const {
+	return id_shards.size();
+}
+
+bool ShardedDataset::has_image(uint64_t id) const {
+	return id < id_shards.size() && id_shards[id] != s_no_shard;
+}
+
+bool ShardedDataset::add_image(const PTR_LIB::shared_ptr<const Image> &image) {
+	return false;
+}
+
+numerics::SparseVectorView ShardedDataset::load_bow_feature(uint64_t id) const {
+	uint32_t s;
+	uint64_t local_id;
+	if(!find_shard(id, s, local_id)) return numerics::SparseVectorView();
+	return shards[s]->load_bow_feature(local_id);
+}
+
+SharedArrayView<float> ShardedDataset::load_vec_feature(uint64_t id) const {
+	uint32_t s;
+	uint64_t local_id;
+	if(!find_shard(id, s, local_id)) return SharedArrayView<float>();
+	return shards[s]->load_vec_feature(local_id);
+}
+
+numerics::SparseVectorView ShardedDataset::load_normalized_bow_feature(uint64_t id) const {
+	uint32_t s;
+	uint64_t local_id;
+	if(!find_shard(id, s, local_id)) return numerics::SparseVectorView();
+	return shards[s]->load_normalized_bow_feature(local_id);
+}
+
+bool ShardedDataset::write_normalized_bow_features(const std::vector<float> &idf_weights, numerics::Norm norm, uint64_t stamp) {
+	bool written = true;
+	for(uint32_t s=0; s<shards.size(); s++) {
+		written = shards[s]->write_normalized_bow_features(idf_weights, norm, stamp) && written;
+	}
+	return written;
+}
+
+uint64_t ShardedDataset::normalized_bow_stamp() const {
+	if(shards.empty()) return 0;
+	const uint64_t stamp = shards[0]->normalized_bow_stamp();
+	for(uint32_t s=1; s<shards.size(); s++) {
+		if(shards[s]->normalized_bow_stamp() != stamp) return 0;
+	}
+	return stamp;
+}
+
+Prefetcher::Ticket ShardedDataset::prefetch_bow_features(const std::vector<uint64_t> &ids) const {
+	const std::vector< std::vector<uint64_t> > &shard_ids = local_ids(ids);
+	Prefetcher::Ticket ticket;
+	for(uint32_t s=0; s<shards.size(); s++) {
+		if(!shard_ids[s].empty()) ticket.add(shards[s]->prefetch_bow_features(shard_ids[s]));
+	}
+	return ticket;
+}
+
+Prefetcher::Ticket ShardedDataset::prefetch_vec_features(const std::vector<uint64_t> &ids) const {
+	const std::vector< std::vector<uint64_t> > &shard_ids = local_ids(ids);
+	Prefetcher::Ticket ticket;
+	for(uint32_t s=0; s<shards.size(); s++) {
+		if(!shard_ids[s].empty()) ticket.add(shards[s]->prefetch_vec_features(shard_ids[s]));
+	}
+	return ticket;
+}
+
+Prefetcher::Ticket ShardedDataset::prefetch_normalized_bow_features(const std::vector<uint64_t> &ids) const {
+	const std::vector< std::vector<uint64_t> > &shard_ids = local_ids(ids);
+	Prefetcher::Ticket ticket;
+	for(uint32_t s=0; s<shards.size(); s++) {
+		if(!shard_ids[s].empty()) ticket.add(shards[s]->prefetch_normalized_bow_features(shard_ids[s]));
+	}
+	return ticket;
+}
+
+bool ShardedDataset::load_mat_feature(uint64_t id, const std::string &feat_name, cv::Mat &data) const {
+	uint32_t s;
+	uint64_t local_id;
+	if(!find_shard(id, s, local_id)) return false;
+	return shards[s]->load_mat_feature(local_id, feat_name, data);
+}
+
+bool ShardedDataset::write_mat_feature(uint64_t id, const std::string &feat_name, const cv::Mat &data) {
+	uint32_t s;
+	uint64_t local_id;
+	if(!find_shard(id, s, local_id)) return false;
+	return shards[s]->write_mat_feature(local_id, feat_name, data);
+}
+
+bool ShardedDataset::flush_mat_features() {
+	bool success = true;
+	for(uint32_t s=0; s<shards.size(); s++) success = shards[s]->flush_mat_features() && success;
+	return success;
+}
+
+uint32_t ShardedDataset::num_shards() const {
+	return shards.size();
+}
+
+const PTR_LIB::shared_ptr<SimpleDataset> &ShardedDataset::shard(uint32_t shard) const {
+	return shards[shard];
+}
+
+bool ShardedDataset::find_shard(uint64_t id, uint32_t &shard, uint64_t &local_id) const {
+	if(id >= id_shards.size() || id_shards[id] == s_no_shard) return false;
+	shard = id_shards[id];
+	local_id = id_local_ids[id];
+	return true;
+}
+
+uint64_t ShardedDataset::global_id(uint32_t shard, uint64_t local_id) const {
+	return shard_global_ids[shard][local_id];
+}
+
+std::vector< std::vector<uint64_t> > ShardedDataset::local_ids(const std::vector<uint64_t> &ids) const {
+	std::vector< std::vector<uint64_t> > shard_ids(shards.size());
+	for(size_t i=0; i<ids.size(); i++) {
+		uint32_t s;
+		uint64_t local_id;
+		if(find_shard(ids[i], s, local_id)) shard_ids[s].push_back(local_id);
+	}
+	return shard_ids;
+}
+
+std::string ShardedDataset::shard_path(uint32_t shard) {
+	char path[32];
+	snprintf(path, sizeof(path), "/shards/%04u", shard);
+	return path;
+}
+
+std::string ShardedDataset::dataset_location(const std::string &shard_location) {
+	return shard_location + "/dataset.bin";
+}
+
+std::string ShardedDataset::global_ids_location(const std::string &shard_location) {
+	return shard_location + "/global_ids.bin";
+}
+
+bool ShardedDataset::write_global_ids(const std::string &shard_location, const std::vector<uint64_t> &global_ids) {
+	const std::string &file_path = global_ids_location(shard_location);
+	filesystem::create_file_directory(file_path);
+	std::ofstream ofs(file_path.c_str(), std::ios::binary | std::ios::trunc);
+	const uint64_t num_ids = global_ids.size();
+	ofs.write((const char *)&num_ids, sizeof(uint64_t));
+	if(num_ids > 0) ofs.write((const char *)&global_ids[0], sizeof(uint64_t) * num_ids);
+	return (ofs.rdstate() & std::ofstream::failbit) == 0;
+}
+
+bool ShardedDataset::read_global_ids(const std::string &shard_location, std::vector<uint64_t> &global_ids) {
+	std::ifstream ifs(global_ids_location(shard_location).c_str(), std::ios::binary);
+	uint64_t num_ids;
+	ifs.read((char *)&num_ids, sizeof(uint64_t));
+	if((ifs.rdstate() & std::ifstream::failbit) != 0) return false;
+	global_ids.resize(num_ids);
+	if(num_ids > 0) ifs.read((char *)&global_ids[0], sizeof(uint64_t) * num_ids);
+	return (ifs.rdstate() & std::ifstream::failbit) == 0;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "config.hpp"
+#include "dataset.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// Presents the shards written by SimpleDataset::shard as a single dataset, so that the search
+/// engines train and search over all of them with the global image ids.  Every shard is a
+/// SimpleDataset with local ids 0, 1, ... which records the global id of each of its images, so a
+/// shard can also be opened, indexed and searched on its own, and its results mapped back with
+/// global_id.  The shards are linked into the data directory as shards/<index>, so the paths of
+/// the images (see ShardImage) are relative to the data directory like those of any dataset.
+class ShardedDataset : public Dataset {
+
+public:
+
+	/// Image of a shard, with its global id.  The locations are those of the image in its shard,
+	/// prefixed by the link to the shard in the data directory.
+	class ShardImage : public Image {
+		public:
+			ShardImage(uint64_t id, const std::string &shard_path, const PTR_LIB::shared_ptr<Image> &image);
+
+			/// Returns the corresponding feature path given a feature name (ex. "sift").
+			std::string feature_path(const std::string &feat_name) const;
+
+			/// Returns the image location relative to the database data directory.
+			std::string location() const;
+
+			/// Returns the image as seen by its shard, with its local id.
+			const PTR_LIB::shared_ptr<Image> &shard_image() const;
+
+		protected:
+			std::string shard_path; /// Link to the shard relative to the data directory, ex. "/shards/0001".
+			PTR_LIB::shared_ptr<Image> image;
+	};
+
+	/// Opens the shards at the given locations, in shard order, and links them into
+	/// base_location/shards.  cache_size is the feature cache size of every shard.
+	ShardedDataset(const std::string &base_location, const std::vector<std::string> &shard_locations, size_t cache_size = 0);
+
+	/// Opens the shards listed in the file at db_data_location (see write).
+	ShardedDataset(const std::string &base_location, const std::string &db_data_location, size_t cache_size = 0);
+
+	~ShardedDataset();
+
+	/// Writes the locations of the shards to the specified file, one per line.  Returns true if
+	/// successful, false otherwise.
+	bool write(const std::string &db_data_location);
+
+	/// Opens the shards listed in the specified file.  Returns true if successful, false
+	/// otherwise, the dataset is then empty.
+	bool read(const std::string &db_data_location);
+
+	/// Given a global image id, returns the ShardImage associated with that id.
+	PTR_LIB::shared_ptr<Image> image(uint64_t id) const;
+
+	/// Returns the number of images of all shards.
+	uint64_t num_images() const;
+
+	/// Returns the largest global id + 1.  The shards need not hold every global id, so this may
+	/// be larger than num_images().
+	uint64_t num_ids() const;
+
+	/// Returns true if a shard holds the global id.
+	bool has_image(uint64_t id) const;
+
+	/// Images are added to the shards, so this always returns false.
+	bool add_image(const PTR_LIB::shared_ptr<const Image> &image);
+
+	/// Load the features of the image from its shard.
+	numerics::SparseVectorView load_bow_feature(uint64_t id) const;
+	SharedArrayView<float> load_vec_feature(uint64_t id) const;
+	numerics::SparseVectorView load_normalized_bow_feature(uint64_t id) const;
+
+	/// Writes the normalized features of every shard.  The stamp is the one of the shards if they
+	/// all have the same, 0 otherwise.
+	bool write_normalized_bow_features(const std::vector<float> &idf_weights, numerics::Norm norm, uint64_t stamp);
+	uint64_t normalized_bow_stamp() const;
+
+	/// Splits the ids between the shards, which prefetch them concurrently.  The ticket holds the
+	/// loads of every shard.
+	Prefetcher::Ticket prefetch_bow_features(const std::vector<uint64_t> &ids) const;
+	Prefetcher::Ticket prefetch_vec_features(const std::vector<uint64_t> &ids) const;
+	Prefetcher::Ticket prefetch_normalized_bow_features(const std::vector<uint64_t> &ids) const;
+
+	bool load_mat_feature(uint64_t id, const std::string &feat_name, cv::Mat &data) const;
+	bool write_mat_feature(uint64_t id, const std::string &feat_name, const cv::Mat &data);
+	bool flush_mat_features();
+
+	/// Returns the number of shards.
+	uint32_t num_shards() const;
+
+	/// Returns a shard.
+	const PTR_LIB::shared_ptr<SimpleDataset> &shard(uint32_t shard) const;
+
+	/// Sets shard and local_id to the shard of an image and its id in the shard and returns true,
+	/// returns false if no image has the global id.
+	bool find_shard(uint64_t id, uint32_t &shard, uint64_t &local_id) const;
+
+	/// Returns the global id of the image with the given local id in a shard.
+	uint64_t global_id(uint32_t shard, uint64_t local_id) const;
+
+	/// Returns the location of the dataset file of a shard, <shard_location>/dataset.bin.
+	static std::string dataset_location(const std::string &shard_location);
+
+	/// Returns the location of the global ids of the images of a shard, <shard_location>/global_ids.bin.
+	static std::string global_ids_location(const std::string &shard_location);
+
+	/// Writes or reads the global ids of the images of a shard, indexed by local id.  Returns true
+	/// if successful, false otherwise.
+	static bool write_global_ids(const std::string &shard_location, const std::vector<uint64_t> &global_ids);
+	static bool read_global_ids(const std::string &shard_location, std::vector<uint64_t> &global_ids);
+
+protected:
+	/// Opens the shards and builds the global id mapping.  Returns false if a shard cannot be
+	/// opened or two shards hold the same global id, the dataset is then empty.
+	bool open_shards(const std::vector<std::string> &locations);
+
+	/// Drops the shards and the id mapping.
+	void clear();
+
+	/// Returns the location of the link to a shard relative to the data directory.
+	static std::string shard_path(uint32_t shard);
+
+	/// Splits ids by shard and maps them to local ids, keeping their order.
+	std::vector< std::vector<uint64_t> > local_ids(const std::vector<uint64_t> &ids) const;
+
+	size_t cache_size; /// Feature cache size of every shard.
+	std::vector<std::string> shard_locations;
+	std::vector< PTR_LIB::shared_ptr<SimpleDataset> > shards;
+	std::vector< std::vector<uint64_t> > shard_global_ids; /// Global id of every local id of every shard.
+	std::vector<uint32_t> id_shards; /// Shard of every global id, UINT32_MAX for ids without an image.
+	std::vector<uint64_t> id_local_ids; /// Local id of every global id.
+	uint64_t count;
+};
@@ -0,0 +1,187 @@
+#include "sparse_vector.hpp"
+
+#include <cmath>
+
+namespace numerics {
+
+	SparseVector::SparseVector(const sparse_vector_t &pairs) : index_array(pairs.size()), value_array(pairs.size()) {
+		for(size_t i=0; i<pairs.size(); i++) {
+			index_array[i] = pairs[i].first;
+			value_array[i] = pairs[i].second;
+		}
+	}
+
+	SparseVector::operator sparse_vector_t() const {
+		sparse_vector_t pairs(index_array.size());
+		for(size_t i=0; i<index_array.size(); i++) {
+			pairs[i] = std::pair<uint32_t, float>(index_array[i], value_array[i]);
+		}
+		return pairs;
+	}
+
+	SparseVector::SparseVector(const SparseVectorView &view) : index_array(view.indices(), view.indices() + view.size()),
+		value_array(view.values(), view.values() + view.size()) {
+	}
+
+	SparseVectorView::operator sparse_vector_t() const {
+		sparse_vector_t pairs(length);
+		for(size_t i=0; i<length; i++) {
+			pairs[i] = std::pair<uint32_t, float>(index_ptr[i], value_ptr[i]);
+		}
+		return pairs;
+	}
+
+	void SparseVector::reserve(size_t size) {
+		index_array.reserve(size);
+		value_array.reserve(size);
+	}
+
+	void SparseVector::resize(size_t size) {
+		index_array.resize(size);
+		value_array.resize(size);
+	}
+
+	void SparseVector::clear() {
+		index_array.clear();
+		value_array.clear();
+	}
+
+	bool SparseVector::operator==(const SparseVector &other) const {
+		return index_array == other.index_array && value_array == other.value_array;
+	}
+
+	float weighted_sum(const SparseVectorView &weights, const std::vector<float> &idfw) {
+		const uint32_t *indices = weights.indices();
+		const float *values = weights.values();
+		float sum = 0.f;
+		for(size_t k=0; k<weights.size(); k++) {
+			sum += values[k] * idfw[indices[k]];
+		}
+		return sum;
+	}
+
+	/// Accumulates the histogram intersection over the shared indices.
+	struct MinHistAccumulator {
+		const uint32_t *indices;
+		const float *values0, *values1, *idfw;
+		float norm0, norm1, sum;
+
+		inline void operator()(size_t i, size_t j) {
+			float min_val = values0[i] / norm0;
+			if(min_val > (values1[j] / norm1)) {
+				min_val = values1[j] / norm1;
+			}
+			sum += min_val * idfw[indices[i]];
+		}
+	};
+
+	/// Accumulates the dot product of the idf weighted vectors over the shared indices.
+	struct DotAccumulator {
+		const uint32_t *indices;
+		const float *values0, *values1, *idfw;
+		float sum;
+
+		inline void operator()(size_t i, size_t j) {
+			const float idf = idfw[indices[i]];
+			sum += (values0[i] * idf) * (values1[j] * idf);
+		}
+	};
+
+	float min_hist(const SparseVectorView &weights0, const SparseVectorView &weights1, const std::vector<float> &idfw) {
+		MinHistAccumulator accumulator;
+		accumulator.indices = weights0.indices();
+		accumulator.values0 = weights0.values();
+		accumulator.values1 = weights1.values();
+		accumulator.idfw = &idfw[0];
+		accumulator.norm0 = weighted_sum(weights0, idfw);
+		accumulator.norm1 = weighted_sum(weights1, idfw);
+		accumulator.sum = 0.f;
+		intersect(weights0, weights1, accumulator);
+		return accumulator.sum;
+	}
+
+	float cos_sim(const SparseVectorView &weights0, const SparseVectorView &weights1, const std::vector<float> &idfw) {
+		float a2 = 0.f, b2 = 0.f;
+		for(size_t k=0; k<weights0.size(); k++) {
+			const float a = weights0.value(k) * idfw[weights0.index(k)];
+			a2 += a*a;
+		}
+		for(size_t k=0; k<weights1.size(); k++) {
+			const float b = weights1.value(k) * idfw[weights1.index(k)];
+			b2 += b*b;
+		}
+
+		DotAccumulator accumulator;
+		accumulator.indices = weights0.indices();
+		accumulator.values0 = weights0.values();
+		accumulator.values1 = weights1.values();
+		accumulator.idfw = &idfw[0];
+		accumulator.sum = 0.f;
+		intersect(weights0, weights1, accumulator);
+		return accumulator.sum / (sqrtf(a2)*sqrtf(b2));
+	}
+
+	float l1_dist(const SparseVectorView &weights0, const SparseVectorView &weights1, const std::vector<float> &idfw) {
+		// |x - y| = x + y - 2 min(x, y) for non negative x and y, and both vectors sum to one
+		return 2.f - 2.f * min_hist(weights0, weights1, idfw);
+	}
+
+	/// Accumulates the histogram intersection of two normalized vectors.
+	struct NormalizedMinAccumulator {
+		const float *values0, *values1;
+		float sum;
+
+		inline void operator()(size_t i, size_t j) {
+			sum += values0[i] < values1[j] ? values0[i] : values1[j];
+		}
+	};
+
+	/// Accumulates the dot product of two normalized vectors.
+	struct NormalizedDotAccumulator {
+		const float *values0, *values1;
+		float sum;
+
+		inline void operator()(size_t i, size_t j) {
+			sum += values0[i] * values1[j];
+		}
+	};
+
+	SparseVector normalize(const SparseVectorView &weights, const std::vector<float> &idfw, Norm norm) {
+		SparseVector normalized;
+		normalized.resize(weights.size());
+		const uint32_t *indices = weights.indices();
+		const float *values = weights.values();
+		uint32_t *normalized_indices = normalized.indices();
+		float *normalized_values = normalized.values();
+		float sum = 0.f;
+		for(size_t k=0; k<weights.size(); k++) {
+			normalized_indices[k] = indices[k];
+			normalized_values[k] = values[k] * idfw[indices[k]];
+			sum += (norm == NORM_L2) ? normalized_values[k] * normalized_values[k] : normalized_values[k];
+		}
+		if(norm == NORM_L2) sum = sqrtf(sum);
+		if(sum > 0.f) {
+			const float inv_sum = 1.f / sum;
+			for(size_t k=0; k<weights.size(); k++) normalized_values[k] *= inv_sum;
+		}
+		return normalized;
+	}
+
+	float min_hist_normalized(const SparseVectorView &normalized0, const SparseVectorView &normalized1) {
+		NormalizedMinAccumulator accumulator;
+		accumulator.values0 = normalized0.values();
+		accumulator.values1 = normalized1.values();
+		accumulator.sum = 0.f;
+		intersect(normalized0, normalized1, accumulator);
+		return accumulator.sum;
+	}
+
+	float cos_sim_normalized(const SparseVectorView &normalized0, const SparseVectorView &normalized1) {
+		NormalizedDotAccumulator accumulator;
+		accumulator.values0 = normalized0.values();
+		accumulator.values1 = normalized1.values();
+		accumulator.sum = 0.f;
+		intersect(normalized0, normalized1, accumulator);
+		return accumulator.sum;
+	}
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include <utility>
+#include <new>
+#include <memory>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+#if defined(WIN32)
+#include <malloc.h>
+#endif
+
+namespace numerics {
+	/// Sparse vector as (index, value) pairs sorted by index, ex. a BoW vector.
+	typedef std::vector< std::pair<uint32_t, float > > sparse_vector_t;
+
+	/// Minimal allocator returning Alignment byte aligned memory, so that arrays can be read
+	/// with aligned SIMD loads.
+	template <typename T, size_t Alignment = 32>
+	struct AlignedAllocator {
+		typedef T value_type;
+
+		template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+		AlignedAllocator() { }
+		template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) { }
+
+		T *allocate(size_t n) {
+			if(n == 0) return 0;
+#if defined(WIN32)
+			void *p = _aligned_malloc(n * sizeof(T), Alignment);
+			if(!p) throw std::bad_alloc();
+#else
+			void *p = 0;
+			if(posix_memalign(&p, Alignment, n * sizeof(T)) != 0) throw std::bad_alloc();
+#endif
+			return (T *)p;
+		}
+
+		void deallocate(T *p, size_t) {
+#if defined(WIN32)
+			_aligned_free(p);
+#else
+			free(p);
+#endif
+		}
+
+		template <typename U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+		template <typename U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+	};
+
+	/// Sparse vector stored as a structure of arrays: the sorted indices and their values are kept
+	/// in separate aligned arrays, so that intersections only stream through the indices and can
+	/// compare several of them per instruction.  Converts to and from sparse_vector_t, so code
+	/// written for the pair layout keeps working.
+	class SparseVectorView;
+	class SparseVector {
+	public:
+		typedef std::vector<uint32_t, AlignedAllocator<uint32_t> > index_array_t;
+		typedef std::vector<float, AlignedAllocator<float> > value_array_t;
+
+		SparseVector() { }
+		explicit SparseVector(const sparse_vector_t &pairs);
+		/// Copies the entries of a view.
+		explicit SparseVector(const SparseVectorView &view);
+
+		/// Returns the vector as (index, value) pairs.  Explicit, so that a SparseVector passed
+		/// to a function overloaded for both layouts picks the SparseVectorView overload.
+		explicit operator sparse_vector_t() const;
+
+		inline size_t size() const { return index_array.size(); }
+		inline bool empty() const { return index_array.empty(); }
+
+		inline uint32_t index(size_t i) const { return index_array[i]; }
+		inline float value(size_t i) const { return value_array[i]; }
+
+		inline const uint32_t *indices() const { return index_array.empty() ? 0 : &index_array[0]; }
+		inline const float *values() const { return value_array.empty() ? 0 : &value_array[0]; }
+		inline uint32_t *indices() { return index_array.empty() ? 0 : &index_array[0]; }
+		inline float *values() { return value_array.empty() ? 0 : &value_array[0]; }
+
+		/// Appends an entry, index must be larger than the last index.
+		inline void push_back(uint32_t index, float value) {
+			index_array.push_back(index);
+			value_array.push_back(value);
+		}
+
+		void reserve(size_t size);
+		void resize(size_t size);
+		void clear();
+
+		bool operator==(const SparseVector &other) const;
+
+	protected:
+		index_array_t index_array;
+		value_array_t value_array;
+	};
+
+	/// Read only view of a sparse vector stored as a structure of arrays, which is owned elsewhere
+	/// (ex. a cached SparseVector or a memory mapped BowStore).  The view optionally shares the
+	/// ownership of its storage, so it can be returned by functions without copying the entries
+	/// and stays valid after a cache evicted them.  Copying a view never allocates.
+	class SparseVectorView {
+	public:
+		SparseVectorView() : index_ptr(0), value_ptr(0), length(0) { }
+		/// Views the entries of vector, which must outlive the view.
+		SparseVectorView(const SparseVector &vector) : index_ptr(vector.indices()), value_ptr(vector.values()),
+			length(vector.size()) { }
+		/// Views the entries of vector and keeps it alive.
+		SparseVectorView(const PTR_LIB::shared_ptr<const SparseVector> &vector) : index_ptr(0), value_ptr(0), length(0),
+			owner(vector) {
+			if(vector) {
+				index_ptr = vector->indices();
+				value_ptr = vector->values();
+				length = vector->size();
+			}
+		}
+		/// Views size entries stored in the given arrays, which are kept alive by owner.
+		SparseVectorView(const uint32_t *indices, const float *values, size_t size,
+			const PTR_LIB::shared_ptr<const void> &owner = PTR_LIB::shared_ptr<const void>()) :
+			index_ptr(indices), value_ptr(values), length(size), owner(owner) { }
+
+		/// Returns the vector as (index, value) pairs.  Explicit, since it copies the entries.
+		explicit operator sparse_vector_t() const;
+
+		inline size_t size() const { return length; }
+		inline bool empty() const { return length == 0; }
+
+		inline uint32_t index(size_t i) const { return index_ptr[i]; }
+		inline float value(size_t i) const { return value_ptr[i]; }
+
+		inline const uint32_t *indices() const { return index_ptr; }
+		inline const float *values() const { return value_ptr; }
+
+	protected:
+		const uint32_t *index_ptr;
+		const float *value_ptr;
+		size_t length;
+		PTR_LIB::shared_ptr<const void> owner; /// Keeps the viewed arrays alive, may be empty.
+	};
+
+	/// Sizes at which the intersection switches to galloping: when one vector is this many times
+	/// longer than the other, every index of the shorter one is searched in the longer one.
+	static const size_t s_galloping_ratio = 32;
+
+	/// Calls f(i, j) for every pair of positions with a.index(i) == b.index(j), in increasing index
+	/// order.  Uses galloping search for skewed sizes, otherwise compares blocks of 4 x 4 indices
+	/// with SSE2 (a plain merge if SSE2 is not enabled).
+	template <typename F>
+	inline void intersect(const SparseVectorView &a, const SparseVectorView &b, F &f);
+
+	/// Returns the sum of the values of the vector weighted by idfw, ie. its idf weighted L1 norm
+	/// for non negative values.
+	float weighted_sum(const SparseVectorView &weights, const std::vector<float> &idfw);
+
+	/// Histogram intersection of two sparse vectors, computed like min_hist for pairs.
+	float min_hist(const SparseVectorView &weights0, const SparseVectorView &weights1, const std::vector<float> &idfw);
+
+	/// Cosine similarity of two sparse vectors after weighting them by idfw, like cos_sim for pairs.
+	float cos_sim(const SparseVectorView &weights0, const SparseVectorView &weights1, const std::vector<float> &idfw);
+
+	/// L1 distance between two non negative sparse vectors normalized by their idf weighted L1
+	/// norms, each entry weighted by idfw.  Equals 2 - 2 * min_hist.
+	float l1_dist(const SparseVectorView &weights0, const SparseVectorView &weights1, const std::vector<float> &idfw);
+
+	/// Normalization of the vectors returned by normalize.
+	enum Norm {
+		NORM_L1, /// the idf weighted values sum to one, for min_hist_normalized
+		NORM_L2 /// the idf weighted values have unit length, for cos_sim_normalized
+	};
+
+	/// Returns the vector with every value multiplied by idfw of its index and divided by the
+	/// norm of the weighted vector.  Computing this once per database image turns every score
+	/// into a single intersection pass without divisions or idfw lookups.
+	SparseVector normalize(const SparseVectorView &weights, const std::vector<float> &idfw, Norm norm = NORM_L1);
+
+	/// Histogram intersection of two vectors returned by normalize with NORM_L1.  Equals min_hist
+	/// of the original vectors for non negative idf weights.
+	float min_hist_normalized(const SparseVectorView &normalized0, const SparseVectorView &normalized1);
+
+	/// Cosine similarity of two vectors returned by normalize with NORM_L2, ie. their dot product.
+	/// Equals cos_sim of the original vectors.
+	float cos_sim_normalized(const SparseVectorView &normalized0, const SparseVectorView &normalized1);
+
+	template <typename F>
+	inline void intersect_merge(const uint32_t *a, size_t a_size, const uint32_t *b, size_t b_size, size_t i, size_t j, F &f) {
+		while(i < a_size && j < b_size) {
+			if(a[i] == b[j]) f(i++, j++);
+			else if(a[i] < b[j]) i++;
+			else j++;
+		}
+	}
+
+	/// Galloping intersection, a is the shorter array.  swapped is true if the arguments of f
+	/// must be swapped (a is the second vector of the intersection).
+	template <typename F>
+	inline void intersect_galloping(const uint32_t *a, size_t a_size, const uint32_t *b, size_t b_size, bool swapped, F &f) {
+		size_t j = 0;
+		for(size_t i=0; i<a_size && j<b_size; i++) {
+			// exponential search for the first index >= a[i], then binary search in the last step
+			size_t step = 1, high = j;
+			while(high < b_size && b[high] < a[i]) {
+				j = high + 1;
+				high += step;
+				step <<= 1;
+			}
+			if(high > b_size) high = b_size;
+			while(j < high) {
+				const size_t middle = j + (high - j) / 2;
+				if(b[middle] < a[i]) j = middle + 1;
+				else high = middle;
+			}
+			if(j < b_size && b[j] == a[i]) {
+				if(swapped) f(j, i);
+				else f(i, j);
+				j++;
+			}
+		}
+	}
+
+#if defined(__SSE2__) && defined(__GNUC__)
+	/// Block intersection: 4 indices of a are compared with the 4 indices of b and their 3
+	/// rotations, and the block with the smaller last index is advanced.  The remainder is merged.
+	template <typename F>
+	inline void intersect_blocks(const uint32_t *a, size_t a_size, const uint32_t *b, size_t b_size, F &f) {
+		size_t i = 0, j = 0;
+		const size_t a_blocks = a_size & ~(size_t)3, b_blocks = b_size & ~(size_t)3;
+		while(i < a_blocks && j < b_blocks) {
+			const __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+			const __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+			const int m0 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+			const int m1 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))));
+			const int m2 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2)))));
+			const int m3 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+			int matches = m0 | m1 | m2 | m3;
+			while(matches) {
+				// lane k of a matched lane (k + rotation) % 4 of b
+				const int k = __builtin_ctz(matches);
+				const int rotation = ((m1 >> k) & 1) ? 1 : ((m2 >> k) & 1) ? 2 : ((m3 >> k) & 1) ? 3 : 0;
+				f(i + k, j + ((k + rotation) & 3));
+				matches &= matches - 1;
+			}
+			const uint32_t a_last = a[i + 3], b_last = b[j + 3];
+			if(a_last <= b_last) i += 4;
+			if(b_last <= a_last) j += 4;
+		}
+		intersect_merge(a, a_size, b, b_size, i, j, f);
+	}
+#endif
+
+	template <typename F>
+	inline void intersect(const SparseVectorView &a, const SparseVectorView &b, F &f) {
+		const size_t a_size = a.size(), b_size = b.size();
+		if(a_size == 0 || b_size == 0) return;
+		if(a_size * s_galloping_ratio < b_size) {
+			intersect_galloping(a.indices(), a_size, b.indices(), b_size, false, f);
+		} else if(b_size * s_galloping_ratio < a_size) {
+			intersect_galloping(b.indices(), b_size, a.indices(), a_size, true, f);
+		} else {
+#if defined(__SSE2__) && defined(__GNUC__)
+			intersect_blocks(a.indices(), a_size, b.indices(), b_size, f);
+#else
+			intersect_merge(a.indices(), a_size, b.indices(), b_size, 0, 0, f);
+#endif
+		}
+	}
+}